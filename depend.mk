@@ -1,33 +1,71 @@
 # This file was generated by "make depend".
 #
 
-$(LIBDBG_ROOT)src/breakpoint.o: $(LIBDBG_ROOT)src/breakpoint.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/types.h
+$(LIBDBG_ROOT)src/addrset.o: $(LIBDBG_ROOT)src/addrset.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/addrset.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/branchtrace.o: $(LIBDBG_ROOT)src/branchtrace.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/breakpoint.o: $(LIBDBG_ROOT)src/breakpoint.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/checkpoint.o: $(LIBDBG_ROOT)src/checkpoint.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/misc.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/condition.o: $(LIBDBG_ROOT)src/condition.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/coverage.o: $(LIBDBG_ROOT)src/coverage.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBDBG_ROOT)src/cpu.o: $(LIBDBG_ROOT)src/cpu.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBDBG_ROOT)src/darwin.o: $(LIBDBG_ROOT)src/darwin.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/misc.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/dbg.o: $(LIBDBG_ROOT)src/dbg.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/types.h
+$(LIBDBG_ROOT)src/dbg.o: $(LIBDBG_ROOT)src/dbg.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/logger.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/misc.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/debuginfo.o: $(LIBDBG_ROOT)src/debuginfo.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/dwarf.o: $(LIBDBG_ROOT)src/dwarf.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/elf.o: $(LIBDBG_ROOT)src/elf.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/history.o: $(LIBDBG_ROOT)src/history.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/linkmap.o: $(LIBDBG_ROOT)src/linkmap.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/logger.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/memory.o: $(LIBDBG_ROOT)src/memory.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/memory.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBDBG_ROOT)src/misc.o: $(LIBDBG_ROOT)src/misc.cc $(LIBDBG_ROOT)include/dbg/misc.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/module.o: $(LIBDBG_ROOT)src/module.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/logger.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/process.o: $(LIBDBG_ROOT)src/process.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBDBG_ROOT)src/processevents.o: $(LIBDBG_ROOT)src/processevents.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBDBG_ROOT)src/ptrace.o: $(LIBDBG_ROOT)src/ptrace.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/logger.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/misc.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/x86.o: $(LIBDBG_ROOT)src/x86.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/types.h $(UDIS86_ROOT)/libudis86/extern.h $(UDIS86_ROOT)/libudis86/itab.h $(UDIS86_ROOT)/libudis86/types.h $(UDIS86_ROOT)/udis86.h $(UDIS86_ROOT)libudis86/itab.h
+$(LIBDBG_ROOT)src/record.o: $(LIBDBG_ROOT)src/record.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/strace.o: $(LIBDBG_ROOT)src/strace.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/misc.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/tracelog.o: $(LIBDBG_ROOT)src/tracelog.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/tracepoint.o: $(LIBDBG_ROOT)src/tracepoint.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/trampoline.o: $(LIBDBG_ROOT)src/trampoline.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/watchtrace.o: $(LIBDBG_ROOT)src/watchtrace.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/misc.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h $(LIBDBG_ROOT)include/dbg/watchtrace.h
+	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
+$(LIBDBG_ROOT)src/x86.o: $(LIBDBG_ROOT)src/x86.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/addrset.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/memory.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h $(UDIS86_ROOT)/libudis86/extern.h $(UDIS86_ROOT)/libudis86/itab.h $(UDIS86_ROOT)/libudis86/types.h $(UDIS86_ROOT)/udis86.h $(UDIS86_ROOT)libudis86/itab.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/shell/breakpoint.o: $(LIBDBG_ROOT)src/shell/breakpoint.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/types.h
+$(LIBDBG_ROOT)src/shell/breakpoint.o: $(LIBDBG_ROOT)src/shell/breakpoint.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/shell/commands.o: $(LIBDBG_ROOT)src/shell/commands.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/types.h $(LIBDBG_ROOT)src/shell/dump.h $(LIBDBG_ROOT)src/shell/edit.h
+$(LIBDBG_ROOT)src/shell/commands.o: $(LIBDBG_ROOT)src/shell/commands.cc $(LIBCOMMON_ROOT)include/common/c++/new.h $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/misc.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/misc.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h $(LIBDBG_ROOT)include/dbg/watchtrace.h $(LIBDBG_ROOT)src/shell/dump.h $(LIBDBG_ROOT)src/shell/edit.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/shell/disassemble.o: $(LIBDBG_ROOT)src/shell/disassemble.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/types.h
+$(LIBDBG_ROOT)src/shell/disassemble.o: $(LIBDBG_ROOT)src/shell/disassemble.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/shell/main.o: $(LIBDBG_ROOT)src/shell/main.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/getopt.h $(LIBCOMMON_ROOT)include/common/logger.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/types.h
+$(LIBDBG_ROOT)src/shell/main.o: $(LIBDBG_ROOT)src/shell/main.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/getopt.h $(LIBCOMMON_ROOT)include/common/logger.h $(LIBCOMMON_ROOT)include/common/path.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/shell/register.o: $(LIBDBG_ROOT)src/shell/register.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/types.h
+$(LIBDBG_ROOT)src/shell/register.o: $(LIBDBG_ROOT)src/shell/register.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
-$(LIBDBG_ROOT)src/shell/state.o: $(LIBDBG_ROOT)src/shell/state.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/types.h
+$(LIBDBG_ROOT)src/shell/state.o: $(LIBDBG_ROOT)src/shell/state.cc $(LIBCOMMON_ROOT)include/common/c++/refcount.h $(LIBCOMMON_ROOT)include/common/error.h $(LIBCOMMON_ROOT)include/common/refcnt.h $(LIBDBG_ROOT)include/dbg/arch.h $(LIBDBG_ROOT)include/dbg/arch/x86.h $(LIBDBG_ROOT)include/dbg/branchtrace.h $(LIBDBG_ROOT)include/dbg/breakpoint.h $(LIBDBG_ROOT)include/dbg/checkpoint.h $(LIBDBG_ROOT)include/dbg/condition.h $(LIBDBG_ROOT)include/dbg/coverage.h $(LIBDBG_ROOT)include/dbg/cpu.h $(LIBDBG_ROOT)include/dbg/dbg.h $(LIBDBG_ROOT)include/dbg/dwarf.h $(LIBDBG_ROOT)include/dbg/elf.h $(LIBDBG_ROOT)include/dbg/history.h $(LIBDBG_ROOT)include/dbg/linkmap.h $(LIBDBG_ROOT)include/dbg/module.h $(LIBDBG_ROOT)include/dbg/process.h $(LIBDBG_ROOT)include/dbg/record.h $(LIBDBG_ROOT)include/dbg/shell.h $(LIBDBG_ROOT)include/dbg/strace.h $(LIBDBG_ROOT)include/dbg/tracelog.h $(LIBDBG_ROOT)include/dbg/tracepoint.h $(LIBDBG_ROOT)include/dbg/trampoline.h $(LIBDBG_ROOT)include/dbg/types.h
 	$(CXX) $(CXXFLAGS) $(CFLAGS) $(LIBDBG_CXXFLAGS) $(LIBDBG_CFLAGS) $(LATE_CXXFLAGS) $(LATE_CFLAGS) -c -o $@ $<
 $(LIBDBG_ROOT)submodules/udis86/libudis86/decode.o: $(LIBDBG_ROOT)submodules/udis86/libudis86/decode.c $(UDIS86_ROOT)libudis86/decode.h $(UDIS86_ROOT)libudis86/extern.h $(UDIS86_ROOT)libudis86/itab.h $(UDIS86_ROOT)libudis86/types.h $(UDIS86_ROOT)libudis86/udint.h
 	$(CC) $(CFLAGS) $(LIBDBG_CFLAGS) $(LATE_CFLAGS) -c -o $@ $<
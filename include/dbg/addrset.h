@@ -0,0 +1,71 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_addrset_h_
+#define dbg_addrset_h_
+
+#include "types.h"
+
+#include <functional>
+#include <vector>
+
+namespace dbg {
+
+//
+// A set of address ranges, built once and then searched many times.
+// The main user is stack scanning, which wants to know which of a few
+// million words look like they point into code.
+//
+struct AddressSet
+{
+   struct Range
+   {
+      addr_t start;
+      addr_t end;
+   };
+
+   // Sorted and non-overlapping after Finalize().
+   //
+   std::vector<Range> ranges;
+
+   // Runs of ranges that fit in a 32-bit span, so a word can be tested
+   // against one with a subtract and an unsigned compare.  Code in a
+   // process tends to sit in a handful of places (the executable, the
+   // shared libraries, maybe a JIT), so there are few of these.
+   //
+   struct Cluster
+   {
+      addr_t start;
+      uint32_t span;
+   };
+   std::vector<Cluster> clusters;
+
+   void
+   Add(addr_t start, addr_t end, error *err);
+
+   void
+   Finalize(error *err);
+
+   bool
+   Contains(addr_t addr);
+
+   // Calls back for every aligned word in buf that falls in the set,
+   // with its offset into buf.  Stops if the callback returns false.
+   // Returns false if it was stopped.
+   //
+   bool
+   Scan(
+      const void *buf,
+      size_t len,
+      const std::function<bool(size_t off, addr_t value)> &callback
+   );
+};
+
+} // end namespace
+
+#endif
@@ -98,6 +98,36 @@ enum
 #endif
 };
 
+/*
+ * DWARF register numbers, as used by CFI, mapped to the above.
+ * Index N of DBG_DWARF_REGISTERS is the regno for DWARF register N.
+ * The return address column is the instruction pointer.
+ */
+#if defined(__amd64__)
+
+#define DBG_DWARF_REGISTERS                                    \
+   DBG_AX, DBG_DX, DBG_CX, DBG_BX, DBG_SI, DBG_DI, DBG_BP, DBG_SP, \
+   DBG_R8, DBG_R9, DBG_R10, DBG_R11, DBG_R12, DBG_R13, DBG_R14,   \
+   DBG_R15, DBG_IP
+
+#define DBG_DWARF_REGISTER_COUNT (17)
+#define DBG_DWARF_SP             (7)
+#define DBG_DWARF_BP             (6)
+#define DBG_DWARF_IP             (16)
+
+#else
+
+#define DBG_DWARF_REGISTERS                                    \
+   DBG_AX, DBG_CX, DBG_DX, DBG_BX, DBG_SP, DBG_BP, DBG_SI, DBG_DI, \
+   DBG_IP
+
+#define DBG_DWARF_REGISTER_COUNT (9)
+#define DBG_DWARF_SP             (4)
+#define DBG_DWARF_BP             (5)
+#define DBG_DWARF_IP             (8)
+
+#endif
+
 #if defined(__FreeBSD__) || defined(__OpenBSD__)
 
 #include <machine/reg.h>
@@ -117,8 +147,6 @@ namespace dbg
 {
    typedef struct user_regs_struct reg_t;
 }
-#define eax orig_eax
-#define rax orig_rax
 #define rflags eflags
 
 #define DBG_ACCESS_REG(regname)   (((reg_t*)NULL)->regname)
@@ -0,0 +1,58 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_branchtrace_h_
+#define dbg_branchtrace_h_
+
+#include "types.h"
+
+#include <vector>
+
+namespace dbg {
+
+//
+// The branches taken while block-stepping, as (from, to) pairs, in a
+// ring of fixed size.  Once it's full, the oldest make way, so a long
+// trace keeps the end: the part that led to wherever it stopped.
+//
+struct BranchTrace
+{
+   struct Branch
+   {
+      addr_t from;
+      addr_t to;
+   };
+
+   std::vector<Branch> ring;
+   size_t next;
+
+   // Every branch recorded since the last Clear(), including those
+   // that have made way.
+   //
+   uint64_t total;
+
+   BranchTrace() : next(0), total(0) {}
+
+   // from is 0 where the branch couldn't be worked out.  The ring is
+   // allocated the first time.
+   //
+   void
+   Record(addr_t from, addr_t to, error *err);
+
+   // What's in the ring, oldest first.
+   //
+   void
+   Get(std::vector<Branch> &out, error *err) const;
+
+   void
+   Clear();
+};
+
+} // end namespace
+
+#endif
@@ -10,16 +10,155 @@
 #define dbg_breakpoint_h_
 
 #include "types.h"
+#include "condition.h"
 
+#include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include <sys/time.h>
+
 namespace dbg {
 
+struct Breakpoint;
+
+//
+// A breakpoint as the user sees it: where they asked for it, and what's
+// happened to it since.  The patches it resolves to come and go with
+// modules and bd/be; this stays until it's cleared.
+//
+// The location survives the module moving around: "module+offset"
+// (from the module's base) or "module!symbol", optionally
+// "module!symbol+offset".  Offsets are hex.  Without a module, offset
+// is just an address.
+//
+struct BreakpointLocation
+{
+   std::string module;
+   std::string symbol;
+   addr_t offset;
+
+   // Set by the debugger.  IDs aren't reused.
+   //
+   int id;
+   bool enabled;
+
+   // Only stop if this is true.
+   //
+   common::Pointer<Condition> condition;
+
+   // Check the condition in the target, without stopping, where we
+   // can.  Anywhere we can't, it's checked by the debugger as usual.
+   //
+   bool inTarget;
+
+   // Only stop for this thread (the platform's ID), or 0 for any.
+   // Other threads are sent on their way before anything else is
+   // looked at, and counted in filtered.
+   //
+   int thread;
+   unsigned long filtered;
+
+   // Times execution has stopped here, and the last time it did.
+   //
+   unsigned long hits;
+   struct timeval lastHit;
+
+   // What it costs, as seen by Debugger::Go().  traps counts every
+   // time the debugger heard from it, whether or not it stopped (a
+   // condition in the target only traps when it's true).  Times are in
+   // nanoseconds: the target stopped here, until it ran again or the
+   // user got control, and within that, checking the condition and
+   // stepping over the breakpoint.
+   //
+   unsigned long traps;
+   uint64_t stoppedTime;
+   uint64_t maxStopped;
+   uint64_t conditionTime;
+   uint64_t stepTime;
+
+   BreakpointLocation()
+      : offset(0), id(0), enabled(true), inTarget(false), thread(0), filtered(0),
+        hits(0), lastHit(),
+        traps(0), stoppedTime(0), maxStopped(0), conditionTime(0), stepTime(0) {}
+
+   bool
+   IsAddress() const
+   {
+      return !module.size();
+   }
+
+   // Returns false if str isn't in one of the above forms (eg. it's a
+   // plain address).
+   //
+   bool
+   Parse(const char *str, error *err);
+
+   void
+   Format(std::string &out, error *err) const;
+
+   // module can be the file name or the full path.  An address
+   // matches nothing.
+   //
+   bool
+   Matches(const char *path) const;
+
+   bool
+   operator==(const BreakpointLocation &other) const
+   {
+      return module == other.module &&
+             symbol == other.symbol &&
+             offset == other.offset;
+   }
+};
+
+// Called when an internal breakpoint is hit, before the instruction
+// under it runs.  May delete the breakpoint.
+//
+typedef
+void (*BreakpointHandler)(Debugger *dbg, Breakpoint *bp, void *context, error *err);
+
 struct Breakpoint
 {
    addr_t vaddr;
    int size;
+
+   // Order of creation.
+   //
+   unsigned long seq;
+
+   // Set by the user, as opposed to the debugger's own.  One patch can
+   // be both; execution only stops for the user's.
+   //
+   bool user;
+
+   // One of the debugger's own that Go() stops at anyway, eg. where a
+   // call returns when stepping over it.
+   //
+   bool temporary;
+
+   BreakpointHandler handler;
+   void *context;
+
+   // What this was resolved from, if it was set by the user.
+   //
+   BreakpointLocation *location;
+
+   // If this is a jump rather than a trap, the trampoline it jumps
+   // to, and where that traps (0 if it never does).  Otherwise 0.
+   //
+   addr_t trampoline;
+   addr_t trap;
+
+   // For a trap, a copy of the instruction under it somewhere else,
+   // followed by a jump back, that a thread can run instead of having
+   // the trap taken out to step over it: [displaced, displacedEnd).
+   // 0 until it's needed, and ~0 if the instruction can't be moved.
+   //
+   addr_t displaced;
+   addr_t displacedEnd;
+
    unsigned char text[];
 
    typedef
@@ -49,7 +188,13 @@ struct Breakpoint
 
 struct BreakpointList
 {
-   std::vector<Breakpoint::ptr> bps;
+   // Keyed by address.  Breakpoints never overlap, so this is also in
+   // order of end address.
+   //
+   std::map<addr_t, Breakpoint::ptr> bps;
+   unsigned long nextSeq;
+
+   BreakpointList() : nextSeq(0) {}
 
    Breakpoint *
    Lookup(addr_t pc);
@@ -62,12 +207,24 @@ struct BreakpointList
       error *err
    );
 
-   Breakpoint *
-   Insert(
-      addr_t addr,
-      int len,
-      error *err
-   );
+   // The user's breakpoints, in the order they were set.
+   //
+   void
+   GetUserBreakpoints(std::vector<Breakpoint*> &output, error *err);
+
+   // Takes a batch already checked for overlaps.  All or nothing.
+   //
+   void
+   Insert(std::vector<Breakpoint::ptr> &batch, error *err);
+
+   void
+   Remove(Breakpoint *bp);
+
+   void
+   Remove(std::vector<Breakpoint*> &list);
+
+   void
+   Clear();
 };
 
 }
@@ -0,0 +1,86 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_checkpoint_h_
+#define dbg_checkpoint_h_
+
+#include "types.h"
+#include "trampoline.h"
+
+#include <map>
+#include <vector>
+
+namespace dbg {
+
+struct Debugger;
+
+//
+// Copies of the target to go back to: .checkpoint and .restart.  Each
+// is the target forked where it stopped (Process::Fork()), and kept
+// stopped, so it costs only the pages either side writes after.  Going
+// back forks the copy again, so it can be gone back to any number of
+// times, and the target there was is killed.
+//
+// A copy's memory has the breakpoints that were patched in when it was
+// made.  Going back swaps those for the ones there are now, and writes
+// any trampolines built since.
+//
+struct Checkpoint
+{
+   int id;
+   int process;
+   addr_t pc;
+   uint64_t time;
+
+   // The patches in memory when it was made: at each vaddr, size bytes
+   // of text, first what's under it, then what's patched in.
+   //
+   struct Patch
+   {
+      addr_t vaddr;
+      int size;
+      size_t text;
+   };
+
+   std::vector<Patch> patches;
+   std::vector<unsigned char> text;
+   std::vector<Trampolines::Arena> arenas;
+   addr_t ring;
+};
+
+struct Checkpoints
+{
+   // Keyed by ID.  IDs aren't reused.
+   //
+   std::map<int, Checkpoint> list;
+   int nextId;
+
+   Checkpoints() : nextId(0) {}
+
+   // Returns the new checkpoint's ID.
+   //
+   int
+   Take(Debugger *dbg, error *err);
+
+   // Makes a copy of the checkpoint the target.  The target is killed.
+   //
+   void
+   Restart(Debugger *dbg, int id, error *err);
+
+   void
+   Delete(Debugger *dbg, int id, error *err);
+
+   // Kills every copy.
+   //
+   void
+   Clear(Debugger *dbg);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_condition_h_
+#define dbg_condition_h_
+
+#include "types.h"
+
+#include <string>
+#include <vector>
+
+namespace dbg {
+
+//
+// A breakpoint condition, eg. "rdi == 0x10 && poi(rsi+8) > 5".
+//
+// Parsed once into a small stack machine, since it runs every time
+// the breakpoint is hit and a hot one is hit a lot.  Numbers are hex
+// unless prefixed with 0n.  Registers are by name (optionally with @),
+// memory is read with poi() (pointer sized), by(), wo(), dwo() and
+// qwo().  Operators are C's, with C's precedence; && and || short
+// circuit.  Everything is unsigned and pointer sized.
+//
+struct Condition : public common::RefCountable
+{
+   std::string text;
+   std::vector<unsigned char> code;
+
+   // The instructions in code.  Operands follow the opcode byte.
+   // Jumps are to an absolute offset in the code; if taken, the value
+   // tested stays on the stack, otherwise it's popped.
+   //
+   enum Op
+   {
+      OpConst,          // addr_t
+      OpRegister,       // regno, size
+      OpLoad,           // size
+      OpNeg,
+      OpNot,
+      OpBitNot,
+      OpBool,
+      OpMul,
+      OpDiv,
+      OpMod,
+      OpAdd,
+      OpSub,
+      OpShl,
+      OpShr,
+      OpLt,
+      OpLe,
+      OpGt,
+      OpGe,
+      OpEq,
+      OpNe,
+      OpAnd,
+      OpXor,
+      OpOr,
+      OpJumpIfZero,     // uint16_t
+      OpJumpIfNonZero,  // uint16_t
+   };
+
+   void
+   Compile(Cpu *cpu, const char *str, error *err);
+
+   // Against the target as it is now.  Registers are read once each,
+   // and memory a cache line at a time, so poi(rsi) and poi(rsi+8)
+   // cost one read.
+   //
+   bool
+   Evaluate(Debugger *dbg, error *err);
+
+   // As above, for the value rather than whether it's true.
+   //
+   addr_t
+   Compute(Debugger *dbg, error *err);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_coverage_h_
+#define dbg_coverage_h_
+
+#include "types.h"
+
+#include <string>
+#include <vector>
+
+namespace dbg {
+
+struct Breakpoint;
+struct Module;
+
+//
+// Basic block coverage without recompiling.  Every block in a module
+// gets a breakpoint, which is removed the first time it's hit.  So a
+// block costs one stop, ever, and once the hot code has been seen the
+// program runs at full speed.
+//
+struct Coverage
+{
+   Debugger *dbg;
+
+   struct CoveredModule
+   {
+      addr_t base;
+      addr_t end;
+      std::string path;
+   };
+   std::vector<CoveredModule> modules;
+
+   struct Block
+   {
+      addr_t addr;
+      uint16_t size;
+      uint16_t module;
+      bool hit;
+   };
+
+   // Sorted by address.
+   //
+   std::vector<Block> blocks;
+   size_t hits;
+
+   Coverage() : dbg(nullptr), hits(0) {}
+
+   // Finds the blocks in a module's code and sets a breakpoint on each.
+   //
+   void
+   Add(Debugger *dbg, Module *mod, error *err);
+
+   // Removes any breakpoints not yet hit.  What's been recorded stays.
+   //
+   void
+   Stop(error *err);
+
+   // Forgets everything.
+   //
+   void
+   Reset();
+
+   // Writes the blocks that were hit, in drcov format (as read by
+   // lighthouse, etc.).
+   //
+   void
+   WriteDrcov(const char *path, error *err);
+};
+
+} // end namespace
+
+#endif
@@ -10,11 +10,15 @@
 #define dbg_cpu_h_
 
 #include <functional>
+#include <vector>
 
 #include "types.h"
 
 namespace dbg {
 
+struct Condition;
+struct Tracepoint;
+
 struct Cpu : public common::RefCountable
 {
    int
@@ -41,12 +45,103 @@ struct Cpu : public common::RefCountable
       error *err
    );
 
+   // Finds where basic blocks start in a run of code, as far as a
+   // linear sweep can tell: the targets of direct jumps and calls, and
+   // whatever follows a jump or return.  Padding between functions is
+   // skipped.  vaddr is the address of text.  Appends to out, sorted.
+   //
+   void
+   FindBasicBlocks(
+      const void *text,
+      size_t len,
+      addr_t vaddr,
+      std::vector<addr_t> &out,
+      error *err
+   );
+
+   // Which branch took a block step that started at vaddr to "to":
+   // the first unconditional one in the code, or the first conditional
+   // one that goes to "to".  vaddr is the address of text.  Returns 0 if
+   // there isn't one in len bytes, or "to" comes first.
+   //
+   addr_t
+   FindTakenBranch(
+      const void *text,
+      size_t len,
+      addr_t vaddr,
+      addr_t to
+   );
+
+   enum BranchKind
+   {
+      BranchNone,
+      BranchConditional,
+      BranchJump,
+      BranchCall,
+      BranchReturn,
+   };
+
+   // Decodes one instruction at pc, for following control flow: what
+   // sort of branch it is, if any, and where it goes if that's in the
+   // instruction (otherwise 0).  Returns its length, or 0 if it can't be
+   // decoded.
+   //
+   int
+   DecodeBranch(
+      const void *text,
+      int len,
+      addr_t pc,
+      BranchKind *kind,
+      addr_t *target
+   );
+
+   // If the instruction at text is a call, or anything else that comes
+   // back to the next one, returns its length.  Otherwise 0.
+   //
+   int
+   GetCallLength(const void *text, int len);
+
+   struct MemoryRange
+   {
+      addr_t addr;
+      int len;
+   };
+
+   // Memory the instruction at pc could write, from the registers as
+   // they are now: what its operands point at, whether it reads them
+   // or writes them, and the stack for a push or a call.  Not what a
+   // system call writes, nor anything through a segment base we can't
+   // see (fs, gs).  Appends to out.
+   //
+   void
+   GetMemoryOperands(
+      Process *proc,
+      const void *text,
+      int len,
+      addr_t pc,
+      std::vector<MemoryRange> &out,
+      error *err
+   );
+
    addr_t
    GetPc(
       Process *proc,
       error *err
    );
 
+   addr_t
+   GetSp(
+      Process *proc,
+      error *err
+   );
+
+   void
+   SetPc(
+      Process *proc,
+      addr_t pc,
+      error *err
+   );
+
    void
    GenerateBreakpoint(
       addr_t pc,
@@ -68,12 +163,89 @@ struct Cpu : public common::RefCountable
       error *err
    );
 
+   // Size of the jump GenerateJump() makes, or 0 if this arch has none
+   // we can patch in over code.
+   //
+   int
+   GetJumpSize();
+
+   // A jump at pc to target, padded out to len with breakpoints.  Fails
+   // if target is out of reach.
+   //
+   void
+   GenerateJump(
+      addr_t pc,
+      addr_t target,
+      void *buffer,
+      int len,
+      error *err
+   );
+
+   // Copies whole instructions from the start of text (which is at pc)
+   // until at least minLen bytes are covered, fixed up to run at "to".
+   // Appends them to out, and sets *consumed to how many bytes of text
+   // they were.  Fails on anything that can't run from somewhere else,
+   // eg. a relative branch.
+   //
+   void
+   RelocateInstructions(
+      const void *text,
+      int len,
+      addr_t pc,
+      int minLen,
+      addr_t to,
+      std::vector<unsigned char> &out,
+      int *consumed,
+      error *err
+   );
+
+   // Native code, to be placed at "to", that evaluates cond as if at
+   // pc.  If it's true, or can't be worked out, the code traps at
+   // *trap with every register as it was at pc apart from the pc
+   // itself.  Otherwise it falls off the end with nothing disturbed.
+   // Memory is read directly, so a bad pointer faults.  Appends to out.
+   //
+   void
+   CompileCondition(
+      const Condition *cond,
+      addr_t pc,
+      addr_t to,
+      std::vector<unsigned char> &out,
+      addr_t *trap,
+      error *err
+   );
+
+   // Native code, which can go anywhere, that appends a record of tp's
+   // items to the ring at "ring", as if at pc, and falls off the end
+   // with nothing disturbed.  If the ring is full, or an item can't be
+   // worked out, it counts the record as dropped.  Appends to out.
+   //
+   void
+   CompileTracepoint(
+      const Tracepoint *tp,
+      addr_t ring,
+      addr_t pc,
+      std::vector<unsigned char> &out,
+      error *err
+   );
+
    void
    StackTrace(
       Debugger *dbg,
       std::function<void(addr_t pc, addr_t frame, bool& cancel, error *err)> callback,
       error *err
    );
+
+   // Best effort for when StackTrace can't make sense of things: reports
+   // every word on the stack that looks like a return address, along
+   // with where it was found.
+   //
+   void
+   ScanStack(
+      Debugger *dbg,
+      std::function<void(addr_t pc, addr_t slot, bool& cancel, error *err)> callback,
+      error *err
+   );
 };
 
 void
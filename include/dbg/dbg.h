@@ -12,6 +12,17 @@
 #include <dbg/cpu.h>
 #include <dbg/process.h>
 #include <dbg/breakpoint.h>
+#include <dbg/branchtrace.h>
+#include <dbg/checkpoint.h>
+#include <dbg/history.h>
+#include <dbg/module.h>
+#include <dbg/linkmap.h>
+#include <dbg/coverage.h>
+#include <dbg/strace.h>
+#include <dbg/trampoline.h>
+#include <dbg/tracepoint.h>
+
+#include <initializer_list>
 
 namespace dbg {
 
@@ -20,17 +31,158 @@ struct Debugger : public common::RefCountable
    common::Pointer<Process> proc;
    common::Pointer<Cpu> cpu;
    BreakpointList bps;
+   ModuleList modules;
+
+   // The user's breakpoints, in the order they were set.  These
+   // outlive the addresses they resolve to, and are resolved again
+   // whenever a module loads.
+   //
+   std::vector<std::unique_ptr<BreakpointLocation>> locations;
+   int nextBreakpointId;
+
+   LinkMapTracker linkMap;
+   Coverage coverage;
+   Trampolines trampolines;
+   Tracepoints tracepoints;
+   BranchTrace branches;
+   History history;
+   Checkpoints checkpoints;
+   SyscallTrace strace;
+
+   // How much of the stack to read up front when walking it.  Zero
+   // reads it a frame at a time.
+   //
+   size_t stackPrefetch;
 
-   // Returns null if the current PC is not a breakpoint.
+   // Where system calls are made from, once there's somewhere.
+   //
+   addr_t syscallStub;
+
+   Debugger() : nextBreakpointId(0), stackPrefetch(64 * 1024), syscallStub(0) {}
+
+   // Start debugging.  Use these rather than going straight to the
+   // Process, so that we can set up our own state.
+   //
+   void
+   Attach(const char *string, error *err);
+
+   void
+   Create(char *const *argv, error *err);
+
+   // Returns null if the current PC is not a breakpoint.  If a
+   // trampoline trapped, moves the PC back to its breakpoint.
    //
    Breakpoint *
    GetCurrentBreakpoint(error *err);
 
-   void
+   BreakpointLocation *
    SetBreakpoint(addr_t pc, error *err);
 
+   // Sets a breakpoint at every address, or at none of them.  Memory
+   // is read and written a page at a time rather than per breakpoint.
+   //
+   void
+   SetBreakpoints(const std::vector<addr_t> &pcs, error *err);
+
+   // Patches any modules already loaded that the location matches.
+   // Otherwise it stays pending.
+   //
+   BreakpointLocation *
+   SetBreakpoint(const BreakpointLocation &loc, error *err);
+
+   // As above, but each module is only searched once, and everything
+   // is patched in one batch.  Addresses are all or nothing.
+   //
+   void
+   SetBreakpoints(const std::vector<BreakpointLocation> &locs, error *err);
+
+   // Return null if there is no such breakpoint.
+   //
+   BreakpointLocation *
+   FindBreakpoint(int id);
+
+   BreakpointLocation *
+   FindBreakpointLocation(const BreakpointLocation &loc);
+
+   // Clearing a breakpoint takes out everywhere it resolved to.
+   //
+   void
+   DeleteBreakpoint(BreakpointLocation *loc, error *err);
+
+   void
+   DeleteBreakpoints(std::vector<BreakpointLocation*> &list, error *err);
+
+   // Clears every user breakpoint.
+   //
+   void
+   DeleteAllBreakpoints(error *err);
+
+   // Disabling unpatches a breakpoint but keeps it, and its hit count,
+   // for enabling later.  Each takes one pass over the target's memory
+   // however many breakpoints are in the list.
+   //
    void
-   DeleteBreakpoint(int idx, error *err);
+   DisableBreakpoints(std::vector<BreakpointLocation*> &list, error *err);
+
+   void
+   EnableBreakpoints(std::vector<BreakpointLocation*> &list, error *err);
+
+   // Sets breakpoints for any locations in a newly loaded module.
+   // Locations that don't resolve are logged, not returned.
+   //
+   void
+   ResolveBreakpoints(Module *mod, error *err);
+
+   // Forgets breakpoints in [start, end) without unpatching them, for
+   // when the memory has gone away.  The user's breakpoints by address
+   // go with them, and so do tracepoints there.
+   //
+   void
+   DropBreakpoints(addr_t start, addr_t end);
+
+   // Breakpoints for the debugger's own use.  They aren't listed, and
+   // don't stop execution: the handler is called and we carry on.
+   //
+   Breakpoint *
+   SetInternalBreakpoint(
+      addr_t pc,
+      BreakpointHandler handler,
+      void *context,
+      error *err
+   );
+
+   // Many at once, with the same handler, batched like
+   // SetBreakpoints().  Addresses that already have a handler, or a
+   // trampoline, are skipped.  Sorts pcs.
+   //
+   void
+   SetInternalBreakpoints(
+      std::vector<addr_t> &pcs,
+      BreakpointHandler handler,
+      void *context,
+      error *err
+   );
+
+   void
+   DeleteInternalBreakpoint(Breakpoint *bp, error *err);
+
+   // Patches in a new breakpoint, or removes one, regardless of who it
+   // belongs to.
+   //
+   Breakpoint *
+   PatchBreakpoint(addr_t pc, error *err);
+
+   void
+   RemoveBreakpoint(Breakpoint *bp, error *err);
+
+   // Batched versions of the above: all or nothing, one read and one
+   // write per page touched.  pcs must be sorted, with no duplicates.
+   //
+   void
+   PatchBreakpoints(const std::vector<addr_t> &pcs, error *err);
+
+   void
+   RemoveBreakpoints(std::vector<Breakpoint*> &list, error *err);
 
    //
    // For the following calls, you could reach down to ->proc to
@@ -39,6 +191,18 @@ struct Debugger : public common::RefCountable
    // logical view.
    //
 
+   // System calls in the target, as Process::Syscall(), from a stub
+   // kept in a trampoline arena so the code at the pc is left alone.
+   // A batch costs one save and restore of the registers.
+   //
+   void
+   Syscall(SystemCall *calls, int n, error *err);
+
+   // Just the one.  A failed call (-errno) is returned as an error.
+   //
+   addr_t
+   Syscall(addr_t nr, std::initializer_list<addr_t> args, error *err);
+
    void
    ReadMemory(addr_t addr, int len, void *buf, error *err);
 
@@ -48,9 +212,64 @@ struct Debugger : public common::RefCountable
    void
    Step(error *err);
 
+   // Runs to the next taken branch, skipping the straight-line code,
+   // and records it in branches.  Stops sooner at a breakpoint.
+   //
+   void
+   StepBlock(error *err);
+
+   // Block-steps until the pc gets to addr, recording every branch on
+   // the way.  Stops sooner where Go() would for the user.
+   //
+   void
+   GoBlocks(addr_t addr, error *err);
+
+   // Steps until the pc gets to addr (if it's not 0), count steps have
+   // been made (if it's not 0), or the process goes away, recording
+   // every step.  Stops sooner where Go() would for the user.
+   //
+   void
+   Record(Recorder *rec, addr_t addr, uint64_t count, error *err);
+
+   // Goes until the current thread gets to pc with its stack pointer at
+   // least sp, so a deeper call through the same place doesn't count.
+   // Stops sooner where Go() would for the user.
+   //
+   void
+   RunTo(addr_t pc, addr_t sp, error *err);
+
+   // Steps over a call, as if it were one instruction, with a
+   // breakpoint where it returns.  Anything else is Step().
+   //
+   void
+   StepOver(error *err);
+
+   // Goes until the current function returns, to where the stack
+   // trace says.
+   //
+   void
+   StepOut(error *err);
+
    void
    Go(error *err);
 
+   // As Go(), but stops the target wherever it is after timeout
+   // nanoseconds, or once it's hit breakpoints (ours included) hits
+   // times.  0 is no limit.  Returns whether it stopped for one.
+   //
+   bool
+   Go(uint64_t timeout, uint64_t hits, error *err);
+
+   // Back a step, or back to the last time the pc was at one of the
+   // user's breakpoints (and its condition held), through history.
+   // ReverseGo() stops at the start of the history if nothing's there.
+   //
+   void
+   ReverseStep(error *err);
+
+   void
+   ReverseGo(error *err);
+
    void
    Detach(error *err);
 };
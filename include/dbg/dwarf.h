@@ -0,0 +1,334 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_dwarf_h_
+#define dbg_dwarf_h_
+
+#include "elf.h"
+#include "arch.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <string.h>
+
+namespace dbg { namespace dwarf {
+
+//
+// Cursor over a section.  Knows the vaddr of every byte so that
+// pc-relative pointer encodings can be resolved.  Running off the end
+// sets overflow and returns zeros rather than faulting.
+//
+struct Reader
+{
+   const unsigned char *start;
+   const unsigned char *p;
+   const unsigned char *end;
+   addr_t vaddr;
+   bool overflow;
+
+   Reader(const ElfSection &sec)
+      : start(sec.data),
+        p(sec.data),
+        end(sec.data + sec.size),
+        vaddr(sec.vaddr),
+        overflow(false)
+   {
+   }
+
+   Reader(const unsigned char *p, const unsigned char *end, addr_t vaddr)
+      : start(p), p(p), end(end), vaddr(vaddr), overflow(false)
+   {
+   }
+
+   size_t
+   Offset() { return p - start; }
+
+   addr_t
+   Vaddr() { return vaddr + (p - start); }
+
+   size_t
+   Remaining() { return p < end ? end - p : 0; }
+
+   void
+   Seek(size_t off);
+
+   void
+   Skip(size_t n);
+
+   template<typename T>
+   T
+   Read()
+   {
+      T r = 0;
+      if (Remaining() < sizeof(T))
+      {
+         overflow = true;
+         p = end;
+      }
+      else
+      {
+         memcpy(&r, p, sizeof(T));
+         p += sizeof(T);
+      }
+      return r;
+   }
+
+   uint8_t
+   U8() { return Read<uint8_t>(); }
+
+   uint16_t
+   U16() { return Read<uint16_t>(); }
+
+   uint32_t
+   U32() { return Read<uint32_t>(); }
+
+   uint64_t
+   U64() { return Read<uint64_t>(); }
+
+   uint64_t
+   Uleb();
+
+   int64_t
+   Sleb();
+
+   const char *
+   String();
+
+   // Reads a DW_EH_PE_* encoded pointer.  datarel is the base for
+   // DW_EH_PE_datarel; indirect pointers are returned undereferenced.
+   //
+   bool
+   EncodedPointer(int enc, addr_t *out, addr_t datarel = 0);
+};
+
+//
+// Register rules, per DWARF 4 section 6.4.1.
+//
+
+enum RuleType
+{
+   RuleSameValue,
+   RuleUndefined,
+   RuleOffset,
+   RuleValOffset,
+   RuleRegister,
+   RuleExpression,
+   RuleValExpression,
+};
+
+struct Rule
+{
+   unsigned char type;
+   unsigned short reg;
+   int64_t offset;
+   const unsigned char *expr;
+   size_t exprLen;
+};
+
+//
+// A fully evaluated row of the CFI table: how to get the CFA and each
+// caller register at one pc.  Expressions point into the image, so a
+// row is only valid as long as the CallFrameInfo that made it.
+//
+struct UnwindRow
+{
+   bool valid;
+   bool signalFrame;
+   unsigned short returnReg;
+   Rule cfa;
+   Rule regs[DBG_DWARF_REGISTER_COUNT];
+};
+
+struct RegisterSet
+{
+   addr_t regs[DBG_DWARF_REGISTER_COUNT];
+   uint32_t valid;
+
+   bool
+   IsValid(int reg) { return (valid & (1U << reg)) ? true : false; }
+
+   void
+   Set(int reg, addr_t val)
+   {
+      regs[reg] = val;
+      valid |= (1U << reg);
+   }
+};
+
+typedef
+std::function<void(addr_t addr, int len, void *buf, error *err)>
+ReadMemoryCallback;
+
+struct CallFrameInfo : public common::RefCountable
+{
+   // Sections in the image.  Any of these may be empty.
+   //
+   common::Pointer<ElfImage> image;
+   ElfSection ehFrameHdr, ehFrame, debugFrame;
+
+   CallFrameInfo();
+
+   void
+   Init(ElfImage *image, error *err);
+
+   // pc is an unrelocated address in the image.  Fills out row, and
+   // returns false if there is no CFI covering pc.
+   //
+   bool
+   FindRow(addr_t pc, UnwindRow *row, error *err);
+
+   // Interesting bits of .eh_frame_hdr
+   //
+   const unsigned char *hdrTable;
+   size_t hdrCount;
+   int hdrTableEnc;
+
+   // Built on first use for .debug_frame and for .eh_frame without a
+   // search table.
+   //
+   struct IndexEntry
+   {
+      addr_t start, end;
+      size_t offset;
+      bool eh;
+   };
+   bool indexBuilt;
+   std::vector<IndexEntry> index;
+
+   // Previously computed rows, including misses.
+   //
+   std::unordered_map<addr_t, UnwindRow> rowCache;
+};
+
+// Given the register state of one frame and the row for its pc,
+// computes the register state of the caller.  The caller's pc is
+// left in DBG_DWARF_IP; it will be marked invalid at the outermost
+// frame.
+//
+void
+Unwind(
+   const UnwindRow &row,
+   RegisterSet &regs,
+   const ReadMemoryCallback &read,
+   error *err
+);
+
+
+//
+// One function in the chain of inlined calls at a pc.  Strings point
+// into the image or the DebugInfo, and may be null if the debug info
+// doesn't say.
+//
+struct InlineFrame
+{
+   const char *name;
+
+   // For inlined frames, where in the caller the call was.
+   //
+   bool inlined;
+   const char *callFile;
+   int callLine;
+};
+
+//
+// The parts of .debug_info we need to map pcs back to functions.
+// Compilation units are found by address on first use, and each one
+// is only walked the first time a pc lands in it.
+//
+struct DebugInfo : public common::RefCountable
+{
+   common::Pointer<ElfImage> image;
+   ElfSection info, abbrev, str, lineStr, strOffsets, addr;
+   ElfSection ranges, rnglists, line;
+
+   DebugInfo() : unitsRead(false) {}
+
+   void
+   Init(ElfImage *image, error *err);
+
+   // pc is an unrelocated address in the image.  Fills out frames,
+   // innermost first, ending with the function that physically
+   // contains pc.  Returns false if there is no debug info for pc.
+   //
+   bool
+   GetInlineChain(addr_t pc, std::vector<InlineFrame> &frames, error *err);
+
+   struct AttrSpec
+   {
+      uint16_t name;
+      uint16_t form;
+      int64_t implicitConst;
+   };
+
+   struct Abbrev
+   {
+      uint16_t tag;
+      bool children;
+      std::vector<AttrSpec> attrs;
+   };
+
+   // Indexed by abbreviation code.  Cached by offset in .debug_abbrev,
+   // since units may share tables.
+   //
+   typedef std::vector<Abbrev> AbbrevTable;
+   std::unordered_map<uint64_t, AbbrevTable> abbrevTables;
+
+   // A function, or a function inlined into one.
+   //
+   struct Scope
+   {
+      int parent;
+      bool inlined;
+      const char *name;
+      uint64_t origin;
+      uint32_t callFile;
+      uint32_t callLine;
+   };
+
+   struct Unit
+   {
+      size_t offset, dieOffset, end;
+      int version, addrSize, offsetSize;
+      uint64_t abbrevOffset;
+      uint64_t strOffsetsBase, addrBase, rnglistsBase;
+      addr_t base;
+      bool hasLines;
+      uint64_t lineOffset;
+
+      // Filled in on first lookup.
+      //
+      bool indexed;
+      std::vector<Scope> scopes;
+      std::vector<std::pair<addr_t, int>> scopeMap;
+      bool filesRead;
+      std::vector<std::string> files;
+   };
+
+   struct UnitRange
+   {
+      addr_t start, end;
+      size_t unit;
+   };
+
+   // Sorted by offset and address respectively.
+   //
+   bool unitsRead;
+   std::vector<Unit> units;
+   std::vector<UnitRange> unitRanges;
+
+   // Names of DIEs referred to by abstract_origin and friends.
+   //
+   std::unordered_map<uint64_t, const char *> names;
+};
+
+} } // end namespace
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_elf_h_
+#define dbg_elf_h_
+
+#include "types.h"
+
+#include <functional>
+#include <vector>
+
+namespace dbg {
+
+// Segment types for GetSegment().  Same values as <elf.h>, which
+// not every platform has.
+//
+enum
+{
+   DBG_PT_DYNAMIC      = 2,
+   DBG_PT_GNU_EH_FRAME = 0x6474e550,
+};
+
+// A contiguous run of bytes from an image, along with the (unrelocated)
+// virtual address it would be loaded at.  vaddr is 0 for sections that
+// are not loaded.
+//
+struct ElfSection
+{
+   const unsigned char *data;
+   size_t size;
+   addr_t vaddr;
+
+   ElfSection() : data(nullptr), size(0), vaddr(0) {}
+};
+
+//
+// A read-only view of an ELF file on disk.  We mmap the whole thing,
+// since most of what we want from it (CFI, debug info) is random
+// access, and the page cache will do a better job than we would.
+//
+struct ElfImage : public common::RefCountable
+{
+   void *map;
+   size_t mapSize;
+
+   ElfImage() : map(nullptr), mapSize(0) {}
+   ElfImage(const ElfImage&) = delete;
+   ~ElfImage();
+
+   void
+   Open(const char *path, error *err);
+
+   // Lowest and highest virtual addresses covered by PT_LOAD segments.
+   // Subtracting GetLoadStart() from the runtime base gives the bias.
+   //
+   addr_t
+   GetLoadStart();
+
+   addr_t
+   GetLoadEnd();
+
+   bool
+   GetSection(const char *name, ElfSection *out);
+
+   bool
+   GetSegment(unsigned int type, ElfSection *out);
+
+   // Returns the file-backed bytes from vaddr to the end of the
+   // PT_LOAD segment that contains it.
+   //
+   bool
+   GetLoadedRange(addr_t vaddr, ElfSection *out);
+
+   // Appends the file-backed part of each executable PT_LOAD segment.
+   //
+   void
+   GetExecutableSegments(std::vector<ElfSection> &out, error *err);
+
+   // Calls back with the name and (unrelocated) value of every defined
+   // function or object in .symtab and .dynsym.  Names may repeat,
+   // since most of .dynsym is also in .symtab.  Stops if the callback
+   // returns false.
+   //
+   void
+   ForEachSymbol(const std::function<bool(const char *name, addr_t value)> &callback);
+};
+
+} // end namespace
+
+#endif
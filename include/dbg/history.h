@@ -0,0 +1,170 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_history_h_
+#define dbg_history_h_
+
+#include "types.h"
+#include "record.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace dbg {
+
+struct Debugger;
+
+//
+// What the current thread did while it was single-stepped, for going
+// back over it: t- and g-.  Steps are kept packed as in an execution
+// record, in chunks of at most ChunkSteps, each of which starts with
+// every register.  Going back puts the registers back from the nearest
+// chunk start, and memory back from what was written since.
+//
+// So that going back a long way doesn't mean undoing every write on
+// the way, each chunk also keeps the bytes it overwrote, as they were
+// before it, and these are merged pairwise into runs of 2, 4, 8 ...
+// chunks as they fill.  Any run of whole chunks is then a handful of
+// these, logarithmic in its length, each no bigger than the memory it
+// touched.
+//
+// Going forward runs the process for real, so anything after where it
+// is now is forgotten.  What the kernel did (system calls, other
+// processes) isn't put back.
+//
+struct History
+{
+   static const uint32_t ChunkSteps = 256;
+
+   struct Chunk
+   {
+      std::vector<unsigned char> data;
+   };
+
+   // A byte as it was before some run of chunks.  Sorted by address,
+   // with no duplicates.
+   //
+   struct Undo
+   {
+      addr_t addr;
+      unsigned char old;
+   };
+   typedef std::vector<Undo> UndoSet;
+
+   // Level n holds merged runs of 2^n chunks: run i is chunks
+   // [(base + i) << n, (base + i + 1) << n).
+   //
+   struct Level
+   {
+      uint64_t base;
+      std::deque<UndoSet> runs;
+   };
+
+   bool enabled;
+   int thread;
+
+   // The most steps to keep.  Past this, the oldest chunks go.
+   //
+   uint64_t maxSteps;
+
+   // Finished chunks, numbered from firstChunk, then the one being
+   // filled, in encoder.
+   //
+   std::deque<Chunk> chunks;
+   uint64_t firstChunk;
+   RecordEncoder encoder;
+   std::vector<Level> levels;
+
+   // The step the process is at now: encoder.total, unless it's been
+   // taken back.
+   //
+   uint64_t pos;
+
+   // Bytes held, for .history.
+   //
+   size_t size;
+
+   StepCapture step;
+
+   History() : enabled(false), thread(0), maxSteps(1000000), firstChunk(0), pos(0), size(0) {}
+
+   void
+   Clear();
+
+   // The first step still kept.
+   //
+   uint64_t
+   GetFirst() const;
+
+   uint64_t
+   GetEnd() const
+   {
+      return encoder.total;
+   }
+
+   // Steps forward for real, and remembers it.  If the process was
+   // taken back, what came after is dropped first.  If it ran, or
+   // another thread is current, the history starts again.
+   //
+   void
+   Step(Debugger *dbg, error *err);
+
+   // Puts the registers and memory back as they were before step n.
+   //
+   void
+   Seek(Debugger *dbg, uint64_t n, error *err);
+
+   // Calls fn with the pc before each step in [start, end), last first,
+   // until it sets stop.  Returns the step it stopped at, or start if it
+   // didn't.
+   //
+   uint64_t
+   Search(
+      uint64_t start,
+      uint64_t end,
+      std::function<void(uint64_t n, addr_t pc, bool &stop, error *err)> fn,
+      error *err
+   );
+
+   // The chunk holding step n, and where it is: finished chunks by
+   // index from firstChunk, or the one being filled.
+   //
+   const unsigned char *
+   GetChunk(uint64_t n, size_t *len, uint64_t *index);
+
+   // The registers before step n.
+   //
+   void
+   GetRegistersAt(uint64_t n, std::vector<addr_t> &regs, error *err);
+
+   // Finishes the chunk being filled, with its undo set.
+   //
+   void
+   FinishChunk(error *err);
+
+   // Undoes the writes of steps [start, end) within one chunk, latest
+   // first.
+   //
+   void
+   UndoSteps(Debugger *dbg, uint64_t start, uint64_t end, error *err);
+
+   // Applies an undo set to the target.
+   //
+   void
+   Apply(Debugger *dbg, const UndoSet &set, error *err);
+
+   // Forgets everything from step n.
+   //
+   void
+   Truncate(uint64_t n, error *err);
+};
+
+} // end namespace
+
+#endif
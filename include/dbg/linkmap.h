@@ -0,0 +1,68 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_linkmap_h_
+#define dbg_linkmap_h_
+
+#include "types.h"
+
+#include <string>
+#include <vector>
+
+namespace dbg {
+
+struct Breakpoint;
+
+//
+// Follows the dynamic linker's list of loaded objects (r_debug and its
+// link_map chain), so that libraries loaded and unloaded after attach
+// show up as OnModuleProbed/OnModuleUnloaded events.
+//
+// The linker calls r_brk (_dl_debug_state in glibc) around every
+// change.  We keep an internal breakpoint there and re-read the list
+// each time it says things are consistent.
+//
+struct LinkMapTracker
+{
+   Debugger *dbg;
+   addr_t rDebug;
+   Breakpoint *entryBp;
+   Breakpoint *brkBp;
+
+   struct Entry
+   {
+      addr_t node;
+      addr_t bias;
+      addr_t base;
+      std::string name;
+   };
+   std::vector<Entry> entries;
+
+   LinkMapTracker() : dbg(nullptr), rDebug(0), entryBp(nullptr), brkBp(nullptr) {}
+
+   // Call after attaching.  If the linker hasn't run yet (eg. we just
+   // started the process), waits for the program's entry point.
+   // Failures to find anything are logged, not returned.
+   //
+   void
+   Init(Debugger *dbg);
+
+   // Forgets everything, without touching the target.
+   //
+   void
+   Reset();
+
+   // Re-reads the link_map chain and reports any changes.
+   //
+   void
+   Update(error *err);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_memory_h_
+#define dbg_memory_h_
+
+#include "types.h"
+
+#include <vector>
+
+namespace dbg {
+
+//
+// A local copy of a range of target memory, read in bulk and grown on
+// demand.  The point is to turn many small reads of nearby memory
+// (eg. walking up the stack) into one or two large ones.
+//
+// Reads below the base, or too far past the end, go straight to the
+// target.
+//
+struct MemoryWindow
+{
+   Debugger *dbg;
+   addr_t base;
+   std::vector<unsigned char> buf;
+
+   // How far past the end we're willing to grow, and by how much at
+   // least when we do.
+   //
+   size_t maxSize;
+   size_t chunkSize;
+
+   // Number of reads issued to the target, for the curious.
+   //
+   int reads;
+
+   MemoryWindow() : dbg(nullptr), base(0), maxSize(0), chunkSize(0), reads(0) {}
+
+   // Reads [base, base+size) up front.  A size of 0 disables the
+   // window and everything is passed through.
+   //
+   void
+   Init(Debugger *dbg, addr_t base, size_t size, error *err);
+
+   void
+   Read(addr_t addr, int len, void *buf, error *err);
+
+   // Makes sure [base, end) is in the window, if it can.
+   //
+   bool
+   Extend(addr_t end, error *err);
+
+   addr_t
+   End() { return base + buf.size(); }
+};
+
+} // end namespace
+
+#endif
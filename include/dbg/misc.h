@@ -10,6 +10,7 @@
 #define dbg_misc_h_
 
 #include <stddef.h>
+#include <stdint.h>
 
 namespace dbg
 {
@@ -17,6 +18,17 @@ namespace dbg
 const char *
 FormatSignal(char *buf, size_t sz, int sig);
 
+// A signal by number, or by name with or without the SIG.  Returns -1
+// if there's no such thing.
+//
+int
+ParseSignal(const char *str);
+
+// Nanoseconds by a clock that only goes forwards, for timing things.
+//
+uint64_t
+MonotonicTime();
+
 } // end namespace
 
 #endif
\ No newline at end of file
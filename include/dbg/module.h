@@ -0,0 +1,79 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_module_h_
+#define dbg_module_h_
+
+#include "types.h"
+#include "elf.h"
+#include "dwarf.h"
+
+#include <string>
+#include <vector>
+
+namespace dbg {
+
+struct Module : public common::RefCountable
+{
+   addr_t base;
+   std::string path;
+
+   // The following are only meaningful once the image is loaded.
+   //
+   addr_t end;
+   addr_t bias;
+
+   Module()
+      : base(0), end(0), bias(0),
+        imageTried(false), cfiTried(false), debugInfoTried(false)
+   {
+   }
+
+   // Lazily maps the on-disk image.  Returns null if there isn't one
+   // or it couldn't be read.
+   //
+   ElfImage *
+   GetImage();
+
+   dwarf::CallFrameInfo *
+   GetCallFrameInfo();
+
+   dwarf::DebugInfo *
+   GetDebugInfo();
+
+   bool imageTried;
+   common::Pointer<ElfImage> image;
+   bool cfiTried;
+   common::Pointer<dwarf::CallFrameInfo> cfi;
+   bool debugInfoTried;
+   common::Pointer<dwarf::DebugInfo> debugInfo;
+};
+
+struct ModuleList
+{
+   // Sorted by base address.
+   //
+   std::vector<common::Pointer<Module>> modules;
+
+   // Returns null if addr is not inside a module we know the extents of.
+   //
+   Module *
+   Lookup(addr_t addr);
+
+   // Replaces anything already at base, unless it's the same file.
+   //
+   Module *
+   Insert(addr_t base, const char *path, error *err);
+
+   void
+   Remove(addr_t base);
+};
+
+} // end namespace
+
+#endif
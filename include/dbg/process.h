@@ -11,26 +11,97 @@
 
 #include "types.h"
 
+#include <signal.h>
 #include <stdarg.h>
 
+#include <vector>
+
 namespace dbg {
 
+// A thread going into a system call being traced, with its arguments,
+// or coming out of one, with its result (-errno on Linux).
+//
+struct SyscallStop
+{
+   int thread;
+   bool entry;
+   addr_t nr;
+   addr_t args[6];
+   addr_t result;
+};
+
 struct ProcessEvents : public virtual common::RefCountable
 {
    virtual void OnMessage(const char *str, error *err);
    virtual void OnProcessExited(error *err) {}
    virtual void OnSignal(int sig, error *err) {}
+   virtual void OnSyscall(const SyscallStop &stop, error *err) {}
    virtual void OnModuleProbed(addr_t baseAddr, const char *optName, error *err) {}
+   virtual void OnModuleUnloaded(addr_t baseAddr, error *err) {}
 
    void OnMessage(error *err, const char *fmt, ...);
    void OnVMessage(error *err, const char *fmt, va_list ap);
 };
 
+// A system call for Process::Syscall().  nr and args are the
+// platform's; result is the raw return value (-errno on Linux).
+//
+struct SystemCall
+{
+   addr_t nr;
+   addr_t args[6];
+   int nargs;
+   addr_t result;
+};
+
+// What to do when the target gets a signal.  Stop is the default:
+// report it and stop, passing it on when it goes again.  Print reports
+// it and passes it on without stopping, Pass passes it on without a
+// word, and Suppress throws it away without a word.
+//
+enum SignalPolicy
+{
+   SignalStop,
+   SignalPrint,
+   SignalPass,
+   SignalSuppress,
+};
+
 struct Process : public common::RefCountable
 {
    common::Pointer<ProcessEvents> EventCallbacks;
    common::Pointer<Cpu> Cpu;
 
+   // When Step() or Go() last saw the target stop, by MonotonicTime(),
+   // or 0 if the platform doesn't keep track.
+   //
+   uint64_t stoppedAt;
+
+   // If set, by MonotonicTime(), waiting for the target stops it then,
+   // wherever it is.  Where the platform can't, it waits as long as it
+   // takes.  timedOut says whether the last stop was this.
+   //
+   uint64_t deadline;
+   bool timedOut;
+
+   // By signal number.  Signals the debugger uses itself (SIGSTOP,
+   // SIGTRAP) may not be told apart.
+   //
+   unsigned char signalPolicy[NSIG];
+
+   Process() : stoppedAt(0), deadline(0), timedOut(false)
+   {
+      for (int i = 0; i < NSIG; ++i)
+         signalPolicy[i] = SignalStop;
+      signalPolicy[SIGCHLD] = SignalPass;
+   }
+
+   SignalPolicy
+   GetSignalPolicy(int sig) const
+   {
+      return sig > 0 && sig < NSIG ? (SignalPolicy)signalPolicy[sig] : SignalStop;
+   }
+
    virtual void
    Attach(const char *string, error *err) = 0;
 
@@ -40,6 +111,19 @@ struct Process : public common::RefCountable
    virtual bool
    IsAttached() = 0;
 
+   // The target's threads, by the platform's IDs, in the order they
+   // were found.  Ones that have gone are 0, so the rest keep their
+   // places.  Empty if the platform doesn't follow threads.
+   //
+   virtual void
+   GetThreads(std::vector<int> &out, error *err) { out.clear(); }
+
+   // The thread that last stopped, which registers, Step() and Go()
+   // act on.  0 if the platform doesn't follow threads.
+   //
+   virtual int
+   GetCurrentThread() { return 0; }
+
    // A recommended block size for memory transfers.
    // In the traditional ptrace, this is going to be quite small,
    // eg. a machine word.
@@ -47,6 +131,18 @@ struct Process : public common::RefCountable
    virtual int
    GetBlockSize() { return 256; }
 
+   // Looks up an entry (AT_*) in the ELF auxiliary vector.  Returns
+   // false if there isn't one or the platform won't tell us.
+   //
+   virtual bool
+   GetAuxiliaryValue(addr_t type, addr_t *value, error *err) { return false; }
+
+   // Opens the file behind one of the target's descriptors, for the
+   // debugger's own use.  Returns -1 if the platform can't.
+   //
+   virtual int
+   OpenFile(int fd, int flags, error *err) { return -1; }
+
    virtual void
    ReadMemory(addr_t addr, int len, void *buf, error *err) = 0;
 
@@ -59,9 +155,59 @@ struct Process : public common::RefCountable
    virtual void
    SetRegister(int regno, const void *reg, error *err) = 0;
 
+   // Makes system calls in the target, one after another, and puts the
+   // registers back as they were.  They run from stub, which holds what
+   // GetSyscallStub() gave, if it's set.  Otherwise they run from the
+   // pc, which is patched for the purpose and put back.  Stops at the
+   // first that couldn't be made; those before it have their results.
+   //
+   virtual void
+   Syscall(SystemCall *calls, int n, addr_t stub, error *err) = 0;
+
+   // Code that makes a system call and traps, to be left somewhere
+   // executable for Syscall().  Returns its length, or 0 if there's no
+   // such thing here.
+   //
+   virtual int
+   GetSyscallStub(void *buf, int len) { return 0; }
+
+   // Copies the target as it is now, with the platform's fork(), and
+   // keeps the copy stopped where it was: memory is copy-on-write, and
+   // only the current thread comes along.  With from, copies one of
+   // those instead.  The system call is made from stub.  Returns the
+   // copy's process ID.
+   //
+   virtual int
+   Fork(int from, addr_t stub, error *err);
+
+   // Kills the target, and makes a copy from Fork() the target instead.
+   //
+   virtual void
+   Switch(int copy, error *err);
+
+   // Kills a copy from Fork().
+   //
+   virtual void
+   Discard(int copy, error *err);
+
+   // Reports the system calls set in calls, by number, to OnSyscall()
+   // without stopping.  None stops.  The setting is kept for processes
+   // created later, which the platform may arrange to stop only for
+   // these; otherwise every call stops, and the rest are passed over.
+   //
+   virtual void
+   SetSyscallTrace(const std::vector<bool> &calls, error *err);
+
    virtual void
    Step(error *err) = 0;
 
+   // Runs to the next taken branch and stops at its target, or sooner
+   // at a breakpoint.  Where the platform can't, it's Step(): slower,
+   // but it ends up in the same places.
+   //
+   virtual void
+   StepBlock(error *err) { Step(err); }
+
    virtual void
    Go(error *err) = 0;
 
@@ -0,0 +1,246 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_record_h_
+#define dbg_record_h_
+
+#include "types.h"
+#include "cpu.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+
+namespace dbg {
+
+struct Debugger;
+
+//
+// What one instruction did, found by stepping it: every register
+// before and after, and the memory its operands pointed at, before and
+// after.  Only memory that changed is kept, trimmed to where it did.
+//
+struct StepCapture
+{
+   // Indexed by register number.
+   //
+   std::vector<addr_t> before;
+   std::vector<addr_t> after;
+
+   // A write's old bytes are at data[old], and its new ones at
+   // data[now].
+   //
+   struct Write
+   {
+      addr_t addr;
+      uint32_t len;
+      size_t old;
+      size_t now;
+   };
+
+   std::vector<Write> writes;
+   std::vector<unsigned char> data;
+   std::vector<Cpu::MemoryRange> ranges;
+
+   // Steps the current thread, with Debugger::Step().  If the process
+   // goes away, it did nothing we can see.
+   //
+   void
+   Step(Debugger *dbg, error *err);
+};
+
+//
+// An execution record, for reading back with .recdump.  After a header
+// come chunks, each of which stands on its own: it starts with every
+// register, and then each step is packed as what changed since the one
+// before it:
+//
+//    varint   the change in the pc, zigzag encoded
+//    varint   a mask of the other registers that changed
+//    varint   each of their changes, zigzag encoded, lowest first
+//    varint   how many memory writes
+//
+// and for each write:
+//
+//    varint   its address less the last one in the chunk (or 0),
+//             zigzag encoded
+//    varint   its length
+//             the old bytes, then the new ones
+//
+// Everything else is in the byte order of the machine that wrote it.
+//
+
+struct RecordHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t registers;
+};
+
+// len is the number of bytes after this: the registers, as uint64_t,
+// then the steps.  first numbers the chunk's first step.
+//
+struct RecordChunk
+{
+   uint32_t len;
+   uint32_t steps;
+   uint64_t first;
+};
+
+//
+// Packs steps into a chunk, starting with a RecordChunk.
+//
+struct RecordEncoder
+{
+   std::vector<unsigned char> chunk;
+
+   // As of the last step.  A step that starts anywhere else (eg. the
+   // user changed a register) needs a new chunk.
+   //
+   std::vector<addr_t> regs;
+   addr_t lastWrite;
+
+   uint32_t steps;
+   uint64_t total;
+
+   RecordEncoder() : lastWrite(0), steps(0), total(0) {}
+
+   bool
+   Follows(const StepCapture &step) const
+   {
+      return steps && regs == step.before;
+   }
+
+   void
+   Append(const StepCapture &step, error *err);
+
+   // Fills in the RecordChunk, so the chunk so far can be decoded.
+   //
+   void
+   Seal();
+
+   // Seals the chunk, and hands it over.  Starts again with the next
+   // step.
+   //
+   void
+   Finish(std::vector<unsigned char> &out);
+};
+
+//
+// Unpacks a chunk a step at a time.
+//
+struct RecordDecoder
+{
+   const unsigned char *p;
+   const unsigned char *end;
+   std::vector<addr_t> regs;
+   addr_t lastWrite;
+   uint32_t left;
+
+   RecordDecoder() : p(nullptr), end(nullptr), lastWrite(0), left(0) {}
+
+   // chunk starts with its RecordChunk, and holds all of it.
+   //
+   void
+   Start(const unsigned char *chunk, size_t len, int registers, error *err);
+
+   // The next step into step, with data for its writes.  False at the
+   // end of the chunk.
+   //
+   bool
+   Next(StepCapture &step, error *err);
+};
+
+//
+// Records steps to a file.  Each is packed as it's made, and whole
+// chunks go to a thread that writes them, so stepping only waits on the
+// disk if it gets a long way ahead.
+//
+struct Recorder
+{
+   RecordEncoder encoder;
+   StepCapture step;
+
+   int fd;
+   std::thread writer;
+   std::mutex lock;
+   std::condition_variable cond;
+   std::deque<std::vector<unsigned char>> queue;
+   bool closing;
+
+   // errno from the writer, which stops at the first failure.
+   //
+   int failed;
+   uint64_t written;
+
+   Recorder() : fd(-1), closing(false), failed(0), written(0) {}
+   Recorder(const Recorder&) = delete;
+   ~Recorder() { error err; Close(&err); }
+
+   bool
+   IsOpen() const
+   {
+      return fd >= 0;
+   }
+
+   // Truncates anything already there.
+   //
+   void
+   Open(Debugger *dbg, const char *path, error *err);
+
+   // Waits for everything to be written.
+   //
+   void
+   Close(error *err);
+
+   // Steps, and records it.
+   //
+   void
+   Step(Debugger *dbg, error *err);
+
+   // Queues the chunk so far.
+   //
+   void
+   Flush(error *err);
+
+   void
+   WriteChunks();
+};
+
+struct RecordReader
+{
+   FILE *file;
+   uint32_t registers;
+   std::vector<unsigned char> chunk;
+   StepCapture step;
+
+   RecordReader() : file(nullptr), registers(0) {}
+   RecordReader(const RecordReader&) = delete;
+   ~RecordReader();
+
+   void
+   Open(const char *path, error *err);
+
+   // Calls onStep for each step, numbered from 0, until the end of the
+   // record.  A record cut short is an error, after what came before.
+   //
+   void
+   Read(
+      std::function<void(uint64_t n, const StepCapture &step, error *err)> onStep,
+      error *err
+   );
+};
+
+} // end namespace
+
+#endif
@@ -26,7 +26,11 @@ struct CommandState
    bool quitFlag;
    bool littleEndian;
 
-   CommandState() : dbg(nullptr), quitFlag(false)
+   // Set by a "~N" before the command: the Nth thread, or -1.
+   //
+   int thread;
+
+   CommandState() : dbg(nullptr), quitFlag(false), thread(-1)
    {
       static const int x = 1;
       littleEndian = (*(char*)&x) ? true : false;
@@ -78,6 +82,9 @@ FormatAddr(
    error *err
 );
 
+void
+FormatDuration(uint64_t ns, char *buf, size_t len);
+
 void
 Disassemble(
    CommandState &st,
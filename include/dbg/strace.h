@@ -0,0 +1,91 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_strace_h_
+#define dbg_strace_h_
+
+#include "types.h"
+
+#include <vector>
+
+namespace dbg {
+
+struct Debugger;
+struct SyscallStop;
+
+// A system call we know by name, and how to show its arguments, a
+// letter each:
+//
+//    d   signed decimal: descriptors, and counts that can be -1
+//    l   the same, as wide as a register: offsets
+//    u   unsigned decimal: sizes
+//    o   octal: modes
+//    x   hex: flags, pointers, and anything else
+//    s   a string in the target: paths
+//    a   a directory descriptor, which can be AT_FDCWD
+//
+struct SyscallName
+{
+   const char *name;
+   long nr;
+   const char *args;
+};
+
+// Null if it isn't one this platform has, or one we know.
+//
+const SyscallName *
+LookupSyscall(const char *name);
+
+const SyscallName *
+LookupSyscall(addr_t nr);
+
+//
+// .strace: logs the system calls the target makes, going in with their
+// arguments and coming out with their results, timed from when the
+// tracing started.  The process does the stopping; see
+// Process::SetSyscallTrace().
+//
+struct SyscallTrace
+{
+   // By number.
+   //
+   std::vector<bool> calls;
+
+   uint64_t start;
+
+   // Threads in a call we've logged the start of, and since when.
+   //
+   struct Open
+   {
+      int thread;
+      uint64_t entered;
+   };
+   std::vector<Open> open;
+
+   SyscallTrace() : start(0) {}
+
+   bool
+   IsEnabled() const;
+
+   // Replaces the calls being traced.  None turns it off.
+   //
+   void
+   Set(Debugger *dbg, const std::vector<bool> &newCalls, error *err);
+
+   // Forgets the calls in progress, for a new process.
+   //
+   void
+   Clear();
+
+   void
+   OnSyscall(Debugger *dbg, const SyscallStop &stop, error *err);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_tracelog_h_
+#define dbg_tracelog_h_
+
+#include "types.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <stdio.h>
+
+namespace dbg {
+
+struct Tracepoint;
+
+//
+// A binary log of what tracepoints recorded, for reading back later with
+// .tracedump.  After a header, it's a series of records, each prefixed
+// with its length and type.  Everything is in the byte order of the
+// machine that wrote it.
+//
+// A tracepoint's definition is written before any of its events, so a
+// log makes sense on its own.
+//
+
+struct TraceLogHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t reserved;
+};
+
+enum TraceLogType
+{
+   TraceLogDefinition = 1,
+   TraceLogEvent,
+   TraceLogDropped,
+};
+
+// len is the number of bytes after this.
+//
+struct TraceLogRecord
+{
+   uint32_t len;
+   uint32_t type;
+};
+
+// Followed by each item: a TraceLogItem, then its text.
+//
+struct TraceLogDefinitionRecord
+{
+   uint32_t id;
+   uint32_t items;
+   uint64_t vaddr;
+   uint32_t size;
+   uint32_t frames;
+};
+
+struct TraceLogItem
+{
+   uint32_t len;
+   uint32_t offset;
+   uint32_t textLen;
+};
+
+// Followed by size bytes of data, laid out as in the definition, then
+// frames return addresses.  seq is from the ring, for records made in
+// the target; time is nanoseconds since the epoch, for those made by
+// the debugger.  Either can be 0.
+//
+struct TraceLogEventRecord
+{
+   uint32_t id;
+   uint32_t frames;
+   uint64_t seq;
+   uint64_t time;
+};
+
+struct TraceLogDroppedRecord
+{
+   uint64_t count;
+};
+
+//
+// Writes a log through a buffer, so a busy tracepoint costs a memcpy
+// most of the time rather than a system call.
+//
+struct TraceLog
+{
+   int fd;
+   std::vector<unsigned char> buffer;
+   size_t used;
+
+   TraceLog() : fd(-1), used(0) {}
+   TraceLog(const TraceLog&) = delete;
+   ~TraceLog() { error err; Close(&err); }
+
+   bool
+   IsOpen() const
+   {
+      return fd >= 0;
+   }
+
+   // Truncates anything already there.
+   //
+   void
+   Open(const char *path, error *err);
+
+   void
+   Close(error *err);
+
+   void
+   Flush(error *err);
+
+   void
+   WriteDefinition(const Tracepoint *tp, error *err);
+
+   void
+   WriteEvent(
+      const Tracepoint *tp,
+      uint64_t seq,
+      uint64_t time,
+      const void *data,
+      const addr_t *frames,
+      uint32_t nframes,
+      error *err
+   );
+
+   void
+   WriteDropped(uint64_t count, error *err);
+
+   void
+   Write(const void *buf, size_t len, error *err);
+};
+
+//
+// Reads a log back, a record at a time.  Definitions are kept, as
+// tracepoints without expressions, for making sense of the events that
+// follow.
+//
+struct TraceLogReader
+{
+   FILE *file;
+   std::vector<unsigned char> record;
+   std::map<uint32_t, std::unique_ptr<Tracepoint>> tracepoints;
+
+   TraceLogReader() : file(nullptr) {}
+   TraceLogReader(const TraceLogReader&) = delete;
+   ~TraceLogReader();
+
+   void
+   Open(const char *path, error *err);
+
+   // Calls onEvent or onDropped for each of those until the end of the
+   // log.  A log cut short (eg. the debugger was killed) is an error,
+   // after everything before that is read.
+   //
+   void
+   Read(
+      std::function<void(const Tracepoint *tp, const TraceLogEventRecord *ev, const unsigned char *data, const addr_t *frames, error *err)> onEvent,
+      std::function<void(uint64_t count, error *err)> onDropped,
+      error *err
+   );
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_tracepoint_h_
+#define dbg_tracepoint_h_
+
+#include "types.h"
+#include "condition.h"
+#include "tracelog.h"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dbg {
+
+//
+// The ring tracepoints write to, in memory shared by the target and the
+// debugger.  A trampoline reserves a slot by bumping head, if it's less
+// than a ring's worth ahead of tail, fills it in, and sets its seq to
+// the slot's number plus one.  The debugger reads slots in order from
+// tail until one isn't finished, and moves tail past them.  If there's
+// no room the record is counted in dropped instead.
+//
+// Each counter has a cache line to itself, so the target's threads
+// fighting over head don't slow down the debugger.
+//
+struct TraceRing
+{
+   uint64_t head;
+   uint64_t pad0[7];
+   uint64_t tail;
+   uint64_t pad1[7];
+   uint64_t dropped;
+   uint64_t pad2[7];
+
+   static const size_t SlotSize = 256;
+   static const uint32_t Slots = 4096;
+};
+
+struct TraceRecord
+{
+   uint64_t seq;
+   uint32_t id;
+   uint32_t reserved;
+   unsigned char data[];
+};
+
+//
+// A tracepoint records values at an address without stopping: the
+// code there is patched with a jump to a trampoline that copies them
+// into the ring, runs the instructions it displaced, and jumps back.
+//
+// What to record is a list of expressions, in the syntax of breakpoint
+// conditions, separated by commas.  Each is recorded as a pointer sized
+// value, or with ":len" (hex, or 0n decimal) as len bytes of memory at
+// that address.  Memory is read directly, so a bad pointer crashes the
+// target.
+//
+// A tracepoint that records a backtrace too is a breakpoint instead,
+// since the debugger has to walk the stack: it stops the target for as
+// long as that takes, and carries on without a word.  What it records
+// goes straight to the log.
+//
+struct Tracepoint
+{
+   int id;
+   addr_t vaddr;
+   addr_t trampoline;
+   std::string text;
+
+   struct Item
+   {
+      std::string text;
+      common::Pointer<Condition> expr;
+
+      // 0 for the value itself, otherwise bytes of memory at it.
+      //
+      uint32_t len;
+
+      // Where it goes in the record's data.
+      //
+      uint32_t offset;
+   };
+   std::vector<Item> items;
+
+   // Bytes of data in each record.
+   //
+   uint32_t size;
+
+   // Return addresses to record, if it's a breakpoint.
+   //
+   uint32_t frames;
+
+   // Records read so far.
+   //
+   unsigned long records;
+
+   Tracepoint() : id(0), vaddr(0), trampoline(0), size(0), frames(0), records(0) {}
+
+   // Fills in items from a list as above.
+   //
+   void
+   Parse(Cpu *cpu, const char *str, error *err);
+};
+
+struct Tracepoints
+{
+   Debugger *dbg;
+
+   // Keyed by ID.  IDs aren't reused.
+   //
+   std::map<int, Tracepoint> tracepoints;
+   int nextId;
+
+   // Those that went with their module, kept until what they recorded
+   // has been drained.
+   //
+   std::map<int, Tracepoint> unloaded;
+
+   // The ring, as mapped in the target and by us.  Set up with the
+   // first tracepoint.
+   //
+   addr_t remote;
+   TraceRing *ring;
+   size_t ringSize;
+
+   // The ring's count of dropped records at the last drain.
+   //
+   uint64_t lastDropped;
+
+   // Where records go, if anywhere, besides the drain callback.
+   //
+   TraceLog log;
+
+   // Hits on tracepoints in the debugger that weren't recorded: there
+   // was no log, or an item couldn't be worked out.
+   //
+   uint64_t missed;
+
+   // A record being put together by the debugger.
+   //
+   std::vector<unsigned char> scratch;
+   std::vector<addr_t> stack;
+
+   Tracepoints()
+      : dbg(nullptr), nextId(0), remote(0), ring(nullptr), ringSize(0), lastDropped(0), missed(0) {}
+   Tracepoints(const Tracepoints&) = delete;
+   ~Tracepoints() { Reset(); }
+
+   // With frames, a breakpoint that records a backtrace as well.
+   //
+   Tracepoint *
+   Add(Debugger *dbg, addr_t pc, const char *items, uint32_t frames, error *err);
+
+   // Takes out the patch.  Records from it still in the ring are
+   // skipped when drained.
+   //
+   void
+   Remove(Tracepoint *tp, error *err);
+
+   // Forgets those in [start, end) without unpatching them, for when
+   // the memory has gone away.  Their records still in the ring are
+   // drained as usual.
+   //
+   void
+   Drop(addr_t start, addr_t end);
+
+   Tracepoint *
+   Find(int id);
+
+   // Whether its patch is still there.
+   //
+   bool
+   IsPatched(const Tracepoint *tp);
+
+   // Hands each finished record to the callback in order, straight from
+   // the ring, which can't reuse the slot until the callback returns.
+   // *dropped is how many the target dropped since the last drain.
+   // Records and drops are logged too, if there's a log; the callback
+   // can be null.
+   //
+   void
+   Drain(
+      std::function<void(const Tracepoint *tp, const TraceRecord *rec, error *err)> callback,
+      uint64_t *dropped,
+      error *err
+   );
+
+   // Starts logging.  Tracepoints already set are defined in the log
+   // first.
+   //
+   void
+   OpenLog(const char *path, error *err);
+
+   // Drains what's left into the log first.
+   //
+   void
+   CloseLog(error *err);
+
+   // Drains the ring into the log and writes out what's buffered, so
+   // the file is up to date.  Nothing without a log.
+   //
+   void
+   FlushLog(error *err);
+
+   // Records a hit on a tracepoint in the debugger, while the target is
+   // stopped there.
+   //
+   void
+   Record(Tracepoint *tp, error *err);
+
+   // Forgets everything, without touching the target.  Our mapping of
+   // the ring goes, and the log is closed.
+   //
+   void
+   Reset();
+
+   // Makes the ring, in a memfd mapped by both of us.  near is for
+   // the trampoline arena its name goes in.
+   //
+   void
+   MapRing(addr_t near, error *err);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_trampoline_h_
+#define dbg_trampoline_h_
+
+#include "types.h"
+#include "breakpoint.h"
+
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace dbg {
+
+//
+// Conditional breakpoints that don't stop unless they have to.  The
+// instructions under the breakpoint are moved to a trampoline in the
+// target, and replaced with a jump there.  The trampoline evaluates the
+// condition natively: if it's false, it runs the moved instructions and
+// jumps back, and the debugger never hears about it.  If it's true, it
+// traps, and we make it look like the original breakpoint did.
+//
+// The patch is bigger than a trap, so anything that jumps into the
+// middle of it will crash.  Function entries are the safe bet.
+//
+struct Trampolines
+{
+   Debugger *dbg;
+
+   // Executable memory we've mapped in the target, handed out from the
+   // front.  Nothing is freed, since a thread could still be in there.
+   //
+   struct Arena
+   {
+      addr_t base;
+      size_t size;
+      size_t used;
+   };
+   std::vector<Arena> arenas;
+
+   // Where each trampoline traps, and the breakpoint it's for.
+   //
+   std::map<addr_t, addr_t> traps;
+
+   Trampolines() : dbg(nullptr) {}
+
+   // Appends the start of a trampoline that will be at "to".
+   //
+   typedef
+   std::function<void(addr_t to, std::vector<unsigned char> &code, error *err)>
+   Generator;
+
+   // Writes a trampoline to the target: what gen makes, then the
+   // instructions at vaddr moved after it, then a jump back.  Returns
+   // the jump to patch in over those instructions, with the text under
+   // it, for the caller to write.  Fails if another breakpoint is under
+   // the patch past vaddr.
+   //
+   Breakpoint::ptr
+   Build(Debugger *dbg, addr_t vaddr, const Generator &gen, error *err);
+
+   // Replaces the trap at bp with a jump to a trampoline for its
+   // location's condition, and returns the new breakpoint (bp is
+   // freed).  Fails, leaving bp alone, if there are instructions there
+   // that can't be moved, another breakpoint in the way, or the
+   // condition can't be compiled for the target.
+   //
+   Breakpoint *
+   Install(Debugger *dbg, Breakpoint *bp, error *err);
+
+   // Where a thread stopped at the trap bp can go instead, to run the
+   // instruction under it and carry on, with the trap left in for
+   // every other thread.  Built the first time it's asked for.  Fails
+   // (and keeps failing) if bp isn't a trap, or what's under it can't
+   // be moved.
+   //
+   addr_t
+   Displace(Debugger *dbg, Breakpoint *bp, error *err);
+
+   // The breakpoint whose trampoline traps at pc, if any.
+   //
+   Breakpoint *
+   FindTrap(addr_t pc);
+
+   // Forgets where bp's trampoline traps, for when bp has gone without
+   // being removed.  The trampoline stays.
+   //
+   void
+   Drop(Breakpoint *bp);
+
+   // Forgets everything, without touching the target.
+   //
+   void
+   Reset();
+
+   // Room for len bytes of code within a jump of near.
+   //
+   addr_t
+   Allocate(Debugger *dbg, addr_t near, size_t len, error *err);
+
+   // For a copy of the target made when the arenas were as in before:
+   // whether anything's been written to them since, what it was (read
+   // from the target), and putting it in the copy, mapping any arenas
+   // it doesn't have where they are here.
+   //
+   bool
+   WrittenSince(const std::vector<Arena> &before);
+
+   void
+   Save(
+      Debugger *dbg,
+      const std::vector<Arena> &before,
+      std::vector<unsigned char> &out,
+      error *err
+   );
+
+   void
+   Restore(
+      Debugger *dbg,
+      const std::vector<Arena> &before,
+      const std::vector<unsigned char> &saved,
+      error *err
+   );
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#ifndef dbg_watchtrace_h_
+#define dbg_watchtrace_h_
+
+#include "types.h"
+#include "cpu.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace dbg {
+
+struct Debugger;
+
+//
+// Runs a function to completion a block at a time and records the
+// calls it makes, with how many instructions each ran: windbg's "wt".
+//
+// Each trap only says where a block ended up, so the instructions in
+// it are counted by following the code from where it started to the
+// branch that was taken.  That code is decoded once and kept, so the
+// loop doesn't touch the target's memory once it's warmed up.
+//
+struct WatchTrace
+{
+   struct Call
+   {
+      // Where it was called, or for the first, where the trace started.
+      //
+      addr_t function;
+      int parent;
+      int depth;
+
+      // Instructions in this call itself, and with everything it
+      // called.  Nanoseconds from the call to its return, with the
+      // tracing.
+      //
+      uint64_t instructions;
+      uint64_t total;
+      uint64_t time;
+   };
+
+   // In the order they were made.  Past MaxCalls, calls are counted in
+   // their caller, and in dropped.
+   //
+   std::vector<Call> calls;
+   uint64_t dropped;
+
+   uint64_t instructions;
+   uint64_t traps;
+   uint64_t time;
+
+   WatchTrace() : dropped(0), instructions(0), traps(0), time(0) {}
+
+   // Traces from the pc until the function it's in returns (the stack
+   // goes above where it is now), or the process goes away.
+   //
+   void
+   Run(Debugger *dbg, error *err);
+
+   struct Instruction
+   {
+      addr_t addr;
+      addr_t target;
+      Cpu::BranchKind kind;
+      int len;
+   };
+
+   // Straight-line code from where a block started, up to and
+   // including the first jump, call or return.
+   //
+   std::unordered_map<addr_t, std::vector<Instruction>> blocks;
+
+   const std::vector<Instruction> *
+   GetBlock(Debugger *dbg, addr_t start, error *err);
+
+   // Counts what ran to get from start to "to", and what sort of
+   // branch ended it (BranchNone if it didn't take one).
+   //
+   uint64_t
+   Walk(Debugger *dbg, addr_t start, addr_t to, Cpu::BranchKind *kind, error *err);
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/addrset.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const uint32_t MaxSpan = 0xffffffff;
+
+// With more clusters than this the vector filter stops paying for
+// itself, and we use the scalar path.
+//
+const size_t MaxVectorClusters = 8;
+
+} // end namespace
+
+void
+dbg::AddressSet::Add(addr_t start, addr_t end, error *err)
+{
+   Range r;
+
+   if (start >= end)
+      goto exit;
+
+   r.start = start;
+   r.end = end;
+
+   try
+   {
+      ranges.push_back(r);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+dbg::AddressSet::Finalize(error *err)
+{
+   try
+   {
+      std::sort(
+         ranges.begin(),
+         ranges.end(),
+         [] (const Range &a, const Range &b) -> bool
+         {
+            return a.start < b.start;
+         }
+      );
+
+      // Merge anything overlapping or adjacent.
+      //
+      size_t out = 0;
+      for (size_t i=0; i<ranges.size(); ++i)
+      {
+         if (out && ranges[i].start <= ranges[out-1].end)
+            ranges[out-1].end = std::max(ranges[out-1].end, ranges[i].end);
+         else
+            ranges[out++] = ranges[i];
+      }
+      ranges.resize(out);
+
+      clusters.clear();
+      for (auto &r : ranges)
+      {
+         addr_t start = r.start;
+
+         // Grow the last cluster if this range fits, otherwise start
+         // a new one (or several, for an absurdly large range).
+         //
+         if (clusters.size())
+         {
+            auto &c = clusters.back();
+            if (r.end - c.start <= MaxSpan)
+            {
+               c.span = r.end - c.start;
+               continue;
+            }
+            if (start < c.start + c.span)
+               start = c.start + c.span;
+         }
+
+         while (start < r.end)
+         {
+            Cluster c;
+            c.start = start;
+            c.span = (r.end - start <= MaxSpan) ? (r.end - start) : MaxSpan;
+            clusters.push_back(c);
+            start += c.span;
+         }
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+bool
+dbg::AddressSet::Contains(addr_t addr)
+{
+   auto it = std::upper_bound(
+      ranges.begin(),
+      ranges.end(),
+      addr,
+      [] (addr_t addr, const Range &r) -> bool
+      {
+         return addr < r.start;
+      }
+   );
+
+   return it != ranges.begin() && addr < (it-1)->end;
+}
+
+bool
+dbg::AddressSet::Scan(
+   const void *buf,
+   size_t len,
+   const std::function<bool(size_t off, addr_t value)> &callback
+)
+{
+   auto words = (const addr_t*)buf;
+   size_t n = len / sizeof(addr_t);
+   size_t i = 0;
+
+   auto check = [this, words, &callback] (size_t i) -> bool
+   {
+      addr_t val = words[i];
+
+      if (!Contains(val))
+         return true;
+      return callback(i * sizeof(addr_t), val);
+   };
+
+   if (!clusters.size())
+      return true;
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+   if (clusters.size() <= MaxVectorClusters)
+   {
+      //
+      // Test a vector of words against each cluster at once:
+      //
+      //    (word - cluster.start) < cluster.span
+      //
+      // SSE2 has no unsigned compare, so flip the sign bits and use the
+      // signed one.  On 64-bit, the difference must also have a zero
+      // upper half.
+      //
+      const size_t lanes = sizeof(__m128i) / sizeof(addr_t);
+      const __m128i sign = _mm_set1_epi32((int)0x80000000);
+      const __m128i zero = _mm_setzero_si128();
+      __m128i starts[MaxVectorClusters];
+      __m128i spans[MaxVectorClusters];
+      size_t nclusters = clusters.size();
+
+      for (size_t j=0; j<nclusters; ++j)
+      {
+#if defined(__x86_64__)
+         starts[j] = _mm_set1_epi64x((long long)clusters[j].start);
+#else
+         starts[j] = _mm_set1_epi32((int)clusters[j].start);
+#endif
+         spans[j] = _mm_set1_epi32((int)(clusters[j].span ^ 0x80000000));
+      }
+
+      for (; i + lanes <= n; i += lanes)
+      {
+         __m128i v = _mm_loadu_si128((const __m128i*)(words + i));
+         __m128i hit = zero;
+         int mask = 0;
+
+         for (size_t j=0; j<nclusters; ++j)
+         {
+#if defined(__x86_64__)
+            __m128i d = _mm_sub_epi64(v, starts[j]);
+            __m128i upper = _mm_cmpeq_epi32(_mm_srli_epi64(d, 32), zero);
+            __m128i lower = _mm_cmplt_epi32(_mm_xor_si128(d, sign), spans[j]);
+            hit = _mm_or_si128(hit, _mm_and_si128(upper, lower));
+#else
+            __m128i d = _mm_sub_epi32(v, starts[j]);
+            hit = _mm_or_si128(hit, _mm_cmplt_epi32(_mm_xor_si128(d, sign), spans[j]));
+#endif
+         }
+
+         // One mask bit from the low dword of each lane.
+         //
+         mask = _mm_movemask_epi8(hit) & ((lanes == 2) ? 0x0101 : 0x1111);
+         if (!mask)
+            continue;
+
+         for (size_t k=0; k<lanes; ++k)
+         {
+            if ((mask & (1 << (k * sizeof(addr_t)))) && !check(i + k))
+               return false;
+         }
+      }
+   }
+#endif
+
+   for (; i<n; ++i)
+   {
+      addr_t val = words[i];
+      bool hit = false;
+
+      for (auto &c : clusters)
+      {
+         if (val - c.start < c.span)
+         {
+            hit = true;
+            break;
+         }
+      }
+
+      if (hit && !check(i))
+         return false;
+   }
+
+   return true;
+}
@@ -0,0 +1,69 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/branchtrace.h>
+
+#include <common/c++/new.h>
+
+namespace {
+
+// 1MB on a 64-bit machine.
+//
+const size_t RingSize = 64 * 1024;
+
+} // end namespace
+
+void
+dbg::BranchTrace::Record(addr_t from, addr_t to, error *err)
+{
+   if (!ring.size())
+   {
+      try
+      {
+         ring.resize(RingSize);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+   }
+
+   ring[next].from = from;
+   ring[next].to = to;
+   next = (next + 1) % ring.size();
+   ++total;
+exit:;
+}
+
+void
+dbg::BranchTrace::Get(std::vector<Branch> &out, error *err) const
+{
+   size_t n = total < ring.size() ? total : ring.size();
+
+   out.clear();
+
+   try
+   {
+      out.reserve(n);
+
+      for (size_t i=0; i<n; ++i)
+         out.push_back(ring[(next + ring.size() - n + i) % ring.size()]);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+dbg::BranchTrace::Clear()
+{
+   next = 0;
+   total = 0;
+}
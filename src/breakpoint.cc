@@ -11,6 +11,8 @@
 
 #include <algorithm>
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -27,34 +29,135 @@ dbg::Breakpoint::Allocate(int size, error *err)
 
    bp->vaddr = 0;
    bp->size = size;
+   bp->seq = 0;
+   bp->user = false;
+   bp->temporary = false;
+   bp->handler = nullptr;
+   bp->context = nullptr;
+   bp->location = nullptr;
+   bp->trampoline = 0;
+   bp->trap = 0;
+   bp->displaced = 0;
+   bp->displacedEnd = 0;
    memset(bp->text, 0, size*2);
 exit:
    return dbg::Breakpoint::ptr(bp, free);
 }
 
+bool
+dbg::BreakpointLocation::Parse(const char *str, error *err)
+{
+   const char *bang = strchr(str, '!');
+   // Search from the end, for the likes of libstdc++.so.6+0x10.
+   //
+   const char *plus = strrchr(bang ? bang : str, '+');
+   const char *moduleEnd = bang ? bang : plus;
+   bool r = false;
+
+   if (!moduleEnd)
+      goto exit;
+   if (moduleEnd == str)
+      ERROR_SET(err, unknown, "Missing module name");
+
+   try
+   {
+      module.assign(str, moduleEnd - str);
+      symbol.clear();
+      if (bang)
+         symbol.assign(bang + 1, plus ? plus - (bang + 1) : strlen(bang + 1));
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   if (bang && !symbol.size())
+      ERROR_SET(err, unknown, "Missing symbol name");
+
+   offset = 0;
+   if (plus)
+   {
+      char *end = nullptr;
+
+      errno = 0;
+      offset = strtoull(plus + 1, &end, 16);
+      if (!plus[1] || *end || errno)
+         ERROR_SET(err, unknown, "Bad offset");
+   }
+
+   r = true;
+exit:
+   return r && !ERROR_FAILED(err);
+}
+
+void
+dbg::BreakpointLocation::Format(std::string &out, error *err) const
+{
+   try
+   {
+      if (IsAddress())
+      {
+         char buf[32];
+         snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)offset);
+         out = buf;
+         goto exit;
+      }
+
+      out = module;
+      if (symbol.size())
+      {
+         out += '!';
+         out += symbol;
+      }
+
+      // Without a symbol we need the offset even if it's 0, or it
+      // won't parse back.
+      //
+      if (offset || !symbol.size())
+      {
+         char buf[32];
+         snprintf(buf, sizeof(buf), "+0x%llx", (unsigned long long)offset);
+         out += buf;
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+bool
+dbg::BreakpointLocation::Matches(const char *path) const
+{
+   const char *p = nullptr;
+
+   if (!path || IsAddress())
+      return false;
+   if (module.find('/') != std::string::npos)
+      return module == path;
+
+   if ((p = strrchr(path, '/')))
+      path = p + 1;
+   return module == path;
+}
+
 std::unique_ptr<dbg::Breakpoint, void(*)(void*)>
 dbg::Breakpoint::Null()
 {
   return dbg::Breakpoint::ptr(nullptr, [] (void*) -> void {});
 }
 
-//
-// XXX - it would be ideal to have faster lookups for breakpoints.
-// but I will assume nobody will create a lot of them.
-//
-
 dbg::Breakpoint *
 dbg::BreakpointList::Lookup(addr_t pc)
 {
-   for (auto &bp : bps)
-   {
-      if (pc >= bp->vaddr && pc < bp->vaddr + bp->size)
-      {
-         return bp.get();
-      }
-   }
+   auto it = bps.upper_bound(pc);
+
+   if (it == bps.begin())
+      return nullptr;
 
-   return nullptr;
+   auto bp = (--it)->second.get();
+   return (pc < bp->vaddr + bp->size) ? bp : nullptr;
 }
 
 void
@@ -65,68 +168,106 @@ dbg::BreakpointList::FindBreakpointsInRange(
    error *err
 )
 {
+   // First one starting after addr; the one before may cover it.
+   //
+   auto it = bps.upper_bound(addr);
+
    output.clear();
 
-   for (auto &bp : bps)
+   if (it != bps.begin())
    {
-      auto start = MAX(addr, bp->vaddr);
-      auto end = MIN(addr + len, bp->vaddr + bp->size);
-      if (start < end)
+      auto prev = std::prev(it);
+      if (prev->second->vaddr + prev->second->size > addr)
+         it = prev;
+   }
+
+   try
+   {
+      for (; it != bps.end() && it->first < addr + len; ++it)
+         output.push_back(it->second.get());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+dbg::BreakpointList::GetUserBreakpoints(std::vector<Breakpoint*> &output, error *err)
+{
+   output.clear();
+
+   try
+   {
+      for (auto &p : bps)
       {
-         try
-         {
-            output.push_back(bp.get());
-         }
-         catch (std::bad_alloc)
-         {
-            ERROR_SET(err, nomem);
-         }
+         if (p.second->user)
+            output.push_back(p.second.get());
       }
    }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
 
    std::sort(
       output.begin(),
       output.end(),
-      [] (Breakpoint *a, Breakpoint *b) -> bool { return a->vaddr < b->vaddr; }
+      [] (Breakpoint *a, Breakpoint *b) -> bool { return a->seq < b->seq; }
    );
 exit:;
 }
 
-dbg::Breakpoint *
-dbg::BreakpointList::Insert(
-   addr_t addr,
-   int len,
-   error *err
-)
+void
+dbg::BreakpointList::Insert(std::vector<Breakpoint::ptr> &batch, error *err)
 {
-   std::vector<Breakpoint*> existing;
-   Breakpoint *p = nullptr;
-   auto n = Breakpoint::Null();
-
-   FindBreakpointsInRange(existing, addr, len, err);
-   ERROR_CHECK(err);
-
-   if (existing.size())
-      ERROR_SET(err, unknown, "Proposed breakpoint overlaps with existing bp");
-
-   n = Breakpoint::Allocate(len, err);
-   ERROR_CHECK(err);
-
-   p = n.get();
-   p->vaddr = addr;
-   p->size = len;
+   size_t i = 0;
 
+   // Make all the nodes first, so that there's nothing to undo once
+   // we start handing over breakpoints.
+   //
    try
    {
-      bps.push_back(std::move(n));
+      auto hint = bps.end();
+
+      for (; i<batch.size(); ++i)
+      {
+         hint = bps.emplace_hint(hint, batch[i]->vaddr, Breakpoint::Null());
+         ++hint;
+      }
    }
    catch (std::bad_alloc)
    {
+      while (i-- > 0)
+         bps.erase(batch[i]->vaddr);
       ERROR_SET(err, nomem);
    }
 
-exit:
-   if (ERROR_FAILED(err))
-      p = nullptr;
-   return p;
+   for (auto &bp : batch)
+   {
+      bp->seq = nextSeq++;
+      bps.find(bp->vaddr)->second = std::move(bp);
+   }
+   batch.clear();
+exit:;
+}
+
+void
+dbg::BreakpointList::Remove(Breakpoint *bp)
+{
+   bps.erase(bp->vaddr);
+}
+
+void
+dbg::BreakpointList::Remove(std::vector<Breakpoint*> &list)
+{
+   for (auto bp : list)
+      bps.erase(bp->vaddr);
+}
+
+void
+dbg::BreakpointList::Clear()
+{
+   bps.clear();
 }
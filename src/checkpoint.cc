@@ -0,0 +1,155 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/checkpoint.h>
+#include <dbg/dbg.h>
+#include <dbg/misc.h>
+
+#include <common/c++/new.h>
+#include <common/misc.h>
+
+#include <string.h>
+#include <sys/syscall.h>
+
+int
+dbg::Checkpoints::Take(Debugger *dbg, error *err)
+{
+   int id = nextId;
+   Checkpoint *cp = nullptr;
+
+   // The copy is made from the system call stub, which is only there
+   // once a call has been made.
+   //
+   if (!dbg->syscallStub)
+   {
+      dbg->Syscall(SYS_getpid, {}, err);
+      ERROR_CHECK(err);
+   }
+
+   try
+   {
+      cp = &list[id];
+      cp->id = id;
+      cp->process = -1;
+      cp->ring = dbg->tracepoints.remote;
+      cp->arenas = dbg->trampolines.arenas;
+
+      for (auto &i : dbg->bps.bps)
+      {
+         auto bp = i.second.get();
+         size_t text = cp->text.size();
+
+         cp->text.resize(text + 2 * bp->size);
+         memcpy(cp->text.data() + text, bp->OldText(), 2 * bp->size);
+         cp->patches.push_back(Checkpoint::Patch{bp->vaddr, bp->size, text});
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   cp->pc = dbg->cpu->GetPc(dbg->proc.Get(), err);
+   ERROR_CHECK(err);
+
+   cp->process = dbg->proc->Fork(0, dbg->syscallStub, err);
+   ERROR_CHECK(err);
+
+   cp->time = MonotonicTime();
+   ++nextId;
+exit:
+   if (ERROR_FAILED(err) && cp)
+      list.erase(id);
+   return ERROR_FAILED(err) ? -1 : id;
+}
+
+void
+dbg::Checkpoints::Restart(Debugger *dbg, int id, error *err)
+{
+   auto it = list.find(id);
+   Checkpoint *cp = nullptr;
+   std::vector<unsigned char> built;
+   int copy = -1;
+
+   if (it == list.end())
+      ERROR_SET(err, unknown, "No such checkpoint");
+   cp = &it->second;
+
+   // The ring is only mapped in the target we're about to lose.
+   //
+   if (dbg->tracepoints.remote != cp->ring)
+      ERROR_SET(err, unknown, "Tracepoints were set up after the checkpoint");
+
+   // So are trampolines built since.  Get them while it's there.
+   //
+   if (dbg->trampolines.WrittenSince(cp->arenas))
+   {
+      if (!dbg->proc->IsAttached())
+         ERROR_SET(err, unknown, "Trampolines were built after the checkpoint, in a process that's gone");
+
+      dbg->trampolines.Save(dbg, cp->arenas, built, err);
+      ERROR_CHECK(err);
+   }
+
+   copy = dbg->proc->Fork(cp->process, dbg->syscallStub, err);
+   ERROR_CHECK(err);
+
+   dbg->proc->Switch(copy, err);
+   ERROR_CHECK(err);
+
+   dbg->trampolines.Restore(dbg, cp->arenas, built, err);
+   ERROR_CHECK(err);
+
+   // Out with the breakpoints it had, and in with the ones there are.
+   //
+   for (auto p = cp->patches.rbegin(); p != cp->patches.rend(); ++p)
+   {
+      dbg->proc->WriteMemory(p->vaddr, p->size, cp->text.data() + p->text, err);
+      ERROR_CHECK(err);
+   }
+   for (auto &i : dbg->bps.bps)
+   {
+      auto bp = i.second.get();
+
+      dbg->proc->WriteMemory(bp->vaddr, bp->size, bp->PatchedText(), err);
+      ERROR_CHECK(err);
+   }
+
+   dbg->history.Clear();
+
+   // Libraries loaded or unloaded since come and go again.
+   //
+   dbg->linkMap.Update(err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Checkpoints::Delete(Debugger *dbg, int id, error *err)
+{
+   auto it = list.find(id);
+
+   if (it == list.end())
+      ERROR_SET(err, unknown, "No such checkpoint");
+
+   dbg->proc->Discard(it->second.process, err);
+   list.erase(it);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Checkpoints::Clear(Debugger *dbg)
+{
+   for (auto &i : list)
+   {
+      error err;
+      dbg->proc->Discard(i.second.process, &err);
+   }
+   list.clear();
+}
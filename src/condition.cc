@@ -0,0 +1,611 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/condition.h>
+#include <dbg/dbg.h>
+
+#include <common/misc.h>
+
+#include <ctype.h>
+#include <string.h>
+
+using dbg::addr_t;
+using dbg::Condition;
+
+namespace {
+
+const int MaxDepth = 16;
+const int MaxRegisters = 64;
+const size_t MaxCode = 0xffff;
+
+struct BinaryOp
+{
+   const char *str;
+   int prec;
+   Condition::Op op;
+};
+
+// Two character operators first, so that they're matched before their
+// prefixes.  && and || are done with jumps.
+//
+const BinaryOp BinaryOps[] =
+{
+   { "||", 1, Condition::OpJumpIfNonZero },
+   { "&&", 2, Condition::OpJumpIfZero },
+   { "==", 6, Condition::OpEq },
+   { "!=", 6, Condition::OpNe },
+   { "<=", 7, Condition::OpLe },
+   { ">=", 7, Condition::OpGe },
+   { "<<", 8, Condition::OpShl },
+   { ">>", 8, Condition::OpShr },
+   { "|", 3, Condition::OpOr },
+   { "^", 4, Condition::OpXor },
+   { "&", 5, Condition::OpAnd },
+   { "<", 7, Condition::OpLt },
+   { ">", 7, Condition::OpGt },
+   { "+", 9, Condition::OpAdd },
+   { "-", 9, Condition::OpSub },
+   { "*", 10, Condition::OpMul },
+   { "/", 10, Condition::OpDiv },
+   { "%", 10, Condition::OpMod },
+};
+
+struct LoadFunction
+{
+   const char *name;
+   int size;
+};
+
+const LoadFunction LoadFunctions[] =
+{
+   { "poi", sizeof(addr_t) },
+   { "by", 1 },
+   { "wo", 2 },
+   { "dwo", 4 },
+   { "qwo", 8 },
+};
+
+struct Token
+{
+   enum Type
+   {
+      End,
+      Number,
+      Name,
+      Punct,
+   };
+
+   Type type;
+   addr_t value;
+   std::string str;
+};
+
+struct Parser
+{
+   dbg::Cpu *cpu;
+   const char *p;
+   std::vector<unsigned char> &code;
+   Token tok;
+   int depth;
+
+   Parser(dbg::Cpu *cpu, const char *str, std::vector<unsigned char> &code)
+      : cpu(cpu), p(str), code(code), depth(0) {}
+
+   void
+   Next(error *err);
+
+   void
+   Emit(const void *buf, size_t len, error *err);
+
+   void
+   Emit(Condition::Op op, error *err)
+   {
+      unsigned char c = op;
+      Emit(&c, 1, err);
+   }
+
+   // Keeps track of how deep the stack gets, so that evaluating can
+   // use a fixed size one.
+   //
+   void
+   Push(error *err)
+   {
+      if (++depth > MaxDepth)
+         ERROR_SET(err, unknown, "Condition is too complex");
+   exit:;
+   }
+
+   void
+   ParseExpression(int minPrec, error *err);
+
+   void
+   ParseUnary(error *err);
+
+   void
+   Expect(const char *punct, error *err);
+};
+
+void
+Parser::Next(error *err)
+{
+   while (isspace((unsigned char)*p))
+      ++p;
+
+   tok.type = Token::End;
+   tok.value = 0;
+
+   try
+   {
+      tok.str.clear();
+
+      if (!*p)
+         goto exit;
+
+      if (isdigit((unsigned char)*p))
+      {
+         int base = 16;
+         addr_t value = 0;
+
+         if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            p += 2;
+         else if (p[0] == '0' && (p[1] == 'n' || p[1] == 'N'))
+         {
+            base = 10;
+            p += 2;
+         }
+
+         if (!isxdigit((unsigned char)*p))
+            ERROR_SET(err, unknown, "Bad number in condition");
+
+         while (isalnum((unsigned char)*p))
+         {
+            int c = tolower((unsigned char)*p++);
+            int digit = isdigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : 99;
+            addr_t next = value * base + digit;
+
+            if (digit >= base)
+               ERROR_SET(err, unknown, "Bad number in condition");
+            if ((next - digit) / base != value)
+               ERROR_SET(err, unknown, "Number too large in condition");
+            value = next;
+         }
+
+         tok.type = Token::Number;
+         tok.value = value;
+      }
+      else if (isalpha((unsigned char)*p) || *p == '_' || *p == '@')
+      {
+         if (*p == '@')
+            ++p;
+         while (isalnum((unsigned char)*p) || *p == '_')
+            tok.str.push_back(*p++);
+         if (!tok.str.size())
+            ERROR_SET(err, unknown, "Expected register name after @");
+         tok.type = Token::Name;
+      }
+      else
+      {
+         for (auto &op : BinaryOps)
+         {
+            size_t len = strlen(op.str);
+            if (!strncmp(p, op.str, len))
+            {
+               tok.str.assign(p, len);
+               break;
+            }
+         }
+         if (!tok.str.size())
+         {
+            if (!strchr("()!~", *p))
+               ERROR_SET(err, unknown, "Unexpected character in condition");
+            tok.str.assign(p, 1);
+         }
+         p += tok.str.size();
+         tok.type = Token::Punct;
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+Parser::Emit(const void *buf, size_t len, error *err)
+{
+   if (code.size() + len > MaxCode)
+      ERROR_SET(err, unknown, "Condition is too complex");
+
+   try
+   {
+      code.insert(code.end(), (const unsigned char*)buf, (const unsigned char*)buf + len);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+Parser::Expect(const char *punct, error *err)
+{
+   if (tok.type != Token::Punct || tok.str != punct)
+      ERROR_SET(err, unknown, "Syntax error in condition");
+   Next(err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+Parser::ParseUnary(error *err)
+{
+   if (tok.type == Token::Punct && (tok.str == "-" || tok.str == "!" || tok.str == "~"))
+   {
+      Condition::Op op =
+         tok.str == "-" ? Condition::OpNeg :
+         tok.str == "!" ? Condition::OpNot :
+         Condition::OpBitNot;
+
+      Next(err);
+      ERROR_CHECK(err);
+      ParseUnary(err);
+      ERROR_CHECK(err);
+      Emit(op, err);
+      ERROR_CHECK(err);
+   }
+   else if (tok.type == Token::Punct && tok.str == "(")
+   {
+      Next(err);
+      ERROR_CHECK(err);
+      ParseExpression(0, err);
+      ERROR_CHECK(err);
+      Expect(")", err);
+      ERROR_CHECK(err);
+   }
+   else if (tok.type == Token::Number)
+   {
+      Push(err);
+      ERROR_CHECK(err);
+      Emit(Condition::OpConst, err);
+      ERROR_CHECK(err);
+      Emit(&tok.value, sizeof(tok.value), err);
+      ERROR_CHECK(err);
+      Next(err);
+      ERROR_CHECK(err);
+   }
+   else if (tok.type == Token::Name)
+   {
+      const char *save = p;
+      int regno = -1;
+      unsigned char operands[2];
+
+      for (auto &fn : LoadFunctions)
+      {
+         if (tok.str != fn.name)
+            continue;
+
+         Next(err);
+         ERROR_CHECK(err);
+         if (tok.type != Token::Punct || tok.str != "(")
+         {
+            // Not a call after all.  Maybe a register.
+            //
+            p = save;
+            tok.str = fn.name;
+            tok.type = Token::Name;
+            break;
+         }
+
+         ParseUnary(err);
+         ERROR_CHECK(err);
+
+         operands[0] = fn.size;
+         Emit(Condition::OpLoad, err);
+         ERROR_CHECK(err);
+         Emit(operands, 1, err);
+         ERROR_CHECK(err);
+         goto exit;
+      }
+
+      regno = cpu->GetRegisterByName(tok.str.c_str());
+      if (regno < 0 || regno >= MaxRegisters)
+         ERROR_SET(err, unknown, "Unknown register in condition");
+      if (cpu->GetRegisterSize(regno) > (int)sizeof(addr_t))
+         ERROR_SET(err, unknown, "Register too large for condition");
+
+      Push(err);
+      ERROR_CHECK(err);
+
+      operands[0] = regno;
+      operands[1] = cpu->GetRegisterSize(regno);
+      Emit(Condition::OpRegister, err);
+      ERROR_CHECK(err);
+      Emit(operands, 2, err);
+      ERROR_CHECK(err);
+
+      Next(err);
+      ERROR_CHECK(err);
+   }
+   else
+   {
+      ERROR_SET(err, unknown, "Syntax error in condition");
+   }
+exit:;
+}
+
+void
+Parser::ParseExpression(int minPrec, error *err)
+{
+   ParseUnary(err);
+   ERROR_CHECK(err);
+
+   while (tok.type == Token::Punct)
+   {
+      const BinaryOp *op = nullptr;
+
+      for (auto &b : BinaryOps)
+      {
+         if (tok.str == b.str)
+         {
+            op = &b;
+            break;
+         }
+      }
+      if (!op || op->prec < minPrec)
+         break;
+
+      Next(err);
+      ERROR_CHECK(err);
+
+      if (op->op == Condition::OpJumpIfZero || op->op == Condition::OpJumpIfNonZero)
+      {
+         //
+         //    <left> bool jz/jnz L <right> bool L:
+         //
+         size_t fixup = 0;
+         uint16_t target = 0;
+
+         Emit(Condition::OpBool, err);
+         ERROR_CHECK(err);
+         Emit(op->op, err);
+         ERROR_CHECK(err);
+         fixup = code.size();
+         Emit(&target, sizeof(target), err);
+         ERROR_CHECK(err);
+         --depth;
+
+         ParseExpression(op->prec + 1, err);
+         ERROR_CHECK(err);
+         Emit(Condition::OpBool, err);
+         ERROR_CHECK(err);
+
+         target = code.size();
+         memcpy(code.data() + fixup, &target, sizeof(target));
+      }
+      else
+      {
+         ParseExpression(op->prec + 1, err);
+         ERROR_CHECK(err);
+         Emit(op->op, err);
+         ERROR_CHECK(err);
+         --depth;
+      }
+   }
+exit:;
+}
+
+//
+// What a condition reads from memory, a line at a time.  Lines are
+// aligned, so never cross a page, so if any of one can be read all of
+// it can.
+//
+struct MemoryCache
+{
+   static const int LineSize = 64;
+   static const int Lines = 4;
+
+   struct Line
+   {
+      addr_t base;
+      bool valid;
+      unsigned char data[LineSize];
+   };
+
+   Line lines[Lines];
+   int next;
+
+   MemoryCache() : next(0)
+   {
+      for (auto &l : lines)
+         l.valid = false;
+   }
+
+   void
+   Read(dbg::Debugger *dbg, addr_t addr, int size, void *buf, error *err)
+   {
+      addr_t base = addr & ~(addr_t)(LineSize - 1);
+      Line *line = nullptr;
+
+      if (addr + size > base + LineSize)
+      {
+         dbg->ReadMemory(addr, size, buf, err);
+         goto exit;
+      }
+
+      for (auto &l : lines)
+      {
+         if (l.valid && l.base == base)
+         {
+            line = &l;
+            break;
+         }
+      }
+
+      if (!line)
+      {
+         line = &lines[next++ % Lines];
+         line->valid = false;
+         dbg->ReadMemory(base, LineSize, line->data, err);
+         ERROR_CHECK(err);
+         line->base = base;
+         line->valid = true;
+      }
+
+      memcpy(buf, line->data + (addr - base), size);
+   exit:;
+   }
+};
+
+} // end namespace
+
+void
+dbg::Condition::Compile(Cpu *cpu, const char *str, error *err)
+{
+   Parser parser(cpu, str, code);
+
+   code.clear();
+
+   try
+   {
+      text = str;
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   parser.Next(err);
+   ERROR_CHECK(err);
+   if (parser.tok.type == Token::End)
+      ERROR_SET(err, unknown, "Empty condition");
+
+   parser.ParseExpression(0, err);
+   ERROR_CHECK(err);
+
+   if (parser.tok.type != Token::End)
+      ERROR_SET(err, unknown, "Syntax error in condition");
+exit:
+   if (ERROR_FAILED(err))
+      code.clear();
+}
+
+dbg::addr_t
+dbg::Condition::Compute(Debugger *dbg, error *err)
+{
+   addr_t stack[MaxDepth];
+   addr_t regs[MaxRegisters];
+   uint64_t haveRegs = 0;
+   MemoryCache cache;
+   const unsigned char *c = code.data();
+   size_t pc = 0, n = code.size();
+   int sp = 0;
+
+   while (pc < n)
+   {
+      addr_t a = 0, b = 0;
+      uint16_t target = 0;
+
+      switch (c[pc++])
+      {
+      case Condition::OpConst:
+         memcpy(&stack[sp++], c + pc, sizeof(addr_t));
+         pc += sizeof(addr_t);
+         break;
+
+      case Condition::OpRegister:
+         if (!(haveRegs & (1ULL << c[pc])))
+         {
+            regs[c[pc]] = 0;
+            dbg->proc->GetRegister(c[pc], &regs[c[pc]], err);
+            ERROR_CHECK(err);
+            haveRegs |= (1ULL << c[pc]);
+         }
+         stack[sp++] = regs[c[pc]];
+         pc += 2;
+         break;
+
+      case Condition::OpLoad:
+         a = 0;
+         cache.Read(dbg, stack[sp-1], c[pc], &a, err);
+         ERROR_CHECK(err);
+         stack[sp-1] = a;
+         ++pc;
+         break;
+
+      case Condition::OpNeg:
+         stack[sp-1] = -stack[sp-1];
+         break;
+      case Condition::OpNot:
+         stack[sp-1] = !stack[sp-1];
+         break;
+      case Condition::OpBitNot:
+         stack[sp-1] = ~stack[sp-1];
+         break;
+      case Condition::OpBool:
+         stack[sp-1] = !!stack[sp-1];
+         break;
+
+      case Condition::OpJumpIfZero:
+      case Condition::OpJumpIfNonZero:
+         memcpy(&target, c + pc, sizeof(target));
+         if ((stack[sp-1] != 0) == (c[pc-1] == Condition::OpJumpIfNonZero))
+         {
+            pc = target;
+         }
+         else
+         {
+            pc += sizeof(target);
+            --sp;
+         }
+         break;
+
+      default:
+         b = stack[--sp];
+         a = stack[sp-1];
+
+         switch (c[pc-1])
+         {
+         case Condition::OpMul: a *= b; break;
+         case Condition::OpDiv:
+         case Condition::OpMod:
+            if (!b)
+               ERROR_SET(err, unknown, "Division by zero in condition");
+            a = (c[pc-1] == Condition::OpDiv) ? a / b : a % b;
+            break;
+         case Condition::OpAdd: a += b; break;
+         case Condition::OpSub: a -= b; break;
+         case Condition::OpShl: a = (b < sizeof(a) * 8) ? a << b : 0; break;
+         case Condition::OpShr: a = (b < sizeof(a) * 8) ? a >> b : 0; break;
+         case Condition::OpLt: a = a < b; break;
+         case Condition::OpLe: a = a <= b; break;
+         case Condition::OpGt: a = a > b; break;
+         case Condition::OpGe: a = a >= b; break;
+         case Condition::OpEq: a = a == b; break;
+         case Condition::OpNe: a = a != b; break;
+         case Condition::OpAnd: a &= b; break;
+         case Condition::OpXor: a ^= b; break;
+         case Condition::OpOr: a |= b; break;
+         default:
+            ERROR_SET(err, unknown, "Bad condition code");
+         }
+
+         stack[sp-1] = a;
+      }
+   }
+
+exit:
+   return (!ERROR_FAILED(err) && sp) ? stack[sp-1] : 0;
+}
+
+bool
+dbg::Condition::Evaluate(Debugger *dbg, error *err)
+{
+   return Compute(dbg, err) != 0;
+}
@@ -0,0 +1,243 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/coverage.h>
+#include <dbg/dbg.h>
+
+#include <common/misc.h>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <stdio.h>
+
+namespace {
+
+// drcov stores block sizes in 16 bits.
+//
+const size_t MaxBlockSize = 0xffff;
+const size_t MaxModules = 0xffff;
+
+bool
+ByAddr(const dbg::Coverage::Block &a, const dbg::Coverage::Block &b)
+{
+   return a.addr < b.addr;
+}
+
+void
+OnBlockHit(dbg::Debugger *dbg, dbg::Breakpoint *bp, void *context, error *err)
+{
+   auto cov = (dbg::Coverage*)context;
+   dbg::Coverage::Block key;
+
+   key.addr = bp->vaddr;
+
+   auto it = std::lower_bound(cov->blocks.begin(), cov->blocks.end(), key, ByAddr);
+   if (it != cov->blocks.end() && it->addr == bp->vaddr && !it->hit)
+   {
+      it->hit = true;
+      ++cov->hits;
+   }
+
+   // One-shot: put the code back and let it run.  The debugger resumes
+   // straight from here, no stepping needed.
+   //
+   dbg->DeleteInternalBreakpoint(bp, err);
+}
+
+} // end namespace
+
+void
+dbg::Coverage::Add(Debugger *dbg, Module *mod, error *err)
+{
+   ElfImage *img = mod->GetImage();
+   ElfSection text;
+   std::vector<ElfSection> segs;
+   std::vector<addr_t> starts;
+   std::vector<Block> newBlocks;
+   CoveredModule cm;
+   size_t n = blocks.size();
+
+   this->dbg = dbg;
+
+   if (!img)
+      ERROR_SET(err, unknown, "No image for module");
+
+   for (auto &m : modules)
+   {
+      if (m.base == mod->base && m.path == mod->path)
+         ERROR_SET(err, unknown, "Module is already covered");
+   }
+   if (modules.size() >= MaxModules)
+      ERROR_SET(err, unknown, "Too many modules");
+
+   try
+   {
+      // Prefer .text, which is just code.  The executable segment also
+      // has the PLT and such.
+      //
+      if (img->GetSection(".text", &text) && text.vaddr)
+      {
+         segs.push_back(text);
+      }
+      else
+      {
+         img->GetExecutableSegments(segs, err);
+         ERROR_CHECK(err);
+      }
+
+      for (auto &seg : segs)
+      {
+         size_t first = starts.size();
+         addr_t segEnd = seg.vaddr + mod->bias + seg.size;
+
+         dbg->cpu->FindBasicBlocks(seg.data, seg.size, seg.vaddr + mod->bias, starts, err);
+         ERROR_CHECK(err);
+
+         // Each block runs until the next one starts.
+         //
+         for (size_t i=first; i<starts.size(); ++i)
+         {
+            addr_t end = (i + 1 < starts.size()) ? starts[i+1] : segEnd;
+            Block b;
+
+            b.addr = starts[i];
+            b.size = MIN(end - starts[i], MaxBlockSize);
+            b.module = modules.size();
+            b.hit = false;
+            newBlocks.push_back(b);
+         }
+      }
+
+      cm.base = mod->base;
+      cm.end = mod->end;
+      cm.path = mod->path;
+
+      // Make room now, so nothing can fail once the breakpoints are in.
+      //
+      modules.reserve(modules.size() + 1);
+      blocks.reserve(blocks.size() + newBlocks.size());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->SetInternalBreakpoints(starts, OnBlockHit, this, err);
+   ERROR_CHECK(err);
+
+   modules.push_back(std::move(cm));
+   blocks.insert(blocks.end(), newBlocks.begin(), newBlocks.end());
+   std::inplace_merge(blocks.begin(), blocks.begin() + n, blocks.end(), ByAddr);
+exit:;
+}
+
+void
+dbg::Coverage::Stop(error *err)
+{
+   std::vector<Breakpoint*> list;
+
+   if (!dbg)
+      goto exit;
+
+   try
+   {
+      for (auto &p : dbg->bps.bps)
+      {
+         auto bp = p.second.get();
+         if (bp->handler == OnBlockHit && bp->context == this && !bp->user)
+            list.push_back(bp);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->RemoveBreakpoints(list, err);
+   ERROR_CHECK(err);
+
+   // Any left are the user's too.
+   //
+   for (auto &p : dbg->bps.bps)
+   {
+      auto bp = p.second.get();
+      if (bp->handler == OnBlockHit && bp->context == this)
+      {
+         bp->handler = nullptr;
+         bp->context = nullptr;
+      }
+   }
+exit:;
+}
+
+void
+dbg::Coverage::Reset()
+{
+   modules.clear();
+   blocks.clear();
+   hits = 0;
+}
+
+void
+dbg::Coverage::WriteDrcov(const char *path, error *err)
+{
+   FILE *file = nullptr;
+
+   // As written by DynamoRIO's drcov: a text header and module table,
+   // then one binary record per block.
+   //
+   struct BBEntry
+   {
+      uint32_t start;
+      uint16_t size;
+      uint16_t module;
+   };
+
+   file = fopen(path, "wb");
+   if (!file)
+      ERROR_SET(err, errno, errno);
+
+   fprintf(file, "DRCOV VERSION: 2\n");
+   fprintf(file, "DRCOV FLAVOR: dbg\n");
+   fprintf(file, "Module Table: version 2, count %d\n", (int)modules.size());
+   fprintf(file, "Columns: id, base, end, entry, checksum, timestamp, path\n");
+
+   for (size_t i=0; i<modules.size(); ++i)
+   {
+      fprintf(
+         file,
+         "%3d, 0x%016llx, 0x%016llx, 0x0000000000000000, 0x00000000, 0x00000000, %s\n",
+         (int)i,
+         (unsigned long long)modules[i].base,
+         (unsigned long long)modules[i].end,
+         modules[i].path.c_str()
+      );
+   }
+
+   fprintf(file, "BB Table: %d bbs\n", (int)hits);
+
+   for (auto &b : blocks)
+   {
+      BBEntry e;
+
+      if (!b.hit)
+         continue;
+
+      e.start = b.addr - modules[b.module].base;
+      e.size = b.size;
+      e.module = b.module;
+      fwrite(&e, sizeof(e), 1, file);
+   }
+
+   if (fflush(file) || ferror(file))
+      ERROR_SET(err, errno, errno);
+exit:
+   if (file)
+      fclose(file);
+}
@@ -656,6 +656,13 @@ struct DarwinProcess : public dbg::Process
    exit:;
    }
 
+   void
+   Syscall(dbg::SystemCall *calls, int n, addr_t stub, error *err)
+   {
+      ERROR_SET(err, unknown, "System calls in the target are not supported");
+   exit:;
+   }
+
 #if defined(__amd64__) || defined(__i386__)
    const uintptr_t stepFlag = 0x100;
 
@@ -953,6 +960,20 @@ struct DarwinProcess : public dbg::Process
             case SIGINT:
                sigToDeliver = 0;
                break;
+            default:
+               // Nothing stops here, so Stop and Print are the same.
+               //
+               switch (GetSignalPolicy(sig))
+               {
+               case dbg::SignalSuppress:
+                  sigToDeliver = 0;
+                  // fall through ...
+               case dbg::SignalPass:
+                  notify = false;
+                  break;
+               default:
+                  break;
+               }
             }
 
             if (notify && EventCallbacks.Get())
@@ -7,8 +7,19 @@
 */
 
 #include <dbg/dbg.h>
+#include <dbg/misc.h>
+#include <dbg/record.h>
 #include <common/c++/new.h>
 #include <common/misc.h>
+#include <common/logger.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 void
 dbg::Debugger::ReadMemory(addr_t addr, int len, void *buf, error *err)
@@ -88,21 +99,139 @@ dbg::Debugger::WriteMemory(addr_t addr, int len, const void *buf, error *err)
 exit:;
 }
 
+namespace {
+
+// Puts the process's system call stub in a trampoline arena.
+//
+dbg::addr_t
+MakeSyscallStub(dbg::Debugger *dbg, error *err)
+{
+   unsigned char stub[16];
+   int len = dbg->proc->GetSyscallStub(stub, sizeof(stub));
+   dbg::addr_t pc = 0, r = 0;
+
+   if (!len)
+      ERROR_SET(err, unknown, "No system call stub");
+
+   pc = dbg->cpu->GetPc(dbg->proc.Get(), err);
+   ERROR_CHECK(err);
+
+   r = dbg->trampolines.Allocate(dbg, pc, len, err);
+   ERROR_CHECK(err);
+
+   dbg->proc->WriteMemory(r, len, stub, err);
+   ERROR_CHECK(err);
+exit:
+   return ERROR_FAILED(err) ? 0 : r;
+}
+
+} // end namespace
+
+void
+dbg::Debugger::Syscall(SystemCall *calls, int n, error *err)
+{
+   // If there's nowhere for the stub, the code at the pc will do, so
+   // failing here isn't fatal.  Making the arena takes a call from the
+   // pc anyway.
+   //
+   if (!syscallStub)
+   {
+      error innerErr;
+      syscallStub = MakeSyscallStub(this, &innerErr);
+   }
+
+   proc->Syscall(calls, n, syscallStub, err);
+}
+
+dbg::addr_t
+dbg::Debugger::Syscall(addr_t nr, std::initializer_list<addr_t> args, error *err)
+{
+   SystemCall call;
+
+   if (args.size() > ARRAY_SIZE(call.args))
+      ERROR_SET(err, unknown, "Too many system call arguments");
+
+   call.nr = nr;
+   call.nargs = args.size();
+   call.result = 0;
+   std::copy(args.begin(), args.end(), call.args);
+
+   Syscall(&call, 1, err);
+   ERROR_CHECK(err);
+
+   if (call.result > (addr_t)-4096)
+      ERROR_SET(err, errno, -call.result);
+exit:
+   return call.result;
+}
+
+void
+dbg::Debugger::Attach(const char *string, error *err)
+{
+   strace.Clear();
+   proc->Attach(string, err);
+   ERROR_CHECK(err);
+
+   trampolines.Reset();
+   tracepoints.Reset();
+   branches.Clear();
+   history.Clear();
+   checkpoints.Clear(this);
+   syscallStub = 0;
+   linkMap.Init(this);
+exit:;
+}
+
+void
+dbg::Debugger::Create(char *const *argv, error *err)
+{
+   // Before the process starts, since it can make calls we trace.
+   //
+   strace.Clear();
+   proc->Create(argv, err);
+   ERROR_CHECK(err);
+
+   trampolines.Reset();
+   tracepoints.Reset();
+   branches.Clear();
+   history.Clear();
+   checkpoints.Clear(this);
+   syscallStub = 0;
+   linkMap.Init(this);
+exit:;
+}
+
 void
 dbg::Debugger::Detach(error *err)
 {
+   std::vector<Breakpoint*> list;
+
    // Clear breakpoints
    //
-   for (auto &bp : bps.bps)
+   try
    {
-      proc->WriteMemory(bp->vaddr, bp->size, bp->OldText(), err);
-      ERROR_CHECK(err);
+      for (auto &p : bps.bps)
+         list.push_back(p.second.get());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
    }
 
+   RemoveBreakpoints(list, err);
+   ERROR_CHECK(err);
+
    proc->Detach(err);
    ERROR_CHECK(err);
 
-   bps.bps.clear();
+   // Trampolines and the trace ring stay mapped in the target, but
+   // nothing jumps to them now.
+   //
+   bps.Clear();
+   linkMap.Reset();
+   trampolines.Reset();
+   tracepoints.Reset();
+   syscallStub = 0;
 exit:;
 }
 
@@ -116,120 +245,1929 @@ dbg::Debugger::GetCurrentBreakpoint(error *err)
    ERROR_CHECK(err);
 
    r = bps.Lookup(pc);
+
+   // The trampoline trapped on the breakpoint's behalf, with everything
+   // but the pc as it was there.
+   //
+   if (!r && (r = trampolines.FindTrap(pc)))
+   {
+      cpu->SetPc(proc.Get(), r->vaddr, err);
+      ERROR_CHECK(err);
+   }
 exit:
    return r;
 }
 
+namespace {
+
+// Where the current thread can go to get past bp with it still in, or
+// 0 to take it out and step over it.  Only worth it with other threads
+// about, which would run straight past while it was out.
+//
+dbg::addr_t
+Displace(dbg::Debugger *dbg, dbg::Breakpoint *bp)
+{
+   std::vector<int> threads;
+   error err;
+   int n = 0;
+
+   if (bp->displaced == ~(dbg::addr_t)0)
+      return 0;
+
+   if (!bp->displaced)
+   {
+      dbg->proc->GetThreads(threads, &err);
+      if (ERROR_FAILED(&err))
+         return 0;
+
+      // Threads that have exited are still listed, as 0.
+      //
+      for (auto tid : threads)
+         n += (tid != 0);
+      if (n < 2)
+         return 0;
+   }
+
+   return dbg->trampolines.Displace(dbg, bp, &err);
+}
+
+} // end namespace
+
 void
 dbg::Debugger::Step(error *err)
 {
+   addr_t displaced = 0;
    auto bp = GetCurrentBreakpoint(err);
    ERROR_CHECK(err);
 
-   // If this is a breakpoint, we'll want to revert the patch.
+   // If this is a breakpoint, we'll want to revert the patch, unless
+   // the instruction under it can be run from somewhere else.
    //
-   if (bp)
+   if (bp && (displaced = Displace(this, bp)))
+   {
+      cpu->SetPc(proc.Get(), displaced, err);
+      ERROR_CHECK(err);
+   }
+   else if (bp)
    {
       proc->WriteMemory(bp->vaddr, bp->size, bp->OldText(), err);
       ERROR_CHECK(err);
    }
 
-   proc->Step(err);
-   ERROR_CHECK(err);
+   // A patch longer than one instruction can't go back until we're
+   // out from under it.  Likewise the copy, which ends with a jump
+   // back.
+   //
+   for (;;)
+   {
+      addr_t pc = 0;
+
+      proc->Step(err);
+      ERROR_CHECK(err);
+
+      if (!bp || !proc->IsAttached())
+         break;
+
+      pc = cpu->GetPc(proc.Get(), err);
+      ERROR_CHECK(err);
+      if (displaced)
+      {
+         if (pc < displaced || pc >= bp->displacedEnd)
+            break;
+      }
+      else if (pc <= bp->vaddr || pc >= bp->vaddr + bp->size)
+      {
+         break;
+      }
+   }
 
    // Re-patch bp.
    //
-   if (bp)
+   if (bp && !displaced && proc->IsAttached())
    {
       proc->WriteMemory(bp->vaddr, bp->size, bp->PatchedText(), err);
       ERROR_CHECK(err);
    }
+
+   // If we landed on one of our own breakpoints, it needs to know.
+   //
+   if (proc->IsAttached())
+   {
+      bp = GetCurrentBreakpoint(err);
+      ERROR_CHECK(err);
+
+      if (bp && bp->handler)
+      {
+         bp->handler(this, bp, bp->context, err);
+         ERROR_CHECK(err);
+      }
+   }
 exit:;
 }
 
+namespace {
+
+// The branch a block step from start to pc took, or 0 if it took none
+// or that can't be worked out.
+//
+dbg::addr_t
+FindBranch(dbg::Debugger *dbg, dbg::addr_t start, dbg::addr_t pc)
+{
+   const size_t PageSize = 4096;
+   unsigned char text[1024];
+   size_t len = sizeof(text);
+   error err;
+
+   dbg->ReadMemory(start, len, text, &err);
+   if (ERROR_FAILED(&err))
+   {
+      // Maybe that ran off the end of the code.  Up to the end of the
+      // page, then.
+      //
+      error_clear(&err);
+      len = MIN(len, PageSize - start % PageSize);
+
+      dbg->ReadMemory(start, len, text, &err);
+      if (ERROR_FAILED(&err))
+         return 0;
+   }
+
+   return dbg->cpu->FindTakenBranch(text, len, start, pc);
+}
+
+} // end namespace
+
 void
-dbg::Debugger::Go(error *err)
+dbg::Debugger::StepBlock(error *err)
 {
+   addr_t start = 0, pc = 0, from = 0;
    auto bp = GetCurrentBreakpoint(err);
    ERROR_CHECK(err);
 
-   // Step over breakpoint.
+   start = cpu->GetPc(proc.Get(), err);
+   ERROR_CHECK(err);
+
+   // A breakpoint has to be stepped over on its own.  That might be
+   // the end of the block already.
    //
    if (bp)
    {
       Step(err);
       ERROR_CHECK(err);
+      if (!proc->IsAttached())
+         goto exit;
 
-      // If the new PC is a breakpoint, stop now.
-      //
-      if (GetCurrentBreakpoint(err) || ERROR_FAILED(err))
+      pc = cpu->GetPc(proc.Get(), err);
+      ERROR_CHECK(err);
+
+      from = FindBranch(this, start, pc);
+      if (from)
+         goto record;
+
+      bp = GetCurrentBreakpoint(err);
+      ERROR_CHECK(err);
+      if (bp)
          goto exit;
    }
 
-   proc->Go(err);
+   proc->StepBlock(err);
+   ERROR_CHECK(err);
+   if (!proc->IsAttached())
+      goto exit;
+
+   pc = cpu->GetPc(proc.Get(), err);
+   ERROR_CHECK(err);
+
+   from = FindBranch(this, start, pc);
+
+   // As in Step(), one of our own breakpoints needs to know.
+   //
+   bp = GetCurrentBreakpoint(err);
    ERROR_CHECK(err);
+   if (bp && bp->handler)
+   {
+      bp->handler(this, bp, bp->context, err);
+      ERROR_CHECK(err);
+   }
+
+record:
+   if (from)
+   {
+      branches.Record(from, pc, err);
+      ERROR_CHECK(err);
+   }
 exit:;
 }
 
+namespace {
+
+// Whether to stop for the user at bp.  A condition that can't be
+// evaluated counts as true, so that the user gets to see why.
+//
+bool
+CheckUserBreakpoint(dbg::Debugger *dbg, dbg::Breakpoint *bp)
+{
+   auto loc = bp->location;
+
+   if (!bp->user)
+      return false;
+
+   if (loc)
+      ++loc->traps;
+
+   // The fast path: not the thread we want.  Nothing but the pc has
+   // been read, and nothing else is.
+   //
+   if (loc && loc->thread && dbg->proc->GetCurrentThread() != loc->thread)
+   {
+      ++loc->filtered;
+      return false;
+   }
+
+   if (loc && loc->condition.Get())
+   {
+      error err;
+      uint64_t start = dbg::MonotonicTime();
+      bool stop = loc->condition->Evaluate(dbg, &err);
+
+      loc->conditionTime += dbg::MonotonicTime() - start;
+
+      if (ERROR_FAILED(&err))
+      {
+         auto errString = error_get_string(&err);
+         log_printf(
+            "Breakpoint %d: failed to evaluate condition%s%s%s",
+            loc->id,
+            errString ? " (" : "",
+            errString ? errString : "",
+            errString ? ")" : ""
+         );
+      }
+      else if (!stop)
+      {
+         return false;
+      }
+   }
+
+   if (loc)
+   {
+      ++loc->hits;
+      gettimeofday(&loc->lastHit, nullptr);
+   }
+   return true;
+}
+
+// Charges the time since the target stopped at loc to it, now that it's
+// about to run again or the user's getting control.
+//
 void
-dbg::Debugger::SetBreakpoint(addr_t pc, error *err)
+ChargeStop(dbg::BreakpointLocation *&loc, uint64_t since)
 {
-   unsigned char text[16];   // XXX should be enough to fit x86 instructions
-   bool read = false;
-   Breakpoint *bp = nullptr;
-   int size = 0;
+   uint64_t t = 0;
 
-   if (!(size = cpu->GetFixedSizedBreakpoint()))
+   if (!loc)
+      return;
+
+   t = dbg::MonotonicTime() - since;
+   loc->stoppedTime += t;
+   if (t > loc->maxStopped)
+      loc->maxStopped = t;
+   loc = nullptr;
+}
+
+} // end namespace
+
+void
+dbg::Debugger::Go(error *err)
+{
+   Go(0, 0, err);
+}
+
+bool
+dbg::Debugger::Go(uint64_t timeout, uint64_t hits, error *err)
+{
+   // The user's breakpoint the target is stopped at, if any, and since
+   // when.  The clock is only read a few times a stop, so this costs
+   // next to nothing next to the trap itself.
+   //
+   BreakpointLocation *at = nullptr;
+   uint64_t since = MonotonicTime();
+   uint64_t traps = 0;
+   bool limited = false;
+
+   // A deadline past the end of the clock is as good as none, but is
+   // still a deadline.
+   //
+   if (!timeout)
+      proc->deadline = 0;
+   else if (timeout > UINT64_MAX - since)
+      proc->deadline = UINT64_MAX;
+   else
+      proc->deadline = since + timeout;
+
+   for (;;)
    {
-      ReadMemory(pc, sizeof(text), text, err);
+      bool stop = false;
+      auto bp = GetCurrentBreakpoint(err);
+      ERROR_CHECK(err);
+
+      // Step over breakpoint.
+      //
+      if (bp)
+      {
+         auto loc = bp->user ? bp->location : nullptr;
+         uint64_t start = MonotonicTime();
+         addr_t displaced = 0;
+
+         // Going again from where the user stopped.
+         //
+         if (!at && loc)
+         {
+            at = loc;
+            since = start;
+         }
+
+         // With other threads about, this one is sent around the
+         // breakpoint rather than stepped over it, and runs on from
+         // there with the rest.
+         //
+         displaced = Displace(this, bp);
+         if (displaced)
+            cpu->SetPc(proc.Get(), displaced, err);
+         else
+            Step(err);
+         if (loc)
+            loc->stepTime += MonotonicTime() - start;
+         ERROR_CHECK(err);
+
+         if (!proc->IsAttached())
+            goto exit;
+         if (proc->timedOut)
+         {
+            limited = true;
+            goto exit;
+         }
+
+         // If the new PC is a breakpoint, stop now.  If it's only one
+         // of ours, Step() has dealt with it, and we go around again
+         // to step over that too.  (If displaced, it's neither.)
+         //
+         bp = GetCurrentBreakpoint(err);
+         ERROR_CHECK(err);
+         if (bp)
+         {
+            if (bp->user)
+            {
+               ChargeStop(at, since);
+               at = bp->location;
+               since = MonotonicTime();
+            }
+            if (CheckUserBreakpoint(this, bp) || bp->temporary)
+               goto exit;
+            if (hits && ++traps >= hits)
+            {
+               limited = true;
+               goto exit;
+            }
+            continue;
+         }
+      }
+
+      ChargeStop(at, since);
+
+      proc->Go(err);
+      ERROR_CHECK(err);
+
+      since = proc->stoppedAt ? proc->stoppedAt : MonotonicTime();
+
+      if (!proc->IsAttached())
+         goto exit;
+      if (proc->timedOut)
+      {
+         limited = true;
+         goto exit;
+      }
+
+      bp = GetCurrentBreakpoint(err);
       ERROR_CHECK(err);
-      read = true;
+      if (!bp)
+         goto exit;
+      if (bp->user)
+         at = bp->location;
 
-      size = cpu->GetInstructionLength(text, sizeof(text));
-      if (size <= 0)
-         ERROR_SET(err, unknown, "Couldn't determine instruction length");
+      // Keep going if it's only ours, or the user's condition says not
+      // to stop.  The handler is allowed to delete bp.
+      //
+      stop = CheckUserBreakpoint(this, bp) || bp->temporary;
+      if (bp->handler)
+      {
+         bp->handler(this, bp, bp->context, err);
+         ERROR_CHECK(err);
+      }
+      if (stop)
+         goto exit;
+      if (hits && ++traps >= hits)
+      {
+         limited = true;
+         goto exit;
+      }
    }
+exit:
+   proc->deadline = 0;
+   ChargeStop(at, since);
 
-   if (!read)
+   // Bring the trace log up to date while the target's stopped, so
+   // it doesn't wait for the ring to fill.  The ring is ours too, so
+   // this works even if the target's gone.
+   //
+   if (tracepoints.log.IsOpen())
    {
-      ReadMemory(pc, size, text, err);
-      ERROR_CHECK(err);
+      error logErr;
+
+      tracepoints.FlushLog(&logErr);
+      if (ERROR_FAILED(&logErr))
+      {
+         auto errString = error_get_string(&logErr);
+         log_printf(
+            "Failed to write trace log%s%s%s",
+            errString ? " (" : "",
+            errString ? errString : "",
+            errString ? ")" : ""
+         );
+      }
    }
+   return limited;
+}
 
-   bp = bps.Insert(pc, size, err);
-   ERROR_CHECK(err);
+void
+dbg::Debugger::GoBlocks(addr_t addr, error *err)
+{
+   Breakpoint *patch = nullptr;
+   Breakpoint *bp = bps.Lookup(addr);
+   addr_t pc = 0;
 
-   memcpy(bp->OldText(), text, size);
-   cpu->GenerateBreakpoint(pc, bp->PatchedText(), size, err);
-   ERROR_CHECK(err);
+   // A block step only stops where a branch goes, so addr needs a
+   // breakpoint, for as long as this takes, if it doesn't have one.
+   //
+   if (bp && bp->vaddr != addr)
+      ERROR_SET(err, unknown, "Can't stop in the middle of another breakpoint");
+   if (!bp)
+   {
+      patch = PatchBreakpoint(addr, err);
+      ERROR_CHECK(err);
+   }
 
-   proc->WriteMemory(pc, size, bp->PatchedText(), err);
-   ERROR_CHECK(err);
+   for (;;)
+   {
+      StepBlock(err);
+      ERROR_CHECK(err);
+      if (!proc->IsAttached())
+         goto exit;
 
+      pc = cpu->GetPc(proc.Get(), err);
+      ERROR_CHECK(err);
+      if (pc == addr)
+         break;
+
+      bp = GetCurrentBreakpoint(err);
+      ERROR_CHECK(err);
+      if (bp && CheckUserBreakpoint(this, bp))
+         break;
+   }
 exit:
-   if (ERROR_FAILED(err) && bp)
+   if (patch && proc->IsAttached())
    {
-      bps.bps.erase(bps.bps.end()-1);
+      error innerErr;
+
+      // Unless someone's claimed it since.
+      //
+      bp = bps.Lookup(addr);
+      if (bp == patch && !bp->user && !bp->handler)
+         RemoveBreakpoint(bp, &innerErr);
    }
 }
 
 void
-dbg::Debugger::DeleteBreakpoint(int idx, error *err)
+dbg::Debugger::Record(Recorder *rec, addr_t addr, uint64_t count, error *err)
 {
-   Breakpoint *bp = nullptr;
-
-   if (idx < 0 || idx >= bps.bps.size())
-      ERROR_SET(err, unknown, "Invalid index");
+   for (uint64_t n=0; !count || n < count; ++n)
+   {
+      Breakpoint *bp = nullptr;
+      addr_t pc = 0;
 
-   bp = bps.bps[idx].get();
+      rec->Step(this, err);
+      ERROR_CHECK(err);
+      if (!proc->IsAttached())
+         break;
 
-   proc->WriteMemory(bp->vaddr, bp->size, bp->OldText(), err);
-   ERROR_CHECK(err);
+      pc = cpu->GetPc(proc.Get(), err);
+      ERROR_CHECK(err);
+      if (addr && pc == addr)
+         break;
 
-   bps.bps.erase(bps.bps.begin() + idx);
+      bp = GetCurrentBreakpoint(err);
+      ERROR_CHECK(err);
+      if (bp && CheckUserBreakpoint(this, bp))
+         break;
+   }
 exit:;
 }
 
+void
+dbg::Debugger::RunTo(addr_t pc, addr_t sp, error *err)
+{
+   Breakpoint *bp = bps.Lookup(pc);
+   Breakpoint *patch = nullptr;
+   BreakpointLocation *loc = nullptr;
+   int thread = proc->GetCurrentThread();
+   addr_t now = 0;
+
+   if (bp && bp->vaddr != pc)
+      ERROR_SET(err, unknown, "Can't stop in the middle of another breakpoint");
+   if (bp && bp->trampoline)
+      ERROR_SET(err, unknown, "Can't stop at a jump to a trampoline");
+   if (!bp)
+   {
+      bp = patch = PatchBreakpoint(pc, err);
+      ERROR_CHECK(err);
+   }
+   bp->temporary = true;
+
+   for (;;)
+   {
+      unsigned long hits = 0;
+
+      // The user's own breakpoint here might want to stop too.
+      //
+      loc = bp->user ? bp->location : nullptr;
+      if (loc)
+         hits = loc->hits;
+
+      Go(err);
+      ERROR_CHECK(err);
+      if (!proc->IsAttached())
+         goto exit;
+
+      now = cpu->GetPc(proc.Get(), err);
+      ERROR_CHECK(err);
+      if (now != pc)
+         break;
+
+      now = cpu->GetSp(proc.Get(), err);
+      ERROR_CHECK(err);
+      if (now >= sp && proc->GetCurrentThread() == thread)
+         break;
+
+      if (loc && loc->hits != hits)
+         break;
+   }
+exit:
+   if (proc->IsAttached())
+   {
+      error innerErr;
+
+      // Unless it's gone since, or someone's claimed it.
+      //
+      bp = bps.Lookup(pc);
+      if (bp && bp->vaddr == pc)
+      {
+         bp->temporary = false;
+         if (bp == patch && !bp->user && !bp->handler)
+            RemoveBreakpoint(bp, &innerErr);
+      }
+   }
+}
+
+void
+dbg::Debugger::StepOver(error *err)
+{
+   unsigned char text[16];
+   addr_t pc = 0, sp = 0;
+   int len = 0;
+
+   pc = cpu->GetPc(proc.Get(), err);
+   ERROR_CHECK(err);
+
+   // Might run off the end of the page, so not an error.  If it's too
+   // short for a call, Step() will say what's wrong with it.
+   //
+   {
+      error innerErr;
+      ReadMemory(pc, sizeof(text), text, &innerErr);
+      if (!ERROR_FAILED(&innerErr))
+         len = cpu->GetCallLength(text, sizeof(text));
+   }
+
+   if (!len)
+   {
+      Step(err);
+      goto exit;
+   }
+
+   sp = cpu->GetSp(proc.Get(), err);
+   ERROR_CHECK(err);
+
+   RunTo(pc + len, sp, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Debugger::StepOut(error *err)
+{
+   addr_t ret = 0, sp = 0;
+   int frame = 0;
+
+   cpu->StackTrace(
+      this,
+      [&] (addr_t pc, addr_t, bool &cancel, error *err) -> void
+      {
+         if (frame++)
+         {
+            ret = pc;
+            cancel = true;
+         }
+      },
+      err
+   );
+   ERROR_CHECK(err);
+
+   if (!ret)
+      ERROR_SET(err, unknown, "Can't find where this function returns to");
+
+   sp = cpu->GetSp(proc.Get(), err);
+   ERROR_CHECK(err);
+
+   // Once it's returned, the stack is above where it is now.
+   //
+   RunTo(ret, sp + 1, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Debugger::ReverseStep(error *err)
+{
+   if (history.pos <= history.GetFirst())
+      ERROR_SET(err, unknown, "No history to go back through");
+
+   history.Seek(this, history.pos - 1, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Debugger::ReverseGo(error *err)
+{
+   uint64_t end = history.pos;
+
+   for (;;)
+   {
+      Breakpoint *bp = nullptr;
+      uint64_t n = 0;
+
+      // The last step that started at a breakpoint, from its pc alone.
+      // Conditions need the rest of the state, so they're checked once
+      // we're there.
+      //
+      n = history.Search(
+         history.GetFirst(),
+         end,
+         [&] (uint64_t, addr_t pc, bool &stop, error *err) -> void
+         {
+            auto p = bps.Lookup(pc);
+            if (p && p->vaddr == pc && p->user)
+            {
+               bp = p;
+               stop = true;
+            }
+         },
+         err
+      );
+      ERROR_CHECK(err);
+
+      history.Seek(this, n, err);
+      ERROR_CHECK(err);
+
+      if (!bp || CheckUserBreakpoint(this, bp))
+         break;
+
+      end = n;
+   }
+exit:;
+}
+
+namespace {
+
+// Claims a user breakpoint at every address, or at none of them.
+// Patches in what isn't already there.
+//
+void
+ClaimBreakpoints(dbg::Debugger *dbg, std::vector<dbg::addr_t> &pcs, error *err)
+{
+   std::vector<dbg::addr_t> fresh;
+   std::vector<dbg::Breakpoint*> adopt;
+
+   std::sort(pcs.begin(), pcs.end());
+   pcs.erase(std::unique(pcs.begin(), pcs.end()), pcs.end());
+
+   try
+   {
+      fresh.reserve(pcs.size());
+
+      for (auto pc : pcs)
+      {
+         auto bp = dbg->bps.Lookup(pc);
+
+         if (bp && bp->vaddr == pc)
+         {
+            if (bp->user)
+               ERROR_SET(err, unknown, "Breakpoint already exists");
+            if (bp->trampoline)
+               ERROR_SET(err, unknown, "A tracepoint is already there");
+            adopt.push_back(bp);
+         }
+         else
+         {
+            fresh.push_back(pc);
+         }
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->PatchBreakpoints(fresh, err);
+   ERROR_CHECK(err);
+
+   // Nothing below can fail.
+   //
+   for (auto pc : fresh)
+      dbg->bps.Lookup(pc)->user = true;
+   for (auto bp : adopt)
+      bp->user = true;
+exit:;
+}
+
+// Hands a claimed breakpoint to its location, moving its condition
+// into the target if asked.  If that can't be done, it stays a trap
+// and the debugger checks the condition.
+//
+void
+AttachLocation(dbg::Debugger *dbg, dbg::addr_t pc, dbg::BreakpointLocation *loc)
+{
+   auto bp = dbg->bps.Lookup(pc);
+   error err;
+
+   bp->location = loc;
+   if (!loc->inTarget || !loc->condition.Get() || bp->trampoline)
+      goto exit;
+
+   dbg->trampolines.Install(dbg, bp, &err);
+   ERROR_CHECK(&err);
+exit:
+   if (ERROR_FAILED(&err))
+   {
+      auto errString = error_get_string(&err);
+      log_printf(
+         "Breakpoint %d: checking condition in the debugger at %p%s%s%s",
+         loc->id,
+         (void*)pc,
+         errString ? " (" : "",
+         errString ? errString : "",
+         errString ? ")" : ""
+      );
+   }
+}
+
+struct Resolved
+{
+   dbg::addr_t pc;
+   dbg::BreakpointLocation *loc;
+   dbg::Module *mod;
+};
+
+void
+LogResolveError(const char *what, const char *path, error *err)
+{
+   auto errString = error_get_string(err);
+   log_printf(
+      "Failed to set breakpoint %s in %s%s%s%s",
+      what,
+      path,
+      errString ? " (" : "",
+      errString ? errString : "",
+      errString ? ")" : ""
+   );
+}
+
+// Finds where the enabled locations (or only those in the given set)
+// are in a module.
+//
+void
+FindLocations(
+   dbg::Debugger *dbg,
+   dbg::Module *mod,
+   const std::unordered_set<dbg::BreakpointLocation*> *only,
+   std::vector<Resolved> &found,
+   error *err
+)
+{
+   std::unordered_map<std::string, std::vector<dbg::BreakpointLocation*>> symbols;
+   std::unordered_set<dbg::BreakpointLocation*> resolved;
+   dbg::ElfImage *img = nullptr;
+   std::string name;
+   size_t n = found.size();
+
+   try
+   {
+      for (auto &loc : dbg->locations)
+      {
+         if (!loc->enabled || !loc->Matches(mod->path.c_str()))
+            continue;
+         if (only && !only->count(loc.get()))
+            continue;
+
+         if (loc->symbol.size())
+            symbols[loc->symbol].push_back(loc.get());
+         else
+            found.push_back(Resolved{mod->base + loc->offset, loc.get(), mod});
+      }
+
+      // One pass over the symbol table for everything we want.
+      // Versioned names (memcpy@GLIBC_2.14) match the plain name.
+      //
+      if (symbols.size() && (img = mod->GetImage()))
+      {
+         img->ForEachSymbol(
+            [&] (const char *sym, dbg::addr_t value) -> bool
+            {
+               name.assign(sym, strcspn(sym, "@"));
+
+               auto it = symbols.find(name);
+               if (it == symbols.end())
+                  return true;
+
+               for (auto loc : it->second)
+                  found.push_back(Resolved{mod->bias + value + loc->offset, loc, mod});
+               return true;
+            }
+         );
+      }
+
+      for (size_t i=n; i<found.size(); ++i)
+         resolved.insert(found[i].loc);
+
+      for (auto &p : symbols)
+      {
+         for (auto loc : p.second)
+         {
+            if (!resolved.count(loc))
+               log_printf("Symbol %s not found in %s", p.first.c_str(), mod->path.c_str());
+         }
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+// Patches everything FindLocations() found.  All at once if we can.
+// If that fails, go one at a time so that we know which ones are bad;
+// those are logged, and stay pending.
+//
+void
+PatchLocations(dbg::Debugger *dbg, std::vector<Resolved> &found, error *err)
+{
+   std::vector<dbg::addr_t> pcs;
+   std::vector<Resolved> kept;
+   std::vector<bool> set;
+   std::string name;
+   error batchErr;
+
+   try
+   {
+      std::sort(
+         found.begin(),
+         found.end(),
+         [] (const Resolved &a, const Resolved &b) -> bool
+         {
+            return a.pc < b.pc || (a.pc == b.pc && a.loc->id < b.loc->id);
+         }
+      );
+      found.erase(
+         std::unique(
+            found.begin(),
+            found.end(),
+            [] (const Resolved &a, const Resolved &b) -> bool
+            {
+               return a.pc == b.pc && a.loc == b.loc;
+            }
+         ),
+         found.end()
+      );
+
+      // Already resolved, eg. the module was reported twice.
+      //
+      found.erase(
+         std::remove_if(
+            found.begin(),
+            found.end(),
+            [dbg] (const Resolved &p) -> bool
+            {
+               auto bp = dbg->bps.Lookup(p.pc);
+               return bp && bp->vaddr == p.pc && bp->user && bp->location == p.loc;
+            }
+         ),
+         found.end()
+      );
+
+      // Two locations can't share a breakpoint: it would only count
+      // hits for one of them.  The later one is logged, and stays
+      // pending.
+      //
+      for (size_t i=0; i<found.size(); ++i)
+      {
+         auto bp = dbg->bps.Lookup(found[i].pc);
+         dbg::BreakpointLocation *owner = nullptr;
+
+         if (bp && bp->vaddr == found[i].pc && bp->user)
+            owner = bp->location;
+         else if (kept.size() && kept.back().pc == found[i].pc)
+            owner = kept.back().loc;
+
+         if (!owner)
+         {
+            kept.push_back(found[i]);
+            continue;
+         }
+
+         found[i].loc->Format(name, err);
+         ERROR_CHECK(err);
+         log_printf(
+            "Failed to set breakpoint %s in %s (breakpoint %d is already there)",
+            name.c_str(),
+            found[i].mod->path.c_str(),
+            owner->id
+         );
+      }
+      found.swap(kept);
+
+      for (auto &p : found)
+         pcs.push_back(p.pc);
+      set.resize(found.size());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   ClaimBreakpoints(dbg, pcs, &batchErr);
+   if (!ERROR_FAILED(&batchErr))
+   {
+      set.assign(set.size(), true);
+   }
+   else
+   {
+      for (size_t i=0; i<found.size(); ++i)
+      {
+         error innerErr;
+
+         pcs.assign(1, found[i].pc);
+         ClaimBreakpoints(dbg, pcs, &innerErr);
+         if (ERROR_FAILED(&innerErr))
+         {
+            found[i].loc->Format(name, err);
+            ERROR_CHECK(err);
+            LogResolveError(name.c_str(), found[i].mod->path.c_str(), &innerErr);
+            continue;
+         }
+         set[i] = true;
+      }
+   }
+
+   for (size_t i=0; i<found.size(); ++i)
+   {
+      if (set[i])
+         AttachLocation(dbg, found[i].pc, found[i].loc);
+   }
+exit:;
+}
+
+// Patches wherever the given locations resolve to.  Addresses are all
+// or nothing, and fail with an error.  Anything in a module that
+// doesn't resolve stays pending.
+//
+void
+ResolveLocations(
+   dbg::Debugger *dbg,
+   const std::vector<dbg::BreakpointLocation*> &list,
+   error *err
+)
+{
+   std::unordered_set<dbg::BreakpointLocation*> only;
+   std::vector<dbg::addr_t> pcs;
+   std::vector<Resolved> found;
+
+   try
+   {
+      for (auto loc : list)
+      {
+         if (loc->IsAddress())
+            pcs.push_back(loc->offset);
+         else
+            only.insert(loc);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   if (pcs.size())
+   {
+      ClaimBreakpoints(dbg, pcs, err);
+      ERROR_CHECK(err);
+
+      for (auto loc : list)
+      {
+         if (loc->IsAddress())
+            AttachLocation(dbg, loc->offset, loc);
+      }
+   }
+
+   if (!only.size())
+      goto exit;
+
+   // Each module gets one pass, however many locations are in it, and
+   // then everything is patched together.
+   //
+   for (auto &mod : dbg->modules.modules)
+   {
+      bool match = false;
+
+      for (auto it = only.begin(); it != only.end() && !match; ++it)
+         match = (*it)->Matches(mod->path.c_str());
+      if (!match)
+         continue;
+
+      FindLocations(dbg, mod.Get(), &only, found, err);
+      ERROR_CHECK(err);
+   }
+
+   PatchLocations(dbg, found, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+} // end namespace
+
+dbg::BreakpointLocation *
+dbg::Debugger::SetBreakpoint(addr_t pc, error *err)
+{
+   BreakpointLocation loc;
+
+   loc.offset = pc;
+   return SetBreakpoint(loc, err);
+}
+
+void
+dbg::Debugger::SetBreakpoints(const std::vector<addr_t> &pcs, error *err)
+{
+   std::vector<BreakpointLocation> locs;
+
+   try
+   {
+      locs.resize(pcs.size());
+      for (size_t i=0; i<pcs.size(); ++i)
+         locs[i].offset = pcs[i];
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   SetBreakpoints(locs, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+dbg::BreakpointLocation *
+dbg::Debugger::SetBreakpoint(const BreakpointLocation &loc, error *err)
+{
+   std::vector<BreakpointLocation> locs;
+   BreakpointLocation *r = nullptr;
+
+   try
+   {
+      locs.push_back(loc);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   SetBreakpoints(locs, err);
+   ERROR_CHECK(err);
+
+   r = locations.back().get();
+exit:
+   return r;
+}
+
+void
+dbg::Debugger::SetBreakpoints(const std::vector<BreakpointLocation> &locs, error *err)
+{
+   std::unordered_set<std::string> seen;
+   std::vector<BreakpointLocation*> added;
+   std::string str;
+   size_t n = locations.size();
+
+   try
+   {
+      for (auto &p : locations)
+      {
+         p->Format(str, err);
+         ERROR_CHECK(err);
+         seen.insert(str);
+      }
+
+      for (auto &loc : locs)
+      {
+         loc.Format(str, err);
+         ERROR_CHECK(err);
+         if (!seen.insert(str).second)
+            ERROR_SET(err, unknown, "Breakpoint already exists");
+      }
+
+      added.reserve(locs.size());
+      for (auto &loc : locs)
+      {
+         std::unique_ptr<BreakpointLocation> p(new BreakpointLocation());
+
+         p->module = loc.module;
+         p->symbol = loc.symbol;
+         p->offset = loc.offset;
+         p->condition = loc.condition;
+         p->inTarget = loc.inTarget;
+         p->thread = loc.thread;
+         added.push_back(p.get());
+         locations.push_back(std::move(p));
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      locations.resize(n);
+      ERROR_SET(err, nomem);
+   }
+
+   for (auto loc : added)
+      loc->id = nextBreakpointId++;
+
+   ResolveLocations(this, added, err);
+   if (ERROR_FAILED(err))
+   {
+      error innerErr;
+      DeleteBreakpoints(added, &innerErr);
+   }
+exit:;
+}
+
+dbg::BreakpointLocation *
+dbg::Debugger::FindBreakpoint(int id)
+{
+   // In order of ID.
+   //
+   auto it = std::lower_bound(
+      locations.begin(),
+      locations.end(),
+      id,
+      [] (const std::unique_ptr<BreakpointLocation> &p, int id) -> bool
+      {
+         return p->id < id;
+      }
+   );
+
+   return (it != locations.end() && (*it)->id == id) ? it->get() : nullptr;
+}
+
+dbg::BreakpointLocation *
+dbg::Debugger::FindBreakpointLocation(const BreakpointLocation &loc)
+{
+   for (auto &p : locations)
+   {
+      if (*p == loc)
+         return p.get();
+   }
+   return nullptr;
+}
+
+void
+dbg::Debugger::ResolveBreakpoints(Module *mod, error *err)
+{
+   std::vector<Resolved> found;
+
+   FindLocations(this, mod, nullptr, found, err);
+   ERROR_CHECK(err);
+
+   PatchLocations(this, found, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Debugger::DropBreakpoints(addr_t start, addr_t end)
+{
+   std::vector<Breakpoint*> list;
+   std::unordered_set<BreakpointLocation*> gone;
+   error err;
+
+   bps.FindBreakpointsInRange(list, start, end - start, &err);
+   if (ERROR_FAILED(&err))
+      return;
+
+   // An address means nothing once its module is gone.
+   //
+   try
+   {
+      for (auto bp : list)
+      {
+         if (bp->user && bp->location && bp->location->IsAddress())
+            gone.insert(bp->location);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      gone.clear();
+   }
+
+   // The debugger's own go too, so nothing else should be left
+   // pointing at them.
+   //
+   for (auto bp : list)
+   {
+      trampolines.Drop(bp);
+      if (bp == linkMap.entryBp)
+         linkMap.entryBp = nullptr;
+      if (bp == linkMap.brkBp)
+         linkMap.brkBp = nullptr;
+   }
+   tracepoints.Drop(start, end);
+
+   bps.Remove(list);
+
+   locations.erase(
+      std::remove_if(
+         locations.begin(),
+         locations.end(),
+         [&gone] (const std::unique_ptr<BreakpointLocation> &p) -> bool
+         {
+            return gone.count(p.get()) != 0;
+         }
+      ),
+      locations.end()
+   );
+}
+
+dbg::Breakpoint *
+dbg::Debugger::SetInternalBreakpoint(
+   addr_t pc,
+   BreakpointHandler handler,
+   void *context,
+   error *err
+)
+{
+   Breakpoint *bp = bps.Lookup(pc);
+
+   if (bp && bp->vaddr == pc)
+   {
+      if (bp->handler)
+         ERROR_SET(err, unknown, "Breakpoint already has a handler");
+      if (bp->trampoline)
+         ERROR_SET(err, unknown, "Breakpoint is a jump to a trampoline");
+   }
+   else
+   {
+      bp = PatchBreakpoint(pc, err);
+      ERROR_CHECK(err);
+   }
+
+   bp->handler = handler;
+   bp->context = context;
+exit:
+   return ERROR_FAILED(err) ? nullptr : bp;
+}
+
+void
+dbg::Debugger::SetInternalBreakpoints(
+   std::vector<addr_t> &pcs,
+   BreakpointHandler handler,
+   void *context,
+   error *err
+)
+{
+   std::vector<addr_t> fresh;
+   std::vector<Breakpoint*> adopt;
+
+   std::sort(pcs.begin(), pcs.end());
+   pcs.erase(std::unique(pcs.begin(), pcs.end()), pcs.end());
+
+   try
+   {
+      fresh.reserve(pcs.size());
+      adopt.reserve(pcs.size());
+
+      for (auto pc : pcs)
+      {
+         auto bp = bps.Lookup(pc);
+
+         if (!bp)
+            fresh.push_back(pc);
+         else if (bp->vaddr == pc && !bp->handler && !bp->trampoline)
+            adopt.push_back(bp);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   PatchBreakpoints(fresh, err);
+   ERROR_CHECK(err);
+
+   for (auto pc : fresh)
+      adopt.push_back(bps.Lookup(pc));
+   for (auto bp : adopt)
+   {
+      bp->handler = handler;
+      bp->context = context;
+   }
+exit:;
+}
+
+void
+dbg::Debugger::DeleteInternalBreakpoint(Breakpoint *bp, error *err)
+{
+   bp->handler = nullptr;
+   bp->context = nullptr;
+
+   if (!bp->user)
+   {
+      RemoveBreakpoint(bp, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+namespace {
+
+// Enough to be sure of reading a whole instruction.
+//
+const int MaxInstructionLength = 16;
+
+//
+// A stretch of target memory that we read once, patch in a local
+// buffer and write back once.  Keeps what was there for rolling back.
+//
+struct PatchRun
+{
+   dbg::addr_t start;
+   std::vector<unsigned char> orig;
+   std::vector<unsigned char> text;
+   size_t dirtyStart;
+   size_t dirtyEnd;
+
+   PatchRun() : start(0), dirtyStart(~(size_t)0), dirtyEnd(0) {}
+
+   void
+   Patch(dbg::addr_t addr, int len, const void *buf)
+   {
+      size_t off = addr - start;
+
+      memcpy(text.data() + off, buf, len);
+      dirtyStart = MIN(dirtyStart, off);
+      dirtyEnd = MAX(dirtyEnd, off + len);
+   }
+};
+
+// Writes every run, or if one fails, puts back the ones before it.
+//
+void
+WriteRuns(dbg::Process *proc, std::vector<PatchRun> &runs, error *err)
+{
+   size_t i = 0;
+
+   for (; i<runs.size(); ++i)
+   {
+      auto &r = runs[i];
+
+      if (r.dirtyStart >= r.dirtyEnd)
+         continue;
+
+      proc->WriteMemory(
+         r.start + r.dirtyStart,
+         r.dirtyEnd - r.dirtyStart,
+         r.text.data() + r.dirtyStart,
+         err
+      );
+      ERROR_CHECK(err);
+   }
+
+exit:
+   if (ERROR_FAILED(err))
+   {
+      while (i-- > 0)
+      {
+         auto &r = runs[i];
+         error innerErr;
+
+         if (r.dirtyStart >= r.dirtyEnd)
+            continue;
+
+         proc->WriteMemory(
+            r.start + r.dirtyStart,
+            r.dirtyEnd - r.dirtyStart,
+            r.orig.data() + r.dirtyStart,
+            &innerErr
+         );
+      }
+   }
+}
+
+} // end namespace
+
+dbg::Breakpoint *
+dbg::Debugger::PatchBreakpoint(addr_t pc, error *err)
+{
+   std::vector<addr_t> pcs;
+   Breakpoint *bp = nullptr;
+
+   try
+   {
+      pcs.push_back(pc);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   PatchBreakpoints(pcs, err);
+   ERROR_CHECK(err);
+
+   bp = bps.Lookup(pc);
+exit:
+   return bp;
+}
+
+void
+dbg::Debugger::PatchBreakpoints(const std::vector<addr_t> &pcs, error *err)
+{
+   const addr_t pageSize = getpagesize();
+   const int fixedSize = cpu->GetFixedSizedBreakpoint();
+   const int tail = fixedSize ? fixedSize : MaxInstructionLength;
+   std::vector<Breakpoint::ptr> batch;
+   std::vector<Breakpoint*> inserted;
+   std::vector<PatchRun> runs;
+   std::vector<Breakpoint*> existing;
+   std::vector<unsigned char> logical;
+   addr_t lastEnd = 0;
+   size_t i = 0;
+
+   try
+   {
+      batch.reserve(pcs.size());
+
+      //
+      // Everything on a page is read in one go, and patched in a local
+      // copy.  Nothing is written to the target until every breakpoint
+      // checks out.
+      //
+      while (i < pcs.size())
+      {
+         addr_t pageEnd = (pcs[i] & ~(pageSize - 1)) + pageSize;
+         size_t j = i;
+         size_t len = 0;
+         error innerErr;
+
+         while (j < pcs.size() && pcs[j] < pageEnd)
+            ++j;
+
+         runs.push_back(PatchRun());
+         auto &run = runs.back();
+
+         run.start = pcs[i];
+         len = pcs[j-1] - run.start + tail;
+         run.text.resize(len);
+
+         // The last instruction may run onto the next page, which may
+         // not be mapped.  If so, make do with this one.
+         //
+         proc->ReadMemory(run.start, len, run.text.data(), &innerErr);
+         if (ERROR_FAILED(&innerErr))
+         {
+            len = MIN(len, pageEnd - run.start);
+            run.text.resize(len);
+            proc->ReadMemory(run.start, len, run.text.data(), err);
+            ERROR_CHECK(err);
+         }
+         run.orig = run.text;
+
+         // What the program thinks is there, for decoding instructions
+         // that run into existing breakpoints.
+         //
+         logical = run.text;
+         bps.FindBreakpointsInRange(existing, run.start, len, err);
+         ERROR_CHECK(err);
+         for (auto bp : existing)
+         {
+            auto start = MAX(run.start, bp->vaddr);
+            auto end = MIN(run.start + len, bp->vaddr + bp->size);
+            memcpy(
+               logical.data() + (start - run.start),
+               (char*)bp->OldText() + (start - bp->vaddr),
+               end - start
+            );
+         }
+
+         for (; i<j; ++i)
+         {
+            addr_t pc = pcs[i];
+            size_t off = pc - run.start;
+            int size = fixedSize;
+            Breakpoint::ptr bp = Breakpoint::Null();
+
+            if (!size)
+               size = cpu->GetInstructionLength(logical.data() + off, len - off);
+            if (size <= 0 || off + size > len)
+               ERROR_SET(err, unknown, "Couldn't determine instruction length");
+
+            bps.FindBreakpointsInRange(existing, pc, size, err);
+            ERROR_CHECK(err);
+            if (existing.size() || pc < lastEnd)
+               ERROR_SET(err, unknown, "Proposed breakpoint overlaps with existing bp");
+            lastEnd = pc + size;
+
+            bp = Breakpoint::Allocate(size, err);
+            ERROR_CHECK(err);
+
+            bp->vaddr = pc;
+            memcpy(bp->OldText(), logical.data() + off, size);
+            cpu->GenerateBreakpoint(pc, bp->PatchedText(), size, err);
+            ERROR_CHECK(err);
+
+            run.Patch(pc, size, bp->PatchedText());
+            batch.push_back(std::move(bp));
+         }
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   try
+   {
+      inserted.reserve(batch.size());
+      for (auto &bp : batch)
+         inserted.push_back(bp.get());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   bps.Insert(batch, err);
+   ERROR_CHECK(err);
+
+   WriteRuns(proc.Get(), runs, err);
+   if (ERROR_FAILED(err))
+      bps.Remove(inserted);
+exit:;
+}
+
+void
+dbg::Debugger::RemoveBreakpoint(Breakpoint *bp, error *err)
+{
+   std::vector<Breakpoint*> list;
+
+   try
+   {
+      list.push_back(bp);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   RemoveBreakpoints(list, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Debugger::RemoveBreakpoints(std::vector<Breakpoint*> &list, error *err)
+{
+   const addr_t pageSize = getpagesize();
+   std::vector<PatchRun> runs;
+   size_t i = 0;
+
+   std::sort(
+      list.begin(),
+      list.end(),
+      [] (Breakpoint *a, Breakpoint *b) -> bool { return a->vaddr < b->vaddr; }
+   );
+
+   try
+   {
+      while (i < list.size())
+      {
+         addr_t pageEnd = (list[i]->vaddr & ~(pageSize - 1)) + pageSize;
+         size_t j = i;
+         size_t len = 0;
+
+         while (j < list.size() && list[j]->vaddr < pageEnd)
+            ++j;
+
+         runs.push_back(PatchRun());
+         auto &run = runs.back();
+
+         run.start = list[i]->vaddr;
+         len = list[j-1]->vaddr + list[j-1]->size - run.start;
+
+         // A lone breakpoint needs no read; we know what's under it.
+         //
+         if (j - i == 1)
+         {
+            run.orig.assign(
+               (unsigned char*)list[i]->PatchedText(),
+               (unsigned char*)list[i]->PatchedText() + len
+            );
+            run.text = run.orig;
+         }
+         else
+         {
+            run.text.resize(len);
+            proc->ReadMemory(run.start, len, run.text.data(), err);
+            ERROR_CHECK(err);
+            run.orig = run.text;
+         }
+
+         for (; i<j; ++i)
+            run.Patch(list[i]->vaddr, list[i]->size, list[i]->OldText());
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   WriteRuns(proc.Get(), runs, err);
+   ERROR_CHECK(err);
+
+   bps.Remove(list);
+exit:;
+}
+
+namespace {
+
+// Gives up the user's claim on each breakpoint, unpatching the ones
+// we don't need ourselves.
+//
+void
+ReleaseBreakpoints(dbg::Debugger *dbg, std::vector<dbg::Breakpoint*> &list, error *err)
+{
+   std::vector<dbg::Breakpoint*> remove;
+
+   try
+   {
+      for (auto bp : list)
+      {
+         if (!bp->handler)
+            remove.push_back(bp);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->RemoveBreakpoints(remove, err);
+   ERROR_CHECK(err);
+
+   // Leave it patched if we still need it ourselves.
+   //
+   for (auto bp : list)
+   {
+      if (bp->handler)
+      {
+         bp->user = false;
+         bp->location = nullptr;
+      }
+   }
+exit:;
+}
+
+} // end namespace
+
+namespace {
+
+// The user's breakpoints that the given ones resolved to.
+//
+void
+FindResolved(
+   dbg::Debugger *dbg,
+   const std::vector<dbg::BreakpointLocation*> &locs,
+   std::vector<dbg::Breakpoint*> &list,
+   error *err
+)
+{
+   std::unordered_set<dbg::BreakpointLocation*> set;
+
+   list.clear();
+
+   try
+   {
+      set.insert(locs.begin(), locs.end());
+
+      for (auto &p : dbg->bps.bps)
+      {
+         auto bp = p.second.get();
+         if (bp->user && set.count(bp->location))
+            list.push_back(bp);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+} // end namespace
+
+void
+dbg::Debugger::DeleteBreakpoint(BreakpointLocation *loc, error *err)
+{
+   std::vector<BreakpointLocation*> list;
+
+   try
+   {
+      list.push_back(loc);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   DeleteBreakpoints(list, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Debugger::DeleteBreakpoints(std::vector<BreakpointLocation*> &list, error *err)
+{
+   std::vector<Breakpoint*> resolved;
+   std::unordered_set<BreakpointLocation*> set;
+
+   FindResolved(this, list, resolved, err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      set.insert(list.begin(), list.end());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   ReleaseBreakpoints(this, resolved, err);
+   ERROR_CHECK(err);
+
+   locations.erase(
+      std::remove_if(
+         locations.begin(),
+         locations.end(),
+         [&set] (const std::unique_ptr<BreakpointLocation> &p) -> bool
+         {
+            return set.count(p.get()) != 0;
+         }
+      ),
+      locations.end()
+   );
+exit:;
+}
+
+void
+dbg::Debugger::DeleteAllBreakpoints(error *err)
+{
+   std::vector<Breakpoint*> list;
+
+   bps.GetUserBreakpoints(list, err);
+   ERROR_CHECK(err);
+
+   ReleaseBreakpoints(this, list, err);
+   ERROR_CHECK(err);
+
+   locations.clear();
+exit:;
+}
+
+void
+dbg::Debugger::DisableBreakpoints(std::vector<BreakpointLocation*> &list, error *err)
+{
+   std::vector<Breakpoint*> resolved;
+
+   FindResolved(this, list, resolved, err);
+   ERROR_CHECK(err);
+
+   ReleaseBreakpoints(this, resolved, err);
+   ERROR_CHECK(err);
+
+   for (auto loc : list)
+      loc->enabled = false;
+exit:;
+}
+
+void
+dbg::Debugger::EnableBreakpoints(std::vector<BreakpointLocation*> &list, error *err)
+{
+   std::vector<BreakpointLocation*> disabled;
+
+   try
+   {
+      for (auto loc : list)
+      {
+         if (!loc->enabled)
+            disabled.push_back(loc);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   for (auto loc : disabled)
+      loc->enabled = true;
+
+   ResolveLocations(this, disabled, err);
+   if (ERROR_FAILED(err))
+   {
+      error innerErr;
+      DisableBreakpoints(disabled, &innerErr);
+   }
+exit:;
+}
+
+namespace {
+
+// Snoops on process events to keep the debugger's view of the target
+// up to date.  Holds a weak reference, since the debugger owns the
+// process which owns us.
+//
+struct DebuggerEvents : public dbg::ProcessEvents
+{
+   dbg::Debugger *dbg;
+
+   DebuggerEvents() : dbg(nullptr) {}
+
+   void
+   OnModuleProbed(dbg::addr_t baseAddr, const char *optName, error *err)
+   {
+      auto mod = dbg->modules.Insert(baseAddr, optName, err);
+      ERROR_CHECK(err);
+
+      dbg->ResolveBreakpoints(mod, err);
+      ERROR_CHECK(err);
+   exit:;
+   }
+
+   void
+   OnModuleUnloaded(dbg::addr_t baseAddr, error *err)
+   {
+      // Its breakpoints went with it.  Any set by location will be
+      // back if it's loaded again.
+      //
+      auto mod = dbg->modules.Lookup(baseAddr);
+      if (mod && mod->base == baseAddr)
+         dbg->DropBreakpoints(mod->base, mod->end);
+
+      dbg->modules.Remove(baseAddr);
+   }
+
+   void
+   OnSyscall(const dbg::SyscallStop &stop, error *err)
+   {
+      dbg->strace.OnSyscall(dbg, stop, err);
+   }
+};
+
+} // end namespace
+
 void
 dbg::Create(
    Debugger **p,
@@ -237,12 +2175,15 @@ dbg::Create(
 )
 {
    common::Pointer<Debugger> r;
+   common::Pointer<DebuggerEvents> events;
    common::New(r, err);
    ERROR_CHECK(err);
    Create(r->proc.GetAddressOf(), err);
    ERROR_CHECK(err);
-   New(r->proc->EventCallbacks, err);
+   New(events, err);
    ERROR_CHECK(err);
+   events->dbg = r.Get();
+   r->proc->EventCallbacks = events.Get();
    Create(r->cpu.GetAddressOf(), err);
    ERROR_CHECK(err);
    r->proc->Cpu = r->cpu;
@@ -0,0 +1,1269 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/dwarf.h>
+
+#include <algorithm>
+#include <map>
+
+using dbg::addr_t;
+using dbg::ElfSection;
+using dbg::dwarf::Reader;
+using dbg::dwarf::DebugInfo;
+
+namespace {
+
+enum
+{
+   DW_TAG_inlined_subroutine = 0x1d,
+   DW_TAG_compile_unit       = 0x11,
+   DW_TAG_subprogram         = 0x2e,
+   DW_TAG_partial_unit       = 0x3c,
+};
+
+enum
+{
+   DW_AT_name              = 0x03,
+   DW_AT_stmt_list         = 0x10,
+   DW_AT_low_pc            = 0x11,
+   DW_AT_high_pc           = 0x12,
+   DW_AT_abstract_origin   = 0x31,
+   DW_AT_specification     = 0x47,
+   DW_AT_ranges            = 0x55,
+   DW_AT_call_file         = 0x58,
+   DW_AT_call_line         = 0x59,
+   DW_AT_linkage_name      = 0x6e,
+   DW_AT_str_offsets_base  = 0x72,
+   DW_AT_addr_base         = 0x73,
+   DW_AT_rnglists_base     = 0x74,
+   DW_AT_MIPS_linkage_name = 0x2007,
+};
+
+enum
+{
+   DW_FORM_addr           = 0x01,
+   DW_FORM_block2         = 0x03,
+   DW_FORM_block4         = 0x04,
+   DW_FORM_data2          = 0x05,
+   DW_FORM_data4          = 0x06,
+   DW_FORM_data8          = 0x07,
+   DW_FORM_string         = 0x08,
+   DW_FORM_block          = 0x09,
+   DW_FORM_block1         = 0x0a,
+   DW_FORM_data1          = 0x0b,
+   DW_FORM_flag           = 0x0c,
+   DW_FORM_sdata          = 0x0d,
+   DW_FORM_strp           = 0x0e,
+   DW_FORM_udata          = 0x0f,
+   DW_FORM_ref_addr       = 0x10,
+   DW_FORM_ref1           = 0x11,
+   DW_FORM_ref2           = 0x12,
+   DW_FORM_ref4           = 0x13,
+   DW_FORM_ref8           = 0x14,
+   DW_FORM_ref_udata      = 0x15,
+   DW_FORM_indirect       = 0x16,
+   DW_FORM_sec_offset     = 0x17,
+   DW_FORM_exprloc        = 0x18,
+   DW_FORM_flag_present   = 0x19,
+   DW_FORM_strx           = 0x1a,
+   DW_FORM_addrx          = 0x1b,
+   DW_FORM_ref_sup4       = 0x1c,
+   DW_FORM_strp_sup       = 0x1d,
+   DW_FORM_data16         = 0x1e,
+   DW_FORM_line_strp      = 0x1f,
+   DW_FORM_ref_sig8       = 0x20,
+   DW_FORM_implicit_const = 0x21,
+   DW_FORM_loclistx       = 0x22,
+   DW_FORM_rnglistx       = 0x23,
+   DW_FORM_ref_sup8       = 0x24,
+   DW_FORM_strx1          = 0x25,
+   DW_FORM_strx2          = 0x26,
+   DW_FORM_strx3          = 0x27,
+   DW_FORM_strx4          = 0x28,
+   DW_FORM_addrx1         = 0x29,
+   DW_FORM_addrx2         = 0x2a,
+   DW_FORM_addrx3         = 0x2b,
+   DW_FORM_addrx4         = 0x2c,
+
+   DW_FORM_GNU_addr_index = 0x1f01,
+   DW_FORM_GNU_str_index  = 0x1f02,
+   DW_FORM_GNU_ref_alt    = 0x1f20,
+   DW_FORM_GNU_strp_alt   = 0x1f21,
+};
+
+enum
+{
+   DW_RLE_end_of_list   = 0x00,
+   DW_RLE_base_addressx = 0x01,
+   DW_RLE_startx_endx   = 0x02,
+   DW_RLE_startx_length = 0x03,
+   DW_RLE_offset_pair   = 0x04,
+   DW_RLE_base_address  = 0x05,
+   DW_RLE_start_end     = 0x06,
+   DW_RLE_start_length  = 0x07,
+};
+
+enum
+{
+   DW_UT_compile       = 0x01,
+   DW_UT_type          = 0x02,
+   DW_UT_partial       = 0x03,
+   DW_UT_skeleton      = 0x04,
+   DW_UT_split_compile = 0x05,
+   DW_UT_split_type    = 0x06,
+};
+
+enum
+{
+   DW_LNCT_path            = 0x1,
+   DW_LNCT_directory_index = 0x2,
+};
+
+// Abbreviation codes are normally small and dense.  Anything past this
+// is ignored rather than growing the table without bound.
+//
+const uint64_t MaxAbbrevCode = 65536;
+
+// How many abstract_origin/specification links we'll follow for a name.
+//
+const int MaxNameDepth = 4;
+
+typedef std::vector<std::pair<addr_t, addr_t>> RangeList;
+
+//
+// A raw attribute value.  Strings, addresses and range lists can't be
+// resolved until we've seen the unit's base attributes, so that is
+// done separately.
+//
+struct Value
+{
+   uint16_t form;
+   uint64_t u;
+   const char *str;
+};
+
+uint64_t
+ReadOffset(Reader &r, int size)
+{
+   return (size == 8) ? r.U64() : r.U32();
+}
+
+addr_t
+ReadAddress(Reader &r, int size)
+{
+   return (size == 8) ? r.U64() : r.U32();
+}
+
+bool
+ReadValue(
+   Reader &r,
+   const DebugInfo::Unit &u,
+   uint16_t form,
+   int64_t implicitConst,
+   Value *v
+)
+{
+   v->form = form;
+   v->u = 0;
+   v->str = nullptr;
+
+   switch (form)
+   {
+   case DW_FORM_addr:
+      v->u = ReadAddress(r, u.addrSize);
+      break;
+
+   case DW_FORM_data1:
+   case DW_FORM_ref1:
+   case DW_FORM_flag:
+   case DW_FORM_strx1:
+   case DW_FORM_addrx1:
+      v->u = r.U8();
+      break;
+
+   case DW_FORM_data2:
+   case DW_FORM_ref2:
+   case DW_FORM_strx2:
+   case DW_FORM_addrx2:
+      v->u = r.U16();
+      break;
+
+   case DW_FORM_strx3:
+   case DW_FORM_addrx3:
+      v->u = r.U16();
+      v->u |= (uint64_t)r.U8() << 16;
+      break;
+
+   case DW_FORM_data4:
+   case DW_FORM_ref4:
+   case DW_FORM_ref_sup4:
+   case DW_FORM_strx4:
+   case DW_FORM_addrx4:
+      v->u = r.U32();
+      break;
+
+   case DW_FORM_data8:
+   case DW_FORM_ref8:
+   case DW_FORM_ref_sig8:
+   case DW_FORM_ref_sup8:
+      v->u = r.U64();
+      break;
+
+   case DW_FORM_data16:
+      r.Skip(16);
+      break;
+
+   case DW_FORM_sdata:
+      v->u = (uint64_t)r.Sleb();
+      break;
+
+   case DW_FORM_udata:
+   case DW_FORM_ref_udata:
+   case DW_FORM_strx:
+   case DW_FORM_addrx:
+   case DW_FORM_loclistx:
+   case DW_FORM_rnglistx:
+   case DW_FORM_GNU_addr_index:
+   case DW_FORM_GNU_str_index:
+      v->u = r.Uleb();
+      break;
+
+   case DW_FORM_string:
+      v->str = r.String();
+      break;
+
+   case DW_FORM_strp:
+   case DW_FORM_line_strp:
+   case DW_FORM_sec_offset:
+   case DW_FORM_strp_sup:
+   case DW_FORM_GNU_ref_alt:
+   case DW_FORM_GNU_strp_alt:
+      v->u = ReadOffset(r, u.offsetSize);
+      break;
+
+   case DW_FORM_ref_addr:
+      v->u = ReadOffset(r, (u.version <= 2) ? u.addrSize : u.offsetSize);
+      break;
+
+   case DW_FORM_block1:
+      r.Skip(r.U8());
+      break;
+
+   case DW_FORM_block2:
+      r.Skip(r.U16());
+      break;
+
+   case DW_FORM_block4:
+      r.Skip(r.U32());
+      break;
+
+   case DW_FORM_block:
+   case DW_FORM_exprloc:
+      r.Skip(r.Uleb());
+      break;
+
+   case DW_FORM_flag_present:
+      v->u = 1;
+      break;
+
+   case DW_FORM_implicit_const:
+      v->u = (uint64_t)implicitConst;
+      break;
+
+   case DW_FORM_indirect:
+      form = r.Uleb();
+      if (form == DW_FORM_indirect || form == DW_FORM_implicit_const)
+         return false;
+      return ReadValue(r, u, form, 0, v);
+
+   default:
+      return false;
+   }
+
+   return !r.overflow;
+}
+
+// Returns the .debug_info offset a reference points to, or 0 if it's
+// somewhere we can't follow (type units, supplementary files).
+//
+uint64_t
+RefOffset(const DebugInfo::Unit &u, const Value &v)
+{
+   switch (v.form)
+   {
+   case DW_FORM_ref1:
+   case DW_FORM_ref2:
+   case DW_FORM_ref4:
+   case DW_FORM_ref8:
+   case DW_FORM_ref_udata:
+      return u.offset + v.u;
+   case DW_FORM_ref_addr:
+      return v.u;
+   default:
+      return 0;
+   }
+}
+
+const char *
+SectionString(const ElfSection &sec, uint64_t off)
+{
+   if (off >= sec.size || !memchr(sec.data + off, 0, sec.size - off))
+      return nullptr;
+   return (const char*)sec.data + off;
+}
+
+const char *
+GetString(DebugInfo &di, const DebugInfo::Unit &u, const Value &v)
+{
+   switch (v.form)
+   {
+   case DW_FORM_string:
+      return v.str;
+
+   case DW_FORM_strp:
+      return SectionString(di.str, v.u);
+
+   case DW_FORM_line_strp:
+      return SectionString(di.lineStr, v.u);
+
+   case DW_FORM_strx:
+   case DW_FORM_strx1:
+   case DW_FORM_strx2:
+   case DW_FORM_strx3:
+   case DW_FORM_strx4:
+   {
+      Reader r(di.strOffsets);
+      uint64_t off = 0;
+
+      r.Seek(u.strOffsetsBase + v.u * u.offsetSize);
+      off = ReadOffset(r, u.offsetSize);
+      return r.overflow ? nullptr : SectionString(di.str, off);
+   }
+
+   default:
+      return nullptr;
+   }
+}
+
+bool
+GetIndexedAddress(DebugInfo &di, const DebugInfo::Unit &u, uint64_t idx, addr_t *out)
+{
+   Reader r(di.addr);
+
+   r.Seek(u.addrBase + idx * u.addrSize);
+   *out = ReadAddress(r, u.addrSize);
+   return !r.overflow;
+}
+
+bool
+GetAddress(DebugInfo &di, const DebugInfo::Unit &u, const Value &v, addr_t *out)
+{
+   switch (v.form)
+   {
+   case DW_FORM_addr:
+      *out = v.u;
+      return true;
+
+   case DW_FORM_addrx:
+   case DW_FORM_addrx1:
+   case DW_FORM_addrx2:
+   case DW_FORM_addrx3:
+   case DW_FORM_addrx4:
+      return GetIndexedAddress(di, u, v.u, out);
+
+   default:
+      return false;
+   }
+}
+
+// Appends the ranges described by a DW_AT_ranges value.  Can throw
+// std::bad_alloc.
+//
+void
+ReadRanges(DebugInfo &di, const DebugInfo::Unit &u, const Value &v, RangeList &out)
+{
+   addr_t base = u.base;
+
+   if (u.version < 5)
+   {
+      Reader r(di.ranges);
+      addr_t baseSelect = (u.addrSize == 8) ? ~(uint64_t)0 : 0xffffffff;
+
+      r.Seek(v.u);
+
+      for (;;)
+      {
+         addr_t start = ReadAddress(r, u.addrSize);
+         addr_t end = ReadAddress(r, u.addrSize);
+
+         if (r.overflow || (!start && !end))
+            break;
+
+         if (start == baseSelect)
+            base = end;
+         else
+            out.push_back(std::make_pair(base + start, base + end));
+      }
+   }
+   else
+   {
+      uint64_t off = v.u;
+
+      if (v.form == DW_FORM_rnglistx)
+      {
+         Reader t(di.rnglists);
+
+         t.Seek(u.rnglistsBase + v.u * u.offsetSize);
+         off = u.rnglistsBase + ReadOffset(t, u.offsetSize);
+         if (t.overflow)
+            return;
+      }
+
+      Reader r(di.rnglists);
+      r.Seek(off);
+
+      for (;;)
+      {
+         addr_t start = 0, end = 0;
+         int kind = r.U8();
+
+         if (r.overflow)
+            break;
+
+         switch (kind)
+         {
+         case DW_RLE_base_addressx:
+            if (!GetIndexedAddress(di, u, r.Uleb(), &base))
+               return;
+            continue;
+
+         case DW_RLE_startx_endx:
+            if (!GetIndexedAddress(di, u, r.Uleb(), &start) ||
+                !GetIndexedAddress(di, u, r.Uleb(), &end))
+               return;
+            break;
+
+         case DW_RLE_startx_length:
+            if (!GetIndexedAddress(di, u, r.Uleb(), &start))
+               return;
+            end = start + r.Uleb();
+            break;
+
+         case DW_RLE_offset_pair:
+            start = base + r.Uleb();
+            end = base + r.Uleb();
+            break;
+
+         case DW_RLE_base_address:
+            base = ReadAddress(r, u.addrSize);
+            continue;
+
+         case DW_RLE_start_end:
+            start = ReadAddress(r, u.addrSize);
+            end = ReadAddress(r, u.addrSize);
+            break;
+
+         case DW_RLE_start_length:
+            start = ReadAddress(r, u.addrSize);
+            end = start + r.Uleb();
+            break;
+
+         case DW_RLE_end_of_list:
+         default:
+            return;
+         }
+
+         if (r.overflow)
+            break;
+         out.push_back(std::make_pair(start, end));
+      }
+   }
+}
+
+// Collects the pc ranges of a DIE from whichever of low_pc, high_pc
+// and ranges it had.  Can throw std::bad_alloc.
+//
+void
+GetRanges(
+   DebugInfo &di,
+   const DebugInfo::Unit &u,
+   const Value *low,
+   const Value *high,
+   const Value *ranges,
+   RangeList &out
+)
+{
+   addr_t start = 0, end = 0;
+
+   if (ranges)
+   {
+      ReadRanges(di, u, *ranges, out);
+      return;
+   }
+
+   if (!low || !high || !GetAddress(di, u, *low, &start))
+      return;
+
+   // high_pc is either an address, or (DWARF 4 and up) a length.
+   //
+   if (!GetAddress(di, u, *high, &end))
+      end = start + high->u;
+
+   out.push_back(std::make_pair(start, end));
+}
+
+const DebugInfo::AbbrevTable *
+GetAbbrevs(DebugInfo &di, uint64_t offset, error *err)
+{
+   DebugInfo::AbbrevTable *table = nullptr;
+   auto it = di.abbrevTables.find(offset);
+
+   if (it != di.abbrevTables.end())
+      return &it->second;
+
+   try
+   {
+      Reader r(di.abbrev);
+
+      table = &di.abbrevTables[offset];
+      r.Seek(offset);
+
+      for (;;)
+      {
+         DebugInfo::Abbrev a;
+         uint64_t code = r.Uleb();
+
+         if (!code || r.overflow)
+            break;
+
+         a.tag = r.Uleb();
+         a.children = r.U8() ? true : false;
+
+         for (;;)
+         {
+            DebugInfo::AttrSpec spec;
+
+            spec.name = r.Uleb();
+            spec.form = r.Uleb();
+            spec.implicitConst = (spec.form == DW_FORM_implicit_const) ? r.Sleb() : 0;
+
+            if (r.overflow || (!spec.name && !spec.form))
+               break;
+
+            a.attrs.push_back(spec);
+         }
+
+         if (code >= MaxAbbrevCode)
+            continue;
+
+         if (table->size() <= code)
+            table->resize(code + 1);
+         (*table)[code] = std::move(a);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+exit:
+   return ERROR_FAILED(err) ? nullptr : table;
+}
+
+const DebugInfo::Abbrev *
+LookupAbbrev(const DebugInfo::AbbrevTable *table, uint64_t code)
+{
+   if (!table || code >= table->size() || !(*table)[code].tag)
+      return nullptr;
+   return &(*table)[code];
+}
+
+// Positions a reader at off, limited to the unit.
+//
+Reader
+UnitReader(DebugInfo &di, const DebugInfo::Unit &u, size_t off)
+{
+   Reader r(di.info);
+
+   r.end = di.info.data + u.end;
+   r.Seek(off);
+   return r;
+}
+
+// Reads the attributes of a unit's root DIE that everything else in it
+// depends on, and notes the addresses it covers.
+//
+void
+ReadUnitRoot(DebugInfo &di, DebugInfo::Unit &u, size_t idx, error *err)
+{
+   Reader r = UnitReader(di, u, u.dieOffset);
+   const DebugInfo::AbbrevTable *abbrevs = nullptr;
+   const DebugInfo::Abbrev *a = nullptr;
+   Value low, high, ranges;
+   bool haveLow = false, haveHigh = false, haveRanges = false;
+   RangeList list;
+
+   abbrevs = GetAbbrevs(di, u.abbrevOffset, err);
+   ERROR_CHECK(err);
+
+   a = LookupAbbrev(abbrevs, r.Uleb());
+   if (!a || (a->tag != DW_TAG_compile_unit && a->tag != DW_TAG_partial_unit))
+      goto exit;
+
+   for (auto &spec : a->attrs)
+   {
+      Value v;
+
+      if (!ReadValue(r, u, spec.form, spec.implicitConst, &v))
+         goto exit;
+
+      switch (spec.name)
+      {
+      case DW_AT_low_pc:
+         low = v;
+         haveLow = true;
+         break;
+      case DW_AT_high_pc:
+         high = v;
+         haveHigh = true;
+         break;
+      case DW_AT_ranges:
+         ranges = v;
+         haveRanges = true;
+         break;
+      case DW_AT_stmt_list:
+         u.hasLines = true;
+         u.lineOffset = v.u;
+         break;
+      case DW_AT_str_offsets_base:
+         u.strOffsetsBase = v.u;
+         break;
+      case DW_AT_addr_base:
+         u.addrBase = v.u;
+         break;
+      case DW_AT_rnglists_base:
+         u.rnglistsBase = v.u;
+         break;
+      }
+   }
+
+   if (haveLow)
+      GetAddress(di, u, low, &u.base);
+
+   try
+   {
+      GetRanges(
+         di,
+         u,
+         haveLow ? &low : nullptr,
+         haveHigh ? &high : nullptr,
+         haveRanges ? &ranges : nullptr,
+         list
+      );
+
+      for (auto &range : list)
+      {
+         DebugInfo::UnitRange ur;
+
+         if (range.first >= range.second)
+            continue;
+
+         ur.start = range.first;
+         ur.end = range.second;
+         ur.unit = idx;
+         di.unitRanges.push_back(ur);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+ReadUnits(DebugInfo &di, error *err)
+{
+   Reader r(di.info);
+
+   di.unitsRead = true;
+
+   while (r.Remaining())
+   {
+      DebugInfo::Unit u;
+      uint64_t length = 0;
+      size_t end = 0;
+      int type = DW_UT_compile;
+
+      u.offset = r.Offset();
+      u.offsetSize = 4;
+      u.addrSize = 0;
+      u.abbrevOffset = 0;
+      u.strOffsetsBase = u.addrBase = u.rnglistsBase = 0;
+      u.base = 0;
+      u.hasLines = false;
+      u.lineOffset = 0;
+      u.indexed = false;
+      u.filesRead = false;
+
+      length = r.U32();
+      if (length == 0xffffffff)
+      {
+         length = r.U64();
+         u.offsetSize = 8;
+      }
+      else if (length >= 0xfffffff0)
+      {
+         break;
+      }
+
+      if (r.overflow || length > r.Remaining())
+         break;
+
+      u.end = r.Offset() + length;
+      u.version = r.U16();
+
+      if (u.version >= 5)
+      {
+         type = r.U8();
+         u.addrSize = r.U8();
+         u.abbrevOffset = ReadOffset(r, u.offsetSize);
+      }
+      else
+      {
+         u.abbrevOffset = ReadOffset(r, u.offsetSize);
+         u.addrSize = r.U8();
+      }
+      u.dieOffset = r.Offset();
+      end = u.end;
+
+      if (!r.overflow &&
+          u.version >= 2 && u.version <= 5 &&
+          (type == DW_UT_compile || type == DW_UT_partial) &&
+          (u.addrSize == 4 || u.addrSize == 8))
+      {
+         ReadUnitRoot(di, u, di.units.size(), err);
+         ERROR_CHECK(err);
+
+         try
+         {
+            di.units.push_back(std::move(u));
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+      }
+
+      r.Seek(end);
+   }
+
+   std::sort(
+      di.unitRanges.begin(),
+      di.unitRanges.end(),
+      [] (const DebugInfo::UnitRange &a, const DebugInfo::UnitRange &b) -> bool
+      {
+         return a.start < b.start;
+      }
+   );
+
+exit:;
+}
+
+// Records that [start, end) belongs to scope, overriding whatever was
+// there.  Scopes are added outermost first, so the map ends up holding
+// the innermost scope for every address.
+//
+void
+AssignRange(std::map<addr_t, int> &owners, addr_t start, addr_t end, int scope)
+{
+   auto it = owners.upper_bound(end);
+   int ownerAtEnd = (it == owners.begin()) ? -1 : (--it)->second;
+
+   owners.insert(std::make_pair(end, ownerAtEnd));
+   owners.erase(owners.lower_bound(start), owners.lower_bound(end));
+   owners[start] = scope;
+}
+
+// Walks every DIE in a unit, building a map from address to the
+// innermost function or inlined call covering it.
+//
+void
+IndexUnit(DebugInfo &di, DebugInfo::Unit &u, error *err)
+{
+   Reader r = UnitReader(di, u, u.dieOffset);
+   const DebugInfo::AbbrevTable *abbrevs = nullptr;
+   std::vector<int> parents;
+   std::map<addr_t, int> owners;
+   RangeList list;
+
+   u.indexed = true;
+
+   abbrevs = GetAbbrevs(di, u.abbrevOffset, err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      while (r.Remaining())
+      {
+         uint64_t code = r.Uleb();
+         const DebugInfo::Abbrev *a = nullptr;
+         int parent = parents.size() ? parents.back() : -1;
+         int scope = -1;
+         bool isScope = false;
+         Value low, high, ranges, name;
+         bool haveLow = false, haveHigh = false, haveRanges = false, haveName = false;
+         uint64_t origin = 0;
+         uint64_t callFile = 0, callLine = 0;
+
+         if (r.overflow)
+            break;
+
+         if (!code)
+         {
+            if (parents.size())
+               parents.pop_back();
+            continue;
+         }
+
+         if (!(a = LookupAbbrev(abbrevs, code)))
+            break;
+
+         isScope = (a->tag == DW_TAG_subprogram ||
+                    a->tag == DW_TAG_inlined_subroutine);
+
+         for (auto &spec : a->attrs)
+         {
+            Value v;
+
+            if (!ReadValue(r, u, spec.form, spec.implicitConst, &v))
+               goto done;
+
+            if (!isScope)
+               continue;
+
+            switch (spec.name)
+            {
+            case DW_AT_low_pc:
+               low = v;
+               haveLow = true;
+               break;
+            case DW_AT_high_pc:
+               high = v;
+               haveHigh = true;
+               break;
+            case DW_AT_ranges:
+               ranges = v;
+               haveRanges = true;
+               break;
+            case DW_AT_name:
+               name = v;
+               haveName = true;
+               break;
+            case DW_AT_abstract_origin:
+            case DW_AT_specification:
+               origin = RefOffset(u, v);
+               break;
+            case DW_AT_call_file:
+               callFile = v.u;
+               break;
+            case DW_AT_call_line:
+               callLine = v.u;
+               break;
+            }
+         }
+
+         if (isScope)
+         {
+            list.clear();
+            GetRanges(
+               di,
+               u,
+               haveLow ? &low : nullptr,
+               haveHigh ? &high : nullptr,
+               haveRanges ? &ranges : nullptr,
+               list
+            );
+
+            for (auto &range : list)
+            {
+               // Functions discarded by the linker show up at 0.
+               //
+               if (!range.first || range.first >= range.second)
+                  continue;
+
+               if (scope < 0)
+               {
+                  DebugInfo::Scope s;
+
+                  s.parent = parent;
+                  s.inlined = (a->tag == DW_TAG_inlined_subroutine);
+                  s.name = haveName ? GetString(di, u, name) : nullptr;
+                  s.origin = s.name ? 0 : origin;
+                  s.callFile = callFile;
+                  s.callLine = callLine;
+
+                  scope = u.scopes.size();
+                  u.scopes.push_back(s);
+               }
+
+               AssignRange(owners, range.first, range.second, scope);
+            }
+         }
+
+         if (a->children)
+            parents.push_back(scope >= 0 ? scope : parent);
+      }
+
+   done:
+      u.scopeMap.assign(owners.begin(), owners.end());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+const char *
+GetName(DebugInfo &di, uint64_t offset, int depth)
+{
+   const char *name = nullptr;
+   const char *linkageName = nullptr;
+   uint64_t next = 0;
+   const DebugInfo::Unit *u = nullptr;
+   const DebugInfo::Abbrev *a = nullptr;
+   error err;
+
+   auto cached = di.names.find(offset);
+   if (cached != di.names.end())
+      return cached->second;
+
+   auto it = std::upper_bound(
+      di.units.begin(),
+      di.units.end(),
+      offset,
+      [] (uint64_t offset, const DebugInfo::Unit &u) -> bool
+      {
+         return offset < u.offset;
+      }
+   );
+   if (it == di.units.begin())
+      goto exit;
+   u = &*--it;
+   if (offset < u->dieOffset || offset >= u->end)
+      goto exit;
+
+   {
+   Reader r = UnitReader(di, *u, offset);
+
+   a = LookupAbbrev(GetAbbrevs(di, u->abbrevOffset, &err), r.Uleb());
+   if (!a)
+      goto exit;
+
+   for (auto &spec : a->attrs)
+   {
+      Value v;
+
+      if (!ReadValue(r, *u, spec.form, spec.implicitConst, &v))
+         goto exit;
+
+      switch (spec.name)
+      {
+      case DW_AT_name:
+         name = GetString(di, *u, v);
+         break;
+      case DW_AT_linkage_name:
+      case DW_AT_MIPS_linkage_name:
+         linkageName = GetString(di, *u, v);
+         break;
+      case DW_AT_abstract_origin:
+      case DW_AT_specification:
+         next = RefOffset(*u, v);
+         break;
+      }
+   }
+   }
+
+   if (!name && next && depth < MaxNameDepth)
+      name = GetName(di, next, depth + 1);
+   if (!name)
+      name = linkageName;
+
+   try
+   {
+      di.names[offset] = name;
+   }
+   catch (std::bad_alloc)
+   {
+   }
+
+exit:
+   return name;
+}
+
+std::string
+JoinPath(const char *dir, const char *name)
+{
+   std::string r;
+
+   if (!name)
+      return r;
+   if (dir && *dir && *name != '/')
+   {
+      r = dir;
+      r += '/';
+   }
+   r += name;
+   return r;
+}
+
+// Reads the file table from the unit's line program header.
+//
+void
+ReadFiles(DebugInfo &di, DebugInfo::Unit &u, error *err)
+{
+   Reader r(di.line);
+   DebugInfo::Unit lu;
+   uint64_t length = 0;
+   int opcodeBase = 0;
+   std::vector<std::pair<const char*, uint64_t>> dirs, files;
+
+   u.filesRead = true;
+   if (!u.hasLines)
+      goto exit;
+
+   r.Seek(u.lineOffset);
+
+   // The header has its own sizes, but takes string offsets from the
+   // unit.
+   //
+   lu.offset = u.offset;
+   lu.addrSize = u.addrSize;
+   lu.strOffsetsBase = u.strOffsetsBase;
+   lu.offsetSize = 4;
+   length = r.U32();
+   if (length == 0xffffffff)
+   {
+      length = r.U64();
+      lu.offsetSize = 8;
+   }
+   if (r.overflow || length > r.Remaining())
+      goto exit;
+   r.end = r.p + length;
+
+   lu.version = r.U16();
+   if (lu.version >= 5)
+   {
+      lu.addrSize = r.U8();
+      r.U8();  // segment selector size
+   }
+   ReadOffset(r, lu.offsetSize);  // header length
+   r.U8();                        // minimum instruction length
+   if (lu.version >= 4)
+      r.U8();                     // maximum operations per instruction
+   r.U8();                        // default is_stmt
+   r.U8();                        // line base
+   r.U8();                        // line range
+   opcodeBase = r.U8();
+   if (opcodeBase)
+      r.Skip(opcodeBase - 1);
+
+   try
+   {
+      if (lu.version < 5)
+      {
+         const char *s = nullptr;
+
+         // Index 0 is the compilation directory, which isn't listed.
+         //
+         dirs.push_back(std::make_pair(nullptr, 0));
+         while ((s = r.String()) && *s)
+            dirs.push_back(std::make_pair(s, 0));
+
+         // File numbers start at 1.
+         //
+         files.push_back(std::make_pair(nullptr, 0));
+         while ((s = r.String()) && *s)
+         {
+            uint64_t dir = r.Uleb();
+            r.Uleb();  // mtime
+            r.Uleb();  // length
+            files.push_back(std::make_pair(s, dir));
+         }
+      }
+      else
+      {
+         for (auto list : { &dirs, &files })
+         {
+            std::vector<std::pair<uint64_t, uint64_t>> format;
+            int nformat = r.U8();
+            uint64_t count = 0;
+
+            for (int i=0; i<nformat; ++i)
+            {
+               uint64_t type = r.Uleb();
+               uint64_t form = r.Uleb();
+               format.push_back(std::make_pair(type, form));
+            }
+
+            count = r.Uleb();
+            for (uint64_t i=0; i<count && !r.overflow; ++i)
+            {
+               const char *path = nullptr;
+               uint64_t dir = 0;
+
+               for (auto &f : format)
+               {
+                  Value v;
+
+                  if (!ReadValue(r, lu, f.second, 0, &v))
+                     goto done;
+
+                  if (f.first == DW_LNCT_path)
+                     path = GetString(di, lu, v);
+                  else if (f.first == DW_LNCT_directory_index)
+                     dir = v.u;
+               }
+
+               list->push_back(std::make_pair(path, dir));
+            }
+         }
+      }
+
+   done:
+      for (auto &file : files)
+      {
+         const char *dir = (file.second < dirs.size()) ? dirs[file.second].first : nullptr;
+         u.files.push_back(JoinPath(dir, file.first));
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+} // end namespace
+
+void
+dbg::dwarf::DebugInfo::Init(ElfImage *image, error *err)
+{
+   this->image = image;
+
+   image->GetSection(".debug_info", &info);
+   image->GetSection(".debug_abbrev", &abbrev);
+   image->GetSection(".debug_str", &str);
+   image->GetSection(".debug_line_str", &lineStr);
+   image->GetSection(".debug_str_offsets", &strOffsets);
+   image->GetSection(".debug_addr", &addr);
+   image->GetSection(".debug_ranges", &ranges);
+   image->GetSection(".debug_rnglists", &rnglists);
+   image->GetSection(".debug_line", &line);
+
+   if (!info.size || !abbrev.size)
+      ERROR_SET(err, unknown, "No debug info");
+exit:;
+}
+
+bool
+dbg::dwarf::DebugInfo::GetInlineChain(
+   addr_t pc,
+   std::vector<InlineFrame> &frames,
+   error *err
+)
+{
+   Unit *u = nullptr;
+   int idx = -1;
+
+   frames.clear();
+
+   if (!unitsRead)
+   {
+      ReadUnits(*this, err);
+      ERROR_CHECK(err);
+   }
+
+   {
+   auto range = std::upper_bound(
+      unitRanges.begin(),
+      unitRanges.end(),
+      pc,
+      [] (addr_t pc, const UnitRange &r) -> bool
+      {
+         return pc < r.start;
+      }
+   );
+   if (range == unitRanges.begin() || pc >= (--range)->end)
+      goto exit;
+   u = &units[range->unit];
+   }
+
+   if (!u->indexed)
+   {
+      IndexUnit(*this, *u, err);
+      ERROR_CHECK(err);
+   }
+
+   {
+   auto scope = std::upper_bound(
+      u->scopeMap.begin(),
+      u->scopeMap.end(),
+      pc,
+      [] (addr_t pc, const std::pair<addr_t, int> &p) -> bool
+      {
+         return pc < p.first;
+      }
+   );
+   if (scope == u->scopeMap.begin())
+      goto exit;
+   idx = (--scope)->second;
+   }
+
+   try
+   {
+      for (; idx >= 0; idx = u->scopes[idx].parent)
+      {
+         auto &s = u->scopes[idx];
+         InlineFrame f;
+
+         f.name = s.name ? s.name : s.origin ? GetName(*this, s.origin, 0) : nullptr;
+         f.inlined = s.inlined;
+         f.callFile = nullptr;
+         f.callLine = 0;
+
+         if (s.inlined)
+         {
+            if (!u->filesRead)
+            {
+               ReadFiles(*this, *u, err);
+               ERROR_CHECK(err);
+            }
+            if (s.callFile < u->files.size() && u->files[s.callFile].size())
+               f.callFile = u->files[s.callFile].c_str();
+            f.callLine = s.callLine;
+         }
+
+         frames.push_back(f);
+
+         // Anything further out is a function this one is lexically
+         // nested in, not one it was inlined into.
+         //
+         if (!s.inlined)
+            break;
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+exit:
+   return !ERROR_FAILED(err) && frames.size();
+}
@@ -0,0 +1,1260 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/dwarf.h>
+#include <common/misc.h>
+
+#include <algorithm>
+
+using dbg::addr_t;
+using dbg::ElfSection;
+using dbg::dwarf::Reader;
+using dbg::dwarf::Rule;
+using dbg::dwarf::UnwindRow;
+using dbg::dwarf::RegisterSet;
+
+namespace {
+
+enum
+{
+   DW_EH_PE_absptr   = 0x00,
+   DW_EH_PE_uleb128  = 0x01,
+   DW_EH_PE_udata2   = 0x02,
+   DW_EH_PE_udata4   = 0x03,
+   DW_EH_PE_udata8   = 0x04,
+   DW_EH_PE_sleb128  = 0x09,
+   DW_EH_PE_sdata2   = 0x0a,
+   DW_EH_PE_sdata4   = 0x0b,
+   DW_EH_PE_sdata8   = 0x0c,
+
+   DW_EH_PE_pcrel    = 0x10,
+   DW_EH_PE_textrel  = 0x20,
+   DW_EH_PE_datarel  = 0x30,
+   DW_EH_PE_funcrel  = 0x40,
+   DW_EH_PE_aligned  = 0x50,
+
+   DW_EH_PE_indirect = 0x80,
+   DW_EH_PE_omit     = 0xff,
+};
+
+enum
+{
+   DW_CFA_advance_loc        = 0x40,
+   DW_CFA_offset             = 0x80,
+   DW_CFA_restore            = 0xc0,
+
+   DW_CFA_nop                = 0x00,
+   DW_CFA_set_loc            = 0x01,
+   DW_CFA_advance_loc1       = 0x02,
+   DW_CFA_advance_loc2       = 0x03,
+   DW_CFA_advance_loc4       = 0x04,
+   DW_CFA_offset_extended    = 0x05,
+   DW_CFA_restore_extended   = 0x06,
+   DW_CFA_undefined          = 0x07,
+   DW_CFA_same_value         = 0x08,
+   DW_CFA_register           = 0x09,
+   DW_CFA_remember_state     = 0x0a,
+   DW_CFA_restore_state      = 0x0b,
+   DW_CFA_def_cfa            = 0x0c,
+   DW_CFA_def_cfa_register   = 0x0d,
+   DW_CFA_def_cfa_offset     = 0x0e,
+   DW_CFA_def_cfa_expression = 0x0f,
+   DW_CFA_expression         = 0x10,
+   DW_CFA_offset_extended_sf = 0x11,
+   DW_CFA_def_cfa_sf         = 0x12,
+   DW_CFA_def_cfa_offset_sf  = 0x13,
+   DW_CFA_val_offset         = 0x14,
+   DW_CFA_val_offset_sf      = 0x15,
+   DW_CFA_val_expression     = 0x16,
+
+   DW_CFA_GNU_window_save    = 0x2d,
+   DW_CFA_GNU_args_size      = 0x2e,
+   DW_CFA_GNU_negative_offset_extended = 0x2f,
+};
+
+enum
+{
+   DW_OP_addr        = 0x03,
+   DW_OP_deref       = 0x06,
+   DW_OP_const1u     = 0x08,
+   DW_OP_const1s     = 0x09,
+   DW_OP_const2u     = 0x0a,
+   DW_OP_const2s     = 0x0b,
+   DW_OP_const4u     = 0x0c,
+   DW_OP_const4s     = 0x0d,
+   DW_OP_const8u     = 0x0e,
+   DW_OP_const8s     = 0x0f,
+   DW_OP_constu      = 0x10,
+   DW_OP_consts      = 0x11,
+   DW_OP_dup         = 0x12,
+   DW_OP_drop        = 0x13,
+   DW_OP_over        = 0x14,
+   DW_OP_pick        = 0x15,
+   DW_OP_swap        = 0x16,
+   DW_OP_rot         = 0x17,
+   DW_OP_abs         = 0x19,
+   DW_OP_and         = 0x1a,
+   DW_OP_div         = 0x1b,
+   DW_OP_minus       = 0x1c,
+   DW_OP_mod         = 0x1d,
+   DW_OP_mul         = 0x1e,
+   DW_OP_neg         = 0x1f,
+   DW_OP_not         = 0x20,
+   DW_OP_or          = 0x21,
+   DW_OP_plus        = 0x22,
+   DW_OP_plus_uconst = 0x23,
+   DW_OP_shl         = 0x24,
+   DW_OP_shr         = 0x25,
+   DW_OP_shra        = 0x26,
+   DW_OP_xor         = 0x27,
+   DW_OP_bra         = 0x28,
+   DW_OP_eq          = 0x29,
+   DW_OP_ge          = 0x2a,
+   DW_OP_gt          = 0x2b,
+   DW_OP_le          = 0x2c,
+   DW_OP_lt          = 0x2d,
+   DW_OP_ne          = 0x2e,
+   DW_OP_skip        = 0x2f,
+   DW_OP_lit0        = 0x30,
+   DW_OP_lit31       = 0x4f,
+   DW_OP_breg0       = 0x70,
+   DW_OP_breg31      = 0x8f,
+   DW_OP_bregx       = 0x92,
+   DW_OP_deref_size  = 0x94,
+   DW_OP_nop         = 0x96,
+};
+
+struct Cie
+{
+   uint64_t codeAlign;
+   int64_t dataAlign;
+   unsigned returnReg;
+   int fdeEncoding;
+   bool hasAugData;
+   bool signalFrame;
+   const unsigned char *insns;
+   const unsigned char *insnsEnd;
+};
+
+struct Fde
+{
+   addr_t start;
+   addr_t end;
+   const unsigned char *insns;
+   const unsigned char *insnsEnd;
+};
+
+// Reads the length and id of the entry at the reader's position.
+// Leaves the reader after the id.  Returns false on the terminator.
+//
+bool
+ReadEntryHeader(
+   Reader &r,
+   bool eh,
+   size_t *entryEnd,
+   size_t *idPos,
+   bool *isCie,
+   uint64_t *id
+)
+{
+   uint64_t length = r.U32();
+   bool is64 = false;
+
+   if (length == 0xffffffff)
+   {
+      length = r.U64();
+      is64 = true;
+   }
+
+   if (!length || r.overflow || length > r.Remaining())
+      return false;
+
+   *entryEnd = r.Offset() + length;
+   *idPos = r.Offset();
+   *id = is64 ? r.U64() : r.U32();
+
+   if (eh)
+      *isCie = (*id == 0);
+   else
+      *isCie = is64 ? (*id == ~(uint64_t)0) : (*id == 0xffffffff);
+
+   return !r.overflow;
+}
+
+bool
+ParseCie(const ElfSection &sec, bool eh, size_t offset, Cie *cie)
+{
+   Reader r(sec);
+   size_t entryEnd = 0, idPos = 0;
+   bool isCie = false;
+   uint64_t id = 0;
+   int version = 0;
+   const char *aug = nullptr;
+   size_t augEnd = 0;
+
+   r.Seek(offset);
+   if (!ReadEntryHeader(r, eh, &entryEnd, &idPos, &isCie, &id) || !isCie)
+      return false;
+
+   cie->fdeEncoding = DW_EH_PE_absptr;
+   cie->hasAugData = false;
+   cie->signalFrame = false;
+
+   version = r.U8();
+   aug = r.String();
+   if (!aug)
+      return false;
+
+   if (version >= 4)
+   {
+      // address_size, segment_selector_size
+      //
+      if (r.U8() != sizeof(addr_t))
+         return false;
+      r.U8();
+   }
+
+   cie->codeAlign = r.Uleb();
+   cie->dataAlign = r.Sleb();
+   cie->returnReg = (version == 1) ? r.U8() : r.Uleb();
+
+   if (*aug == 'z')
+   {
+      cie->hasAugData = true;
+      augEnd = r.Uleb();
+      augEnd += r.Offset();
+
+      for (++aug; *aug; ++aug)
+      {
+         switch (*aug)
+         {
+         case 'R':
+            cie->fdeEncoding = r.U8();
+            break;
+         case 'L':
+            r.U8();
+            break;
+         case 'P':
+            {
+               addr_t personality = 0;
+               if (!r.EncodedPointer(r.U8() & ~DW_EH_PE_indirect, &personality))
+                  return false;
+            }
+            break;
+         case 'S':
+            cie->signalFrame = true;
+            break;
+         default:
+            // Unknown augmentation, but we have the length so we
+            // can skip the rest.
+            //
+            goto augDone;
+         }
+      }
+   augDone:
+      r.Seek(augEnd);
+   }
+   else if (*aug)
+   {
+      // Some ancient or exotic augmentation without the 'z' length
+      // prefix, so we have no idea how to parse the rest.
+      //
+      return false;
+   }
+
+   if (r.overflow || entryEnd > (size_t)(r.end - r.start))
+      return false;
+
+   cie->insns = r.p;
+   cie->insnsEnd = r.start + entryEnd;
+   return true;
+}
+
+bool
+ParseFde(const ElfSection &sec, bool eh, size_t offset, Cie *cie, Fde *fde)
+{
+   Reader r(sec);
+   size_t entryEnd = 0, idPos = 0;
+   bool isCie = false;
+   uint64_t id = 0;
+   addr_t range = 0;
+
+   r.Seek(offset);
+   if (!ReadEntryHeader(r, eh, &entryEnd, &idPos, &isCie, &id) || isCie)
+      return false;
+
+   // In .eh_frame the CIE pointer is relative to itself, in
+   // .debug_frame it's a section offset.
+   //
+   if (!ParseCie(sec, eh, eh ? idPos - id : id, cie))
+      return false;
+
+   if (!r.EncodedPointer(cie->fdeEncoding, &fde->start) ||
+       !r.EncodedPointer(cie->fdeEncoding & 0x0f, &range))
+      return false;
+   fde->end = fde->start + range;
+
+   if (cie->hasAugData)
+      r.Skip(r.Uleb());
+
+   if (r.overflow || entryEnd > (size_t)(r.end - r.start))
+      return false;
+
+   fde->insns = r.p;
+   fde->insnsEnd = r.start + entryEnd;
+   return true;
+}
+
+void
+SetRule(UnwindRow *row, uint64_t reg, unsigned char type, int64_t offset)
+{
+   if (reg < DBG_DWARF_REGISTER_COUNT)
+   {
+      auto &rule = row->regs[reg];
+      rule.type = type;
+      rule.offset = offset;
+   }
+}
+
+void
+SetExprRule(UnwindRow *row, uint64_t reg, unsigned char type, Reader &r)
+{
+   uint64_t len = r.Uleb();
+   const unsigned char *expr = r.p;
+
+   r.Skip(len);
+
+   if (reg < DBG_DWARF_REGISTER_COUNT && !r.overflow)
+   {
+      auto &rule = row->regs[reg];
+      rule.type = type;
+      rule.expr = expr;
+      rule.exprLen = len;
+   }
+}
+
+//
+// Runs CFA instructions until the location passes pc.  If initial is
+// non-null, DW_CFA_restore refers to it.
+//
+bool
+RunProgram(
+   const Cie &cie,
+   const unsigned char *insns,
+   const unsigned char *insnsEnd,
+   addr_t loc,
+   addr_t pc,
+   const UnwindRow *initial,
+   UnwindRow *row
+)
+{
+   Reader r(insns, insnsEnd, 0);
+   std::vector<UnwindRow> stack;
+
+   while (r.Remaining())
+   {
+      uint8_t op = r.U8();
+      uint64_t reg = 0;
+      addr_t delta = 0;
+
+      switch (op & 0xc0)
+      {
+      case DW_CFA_advance_loc:
+         delta = (op & 0x3f) * cie.codeAlign;
+         goto advance;
+      case DW_CFA_offset:
+         SetRule(row, op & 0x3f, dbg::dwarf::RuleOffset, r.Uleb() * cie.dataAlign);
+         continue;
+      case DW_CFA_restore:
+         reg = op & 0x3f;
+         goto restore;
+      }
+
+      switch (op)
+      {
+      case DW_CFA_nop:
+      case DW_CFA_GNU_window_save:
+         break;
+      case DW_CFA_set_loc:
+         {
+            addr_t newLoc = 0;
+            if (!r.EncodedPointer(cie.fdeEncoding, &newLoc))
+               return false;
+            if (newLoc > pc)
+               return true;
+            loc = newLoc;
+         }
+         break;
+      case DW_CFA_advance_loc1:
+         delta = r.U8() * cie.codeAlign;
+         goto advance;
+      case DW_CFA_advance_loc2:
+         delta = r.U16() * cie.codeAlign;
+         goto advance;
+      case DW_CFA_advance_loc4:
+         delta = r.U32() * cie.codeAlign;
+         goto advance;
+      case DW_CFA_offset_extended:
+         reg = r.Uleb();
+         SetRule(row, reg, dbg::dwarf::RuleOffset, r.Uleb() * cie.dataAlign);
+         break;
+      case DW_CFA_restore_extended:
+         reg = r.Uleb();
+         goto restore;
+      case DW_CFA_undefined:
+         SetRule(row, r.Uleb(), dbg::dwarf::RuleUndefined, 0);
+         break;
+      case DW_CFA_same_value:
+         SetRule(row, r.Uleb(), dbg::dwarf::RuleSameValue, 0);
+         break;
+      case DW_CFA_register:
+         reg = r.Uleb();
+         {
+            uint64_t reg2 = r.Uleb();
+            if (reg2 >= DBG_DWARF_REGISTER_COUNT)
+               SetRule(row, reg, dbg::dwarf::RuleUndefined, 0);
+            else
+            {
+               SetRule(row, reg, dbg::dwarf::RuleRegister, 0);
+               if (reg < DBG_DWARF_REGISTER_COUNT)
+                  row->regs[reg].reg = reg2;
+            }
+         }
+         break;
+      case DW_CFA_remember_state:
+         try
+         {
+            stack.push_back(*row);
+         }
+         catch (std::bad_alloc)
+         {
+            return false;
+         }
+         break;
+      case DW_CFA_restore_state:
+         if (!stack.size())
+            return false;
+         *row = stack.back();
+         stack.pop_back();
+         break;
+      case DW_CFA_def_cfa:
+         row->cfa.type = dbg::dwarf::RuleRegister;
+         row->cfa.reg = r.Uleb();
+         row->cfa.offset = r.Uleb();
+         break;
+      case DW_CFA_def_cfa_sf:
+         row->cfa.type = dbg::dwarf::RuleRegister;
+         row->cfa.reg = r.Uleb();
+         row->cfa.offset = r.Sleb() * cie.dataAlign;
+         break;
+      case DW_CFA_def_cfa_register:
+         row->cfa.type = dbg::dwarf::RuleRegister;
+         row->cfa.reg = r.Uleb();
+         break;
+      case DW_CFA_def_cfa_offset:
+         row->cfa.offset = r.Uleb();
+         break;
+      case DW_CFA_def_cfa_offset_sf:
+         row->cfa.offset = r.Sleb() * cie.dataAlign;
+         break;
+      case DW_CFA_def_cfa_expression:
+         row->cfa.type = dbg::dwarf::RuleExpression;
+         row->cfa.exprLen = r.Uleb();
+         row->cfa.expr = r.p;
+         r.Skip(row->cfa.exprLen);
+         break;
+      case DW_CFA_expression:
+         reg = r.Uleb();
+         SetExprRule(row, reg, dbg::dwarf::RuleExpression, r);
+         break;
+      case DW_CFA_val_expression:
+         reg = r.Uleb();
+         SetExprRule(row, reg, dbg::dwarf::RuleValExpression, r);
+         break;
+      case DW_CFA_offset_extended_sf:
+         reg = r.Uleb();
+         SetRule(row, reg, dbg::dwarf::RuleOffset, r.Sleb() * cie.dataAlign);
+         break;
+      case DW_CFA_val_offset:
+         reg = r.Uleb();
+         SetRule(row, reg, dbg::dwarf::RuleValOffset, r.Uleb() * cie.dataAlign);
+         break;
+      case DW_CFA_val_offset_sf:
+         reg = r.Uleb();
+         SetRule(row, reg, dbg::dwarf::RuleValOffset, r.Sleb() * cie.dataAlign);
+         break;
+      case DW_CFA_GNU_args_size:
+         r.Uleb();
+         break;
+      case DW_CFA_GNU_negative_offset_extended:
+         reg = r.Uleb();
+         SetRule(row, reg, dbg::dwarf::RuleOffset, -(int64_t)(r.Uleb() * cie.dataAlign));
+         break;
+      default:
+         return false;
+      }
+
+      if (r.overflow)
+         return false;
+      continue;
+
+   advance:
+      if (loc + delta > pc)
+         return true;
+      loc += delta;
+      continue;
+
+   restore:
+      if (initial && reg < DBG_DWARF_REGISTER_COUNT)
+         row->regs[reg] = initial->regs[reg];
+      else
+         SetRule(row, reg, dbg::dwarf::RuleSameValue, 0);
+   }
+
+   return !r.overflow;
+}
+
+bool
+EvaluateExpression(
+   const unsigned char *expr,
+   size_t len,
+   RegisterSet &regs,
+   const dbg::dwarf::ReadMemoryCallback &read,
+   bool pushCfa,
+   addr_t cfa,
+   addr_t *result,
+   error *err
+)
+{
+   Reader r(expr, expr + len, 0);
+   addr_t stack[64];
+   int sp = 0;
+   bool ok = false;
+
+#define PUSH(x)                                             \
+   do                                                       \
+   {                                                        \
+      addr_t val_ = (x);                                    \
+      if (sp == ARRAY_SIZE(stack))                          \
+         goto exit;                                         \
+      stack[sp++] = val_;                                   \
+   } while (0)
+#define NEED(n)                                             \
+   do                                                       \
+   {                                                        \
+      if (sp < (n))                                         \
+         goto exit;                                         \
+   } while (0)
+#define BINOP(expr)                                         \
+   do                                                       \
+   {                                                        \
+      NEED(2);                                              \
+      addr_t b = stack[--sp];                               \
+      addr_t a = stack[sp-1];                               \
+      (void)a; (void)b;                                     \
+      stack[sp-1] = (expr);                                 \
+   } while (0)
+
+   if (pushCfa)
+      PUSH(cfa);
+
+   while (r.Remaining())
+   {
+      uint8_t op = r.U8();
+
+      if (op >= DW_OP_lit0 && op <= DW_OP_lit31)
+      {
+         PUSH(op - DW_OP_lit0);
+         continue;
+      }
+
+      if ((op >= DW_OP_breg0 && op <= DW_OP_breg31) || op == DW_OP_bregx)
+      {
+         uint64_t reg = (op == DW_OP_bregx) ? r.Uleb() : op - DW_OP_breg0;
+         int64_t off = r.Sleb();
+
+         if (reg >= DBG_DWARF_REGISTER_COUNT || !regs.IsValid(reg))
+            goto exit;
+         PUSH(regs.regs[reg] + off);
+         continue;
+      }
+
+      switch (op)
+      {
+      case DW_OP_addr:     PUSH(r.Read<addr_t>()); break;
+      case DW_OP_const1u:  PUSH(r.U8()); break;
+      case DW_OP_const1s:  PUSH((int8_t)r.U8()); break;
+      case DW_OP_const2u:  PUSH(r.U16()); break;
+      case DW_OP_const2s:  PUSH((int16_t)r.U16()); break;
+      case DW_OP_const4u:  PUSH(r.U32()); break;
+      case DW_OP_const4s:  PUSH((int32_t)r.U32()); break;
+      case DW_OP_const8u:  PUSH(r.U64()); break;
+      case DW_OP_const8s:  PUSH((int64_t)r.U64()); break;
+      case DW_OP_constu:   PUSH(r.Uleb()); break;
+      case DW_OP_consts:   PUSH(r.Sleb()); break;
+      case DW_OP_dup:      NEED(1); PUSH(stack[sp-1]); break;
+      case DW_OP_drop:     NEED(1); --sp; break;
+      case DW_OP_over:     NEED(2); PUSH(stack[sp-2]); break;
+      case DW_OP_pick:
+         {
+            int idx = r.U8();
+            NEED(idx + 1);
+            PUSH(stack[sp - 1 - idx]);
+         }
+         break;
+      case DW_OP_swap:
+         NEED(2);
+         std::swap(stack[sp-1], stack[sp-2]);
+         break;
+      case DW_OP_rot:
+         {
+            NEED(3);
+            addr_t top = stack[sp-1];
+            stack[sp-1] = stack[sp-2];
+            stack[sp-2] = stack[sp-3];
+            stack[sp-3] = top;
+         }
+         break;
+      case DW_OP_deref:
+      case DW_OP_deref_size:
+         {
+            int size = (op == DW_OP_deref) ? sizeof(addr_t) : r.U8();
+            addr_t val = 0;
+            NEED(1);
+            if (size <= 0 || (size_t)size > sizeof(addr_t))
+               goto exit;
+            read(stack[sp-1], size, &val, err);
+            ERROR_CHECK(err);
+            stack[sp-1] = val;
+         }
+         break;
+      case DW_OP_abs:
+         NEED(1);
+         if ((intptr_t)stack[sp-1] < 0)
+            stack[sp-1] = -stack[sp-1];
+         break;
+      case DW_OP_neg:
+         NEED(1);
+         stack[sp-1] = -stack[sp-1];
+         break;
+      case DW_OP_not:
+         NEED(1);
+         stack[sp-1] = ~stack[sp-1];
+         break;
+      case DW_OP_plus_uconst:
+         NEED(1);
+         stack[sp-1] += r.Uleb();
+         break;
+      case DW_OP_and:   BINOP(a & b); break;
+      case DW_OP_or:    BINOP(a | b); break;
+      case DW_OP_xor:   BINOP(a ^ b); break;
+      case DW_OP_plus:  BINOP(a + b); break;
+      case DW_OP_minus: BINOP(a - b); break;
+      case DW_OP_mul:   BINOP(a * b); break;
+      case DW_OP_shl:   BINOP(a << b); break;
+      case DW_OP_shr:   BINOP(a >> b); break;
+      case DW_OP_shra:  BINOP((intptr_t)a >> b); break;
+      case DW_OP_eq:    BINOP((intptr_t)a == (intptr_t)b); break;
+      case DW_OP_ge:    BINOP((intptr_t)a >= (intptr_t)b); break;
+      case DW_OP_gt:    BINOP((intptr_t)a > (intptr_t)b); break;
+      case DW_OP_le:    BINOP((intptr_t)a <= (intptr_t)b); break;
+      case DW_OP_lt:    BINOP((intptr_t)a < (intptr_t)b); break;
+      case DW_OP_ne:    BINOP((intptr_t)a != (intptr_t)b); break;
+      case DW_OP_div:
+         NEED(2);
+         if (!stack[sp-1])
+            goto exit;
+         BINOP((intptr_t)a / (intptr_t)b);
+         break;
+      case DW_OP_mod:
+         NEED(2);
+         if (!stack[sp-1])
+            goto exit;
+         BINOP(a % b);
+         break;
+      case DW_OP_skip:
+      case DW_OP_bra:
+         {
+            int16_t off = (int16_t)r.U16();
+            bool taken = true;
+
+            if (op == DW_OP_bra)
+            {
+               NEED(1);
+               taken = stack[--sp] ? true : false;
+            }
+
+            if (taken)
+            {
+               if (off < 0 ? (size_t)-off > r.Offset() : (size_t)off > r.Remaining())
+                  goto exit;
+               r.p += off;
+            }
+         }
+         break;
+      case DW_OP_nop:
+         break;
+      default:
+         goto exit;
+      }
+
+      if (r.overflow)
+         goto exit;
+   }
+
+#undef PUSH
+#undef NEED
+#undef BINOP
+
+   if (sp)
+   {
+      *result = stack[sp-1];
+      ok = true;
+   }
+
+exit:
+   return ok && !ERROR_FAILED(err);
+}
+
+} // end namespace
+
+void
+Reader::Seek(size_t off)
+{
+   if (off > (size_t)(end - start))
+   {
+      overflow = true;
+      p = end;
+   }
+   else
+   {
+      p = start + off;
+   }
+}
+
+void
+Reader::Skip(size_t n)
+{
+   if (n > Remaining())
+   {
+      overflow = true;
+      p = end;
+   }
+   else
+   {
+      p += n;
+   }
+}
+
+uint64_t
+Reader::Uleb()
+{
+   uint64_t r = 0;
+   int shift = 0;
+
+   for (;;)
+   {
+      if (p >= end)
+      {
+         overflow = true;
+         return 0;
+      }
+
+      uint8_t b = *p++;
+      if (shift < 64)
+         r |= (uint64_t)(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80))
+         break;
+   }
+
+   return r;
+}
+
+int64_t
+Reader::Sleb()
+{
+   int64_t r = 0;
+   int shift = 0;
+   uint8_t b = 0;
+
+   do
+   {
+      if (p >= end)
+      {
+         overflow = true;
+         return 0;
+      }
+
+      b = *p++;
+      if (shift < 64)
+         r |= (int64_t)(b & 0x7f) << shift;
+      shift += 7;
+   } while (b & 0x80);
+
+   if (shift < 64 && (b & 0x40))
+      r |= -((int64_t)1 << shift);
+
+   return r;
+}
+
+const char *
+Reader::String()
+{
+   auto s = p;
+
+   while (p < end && *p)
+      ++p;
+
+   if (p >= end)
+   {
+      overflow = true;
+      return nullptr;
+   }
+
+   ++p;
+   return (const char*)s;
+}
+
+bool
+Reader::EncodedPointer(int enc, addr_t *out, addr_t datarel)
+{
+   addr_t base = 0;
+   addr_t val = 0;
+
+   if (enc == DW_EH_PE_omit)
+      return false;
+
+   switch (enc & 0x70)
+   {
+   case DW_EH_PE_absptr:
+      break;
+   case DW_EH_PE_pcrel:
+      base = Vaddr();
+      break;
+   case DW_EH_PE_datarel:
+      base = datarel;
+      break;
+   case DW_EH_PE_aligned:
+      {
+         size_t off = Offset();
+         Skip((sizeof(addr_t) - (off % sizeof(addr_t))) % sizeof(addr_t));
+      }
+      break;
+   default:
+      // textrel and funcrel aren't used on the platforms we support.
+      //
+      return false;
+   }
+
+   switch (enc & 0x0f)
+   {
+   case DW_EH_PE_absptr:  val = Read<addr_t>(); break;
+   case DW_EH_PE_uleb128: val = Uleb(); break;
+   case DW_EH_PE_udata2:  val = U16(); break;
+   case DW_EH_PE_udata4:  val = U32(); break;
+   case DW_EH_PE_udata8:  val = U64(); break;
+   case DW_EH_PE_sleb128: val = Sleb(); break;
+   case DW_EH_PE_sdata2:  val = (int16_t)U16(); break;
+   case DW_EH_PE_sdata4:  val = (int32_t)U32(); break;
+   case DW_EH_PE_sdata8:  val = (int64_t)U64(); break;
+   default:
+      return false;
+   }
+
+   *out = base + val;
+   return !overflow;
+}
+
+dbg::dwarf::CallFrameInfo::CallFrameInfo()
+   : hdrTable(nullptr), hdrCount(0), hdrTableEnc(DW_EH_PE_omit), indexBuilt(false)
+{
+}
+
+void
+dbg::dwarf::CallFrameInfo::Init(ElfImage *image, error *err)
+{
+   int ptrEnc, countEnc;
+   addr_t ehFramePtr = 0, count = 0;
+
+   this->image = image;
+
+   image->GetSection(".eh_frame", &ehFrame);
+   image->GetSection(".debug_frame", &debugFrame);
+
+   if (!image->GetSegment(DBG_PT_GNU_EH_FRAME, &ehFrameHdr))
+      goto exit;
+
+   {
+   Reader r(ehFrameHdr);
+
+   if (r.U8() != 1)
+      goto exit;
+
+   ptrEnc = r.U8();
+   countEnc = r.U8();
+   hdrTableEnc = r.U8();
+
+   if (!r.EncodedPointer(ptrEnc, &ehFramePtr, ehFrameHdr.vaddr))
+      goto exit;
+
+   if (!ehFrame.size || ehFrame.vaddr != ehFramePtr)
+   {
+      // Section headers were stripped or don't match; the header
+      // tells us where it is, though not how long it is.
+      //
+      ehFrame = ElfSection();
+      if (!image->GetLoadedRange(ehFramePtr, &ehFrame))
+         goto exit;
+   }
+
+   // We only binary search fixed-size entries, which in practice is
+   // what every linker emits.
+   //
+   switch (hdrTableEnc & 0x0f)
+   {
+   case DW_EH_PE_udata4:
+   case DW_EH_PE_sdata4:
+   case DW_EH_PE_udata8:
+   case DW_EH_PE_sdata8:
+      break;
+   default:
+      goto exit;
+   }
+
+   if (countEnc == DW_EH_PE_omit || !r.EncodedPointer(countEnc, &count, ehFrameHdr.vaddr))
+      goto exit;
+
+   hdrTable = r.p;
+   hdrCount = count;
+
+   if (hdrCount > r.Remaining() / 8)
+   {
+      hdrTable = nullptr;
+      hdrCount = 0;
+   }
+   }
+
+exit:;
+}
+
+static bool
+FindInHdrTable(
+   dbg::dwarf::CallFrameInfo *cfi,
+   addr_t pc,
+   size_t *fdeOffset
+)
+{
+   int entrySize = 0;
+   size_t lo = 0, hi = cfi->hdrCount;
+   ElfSection table;
+   addr_t fdeAddr = 0;
+
+   switch (cfi->hdrTableEnc & 0x0f)
+   {
+   case DW_EH_PE_udata4:
+   case DW_EH_PE_sdata4:
+      entrySize = 8;
+      break;
+   default:
+      entrySize = 16;
+   }
+
+   if (!cfi->hdrTable)
+      return false;
+
+   table.data = cfi->hdrTable;
+   table.size = cfi->hdrCount * entrySize;
+   table.vaddr = cfi->ehFrameHdr.vaddr + (cfi->hdrTable - cfi->ehFrameHdr.data);
+
+   if (table.size > cfi->ehFrameHdr.size - (cfi->hdrTable - cfi->ehFrameHdr.data))
+      return false;
+
+   // Find the last entry whose initial location is <= pc.
+   //
+   while (lo < hi)
+   {
+      size_t mid = lo + (hi - lo) / 2;
+      addr_t loc = 0;
+      Reader r(table);
+
+      r.Seek(mid * entrySize);
+      if (!r.EncodedPointer(cfi->hdrTableEnc, &loc, cfi->ehFrameHdr.vaddr))
+         return false;
+
+      if (loc <= pc)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   if (!lo)
+      return false;
+
+   {
+      Reader r(table);
+      addr_t loc = 0;
+      r.Seek((lo - 1) * entrySize);
+      if (!r.EncodedPointer(cfi->hdrTableEnc, &loc, cfi->ehFrameHdr.vaddr) ||
+          !r.EncodedPointer(cfi->hdrTableEnc, &fdeAddr, cfi->ehFrameHdr.vaddr))
+         return false;
+   }
+
+   if (fdeAddr < cfi->ehFrame.vaddr || fdeAddr - cfi->ehFrame.vaddr >= cfi->ehFrame.size)
+      return false;
+
+   *fdeOffset = fdeAddr - cfi->ehFrame.vaddr;
+   return true;
+}
+
+static void
+IndexSection(
+   dbg::dwarf::CallFrameInfo *cfi,
+   const ElfSection &sec,
+   bool eh,
+   error *err
+)
+{
+   Reader r(sec);
+
+   while (r.Remaining())
+   {
+      size_t start = r.Offset();
+      size_t entryEnd = 0, idPos = 0;
+      bool isCie = false;
+      uint64_t id = 0;
+
+      if (!ReadEntryHeader(r, eh, &entryEnd, &idPos, &isCie, &id))
+         break;
+
+      if (!isCie)
+      {
+         Cie cie;
+         Fde fde;
+
+         if (ParseFde(sec, eh, start, &cie, &fde) && fde.start < fde.end)
+         {
+            dbg::dwarf::CallFrameInfo::IndexEntry ent;
+            ent.start = fde.start;
+            ent.end = fde.end;
+            ent.offset = start;
+            ent.eh = eh;
+
+            try
+            {
+               cfi->index.push_back(ent);
+            }
+            catch (std::bad_alloc)
+            {
+               ERROR_SET(err, nomem);
+            }
+         }
+      }
+
+      r.Seek(entryEnd);
+   }
+exit:;
+}
+
+bool
+dbg::dwarf::CallFrameInfo::FindRow(addr_t pc, UnwindRow *row, error *err)
+{
+   bool found = false;
+   bool eh = true;
+   size_t offset = 0;
+   Cie cie;
+   Fde fde;
+   UnwindRow initial;
+
+   memset(row, 0, sizeof(*row));
+
+   {
+      auto it = rowCache.find(pc);
+      if (it != rowCache.end())
+      {
+         *row = it->second;
+         return row->valid;
+      }
+   }
+
+   if (hdrTable && ehFrame.size)
+      found = FindInHdrTable(this, pc, &offset);
+
+   if (!found && (debugFrame.size || (!hdrTable && ehFrame.size)))
+   {
+      if (!indexBuilt)
+      {
+         indexBuilt = true;
+         if (!hdrTable)
+         {
+            IndexSection(this, ehFrame, true, err);
+            ERROR_CHECK(err);
+         }
+         IndexSection(this, debugFrame, false, err);
+         ERROR_CHECK(err);
+         std::sort(
+            index.begin(),
+            index.end(),
+            [] (const IndexEntry &a, const IndexEntry &b) -> bool
+            {
+               return a.start < b.start;
+            }
+         );
+      }
+
+      auto it = std::upper_bound(
+         index.begin(),
+         index.end(),
+         pc,
+         [] (addr_t pc, const IndexEntry &e) -> bool { return pc < e.start; }
+      );
+      if (it != index.begin() && pc < (--it)->end)
+      {
+         found = true;
+         offset = it->offset;
+         eh = it->eh;
+      }
+   }
+
+   if (found)
+      found = ParseFde(eh ? ehFrame : debugFrame, eh, offset, &cie, &fde) &&
+              pc >= fde.start && pc < fde.end;
+
+   if (found)
+   {
+      row->returnReg = cie.returnReg;
+      row->signalFrame = cie.signalFrame;
+      row->cfa.type = RuleUndefined;
+
+      found = RunProgram(cie, cie.insns, cie.insnsEnd, fde.start, ~(addr_t)0, nullptr, row);
+   }
+
+   if (found)
+   {
+      initial = *row;
+      found = RunProgram(cie, fde.insns, fde.insnsEnd, fde.start, pc, &initial, row);
+   }
+
+   row->valid = found && (row->cfa.type == RuleRegister || row->cfa.type == RuleExpression);
+
+   try
+   {
+      // Don't let this grow without bound on a long session.
+      //
+      if (rowCache.size() >= 65536)
+         rowCache.clear();
+      rowCache[pc] = *row;
+   }
+   catch (std::bad_alloc)
+   {
+   }
+
+exit:
+   return row->valid && !ERROR_FAILED(err);
+}
+
+void
+dbg::dwarf::Unwind(
+   const UnwindRow &row,
+   RegisterSet &regs,
+   const ReadMemoryCallback &read,
+   error *err
+)
+{
+   RegisterSet out = regs;
+   addr_t cfa = 0;
+
+   if (!row.valid)
+      ERROR_SET(err, unknown, "No unwind info");
+
+   switch (row.cfa.type)
+   {
+   case RuleRegister:
+      if (row.cfa.reg >= DBG_DWARF_REGISTER_COUNT || !regs.IsValid(row.cfa.reg))
+         ERROR_SET(err, unknown, "CFA register not available");
+      cfa = regs.regs[row.cfa.reg] + row.cfa.offset;
+      break;
+   case RuleExpression:
+      if (!EvaluateExpression(row.cfa.expr, row.cfa.exprLen, regs, read, false, 0, &cfa, err))
+      {
+         ERROR_CHECK(err);
+         ERROR_SET(err, unknown, "Could not evaluate CFA expression");
+      }
+      break;
+   default:
+      ERROR_SET(err, unknown, "Bad CFA rule");
+   }
+
+   // Unless told otherwise, the caller's stack pointer is the CFA.
+   //
+   out.Set(DBG_DWARF_SP, cfa);
+
+   for (int i=0; i<DBG_DWARF_REGISTER_COUNT; ++i)
+   {
+      auto &rule = row.regs[i];
+      addr_t val = 0;
+
+      switch (rule.type)
+      {
+      case RuleSameValue:
+         break;
+      case RuleUndefined:
+         out.valid &= ~(1U << i);
+         break;
+      case RuleOffset:
+         read(cfa + rule.offset, sizeof(val), &val, err);
+         ERROR_CHECK(err);
+         out.Set(i, val);
+         break;
+      case RuleValOffset:
+         out.Set(i, cfa + rule.offset);
+         break;
+      case RuleRegister:
+         if (regs.IsValid(rule.reg))
+            out.Set(i, regs.regs[rule.reg]);
+         else
+            out.valid &= ~(1U << i);
+         break;
+      case RuleExpression:
+      case RuleValExpression:
+         if (!EvaluateExpression(rule.expr, rule.exprLen, regs, read, true, cfa, &val, err))
+         {
+            ERROR_CHECK(err);
+            out.valid &= ~(1U << i);
+            break;
+         }
+         if (rule.type == RuleExpression)
+         {
+            addr_t addr = val;
+            read(addr, sizeof(val), &val, err);
+            ERROR_CHECK(err);
+         }
+         out.Set(i, val);
+         break;
+      }
+   }
+
+   // The return address column gives the caller's pc.
+   //
+   if (row.returnReg != DBG_DWARF_IP)
+   {
+      if (row.returnReg < DBG_DWARF_REGISTER_COUNT && out.IsValid(row.returnReg))
+         out.Set(DBG_DWARF_IP, out.regs[row.returnReg]);
+      else
+         out.valid &= ~(1U << DBG_DWARF_IP);
+   }
+   else if (row.regs[DBG_DWARF_IP].type == RuleSameValue)
+   {
+      // Nobody said where the return address is, so there isn't one.
+      //
+      out.valid &= ~(1U << DBG_DWARF_IP);
+   }
+
+   regs = out;
+exit:;
+}
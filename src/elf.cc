@@ -0,0 +1,400 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/elf.h>
+
+#if defined(__ELF__)
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#if defined(__LP64__)
+typedef Elf64_Ehdr Ehdr;
+typedef Elf64_Phdr Phdr;
+typedef Elf64_Shdr Shdr;
+typedef Elf64_Sym Sym;
+#define NATIVE_ELFCLASS ELFCLASS64
+#else
+typedef Elf32_Ehdr Ehdr;
+typedef Elf32_Phdr Phdr;
+typedef Elf32_Shdr Shdr;
+typedef Elf32_Sym Sym;
+#define NATIVE_ELFCLASS ELFCLASS32
+#endif
+
+namespace {
+
+const Ehdr *
+GetHeader(dbg::ElfImage *img)
+{
+   return (const Ehdr*)img->map;
+}
+
+const Phdr *
+GetProgramHeaders(dbg::ElfImage *img, int *count)
+{
+   auto hdr = GetHeader(img);
+   *count = hdr->e_phnum;
+   return (const Phdr*)((const char*)img->map + hdr->e_phoff);
+}
+
+const Shdr *
+GetSectionHeaders(dbg::ElfImage *img, int *count)
+{
+   auto hdr = GetHeader(img);
+   *count = hdr->e_shnum;
+   return hdr->e_shoff ? (const Shdr*)((const char*)img->map + hdr->e_shoff) : nullptr;
+}
+
+bool
+InBounds(dbg::ElfImage *img, uint64_t off, uint64_t len)
+{
+   return off <= img->mapSize && len <= img->mapSize - off;
+}
+
+} // end namespace
+
+dbg::ElfImage::~ElfImage()
+{
+   if (map)
+      munmap(map, mapSize);
+}
+
+void
+dbg::ElfImage::Open(const char *path, error *err)
+{
+   int fd = -1;
+   struct stat st;
+   const Ehdr *hdr = nullptr;
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0)
+      ERROR_SET(err, errno, errno);
+
+   if (fstat(fd, &st))
+      ERROR_SET(err, errno, errno);
+
+   if (st.st_size < (off_t)sizeof(Ehdr))
+      ERROR_SET(err, unknown, "File too small to be ELF");
+
+   map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+   {
+      map = nullptr;
+      ERROR_SET(err, errno, errno);
+   }
+   mapSize = st.st_size;
+
+   hdr = GetHeader(this);
+
+   if (memcmp(hdr->e_ident, ELFMAG, SELFMAG))
+      ERROR_SET(err, unknown, "Not an ELF file");
+   if (hdr->e_ident[EI_CLASS] != NATIVE_ELFCLASS)
+      ERROR_SET(err, unknown, "ELF class does not match debugger");
+
+   if (!InBounds(this, hdr->e_phoff, (uint64_t)hdr->e_phnum * sizeof(Phdr)))
+      ERROR_SET(err, unknown, "Program headers out of bounds");
+
+   if (hdr->e_shoff &&
+       (!InBounds(this, hdr->e_shoff, (uint64_t)hdr->e_shnum * sizeof(Shdr)) ||
+        hdr->e_shstrndx >= hdr->e_shnum))
+      ERROR_SET(err, unknown, "Section headers out of bounds");
+
+exit:
+   if (fd >= 0)
+      close(fd);
+   if (ERROR_FAILED(err) && map)
+   {
+      munmap(map, mapSize);
+      map = nullptr;
+      mapSize = 0;
+   }
+}
+
+dbg::addr_t
+dbg::ElfImage::GetLoadStart()
+{
+   int n = 0;
+   auto ph = GetProgramHeaders(this, &n);
+   addr_t r = ~(addr_t)0;
+
+   for (int i=0; i<n; ++i)
+   {
+      if (ph[i].p_type == PT_LOAD && ph[i].p_vaddr < r)
+         r = ph[i].p_vaddr;
+   }
+
+   // The OS maps whole pages, so that's where the runtime base will be.
+   //
+   return (r == ~(addr_t)0) ? 0 : (r & ~(addr_t)(getpagesize() - 1));
+}
+
+dbg::addr_t
+dbg::ElfImage::GetLoadEnd()
+{
+   int n = 0;
+   auto ph = GetProgramHeaders(this, &n);
+   addr_t r = 0;
+
+   for (int i=0; i<n; ++i)
+   {
+      if (ph[i].p_type == PT_LOAD && ph[i].p_vaddr + ph[i].p_memsz > r)
+         r = ph[i].p_vaddr + ph[i].p_memsz;
+   }
+
+   return r;
+}
+
+bool
+dbg::ElfImage::GetSection(const char *name, ElfSection *out)
+{
+   int n = 0;
+   auto sh = GetSectionHeaders(this, &n);
+   const Shdr *strtab = nullptr;
+
+   if (!sh)
+      return false;
+
+   strtab = &sh[GetHeader(this)->e_shstrndx];
+   if (!InBounds(this, strtab->sh_offset, strtab->sh_size))
+      return false;
+
+   for (int i=0; i<n; ++i)
+   {
+      const char *p = (const char*)map + strtab->sh_offset + sh[i].sh_name;
+
+      if (sh[i].sh_name >= strtab->sh_size ||
+          strncmp(p, name, strtab->sh_size - sh[i].sh_name))
+         continue;
+
+      if (sh[i].sh_type == SHT_NOBITS ||
+          !InBounds(this, sh[i].sh_offset, sh[i].sh_size))
+         return false;
+
+#if defined(SHF_COMPRESSED)
+      // Callers want the raw bytes, and we don't carry zlib.
+      //
+      if (sh[i].sh_flags & SHF_COMPRESSED)
+         return false;
+#endif
+
+      out->data = (const unsigned char*)map + sh[i].sh_offset;
+      out->size = sh[i].sh_size;
+      out->vaddr = sh[i].sh_addr;
+      return true;
+   }
+
+   return false;
+}
+
+bool
+dbg::ElfImage::GetSegment(unsigned int type, ElfSection *out)
+{
+   int n = 0;
+   auto ph = GetProgramHeaders(this, &n);
+
+   for (int i=0; i<n; ++i)
+   {
+      if (ph[i].p_type != type)
+         continue;
+
+      if (!InBounds(this, ph[i].p_offset, ph[i].p_filesz))
+         return false;
+
+      out->data = (const unsigned char*)map + ph[i].p_offset;
+      out->size = ph[i].p_filesz;
+      out->vaddr = ph[i].p_vaddr;
+      return true;
+   }
+
+   return false;
+}
+
+bool
+dbg::ElfImage::GetLoadedRange(addr_t vaddr, ElfSection *out)
+{
+   int n = 0;
+   auto ph = GetProgramHeaders(this, &n);
+
+   for (int i=0; i<n; ++i)
+   {
+      if (ph[i].p_type != PT_LOAD ||
+          vaddr < ph[i].p_vaddr ||
+          vaddr >= ph[i].p_vaddr + ph[i].p_filesz ||
+          !InBounds(this, ph[i].p_offset, ph[i].p_filesz))
+         continue;
+
+      out->data = (const unsigned char*)map + ph[i].p_offset + (vaddr - ph[i].p_vaddr);
+      out->size = ph[i].p_filesz - (vaddr - ph[i].p_vaddr);
+      out->vaddr = vaddr;
+      return true;
+   }
+
+   return false;
+}
+
+void
+dbg::ElfImage::GetExecutableSegments(std::vector<ElfSection> &out, error *err)
+{
+   int n = 0;
+   auto ph = GetProgramHeaders(this, &n);
+
+   try
+   {
+      for (int i=0; i<n; ++i)
+      {
+         ElfSection seg;
+
+         if (ph[i].p_type != PT_LOAD ||
+             !(ph[i].p_flags & PF_X) ||
+             !InBounds(this, ph[i].p_offset, ph[i].p_filesz))
+            continue;
+
+         seg.data = (const unsigned char*)map + ph[i].p_offset;
+         seg.size = ph[i].p_filesz;
+         seg.vaddr = ph[i].p_vaddr;
+         out.push_back(seg);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+dbg::ElfImage::ForEachSymbol(
+   const std::function<bool(const char *name, addr_t value)> &callback
+)
+{
+   int n = 0;
+   auto sh = GetSectionHeaders(this, &n);
+
+   if (!sh)
+      return;
+
+   for (int i=0; i<n; ++i)
+   {
+      const Shdr *strtab = nullptr;
+      const Sym *syms = nullptr;
+      const char *strings = nullptr;
+      size_t count = 0;
+
+      if ((sh[i].sh_type != SHT_SYMTAB && sh[i].sh_type != SHT_DYNSYM) ||
+          sh[i].sh_link >= (size_t)n ||
+          !InBounds(this, sh[i].sh_offset, sh[i].sh_size))
+         continue;
+
+      strtab = &sh[sh[i].sh_link];
+      if (strtab->sh_type != SHT_STRTAB ||
+          !InBounds(this, strtab->sh_offset, strtab->sh_size))
+         continue;
+
+      syms = (const Sym*)((const char*)map + sh[i].sh_offset);
+      strings = (const char*)map + strtab->sh_offset;
+      count = sh[i].sh_size / sizeof(Sym);
+
+      for (size_t j=0; j<count; ++j)
+      {
+         const Sym &sym = syms[j];
+         const char *name = strings + sym.st_name;
+
+         switch (ELF32_ST_TYPE(sym.st_info))
+         {
+         case STT_NOTYPE:
+         case STT_OBJECT:
+         case STT_FUNC:
+#if defined(STT_GNU_IFUNC)
+         case STT_GNU_IFUNC:
+#endif
+            break;
+         default:
+            continue;
+         }
+
+         if (sym.st_shndx == SHN_UNDEF ||
+             sym.st_shndx == SHN_ABS ||
+             sym.st_name >= strtab->sh_size ||
+             !*name ||
+             !memchr(name, 0, strtab->sh_size - sym.st_name))
+            continue;
+
+         if (!callback(name, sym.st_value))
+            return;
+      }
+   }
+}
+
+#else
+
+//
+// No ELF on this platform.  Everything comes back empty and callers
+// fall back to whatever they did before they had images.
+//
+
+dbg::ElfImage::~ElfImage()
+{
+}
+
+void
+dbg::ElfImage::Open(const char *path, error *err)
+{
+   ERROR_SET(err, unknown, "ELF images not supported on this platform");
+exit:;
+}
+
+dbg::addr_t
+dbg::ElfImage::GetLoadStart()
+{
+   return 0;
+}
+
+dbg::addr_t
+dbg::ElfImage::GetLoadEnd()
+{
+   return 0;
+}
+
+bool
+dbg::ElfImage::GetSection(const char *name, ElfSection *out)
+{
+   return false;
+}
+
+bool
+dbg::ElfImage::GetSegment(unsigned int type, ElfSection *out)
+{
+   return false;
+}
+
+bool
+dbg::ElfImage::GetLoadedRange(addr_t vaddr, ElfSection *out)
+{
+   return false;
+}
+
+void
+dbg::ElfImage::GetExecutableSegments(std::vector<ElfSection> &out, error *err)
+{
+}
+
+void
+dbg::ElfImage::ForEachSymbol(
+   const std::function<bool(const char *name, addr_t value)> &callback
+)
+{
+}
+
+#endif
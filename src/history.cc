@@ -0,0 +1,619 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/history.h>
+#include <dbg/dbg.h>
+#include <dbg/arch.h>
+
+#include <common/c++/new.h>
+#include <common/misc.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+using dbg::addr_t;
+
+namespace {
+
+// How much of an undo set goes to the target at once.
+//
+const size_t MaxWrite = 4096;
+
+dbg::RecordChunk
+GetHeader(const unsigned char *chunk)
+{
+   dbg::RecordChunk hdr;
+   memcpy(&hdr, chunk, sizeof(hdr));
+   return hdr;
+}
+
+// Both sets are sorted.  Where they overlap, the earlier one has the
+// older bytes.
+//
+void
+Merge(
+   const dbg::History::UndoSet &earlier,
+   const dbg::History::UndoSet &later,
+   dbg::History::UndoSet &out
+)
+{
+   auto a = earlier.begin(), b = later.begin();
+
+   out.reserve(earlier.size() + later.size());
+
+   while (a != earlier.end() || b != later.end())
+   {
+      if (b == later.end() || (a != earlier.end() && a->addr <= b->addr))
+      {
+         if (b != later.end() && a->addr == b->addr)
+            ++b;
+         out.push_back(*a++);
+      }
+      else
+      {
+         out.push_back(*b++);
+      }
+   }
+}
+
+} // end namespace
+
+void
+dbg::History::Clear()
+{
+   chunks.clear();
+   levels.clear();
+   encoder = RecordEncoder();
+   firstChunk = 0;
+   pos = 0;
+   size = 0;
+   thread = 0;
+}
+
+uint64_t
+dbg::History::GetFirst() const
+{
+   if (chunks.size())
+      return GetHeader(chunks.front().data.data()).first;
+   return encoder.total - encoder.steps;
+}
+
+const unsigned char *
+dbg::History::GetChunk(uint64_t n, size_t *len, uint64_t *index)
+{
+   size_t lo = 0, hi = chunks.size();
+
+   if (encoder.steps && n >= encoder.total - encoder.steps && n < encoder.total)
+   {
+      encoder.Seal();
+      *len = encoder.chunk.size();
+      *index = firstChunk + chunks.size();
+      return encoder.chunk.data();
+   }
+
+   // The last chunk starting at or before n.
+   //
+   while (hi - lo > 1)
+   {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (GetHeader(chunks[mid].data.data()).first <= n)
+         lo = mid;
+      else
+         hi = mid;
+   }
+
+   if (lo < chunks.size())
+   {
+      auto &data = chunks[lo].data;
+      RecordChunk hdr = GetHeader(data.data());
+
+      if (n >= hdr.first && n < hdr.first + hdr.steps)
+      {
+         *len = data.size();
+         *index = firstChunk + lo;
+         return data.data();
+      }
+   }
+   return nullptr;
+}
+
+void
+dbg::History::FinishChunk(error *err)
+{
+   RecordDecoder decoder;
+   UndoSet set;
+   uint64_t index = firstChunk + chunks.size();
+
+   try
+   {
+      Chunk chunk;
+
+      encoder.Finish(chunk.data);
+      chunks.push_back(std::move(chunk));
+      size += chunks.back().data.size();
+
+      // Every byte it wrote, as it was first.
+      //
+      decoder.Start(chunks.back().data.data(), chunks.back().data.size(), encoder.regs.size(), err);
+      ERROR_CHECK(err);
+      while (decoder.Next(step, err))
+      {
+         for (auto &w : step.writes)
+         {
+            for (uint32_t i=0; i<w.len; ++i)
+               set.push_back(Undo{w.addr + i, step.data[w.old + i]});
+         }
+      }
+      ERROR_CHECK(err);
+
+      std::stable_sort(
+         set.begin(),
+         set.end(),
+         [] (const Undo &a, const Undo &b) -> bool { return a.addr < b.addr; }
+      );
+      set.erase(
+         std::unique(
+            set.begin(),
+            set.end(),
+            [] (const Undo &a, const Undo &b) -> bool { return a.addr == b.addr; }
+         ),
+         set.end()
+      );
+      set.shrink_to_fit();
+
+      // Then runs of 2, 4, 8 ... that it completes.
+      //
+      for (size_t n=0; ; ++n)
+      {
+         uint64_t run = index >> n;
+
+         if (levels.size() <= n)
+            levels.push_back(Level{run, std::deque<UndoSet>()});
+
+         auto &level = levels[n];
+         if (!level.runs.size())
+            level.base = run;
+         if (run != level.base + level.runs.size())
+            break;
+
+         size += set.size() * sizeof(Undo);
+         level.runs.push_back(std::move(set));
+         set = UndoSet();
+
+         if (!(run & 1) || run - 1 < level.base)
+            break;
+
+         Merge(level.runs[run - 1 - level.base], level.runs[run - level.base], set);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+dbg::History::Truncate(uint64_t n, error *err)
+{
+   std::vector<unsigned char> copy;
+   RecordDecoder decoder;
+   RecordChunk hdr;
+   uint64_t index = 0;
+   size_t len = 0;
+   const unsigned char *chunk = GetChunk(n, &len, &index);
+
+   if (!chunk)
+      goto exit;
+
+   try
+   {
+      copy.assign(chunk, chunk + len);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+   hdr = GetHeader(copy.data());
+
+   // Everything from its chunk on goes, and the chunk is packed again
+   // up to n.
+   //
+   while (chunks.size() && firstChunk + chunks.size() > index)
+   {
+      size -= chunks.back().data.size();
+      chunks.pop_back();
+   }
+   for (size_t i=0; i<levels.size(); ++i)
+   {
+      auto &level = levels[i];
+
+      while (level.runs.size() && ((level.base + level.runs.size()) << i) > index)
+      {
+         size -= level.runs.back().size() * sizeof(Undo);
+         level.runs.pop_back();
+      }
+   }
+
+   decoder.Start(copy.data(), copy.size(), encoder.regs.size(), err);
+   ERROR_CHECK(err);
+
+   encoder = RecordEncoder();
+   encoder.total = hdr.first;
+   encoder.regs = decoder.regs;
+
+   for (uint64_t i=hdr.first; i<n && decoder.Next(step, err); ++i)
+   {
+      encoder.Append(step, err);
+      ERROR_CHECK(err);
+   }
+   ERROR_CHECK(err);
+
+   pos = n;
+exit:;
+}
+
+void
+dbg::History::Step(Debugger *dbg, error *err)
+{
+   int current = dbg->proc->GetCurrentThread();
+
+   if (pos != encoder.total)
+   {
+      Truncate(pos, err);
+      ERROR_CHECK(err);
+   }
+
+   step.Step(dbg, err);
+   ERROR_CHECK(err);
+
+   if (!dbg->proc->IsAttached())
+   {
+      Clear();
+      goto exit;
+   }
+
+   // It's not carrying on from where we were.
+   //
+   if (current != thread ||
+       (GetEnd() > GetFirst() && encoder.regs != step.before))
+   {
+      Clear();
+      thread = current;
+   }
+
+   encoder.Append(step, err);
+   ERROR_CHECK(err);
+   if (encoder.steps >= ChunkSteps)
+   {
+      FinishChunk(err);
+      ERROR_CHECK(err);
+   }
+   pos = encoder.total;
+
+   // Past the window, the oldest chunks go, and with them any runs that
+   // start in them.
+   //
+   while (chunks.size() > 1 && GetEnd() - GetFirst() > maxSteps)
+   {
+      size -= chunks.front().data.size();
+      chunks.pop_front();
+      ++firstChunk;
+
+      for (size_t i=0; i<levels.size(); ++i)
+      {
+         auto &level = levels[i];
+
+         while (level.runs.size() && (level.base << i) < firstChunk)
+         {
+            size -= level.runs.front().size() * sizeof(Undo);
+            level.runs.pop_front();
+            ++level.base;
+         }
+      }
+   }
+exit:;
+}
+
+void
+dbg::History::UndoSteps(Debugger *dbg, uint64_t start, uint64_t end, error *err)
+{
+   std::vector<StepCapture::Write> writes;
+   std::vector<unsigned char> data;
+   RecordDecoder decoder;
+   RecordChunk hdr;
+   uint64_t index = 0;
+   size_t len = 0;
+   const unsigned char *chunk = nullptr;
+
+   if (start >= end)
+      goto exit;
+
+   chunk = GetChunk(start, &len, &index);
+   if (!chunk)
+      ERROR_SET(err, unknown, "Step isn't in the history");
+   hdr = GetHeader(chunk);
+
+   decoder.Start(chunk, len, encoder.regs.size(), err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      for (uint64_t i=hdr.first; i<end && decoder.Next(step, err); ++i)
+      {
+         if (i < start)
+            continue;
+         for (auto w : step.writes)
+         {
+            size_t off = data.size();
+
+            data.insert(data.end(), &step.data[w.old], &step.data[w.old] + w.len);
+            w.old = off;
+            writes.push_back(w);
+         }
+      }
+      ERROR_CHECK(err);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   for (size_t i=writes.size(); i-- > 0; )
+   {
+      dbg->WriteMemory(writes[i].addr, writes[i].len, &data[writes[i].old], err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+dbg::History::Apply(Debugger *dbg, const UndoSet &set, error *err)
+{
+   unsigned char buf[MaxWrite];
+   size_t i = 0;
+
+   // Contiguous bytes go together.
+   //
+   while (i < set.size())
+   {
+      addr_t start = set[i].addr;
+      size_t n = 0;
+
+      while (i < set.size() && n < sizeof(buf) && set[i].addr == start + n)
+         buf[n++] = set[i++].old;
+
+      dbg->WriteMemory(start, n, buf, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+dbg::History::GetRegistersAt(uint64_t n, std::vector<addr_t> &regs, error *err)
+{
+   RecordDecoder decoder;
+   RecordChunk hdr;
+   uint64_t index = 0;
+   size_t len = 0;
+   const unsigned char *chunk = nullptr;
+
+   if (n == GetEnd())
+   {
+      try
+      {
+         regs = encoder.regs;
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+      goto exit;
+   }
+
+   // From the start of its chunk.
+   //
+   chunk = GetChunk(n, &len, &index);
+   if (!chunk)
+      ERROR_SET(err, unknown, "Step isn't in the history");
+   hdr = GetHeader(chunk);
+
+   decoder.Start(chunk, len, encoder.regs.size(), err);
+   ERROR_CHECK(err);
+   for (uint64_t i=hdr.first; i<n && decoder.Next(step, err); ++i)
+      ;
+   ERROR_CHECK(err);
+
+   try
+   {
+      regs = decoder.regs;
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+dbg::History::Seek(Debugger *dbg, uint64_t n, error *err)
+{
+   std::vector<addr_t> regs, now, expected;
+   std::vector<const UndoSet*> runs;
+   RecordChunk hdr;
+   uint64_t from = 0, to = 0, a = 0, b = 0;
+   size_t len = 0;
+   int count = dbg->cpu->GetRegisterCount();
+
+   if (n < GetFirst() || n > pos)
+      ERROR_SET(err, unknown, "Step isn't in the history");
+   if (n == pos)
+      goto exit;
+
+   // Something else may have run since.  Then none of this applies.
+   //
+   GetRegistersAt(pos, expected, err);
+   ERROR_CHECK(err);
+   try
+   {
+      now.resize(count);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+   for (int i=0; i<count; ++i)
+   {
+      dbg->proc->GetRegister(i, &now[i], err);
+      ERROR_CHECK(err);
+   }
+   if (now != expected || dbg->proc->GetCurrentThread() != thread)
+   {
+      Clear();
+      ERROR_SET(err, unknown, "The process has run since; the history is gone");
+   }
+
+   GetRegistersAt(n, regs, err);
+   ERROR_CHECK(err);
+
+   GetChunk(n, &len, &to);
+
+   // Memory, latest first: what's done of the chunk we're in, whole
+   // chunks in between, then the end of n's chunk.
+   //
+   GetChunk(pos - 1, &len, &from);
+   if (from == to)
+   {
+      UndoSteps(dbg, n, pos, err);
+      ERROR_CHECK(err);
+   }
+   else
+   {
+      hdr = GetHeader(GetChunk(pos - 1, &len, &from));
+      UndoSteps(dbg, hdr.first, pos, err);
+      ERROR_CHECK(err);
+
+      // The biggest runs that fit, left to right, and applied the
+      // other way.
+      //
+      a = to + 1;
+      b = from;
+      while (a < b)
+      {
+         size_t k = 0;
+
+         while (k + 1 < levels.size() &&
+                !(a & ((2ULL << k) - 1)) &&
+                a + (2ULL << k) <= b &&
+                (a >> (k + 1)) >= levels[k + 1].base &&
+                (a >> (k + 1)) < levels[k + 1].base + levels[k + 1].runs.size())
+         {
+            ++k;
+         }
+
+         if (!levels.size() ||
+             a < levels[0].base ||
+             a >= levels[0].base + levels[0].runs.size())
+         {
+            ERROR_SET(err, unknown, "History is missing a chunk");
+         }
+
+         try
+         {
+            runs.push_back(&levels[k].runs[(a >> k) - levels[k].base]);
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+         a += 1ULL << k;
+      }
+
+      for (size_t i=runs.size(); i-- > 0; )
+      {
+         Apply(dbg, *runs[i], err);
+         ERROR_CHECK(err);
+      }
+
+      hdr = GetHeader(GetChunk(n, &len, &to));
+      UndoSteps(dbg, n, hdr.first + hdr.steps, err);
+      ERROR_CHECK(err);
+   }
+
+   for (size_t i=0; i<regs.size(); ++i)
+   {
+      dbg->proc->SetRegister(i, &regs[i], err);
+      ERROR_CHECK(err);
+   }
+
+   pos = n;
+exit:;
+}
+
+uint64_t
+dbg::History::Search(
+   uint64_t start,
+   uint64_t end,
+   std::function<void(uint64_t n, addr_t pc, bool &stop, error *err)> fn,
+   error *err
+)
+{
+   std::vector<addr_t> pcs;
+   uint64_t r = start;
+
+   while (end > start)
+   {
+      RecordDecoder decoder;
+      RecordChunk hdr;
+      uint64_t index = 0, first = 0;
+      size_t len = 0;
+      bool stop = false;
+      const unsigned char *chunk = GetChunk(end - 1, &len, &index);
+
+      if (!chunk)
+         ERROR_SET(err, unknown, "Step isn't in the history");
+      hdr = GetHeader(chunk);
+      first = MAX(hdr.first, start);
+
+      decoder.Start(chunk, len, encoder.regs.size(), err);
+      ERROR_CHECK(err);
+
+      pcs.clear();
+      for (uint64_t i=hdr.first; i<end && decoder.Next(step, err); ++i)
+      {
+         if (i < first)
+            continue;
+         try
+         {
+            pcs.push_back(step.before[DBG_IP]);
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+      }
+      ERROR_CHECK(err);
+
+      for (size_t i=pcs.size(); i-- > 0; )
+      {
+         fn(first + i, pcs[i], stop, err);
+         ERROR_CHECK(err);
+         if (stop)
+         {
+            r = first + i;
+            goto exit;
+         }
+      }
+
+      end = first;
+   }
+exit:
+   return r;
+}
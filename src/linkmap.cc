@@ -0,0 +1,491 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/linkmap.h>
+#include <dbg/dbg.h>
+
+#include <common/c++/new.h>
+#include <common/logger.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+#if defined(__ELF__)
+#include <elf.h>
+#endif
+
+void
+dbg::LinkMapTracker::Reset()
+{
+   rDebug = 0;
+   entryBp = nullptr;
+   brkBp = nullptr;
+   entries.clear();
+}
+
+#if defined(__ELF__)
+
+#if defined(__LP64__)
+typedef Elf64_Phdr Phdr;
+typedef Elf64_Dyn Dyn;
+#else
+typedef Elf32_Phdr Phdr;
+typedef Elf32_Dyn Dyn;
+#endif
+
+using dbg::addr_t;
+
+namespace {
+
+//
+// struct r_debug and struct link_map from <link.h>.  Every field is
+// pointer sized or padded out to it, so we read them as arrays of
+// words.  r_next is only there for r_version >= 2 (glibc's dlmopen
+// namespaces).
+//
+
+enum
+{
+   RDebugVersion,
+   RDebugMap,
+   RDebugBrk,
+   RDebugState,
+   RDebugLdBase,
+   RDebugNext,
+   RDebugWords
+};
+
+enum
+{
+   LinkMapAddr,
+   LinkMapName,
+   LinkMapLd,
+   LinkMapNext,
+   LinkMapPrev,
+   LinkMapWords
+};
+
+enum
+{
+   RT_CONSISTENT,
+   RT_ADD,
+   RT_DELETE,
+};
+
+// Limits, in case we're reading garbage or the list has a cycle.
+//
+const int MaxObjects = 65536;
+const int MaxNamespaces = 16;
+const size_t MaxPath = 4096;
+const addr_t MaxProgramHeaders = 4096;
+
+void
+LogError(const char *msg, error *err)
+{
+   auto errString = error_get_string(err);
+   log_printf(
+      "%s%s%s%s",
+      msg,
+      errString ? " (" : "",
+      errString ? errString : "",
+      errString ? ")" : ""
+   );
+}
+
+void
+ReadString(dbg::Debugger *dbg, addr_t addr, std::string &out, error *err)
+{
+   char buf[64];
+
+   out.clear();
+   if (!addr)
+      goto exit;
+
+   try
+   {
+      while (out.size() < MaxPath)
+      {
+         const char *nul = nullptr;
+
+         dbg->ReadMemory(addr, sizeof(buf), buf, err);
+         ERROR_CHECK(err);
+
+         nul = (const char*)memchr(buf, 0, sizeof(buf));
+         out.append(buf, nul ? nul - buf : sizeof(buf));
+         if (nul)
+            break;
+         addr += sizeof(buf);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+// Finds the program's DT_DEBUG entry, which the dynamic linker points
+// at its r_debug.  Returns false for a program with no dynamic section.
+// *rDebug is 0 if the linker hasn't run yet.
+//
+bool
+FindRDebug(dbg::Debugger *dbg, addr_t *rDebug, error *err)
+{
+   addr_t phdr = 0, phnum = 0;
+   addr_t bias = 0, dynamic = 0, dynamicSize = 0;
+   std::vector<Phdr> phdrs;
+   std::vector<Dyn> dyn;
+   bool r = false;
+
+   *rDebug = 0;
+
+   if (!dbg->proc->GetAuxiliaryValue(AT_PHDR, &phdr, err) ||
+       !dbg->proc->GetAuxiliaryValue(AT_PHNUM, &phnum, err))
+      goto exit;
+
+   if (!phnum || phnum > MaxProgramHeaders)
+      ERROR_SET(err, unknown, "Bad program header count");
+
+   try
+   {
+      phdrs.resize(phnum);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->ReadMemory(phdr, phnum * sizeof(Phdr), phdrs.data(), err);
+   ERROR_CHECK(err);
+
+   for (auto &ph : phdrs)
+   {
+      switch (ph.p_type)
+      {
+      case PT_PHDR:
+         bias = phdr - ph.p_vaddr;
+         break;
+      case PT_DYNAMIC:
+         dynamic = ph.p_vaddr;
+         dynamicSize = ph.p_memsz;
+         break;
+      }
+   }
+
+   if (!dynamic)
+      goto exit;
+   r = true;
+
+   try
+   {
+      dyn.resize(dynamicSize / sizeof(Dyn));
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->ReadMemory(dynamic + bias, dyn.size() * sizeof(Dyn), dyn.data(), err);
+   ERROR_CHECK(err);
+
+   for (auto &d : dyn)
+   {
+      if (d.d_tag == DT_NULL)
+         break;
+      if (d.d_tag == DT_DEBUG)
+      {
+         *rDebug = d.d_un.d_ptr;
+         break;
+      }
+   }
+
+exit:
+   return r && !ERROR_FAILED(err);
+}
+
+void
+OnDebugState(dbg::Debugger *dbg, dbg::Breakpoint *bp, void *context, error *err)
+{
+   auto t = (dbg::LinkMapTracker*)context;
+   error innerErr;
+   int state = 0;
+
+   // The linker calls this once before it changes the list and again
+   // after.  Only the second time is it safe to read.
+   //
+   dbg->ReadMemory(
+      t->rDebug + RDebugState * sizeof(addr_t),
+      sizeof(state),
+      &state,
+      &innerErr
+   );
+   ERROR_CHECK(&innerErr);
+
+   if (state == RT_CONSISTENT)
+   {
+      t->Update(&innerErr);
+      ERROR_CHECK(&innerErr);
+   }
+
+exit:
+   if (ERROR_FAILED(&innerErr))
+      LogError("Failed to update module list", &innerErr);
+}
+
+// Once r_debug is known: watch r_brk, and pick up what's already
+// loaded.
+//
+void
+Watch(dbg::LinkMapTracker *t)
+{
+   error err;
+   addr_t brk = 0;
+
+   t->dbg->ReadMemory(t->rDebug + RDebugBrk * sizeof(addr_t), sizeof(brk), &brk, &err);
+   ERROR_CHECK(&err);
+
+   if (!brk)
+      ERROR_SET(&err, unknown, "r_debug has no r_brk");
+
+   t->brkBp = t->dbg->SetInternalBreakpoint(brk, OnDebugState, t, &err);
+   ERROR_CHECK(&err);
+
+   t->Update(&err);
+   ERROR_CHECK(&err);
+
+exit:
+   if (ERROR_FAILED(&err))
+      LogError("Failed to track dynamic linker", &err);
+}
+
+void
+OnEntry(dbg::Debugger *dbg, dbg::Breakpoint *bp, void *context, error *err)
+{
+   auto t = (dbg::LinkMapTracker*)context;
+   error innerErr;
+
+   t->entryBp = nullptr;
+   dbg->DeleteInternalBreakpoint(bp, err);
+   ERROR_CHECK(err);
+
+   if (FindRDebug(dbg, &t->rDebug, &innerErr) && t->rDebug)
+      Watch(t);
+   else if (ERROR_FAILED(&innerErr))
+      LogError("Failed to find r_debug", &innerErr);
+
+exit:;
+}
+
+bool
+SameObject(const dbg::LinkMapTracker::Entry &a, const dbg::LinkMapTracker::Entry &b)
+{
+   return a.node == b.node && a.bias == b.bias && a.name == b.name;
+}
+
+// The link map gives us the bias, but modules are known by their lowest
+// mapped address.
+//
+addr_t
+GetBase(const dbg::LinkMapTracker::Entry &e)
+{
+   common::Pointer<dbg::ElfImage> img;
+   error err;
+   addr_t r = e.bias;
+
+   if (e.name[0] != '/')
+      goto exit;
+
+   New(img, &err);
+   ERROR_CHECK(&err);
+
+   img->Open(e.name.c_str(), &err);
+   ERROR_CHECK(&err);
+
+   r += img->GetLoadStart();
+exit:
+   return r;
+}
+
+} // end namespace
+
+void
+dbg::LinkMapTracker::Init(Debugger *dbg)
+{
+   error err;
+   addr_t entry = 0;
+
+   Reset();
+   this->dbg = dbg;
+
+   if (!FindRDebug(dbg, &rDebug, &err))
+      goto exit;
+
+   if (rDebug)
+   {
+      Watch(this);
+      goto exit;
+   }
+
+   // DT_DEBUG isn't filled in until the linker has run, so if we
+   // started the process ourselves, wait until it's done.
+   //
+   if (!dbg->proc->GetAuxiliaryValue(AT_ENTRY, &entry, &err) || !entry)
+      goto exit;
+
+   entryBp = dbg->SetInternalBreakpoint(entry, OnEntry, this, &err);
+   ERROR_CHECK(&err);
+
+exit:
+   if (ERROR_FAILED(&err))
+      LogError("Failed to find r_debug", &err);
+}
+
+void
+dbg::LinkMapTracker::Update(error *err)
+{
+   std::vector<Entry> current;
+   std::string name;
+   addr_t r = rDebug;
+   auto events = dbg->proc->EventCallbacks.Get();
+   auto byNode = [] (const Entry &a, const Entry &b) -> bool
+   {
+      return a.node < b.node;
+   };
+
+   try
+   {
+      for (int ns=0; r && ns<MaxNamespaces; ++ns)
+      {
+         addr_t words[RDebugWords];
+         int version = 0;
+         addr_t node = 0;
+         int n = 0;
+
+         memset(words, 0, sizeof(words));
+
+         dbg->ReadMemory(r, RDebugNext * sizeof(addr_t), words, err);
+         ERROR_CHECK(err);
+
+         memcpy(&version, &words[RDebugVersion], sizeof(version));
+         if (version >= 2)
+         {
+            dbg->ReadMemory(
+               r + RDebugNext * sizeof(addr_t),
+               sizeof(addr_t),
+               &words[RDebugNext],
+               err
+            );
+            ERROR_CHECK(err);
+         }
+
+         for (node = words[RDebugMap]; node && n < MaxObjects; ++n)
+         {
+            addr_t lm[LinkMapWords];
+            Entry e;
+
+            dbg->ReadMemory(node, sizeof(lm), lm, err);
+            ERROR_CHECK(err);
+
+            ReadString(dbg, lm[LinkMapName], name, err);
+            ERROR_CHECK(err);
+
+            // The program itself has no name here.  We found it when
+            // we attached.
+            //
+            if (name.size())
+            {
+               e.node = node;
+               e.bias = lm[LinkMapAddr];
+               e.base = 0;
+               e.name = name;
+               current.push_back(e);
+            }
+
+            node = lm[LinkMapNext];
+         }
+
+         r = (version >= 2) ? words[RDebugNext] : 0;
+      }
+
+      std::sort(current.begin(), current.end(), byNode);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   // Both lists are sorted by node, so walk them together.  Anything
+   // only in the old list was unloaded, anything only in the new one
+   // was loaded.
+   //
+   {
+   auto o = entries.begin();
+   auto c = current.begin();
+
+   while (o != entries.end() || c != current.end())
+   {
+      if (c == current.end() || (o != entries.end() && o->node < c->node))
+      {
+         if (events)
+         {
+            events->OnModuleUnloaded(o->base, err);
+            ERROR_CHECK(err);
+         }
+         ++o;
+      }
+      else if (o == entries.end() || c->node < o->node || !SameObject(*o, *c))
+      {
+         if (o != entries.end() && c->node == o->node)
+         {
+            // Same node, different object.
+            //
+            if (events)
+            {
+               events->OnModuleUnloaded(o->base, err);
+               ERROR_CHECK(err);
+            }
+            ++o;
+         }
+
+         c->base = GetBase(*c);
+         if (events)
+         {
+            events->OnModuleProbed(c->base, c->name.c_str(), err);
+            ERROR_CHECK(err);
+         }
+         ++c;
+      }
+      else
+      {
+         c->base = o->base;
+         ++o;
+         ++c;
+      }
+   }
+   }
+
+   entries.swap(current);
+exit:;
+}
+
+#else
+
+void
+dbg::LinkMapTracker::Init(Debugger *dbg)
+{
+   Reset();
+   this->dbg = dbg;
+}
+
+void
+dbg::LinkMapTracker::Update(error *err)
+{
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/memory.h>
+#include <dbg/dbg.h>
+
+#include <common/misc.h>
+
+#include <string.h>
+
+namespace {
+
+// Default stack rlimit on most systems; no point going further.
+//
+const size_t DefaultMaxSize = 8 * 1024 * 1024;
+
+const size_t PageSize = 4096;
+
+} // end namespace
+
+void
+dbg::MemoryWindow::Init(Debugger *dbg, addr_t base, size_t size, error *err)
+{
+   this->dbg = dbg;
+   this->base = base;
+   buf.clear();
+   reads = 0;
+   chunkSize = size;
+   maxSize = MAX(size, DefaultMaxSize);
+
+   // With the word-at-a-time ptrace interface a big read costs the same
+   // as lots of little ones, and we'd be reading more than we need.
+   //
+   if (dbg->proc->GetBlockSize() <= (int)sizeof(addr_t))
+      chunkSize = 0;
+
+   if (chunkSize)
+   {
+      Extend(base + chunkSize, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+bool
+dbg::MemoryWindow::Extend(addr_t end, error *err)
+{
+   size_t oldSize = buf.size();
+   size_t newSize = 0;
+   bool r = false;
+
+   if (!chunkSize || end < base)
+      goto exit;
+   if (end <= End())
+   {
+      r = true;
+      goto exit;
+   }
+   if (end - base > maxSize)
+      goto exit;
+
+   // Grow geometrically, so a deep stack takes a logarithmic number of
+   // reads.
+   //
+   newSize = MAX(end - base, oldSize + MAX(oldSize, chunkSize));
+   newSize = MIN(newSize, maxSize);
+
+   for (;;)
+   {
+      error innerErr;
+
+      try
+      {
+         buf.resize(newSize);
+      }
+      catch (std::bad_alloc)
+      {
+         buf.resize(oldSize);
+         ERROR_SET(err, nomem);
+      }
+
+      dbg->ReadMemory(base + oldSize, newSize - oldSize, buf.data() + oldSize, &innerErr);
+      ++reads;
+      if (!ERROR_FAILED(&innerErr))
+      {
+         r = true;
+         break;
+      }
+
+      // Probably ran off the end of the stack mapping.  Try again
+      // with just enough pages to cover the request.
+      //
+      size_t needed = end - base;
+      needed = (needed + PageSize - 1) & ~(PageSize - 1);
+      if (newSize <= needed)
+      {
+         buf.resize(oldSize);
+         break;
+      }
+      newSize = needed;
+   }
+
+exit:
+   return r;
+}
+
+void
+dbg::MemoryWindow::Read(addr_t addr, int len, void *out, error *err)
+{
+   if (addr >= base && addr + len >= addr && Extend(addr + len, err))
+   {
+      memcpy(out, buf.data() + (addr - base), len);
+      goto exit;
+   }
+   ERROR_CHECK(err);
+
+   dbg->ReadMemory(addr, len, out, err);
+   ++reads;
+   ERROR_CHECK(err);
+exit:;
+}
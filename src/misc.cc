@@ -9,7 +9,11 @@
 #include <dbg/misc.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
 
 namespace {
 
@@ -64,6 +68,7 @@ static const struct signame signames[] =
 #ifdef SIGTHR
    DECLARE(SIGTHR),
 #endif
+   { 0, nullptr },
 };
 #undef DECLARE
 
@@ -89,3 +94,34 @@ dbg::FormatSignal(char *buf, size_t sz, int sig)
 
    return buf;
 }
+
+int
+dbg::ParseSignal(const char *str)
+{
+   const struct signame *p = signames;
+   char *end = nullptr;
+   long sig = strtol(str, &end, 0);
+
+   if (*str && !*end)
+      return sig > 0 && sig < NSIG ? sig : -1;
+
+   if (!strncasecmp(str, "SIG", 3))
+      str += 3;
+
+   for (; p->name; ++p)
+   {
+      if (!strcasecmp(str, p->name + 3))
+         return p->sig;
+   }
+
+   return -1;
+}
+
+uint64_t
+dbg::MonotonicTime()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
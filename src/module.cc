@@ -0,0 +1,189 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/module.h>
+
+#include <common/c++/new.h>
+#include <common/logger.h>
+
+#include <algorithm>
+
+dbg::ElfImage *
+dbg::Module::GetImage()
+{
+   error err;
+
+   if (imageTried)
+      goto exit;
+   imageTried = true;
+
+   if (!path.size() || path[0] != '/')
+      goto exit;
+
+   New(image, &err);
+   ERROR_CHECK(&err);
+
+   image->Open(path.c_str(), &err);
+   ERROR_CHECK(&err);
+
+   bias = base - image->GetLoadStart();
+   end = image->GetLoadEnd() + bias;
+
+exit:
+   if (ERROR_FAILED(&err))
+   {
+      auto errString = error_get_string(&err);
+      log_printf(
+         "Failed to load image %s%s%s%s",
+         path.c_str(),
+         errString ? " (" : "",
+         errString ? errString : "",
+         errString ? ")" : ""
+      );
+      image = nullptr;
+   }
+   return image.Get();
+}
+
+dbg::dwarf::CallFrameInfo *
+dbg::Module::GetCallFrameInfo()
+{
+   error err;
+   ElfImage *img = nullptr;
+
+   if (cfiTried)
+      goto exit;
+   cfiTried = true;
+
+   img = GetImage();
+   if (!img)
+      goto exit;
+
+   New(cfi, &err);
+   ERROR_CHECK(&err);
+
+   cfi->Init(img, &err);
+   ERROR_CHECK(&err);
+
+exit:
+   if (ERROR_FAILED(&err))
+      cfi = nullptr;
+   return cfi.Get();
+}
+
+dbg::dwarf::DebugInfo *
+dbg::Module::GetDebugInfo()
+{
+   error err;
+   ElfImage *img = nullptr;
+
+   if (debugInfoTried)
+      goto exit;
+   debugInfoTried = true;
+
+   img = GetImage();
+   if (!img)
+      goto exit;
+
+   New(debugInfo, &err);
+   ERROR_CHECK(&err);
+
+   debugInfo->Init(img, &err);
+   ERROR_CHECK(&err);
+
+exit:
+   if (ERROR_FAILED(&err))
+      debugInfo = nullptr;
+   return debugInfo.Get();
+}
+
+dbg::Module *
+dbg::ModuleList::Lookup(addr_t addr)
+{
+   auto it = std::upper_bound(
+      modules.begin(),
+      modules.end(),
+      addr,
+      [] (addr_t addr, const common::Pointer<Module> &m) -> bool
+      {
+         return addr < m->base;
+      }
+   );
+
+   if (it == modules.begin())
+      return nullptr;
+
+   auto m = (--it)->Get();
+   if (!m->GetImage() || addr >= m->end)
+      return nullptr;
+
+   return m;
+}
+
+dbg::Module *
+dbg::ModuleList::Insert(addr_t base, const char *path, error *err)
+{
+   common::Pointer<Module> m;
+
+   auto it = std::upper_bound(
+      modules.begin(),
+      modules.end(),
+      base,
+      [] (addr_t addr, const common::Pointer<Module> &m) -> bool
+      {
+         return addr < m->base;
+      }
+   );
+
+   // Seen it already?  Keep what we've loaded for it.
+   //
+   if (it != modules.begin() &&
+       (it-1)->Get()->base == base &&
+       (it-1)->Get()->path == (path ? path : ""))
+   {
+      m = *(it-1);
+      goto exit;
+   }
+
+   New(m, err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      m->base = base;
+      if (path)
+         m->path = path;
+
+      // Replace a stale entry at the same address.
+      //
+      if (it != modules.begin() && (it-1)->Get()->base == base)
+         *(it-1) = m;
+      else
+         modules.insert(it, m);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+exit:
+   return ERROR_FAILED(err) ? nullptr : m.Get();
+}
+
+void
+dbg::ModuleList::Remove(addr_t base)
+{
+   for (auto it = modules.begin(); it != modules.end(); ++it)
+   {
+      if (it->Get()->base == base)
+      {
+         modules.erase(it);
+         break;
+      }
+   }
+}
@@ -0,0 +1,44 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/process.h>
+
+//
+// What a platform gets if it can't do any better.
+//
+
+int
+dbg::Process::Fork(int from, addr_t stub, error *err)
+{
+   ERROR_SET(err, unknown, "Copying the target is not supported");
+exit:
+   return -1;
+}
+
+void
+dbg::Process::Switch(int copy, error *err)
+{
+   ERROR_SET(err, unknown, "Copying the target is not supported");
+exit:;
+}
+
+void
+dbg::Process::Discard(int copy, error *err)
+{
+}
+
+void
+dbg::Process::SetSyscallTrace(const std::vector<bool> &calls, error *err)
+{
+   for (auto traced : calls)
+   {
+      if (traced)
+         ERROR_SET(err, unknown, "Tracing system calls is not supported");
+   }
+exit:;
+}
@@ -12,6 +12,7 @@
 #include <sys/user.h>
 #include <sys/wait.h>
 
+#include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -30,6 +31,9 @@
 #include <common/misc.h>
 #include <common/logger.h>
 
+#include <algorithm>
+#include <vector>
+
 using dbg::addr_t;
 using dbg::reg_t;
 using dbg::FormatSignal;
@@ -56,34 +60,153 @@ typedef int ptrace_unit_t;
 #define GETREGS_REVERSED
 #endif
 
+// Follow the target's threads.  Elsewhere we only know about the one.
+//
+#if defined(__linux__) && defined(PT_SETOPTIONS) && defined(PT_GETEVENTMSG)
+#define USE_THREADS
+#include <sys/syscall.h>
+#endif
+
+// Waiting with a deadline: poll() a timerfd, and SIGCHLD through a
+// signalfd.
+//
+#if defined(__linux__)
+#define USE_TIMERFD
+#include <poll.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
+// Copies of the target, for checkpoints: a clone() made in it.
+//
+#if defined(USE_THREADS) && (defined(__amd64__) || defined(__i386__))
+#define USE_FORK
+#include <sys/prctl.h>
+#include <sched.h>
+#if !defined(PR_GET_TID_ADDRESS)
+#define PR_GET_TID_ADDRESS 40
+#endif
+#endif
+
+// Tracing system calls: PTRACE_SYSCALL stops, made sense of with
+// PTRACE_GET_SYSCALL_INFO.  A process we start can be given a seccomp
+// filter instead, so only the calls being traced stop.
+//
+#if defined(USE_THREADS) && defined(PTRACE_GET_SYSCALL_INFO)
+#define USE_STRACE
+#if defined(__amd64__)
+#define SECCOMP_ARCH AUDIT_ARCH_X86_64
+#elif defined(__i386__)
+#define SECCOMP_ARCH AUDIT_ARCH_I386
+#elif defined(__aarch64__)
+#define SECCOMP_ARCH AUDIT_ARCH_AARCH64
+#endif
+#if defined(SECCOMP_ARCH)
+#define USE_SECCOMP
+#include <stddef.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#endif
+#endif
+
 namespace {
 
 struct PtraceProcess : public dbg::Process
 {
    pid_t pid;
+
+   // The thread that last stopped.  Registers, Step() and Go() are for
+   // it.
+   //
+   pid_t tid;
+#if defined(USE_THREADS)
+   // Every thread we've seen, in order.  Ones that have exited are 0,
+   // so that the rest keep their numbers.
+   //
+   std::vector<pid_t> threads;
+
+   // Threads we've heard are coming, but haven't seen stop yet.
+   //
+   std::vector<pid_t> starting;
+#endif
+#if defined(USE_FORK)
+   // Copies from Fork(), stopped.  They outlive the target, but not us.
+   //
+   std::vector<pid_t> copies;
+
+   // What the last clone() in Syscall() made, or -1.
+   //
+   pid_t cloned;
+#endif
 #if defined(USE_GETREGS)
    bool registersDirty;
    reg_t registers;
 #endif
    int pendingSignal;
    ptrace_op_t lastStep;
+#if defined(USE_TIMERFD)
+   int timerfd;
+   int sigfd;
+
+   // SIGSTOPs sent for the deadline that we haven't seen yet.
+   //
+   int stopsPending;
+#endif
+#if defined(USE_STRACE)
+   // System calls to report, by number, and those the target's seccomp
+   // filter stops for, if we gave it one.  If anything in the first
+   // isn't in the second, every call has to stop, with PTRACE_SYSCALL.
+   //
+   std::vector<bool> traced;
+   std::vector<bool> filtered;
+   bool traceAll;
+
+   // Threads in a call that's being reported, and which call.
+   //
+   std::vector<std::pair<pid_t, dbg::addr_t>> inSyscall;
+#endif
 #if defined(USE_PROC_MEM)
    int memfd;
 #endif
 
    PtraceProcess()
-      : pid(-1), pendingSignal(0), lastStep(PT_STEP)
+      : pid(-1), tid(-1), pendingSignal(0), lastStep(PT_STEP)
    {
       MarkRegistersDirty();
 
 #if defined(USE_PROC_MEM)
       memfd = -1;
+#endif
+#if defined(USE_FORK)
+      cloned = -1;
+#endif
+#if defined(USE_TIMERFD)
+      timerfd = sigfd = -1;
+      stopsPending = 0;
+#endif
+#if defined(USE_STRACE)
+      traceAll = false;
 #endif
    }
 
    ~PtraceProcess()
    {
+#if defined(USE_FORK)
+      // Left alone, they'd run again from where they were copied.
+      //
+      for (auto copy : copies)
+         Reap(copy);
+#endif
       ClearPid();
+#if defined(USE_TIMERFD)
+      if (timerfd >= 0)
+         close(timerfd);
+      if (sigfd >= 0)
+         close(sigfd);
+#endif
    }
 
 #if defined(PT_IO)
@@ -203,7 +326,7 @@ struct PtraceProcess : public dbg::Process
 #else
                ptrace_op_t op2 = PT_READ_D;
 #endif
-               i = ptrace(op2, pid, (void*)addr, 0);
+               i = ptrace(op2, tid, (void*)addr, 0);
             }
 
             // Copy that which needs to be written.
@@ -212,14 +335,14 @@ struct PtraceProcess : public dbg::Process
 
             // Do the write.
             //
-            if (ptrace(op, pid, (void*)addr, i))
+            if (ptrace(op, tid, (void*)addr, i))
                ERROR_SET(err, errno, errno);
          }
          else
          {
             // Do the read.
             //
-            i = ptrace(op, pid, (void*)addr, 0);
+            i = ptrace(op, tid, (void*)addr, 0);
 
             // Copy back to the buffer.
             //
@@ -248,6 +371,51 @@ struct PtraceProcess : public dbg::Process
 
 #endif
 
+#if defined(__linux__)
+   bool
+   GetAuxiliaryValue(addr_t type, addr_t *value, error *err)
+   {
+      char buf[64];
+      int fd = -1;
+      addr_t entry[2];
+      bool r = false;
+
+      snprintf(buf, sizeof(buf), "/proc/%" PID_T_FMT "/auxv", pid);
+      fd = open(buf, O_RDONLY);
+      if (fd < 0)
+         ERROR_SET(err, errno, errno);
+
+      while (read(fd, entry, sizeof(entry)) == sizeof(entry) && entry[0])
+      {
+         if (entry[0] == type)
+         {
+            *value = entry[1];
+            r = true;
+            break;
+         }
+      }
+
+   exit:
+      if (fd >= 0)
+         close(fd);
+      return r;
+   }
+
+   int
+   OpenFile(int targetFd, int flags, error *err)
+   {
+      char buf[64];
+      int fd = -1;
+
+      snprintf(buf, sizeof(buf), "/proc/%" PID_T_FMT "/fd/%d", pid, targetFd);
+      fd = open(buf, flags | O_CLOEXEC);
+      if (fd < 0)
+         ERROR_SET(err, errno, errno);
+   exit:
+      return fd;
+   }
+#endif
+
    void
    ReadMemory(addr_t addr, int len, void *buf, error *err)
    {
@@ -309,41 +477,708 @@ struct PtraceProcess : public dbg::Process
    exit:;
    }
 
-   void
-   SetRegister(int regno, const void *reg, error *err)
-   {
-      void *offset = nullptr;
-      size_t len = 0;
+   void
+   SetRegister(int regno, const void *reg, error *err)
+   {
+      void *offset = nullptr;
+      size_t len = 0;
+
+      RegDeref(regno, &offset, &len, err);
+      ERROR_CHECK(err);
+
+#if defined(USE_GETREGS)
+      LoadAllRegisters(err);
+      ERROR_CHECK(err);
+
+      // Set the register...
+      //
+      memcpy(((char*)&registers) + (size_t)offset, reg, len);
+      
+      StoreAllRegisters(err);
+      ERROR_CHECK(err);
+#elif defined(PT_READ_U)
+      MemoryOp(PT_WRITE_U, offset, len, (void*)reg, err);
+#else
+#error
+#endif
+   exit:;
+   }
+
+#if defined(__linux__) && (defined(__amd64__) || defined(__i386__))
+   int
+   GetSyscallStub(void *buf, int len)
+   {
+#if defined(__amd64__)
+      static const unsigned char stub[] = { 0x0f, 0x05, 0xcc };   // syscall; int3
+#else
+      static const unsigned char stub[] = { 0xcd, 0x80, 0xcc };   // int $0x80; int3
+#endif
+      if (len < (int)sizeof(stub))
+         return 0;
+      memcpy(buf, stub, sizeof(stub));
+      return sizeof(stub);
+   }
+#endif
+
+   void
+   Syscall(dbg::SystemCall *calls, int n, addr_t stub, error *err)
+   {
+#if defined(__linux__) && (defined(__amd64__) || defined(__i386__))
+#if defined(__amd64__)
+      static const unsigned char insn[] = { 0x0f, 0x05 };   // syscall
+      static const int argRegs[] = { DBG_DI, DBG_SI, DBG_DX, DBG_R10, DBG_R8, DBG_R9 };
+#else
+      static const unsigned char insn[] = { 0xcd, 0x80 };   // int $0x80
+      static const int argRegs[] = { DBG_BX, DBG_CX, DBG_DX, DBG_SI, DBG_DI, DBG_BP };
+#endif
+      unsigned char text[sizeof(insn)];
+      reg_t saved;
+      addr_t pc = 0;
+      bool restoreText = false, restoreRegs = false;
+      int status = 0;
+      auto set = [this] (int regno, addr_t value, error *err) -> void
+      {
+         void *offset = nullptr;
+         size_t len = 0;
+
+         RegDeref(regno, &offset, &len, err);
+         if (!ERROR_FAILED(err))
+            memcpy(((char*)&registers) + (size_t)offset, &value, len);
+      };
+
+      for (int i=0; i<n; ++i)
+      {
+         if (calls[i].nargs < 0 || calls[i].nargs > (int)ARRAY_SIZE(argRegs))
+            ERROR_SET(err, unknown, "Too many system call arguments");
+      }
+
+      LoadAllRegisters(err);
+      ERROR_CHECK(err);
+      saved = registers;
+      restoreRegs = true;
+
+      GetRegister(DBG_IP, &pc, err);
+      ERROR_CHECK(err);
+
+      // Without a stub, borrow the code at the pc.
+      //
+      if (!stub)
+      {
+         ReadMemory(pc, sizeof(text), text, err);
+         ERROR_CHECK(err);
+         WriteMemory(pc, sizeof(insn), insn, err);
+         ERROR_CHECK(err);
+         restoreText = true;
+      }
+
+      for (int i=0; i<n; ++i)
+      {
+         auto &call = calls[i];
+         addr_t r = 0, end = 0;
+
+         registers = saved;
+         set(DBG_IP, stub ? stub : pc, err);
+         ERROR_CHECK(err);
+         set(DBG_AX, call.nr, err);
+         ERROR_CHECK(err);
+         for (int j=0; j<call.nargs; ++j)
+         {
+            set(argRegs[j], call.args[j], err);
+            ERROR_CHECK(err);
+         }
+
+         // If we stopped in the middle of a system call, don't let the
+         // kernel think this is it being restarted.
+         //
+#if defined(__amd64__)
+         registers.orig_rax = -1;
+#else
+         registers.orig_eax = -1;
+#endif
+         StoreAllRegisters(err);
+         ERROR_CHECK(err);
+
+         // Not Step() or Go(): they would deliver pendingSignal, and
+         // report the stop to the user.  The stub ends in a trap, so it
+         // can run freely; the pc has to be stepped.
+         //
+         MarkRegistersDirty();
+         if (ptrace(stub ? PT_CONTINUE : PT_STEP, tid, (caddr_t)1, 0))
+            ERROR_SET(err, errno, errno);
+         if (waitpid(tid, &status, WaitFlags()) < 0)
+            ERROR_SET(err, errno, errno);
+#if defined(USE_STRACE)
+         // Our own calls go unreported, even where the filter says.
+         //
+         while (WIFSTOPPED(status) && (status >> 8) == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)))
+         {
+            if (ptrace(stub ? PT_CONTINUE : PT_STEP, tid, (caddr_t)1, 0))
+               ERROR_SET(err, errno, errno);
+            if (waitpid(tid, &status, WaitFlags()) < 0)
+               ERROR_SET(err, errno, errno);
+         }
+#endif
+#if defined(USE_FORK)
+         // A clone() stops on the way out, to tell us what it made.
+         //
+         if (WIFSTOPPED(status) && (status >> 8) == (SIGTRAP | (PTRACE_EVENT_CLONE << 8)))
+         {
+            unsigned long msg = 0;
+
+            if (!ptrace(PT_GETEVENTMSG, tid, 0, &msg))
+               cloned = msg;
+            if (ptrace(stub ? PT_CONTINUE : PT_STEP, tid, (caddr_t)1, 0))
+               ERROR_SET(err, errno, errno);
+            if (waitpid(tid, &status, WaitFlags()) < 0)
+               ERROR_SET(err, errno, errno);
+         }
+#endif
+
+         if (!WIFSTOPPED(status))
+         {
+            restoreText = restoreRegs = false;
+            ClearPid();
+            ERROR_SET(err, unknown, "Process exited during system call");
+         }
+         if (WSTOPSIG(status) != SIGTRAP)
+         {
+            // A signal got there first, and the call never ran.  Let
+            // the target have it the next time it runs.
+            //
+            if (!pendingSignal)
+               pendingSignal = WSTOPSIG(status);
+            ERROR_SET(err, unknown, "System call interrupted by signal");
+         }
+
+         GetRegister(DBG_IP, &end, err);
+         ERROR_CHECK(err);
+         if (end != (stub ? stub + sizeof(insn) + 1 : pc + sizeof(insn)))
+            ERROR_SET(err, unknown, "System call didn't come back");
+
+         GetRegister(DBG_AX, &r, err);
+         ERROR_CHECK(err);
+         call.result = r;
+      }
+   exit:
+      if (restoreText)
+      {
+         error innerErr;
+         WriteMemory(pc, sizeof(text), text, &innerErr);
+         if (ERROR_FAILED(&innerErr))
+            log_printf("Failed to restore code after system call at %p", (void*)pc);
+      }
+      if (restoreRegs)
+      {
+         error innerErr;
+         registers = saved;
+         StoreAllRegisters(&innerErr);
+         if (ERROR_FAILED(&innerErr))
+            log_printf("Failed to restore registers after system call");
+      }
+#else
+      ERROR_SET(err, unknown, "System calls in the target are not supported");
+   exit:;
+#endif
+   }
+
+   static int
+   WaitFlags()
+   {
+#if defined(USE_THREADS)
+      return __WALL;
+#else
+      return 0;
+#endif
+   }
+
+   pid_t
+   AnyThread()
+   {
+#if defined(USE_THREADS)
+      return -1;
+#else
+      return pid;
+#endif
+   }
+
+   // Whether a SIGTRAP after a block step was a breakpoint instruction,
+   // rather than the end of the block.  The kernel says which: a trap
+   // instruction is SI_KERNEL, a debug exception isn't.
+   //
+   bool
+   TrappedOnBreakpoint()
+   {
+#if defined(PT_STEPBLOCK)
+      siginfo_t info;
+
+      if (lastStep != PT_STEPBLOCK)
+         return false;
+
+      memset(&info, 0, sizeof(info));
+      if (ptrace(PTRACE_GETSIGINFO, tid, (caddr_t)0, &info))
+         return false;
+
+      return info.si_code == SI_KERNEL;
+#else
+      return false;
+#endif
+   }
+
+   // What to send a thread on its way with, given op: while every
+   // system call has to stop, that's PTRACE_SYSCALL, not PT_CONTINUE.
+   //
+   ptrace_op_t
+   ResumeOp(ptrace_op_t op)
+   {
+#if defined(USE_STRACE)
+      if (op == PT_CONTINUE && traceAll)
+         return PTRACE_SYSCALL;
+#endif
+      return op;
+   }
+
+#if defined(USE_THREADS)
+
+   // For PT_SETOPTIONS, on every thread.
+   //
+   long
+   TraceOptions()
+   {
+      long r = PTRACE_O_TRACECLONE;
+#if defined(USE_STRACE)
+      r |= PTRACE_O_TRACESYSGOOD;
+
+      // Without this, the calls the filter traces fail with ENOSYS.
+      //
+      if (filtered.size())
+         r |= PTRACE_O_TRACESECCOMP;
+#endif
+      return r;
+   }
+
+   // Starts following a thread that's already running, as when we
+   // attach.  It's left running.
+   //
+   void
+   AttachThread(pid_t t)
+   {
+      int status = 0;
+
+      if (ptrace(PT_ATTACH, t, 0, 0))
+         return;
+      if (waitpid(t, &status, __WALL) < 0 || !WIFSTOPPED(status))
+         return;
+
+      ptrace(PT_SETOPTIONS, t, 0, (void*)TraceOptions());
+      threads.push_back(t);
+      ptrace(ResumeOp(PT_CONTINUE), t, (caddr_t)1, 0);
+   }
+
+   // Attaches to any threads in /proc we don't know about, until there
+   // aren't any new ones.
+   //
+   void
+   AttachThreads(error *err)
+   {
+      char path[64];
+      bool found = true;
+
+      snprintf(path, sizeof(path), "/proc/%" PID_T_FMT "/task", pid);
+
+      try
+      {
+         while (found)
+         {
+            DIR *dir = opendir(path);
+            struct dirent *ent = nullptr;
+
+            found = false;
+            if (!dir)
+               break;
+
+            while ((ent = readdir(dir)))
+            {
+               pid_t t = atol(ent->d_name);
+
+               if (t <= 0 || std::find(threads.begin(), threads.end(), t) != threads.end())
+                  continue;
+
+               AttachThread(t);
+               found = true;
+            }
+
+            closedir(dir);
+         }
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+   exit:;
+   }
+
+   // Deals with threads starting and exiting.  Returns true if that's
+   // all that happened, and the thread has been sent on its way.
+   //
+   bool
+   OnThreadEvent(pid_t child, int status)
+   {
+      bool r = false;
+
+      try
+      {
+         if (WIFEXITED(status) || WIFSIGNALED(status))
+         {
+            if (child == pid)
+               goto exit;
+
+            std::replace(threads.begin(), threads.end(), child, 0);
+            r = true;
+         }
+         else if (WIFSTOPPED(status) && (status >> 8) == (SIGTRAP | (PTRACE_EVENT_CLONE << 8)))
+         {
+            unsigned long msg = 0;
+
+            if (!ptrace(PT_GETEVENTMSG, child, 0, &msg) &&
+                std::find(threads.begin(), threads.end(), (pid_t)msg) == threads.end())
+            {
+               threads.push_back(msg);
+               starting.push_back(msg);
+            }
+
+            ptrace(ResumeOp(child == tid ? lastStep : PT_CONTINUE), child, (caddr_t)1, 0);
+            r = true;
+         }
+         else if (WIFSTOPPED(status) && WSTOPSIG(status) == SIGSTOP && child != pid)
+         {
+            // A new thread's first stop.  It can beat the clone event.
+            //
+            auto it = std::find(starting.begin(), starting.end(), child);
+
+            if (it != starting.end())
+               starting.erase(it);
+            else if (std::find(threads.begin(), threads.end(), child) == threads.end())
+               threads.push_back(child);
+            else
+               goto exit;
+
+            ptrace(ResumeOp(PT_CONTINUE), child, (caddr_t)1, 0);
+            r = true;
+         }
+      }
+      catch (std::bad_alloc)
+      {
+         // Lose track of it rather than leave it stopped.
+         //
+         if (WIFSTOPPED(status))
+            ptrace(ResumeOp(PT_CONTINUE), child, (caddr_t)1, 0);
+         r = true;
+      }
+   exit:
+      return r;
+   }
+
+#if defined(USE_STRACE)
+
+   bool
+   IsTraced(dbg::addr_t nr)
+   {
+      return nr < traced.size() && traced[nr];
+   }
+
+   void
+   UpdateTraceAll()
+   {
+      traceAll = false;
+      for (size_t nr = 0; nr < traced.size() && !traceAll; ++nr)
+         traceAll = traced[nr] && (nr >= filtered.size() || !filtered[nr]);
+   }
+
+   void
+   SetSyscallTrace(const std::vector<bool> &calls, error *err)
+   {
+      try
+      {
+         traced = calls;
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+      UpdateTraceAll();
+
+      // Threads already running pick this up the next time they stop.
+      //
+   exit:;
+   }
+
+   // Deals with a stop at a system call, reporting it if it's being
+   // traced.  Returns true if that's what it was, and the thread has
+   // been sent on its way.
+   //
+   bool
+   OnSyscallEvent(pid_t child, int status, error *err)
+   {
+      struct __ptrace_syscall_info info;
+      dbg::SyscallStop stop;
+      ptrace_op_t op = child == tid ? lastStep : PT_CONTINUE;
+      bool seccomp = false, report = false;
+
+      if (!WIFSTOPPED(status))
+         return false;
+      seccomp = (status >> 8) == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8));
+      if (!seccomp && WSTOPSIG(status) != (SIGTRAP | 0x80))
+         return false;
+
+      memset(&info, 0, sizeof(info));
+      memset(&stop, 0, sizeof(stop));
+      stop.thread = child;
+
+      // Kernels before 5.3 can't say, so nothing is reported.
+      //
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, child, (void*)sizeof(info), &info) <= 0)
+         goto resume;
+
+      switch (info.op)
+      {
+      case PTRACE_SYSCALL_INFO_ENTRY:
+      case PTRACE_SYSCALL_INFO_SECCOMP:
+         // A thread being stepped doesn't stop on the way out, so it's
+         // let through unreported.
+         //
+         if (op != PT_CONTINUE || !IsTraced(info.entry.nr))
+            break;
+
+         stop.entry = true;
+         stop.nr = info.entry.nr;
+         for (int i = 0; i < 6; ++i)
+            stop.args[i] = info.entry.args[i];
+
+         try
+         {
+            auto it = inSyscall.begin();
+            while (it != inSyscall.end() && it->first != child)
+               ++it;
+            if (it == inSyscall.end())
+               inSyscall.push_back(std::make_pair(child, stop.nr));
+            else
+               it->second = stop.nr;
+         }
+         catch (std::bad_alloc)
+         {
+            break;
+         }
+
+         op = PTRACE_SYSCALL;
+         report = true;
+         break;
+      case PTRACE_SYSCALL_INFO_EXIT:
+         for (auto it = inSyscall.begin(); it != inSyscall.end(); ++it)
+         {
+            if (it->first == child)
+            {
+               stop.nr = it->second;
+               stop.result = info.exit.rval;
+               inSyscall.erase(it);
+               report = IsTraced(stop.nr);
+               break;
+            }
+         }
+         break;
+      }
+
+      // Reported as the thread it is, so its memory can be read.
+      //
+      if (report && EventCallbacks.Get())
+      {
+         pid_t current = tid;
+
+         tid = child;
+         MarkRegistersDirty();
+         EventCallbacks->OnSyscall(stop, err);
+         tid = current;
+         MarkRegistersDirty();
+      }
+
+   resume:
+      ptrace(ResumeOp(op), child, (caddr_t)1, 0);
+      return true;
+   }
+
+#endif
+
+   // Stops a thread other than the current one and lets it go.  If it
+   // had just hit a breakpoint, it's moved back to run what's there
+   // now.
+   //
+   void
+   DetachThread(pid_t t)
+   {
+      pid_t current = tid;
+
+      if (syscall(SYS_tgkill, pid, t, SIGSTOP))
+         return;
+
+      for (;;)
+      {
+         int status = 0;
+         int sig = 0;
+
+         if (waitpid(t, &status, __WALL) < 0 || !WIFSTOPPED(status))
+            break;
+
+         sig = WSTOPSIG(status);
+         if (sig == SIGSTOP)
+         {
+            ptrace(PT_DETACH, t, (caddr_t)1, 0);
+            break;
+         }
+
+         if (status >> 8 == SIGTRAP && Cpu.Get())
+         {
+            error err;
+
+            tid = t;
+            MarkRegistersDirty();
+            Cpu->OnBreakpointBreak(this, &err);
+            tid = current;
+            MarkRegistersDirty();
+         }
+
+         ptrace(PT_CONTINUE, t, (caddr_t)1, (sig == SIGTRAP) ? 0 : sig);
+      }
+   }
+
+#endif
+
+   void
+   GetThreads(std::vector<int> &out, error *err)
+   {
+      try
+      {
+#if defined(USE_THREADS)
+         out.assign(threads.begin(), threads.end());
+#else
+         out.clear();
+         if (pid >= 0)
+            out.push_back(pid);
+#endif
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+   exit:;
+   }
+
+   int
+   GetCurrentThread()
+   {
+      return tid;
+   }
+
+#if defined(USE_TIMERFD)
+
+   // Waits until there's something for waitpid(), or the deadline,
+   // without taking it.  Returns false for the deadline.
+   //
+   bool
+   Sleep(pid_t who, error *err)
+   {
+      sigset_t chld, old;
+      struct itimerspec its;
+      bool ready = false, masked = false;
+
+      sigemptyset(&chld);
+      sigaddset(&chld, SIGCHLD);
+
+      if (timerfd < 0)
+      {
+         timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+         if (timerfd < 0)
+            ERROR_SET(err, errno, errno);
+      }
+      if (sigfd < 0)
+      {
+         sigfd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+         if (sigfd < 0)
+            ERROR_SET(err, errno, errno);
+      }
+
+      // MonotonicTime() is CLOCK_MONOTONIC too.
+      //
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_sec = deadline / 1000000000;
+      its.it_value.tv_nsec = deadline % 1000000000;
+      if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, nullptr))
+         ERROR_SET(err, errno, errno);
+
+      // Blocked, SIGCHLD waits in the signalfd for poll() to see.  Only
+      // while we're here, or a target we start would inherit it.
+      //
+      if ((errno = pthread_sigmask(SIG_BLOCK, &chld, &old)))
+         ERROR_SET(err, errno, errno);
+      masked = true;
+
+      for (;;)
+      {
+         siginfo_t info;
+         struct pollfd fds[2];
+         struct signalfd_siginfo si;
+         uint64_t expired = 0;
 
-      RegDeref(regno, &offset, &len, err);
-      ERROR_CHECK(err);
+         // Checked after the mask, so a SIGCHLD from now on is seen.
+         //
+         memset(&info, 0, sizeof(info));
+         if (waitid(who < 0 ? P_ALL : P_PID, who < 0 ? 0 : who, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT | WaitFlags()))
+         {
+            if (errno == EINTR)
+               continue;
+            ERROR_SET(err, errno, errno);
+         }
+         if (info.si_pid)
+         {
+            ready = true;
+            break;
+         }
 
-#if defined(USE_GETREGS)
-      LoadAllRegisters(err);
-      ERROR_CHECK(err);
+         memset(fds, 0, sizeof(fds));
+         fds[0].fd = sigfd;
+         fds[0].events = POLLIN;
+         fds[1].fd = timerfd;
+         fds[1].events = POLLIN;
 
-      // Set the register...
-      //
-      memcpy(((char*)&registers) + (size_t)offset, reg, len);
-      
-      StoreAllRegisters(err);
-      ERROR_CHECK(err);
-#elif defined(PT_READ_U)
-      MemoryOp(PT_WRITE_U, offset, len, (void*)reg, err);
-#else
-#error
-#endif
-   exit:;
+         if (poll(fds, ARRAY_SIZE(fds), -1) < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            ERROR_SET(err, errno, errno);
+         }
+         if (fds[1].revents & POLLIN)
+         {
+            if (read(timerfd, &expired, sizeof(expired)) < 0)
+               ERROR_SET(err, errno, errno);
+            break;
+         }
+         while (read(sigfd, &si, sizeof(si)) == sizeof(si))
+            ;
+      }
+   exit:
+      if (masked)
+         pthread_sigmask(SIG_SETMASK, &old, nullptr);
+      return ready;
    }
 
+#endif
+
    void
    Wait(error *err)
    {
-      Wait(true, err);
+      Wait(AnyThread(), true, err);
    }
 
    void
-   Wait(bool block, error *err)
+   Wait(pid_t who, bool block, error *err)
    {
       pid_t child;
       int status;
@@ -352,17 +1187,63 @@ struct PtraceProcess : public dbg::Process
       bool pgidSet = false;
 
       pendingSignal = 0;
+      timedOut = false;
 
       if (!block)
          flags |= WNOHANG;
 
    retry:
-      child = waitpid(pid, &status, flags);
+#if defined(USE_TIMERFD)
+      // Out of time: stop it wherever it is.  Once is enough; something
+      // already on its way can overtake the stop.
+      //
+      if (block && deadline && !stopsPending && pid >= 0 && !Sleep(who, err))
+      {
+         ERROR_CHECK(err);
+#if defined(USE_THREADS)
+         // Just the current thread, so it's the one stop we count.  If
+         // it's gone, any thread will do.
+         //
+         if (syscall(SYS_tgkill, pid, tid, SIGSTOP) && (errno != ESRCH || kill(pid, SIGSTOP)))
+            ERROR_SET(err, errno, errno);
+#else
+         if (kill(pid, SIGSTOP))
+            ERROR_SET(err, errno, errno);
+#endif
+         ++stopsPending;
+      }
+      ERROR_CHECK(err);
+#endif
+      child = waitpid(who, &status, flags | WaitFlags());
+
+      // Before anything else, so the debugger's own work counts.
+      //
+      if (child > 0)
+         stoppedAt = dbg::MonotonicTime();
+
       if (!block && !child)
          goto exit;
       else if (child < 0)
          ERROR_SET(err, errno, errno);
-      else if (WIFEXITED(status))
+
+#if defined(USE_THREADS)
+      if (OnThreadEvent(child, status))
+         goto retry;
+#endif
+#if defined(USE_STRACE)
+      if (OnSyscallEvent(child, status, err))
+      {
+         ERROR_CHECK(err);
+         goto retry;
+      }
+#endif
+      if (child != tid)
+      {
+         tid = child;
+         MarkRegistersDirty();
+      }
+
+      if (WIFEXITED(status))
       {
          if (EventCallbacks.Get())
          {
@@ -408,15 +1289,59 @@ struct PtraceProcess : public dbg::Process
                if (tcsetpgrp(0, getpgid(pid)))
                   ERROR_SET(err, errno, errno);
                pgidSet = true;
-               // fall through ...
-            case SIGCHLD:
-               if (ptrace(lastStep, pid, (caddr_t)1, SIGCONT))
+               if (ptrace(ResumeOp(lastStep), tid, (caddr_t)1, SIGCONT))
                   ERROR_SET(err, errno, errno);
                goto retry;
-            case SIGINT:
             case SIGSTOP:
+#if defined(USE_TIMERFD)
+               // Ours, for the deadline.  If it was overtaken, and
+               // there's time left, it's come too late to matter.
+               //
+               if (stopsPending)
+               {
+                  --stopsPending;
+                  if (deadline && dbg::MonotonicTime() < deadline)
+                  {
+                     if (ptrace(ResumeOp(lastStep), tid, (caddr_t)1, 0))
+                        ERROR_SET(err, errno, errno);
+                     goto retry;
+                  }
+                  timedOut = true;
+                  goto exit;
+               }
+#endif
+               break;
+            case SIGINT:
                break;
             default:
+               // Straight back in, with the signal or without it.
+               // Timer signals can come thousands of times a second, so
+               // the quiet ones don't get so much as a message.
+               //
+               switch (GetSignalPolicy(sig))
+               {
+               case dbg::SignalPrint:
+                  if (EventCallbacks.Get())
+                  {
+                     EventCallbacks->OnMessage(
+                        err,
+                        "Passing signal %s\n",
+                        FormatSignal(namebuf, sizeof(namebuf), sig)
+                     );
+                     ERROR_CHECK(err);
+                  }
+                  // fall through ...
+               case dbg::SignalPass:
+                  if (ptrace(ResumeOp(lastStep), tid, (caddr_t)1, sig))
+                     ERROR_SET(err, errno, errno);
+                  goto retry;
+               case dbg::SignalSuppress:
+                  if (ptrace(ResumeOp(lastStep), tid, (caddr_t)1, 0))
+                     ERROR_SET(err, errno, errno);
+                  goto retry;
+               case dbg::SignalStop:
+                  break;
+               }
                pendingSignal = sig;
             }
 
@@ -433,7 +1358,7 @@ struct PtraceProcess : public dbg::Process
                ERROR_CHECK(err);
             }
          }
-         else if (lastStep == PT_CONTINUE)
+         else if (lastStep == PT_CONTINUE || TrappedOnBreakpoint())
          {
             // SIGTRAP after Go().  Likely breakpoint.
             //
@@ -458,15 +1383,36 @@ struct PtraceProcess : public dbg::Process
 
       MarkRegistersDirty();
 
-      r = ptrace(lastStep=PT_STEP, pid, (caddr_t)1, pendingSignal);
+      r = ptrace(lastStep=PT_STEP, tid, (caddr_t)1, pendingSignal);
       if (r)
          ERROR_SET(err, errno, errno);
 
-      Wait(err);
+      // Just this thread.  Anything the others do keeps for Go().
+      //
+      Wait(tid, true, err);
+      ERROR_CHECK(err);
+
+   exit:;
+   }
+
+#if defined(PT_STEPBLOCK)
+   void
+   StepBlock(error *err)
+   {
+      int r = 0;
+
+      MarkRegistersDirty();
+
+      r = ptrace(lastStep=PT_STEPBLOCK, tid, (caddr_t)1, pendingSignal);
+      if (r)
+         ERROR_SET(err, errno, errno);
+
+      Wait(tid, true, err);
       ERROR_CHECK(err);
 
    exit:;
    }
+#endif
 
    void
    Go(error *err)
@@ -475,7 +1421,8 @@ struct PtraceProcess : public dbg::Process
 
       MarkRegistersDirty();
 
-      r = ptrace(lastStep=PT_CONTINUE, pid, (caddr_t)1, pendingSignal);
+      lastStep = PT_CONTINUE;
+      r = ptrace(ResumeOp(lastStep), tid, (caddr_t)1, pendingSignal);
       if (r)
          ERROR_SET(err, errno, errno);
 
@@ -500,9 +1447,37 @@ struct PtraceProcess : public dbg::Process
    void
    Detach(error *err)
    {
-      if (ptrace(PT_DETACH, pid, (caddr_t)1, pendingSignal))
+#if defined(USE_THREADS)
+      for (auto t : threads)
+      {
+         if (t && t != tid)
+            DetachThread(t);
+      }
+#endif
+
+#if defined(USE_TIMERFD)
+      // A SIGCONT takes any stop still on its way with it.  Otherwise
+      // it would stop the target as soon as we'd gone.
+      //
+      if (stopsPending)
+         kill(pid, SIGCONT);
+#endif
+
+      if (ptrace(PT_DETACH, tid, (caddr_t)1, pendingSignal))
          ERROR_SET(err, errno, errno);
 
+#if defined(USE_STRACE)
+      // There's no taking a seccomp filter back.
+      //
+      if (filtered.size() && EventCallbacks.Get())
+      {
+         EventCallbacks->OnMessage(
+            err,
+            "The system calls traced by the target's seccomp filter will now fail with ENOSYS\n"
+         );
+      }
+#endif
+
       ClearPid();
    exit:;
    }
@@ -518,40 +1493,265 @@ struct PtraceProcess : public dbg::Process
    exit:;
    }
 
+#if defined(USE_FORK)
+
+   // Kills a process or thread and waits for it to go, so that Wait()
+   // never hears about it.
+   //
+   static void
+   Reap(pid_t t, bool signal = true)
+   {
+      int status = 0;
+
+      if (signal && kill(t, SIGKILL))
+         return;
+
+      while (waitpid(t, &status, __WALL) == t)
+      {
+         if (WIFEXITED(status) || WIFSIGNALED(status))
+            break;
+      }
+   }
+
+   int
+   Fork(int from, addr_t stub, error *err)
+   {
+      pid_t current = tid, child = -1;
+      reg_t saved;
+      addr_t sp = 0, scratch = 0, tidAddress = 0;
+      int status = 0;
+      dbg::SystemCall getTid = { SYS_prctl, { PR_GET_TID_ADDRESS }, 2 };
+      dbg::SystemCall clone = { SYS_clone, { 0 }, 5 };
+
+      if (!stub)
+         ERROR_SET(err, unknown, "Nowhere to make system calls from");
+
+      try
+      {
+         copies.reserve(copies.size() + 1);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      if (from)
+      {
+         if (std::find(copies.begin(), copies.end(), from) == copies.end())
+            ERROR_SET(err, unknown, "Not a copy of the target");
+         tid = from;
+         MarkRegistersDirty();
+      }
+      else if (pid < 0)
+      {
+         ERROR_SET(err, unknown, "No process to copy");
+      }
+
+      LoadAllRegisters(err);
+      ERROR_CHECK(err);
+      saved = registers;
+
+      GetRegister(DBG_SP, &sp, err);
+      ERROR_CHECK(err);
+
+      // Where the C library keeps the thread's ID (the kernel clears it
+      // when the thread exits), so that the copy's can go there, as
+      // with fork().  Not every kernel says.  It's written past the
+      // red zone, which nobody's using; read it through ptrace, since
+      // tid may not be the target.
+      //
+      scratch = (sp - 256) & ~(addr_t)(sizeof(addr_t) - 1);
+      getTid.args[1] = scratch;
+      Syscall(&getTid, 1, stub, err);
+      ERROR_CHECK(err);
+      if (!getTid.result)
+      {
+         errno = 0;
+         tidAddress = ptrace(PT_READ_D, tid, (caddr_t)scratch, 0);
+         if (errno)
+            tidAddress = 0;
+      }
+
+      // Nothing shared, and no signal for the parent when it exits, so
+      // the target's own wait() never sees it.
+      //
+      clone.args[0] = tidAddress ? CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID : 0;
+#if defined(__amd64__)
+      clone.args[3] = tidAddress;
+#else
+      clone.args[4] = tidAddress;
+#endif
+      cloned = -1;
+      Syscall(&clone, 1, stub, err);
+      ERROR_CHECK(err);
+      if (clone.result > (addr_t)-4096)
+         ERROR_SET(err, errno, -clone.result);
+
+      child = clone.result;
+      if (cloned != child)
+      {
+         Reap(child);
+         child = -1;
+         ERROR_SET(err, unknown, "The copy wasn't traced");
+      }
+
+      // It's traced from the start, and stops first with a SIGSTOP.
+      //
+      if (waitpid(child, &status, __WALL) < 0 || !WIFSTOPPED(status))
+         ERROR_SET(err, unknown, "The copy didn't stop");
+
+      // It returns from the call as the original did.  Put it back to
+      // before.
+      //
+      tid = child;
+      registers = saved;
+      StoreAllRegisters(err);
+      ERROR_CHECK(err);
+
+      copies.push_back(child);
+   exit:
+      if (ERROR_FAILED(err) && child > 0)
+         Reap(child);
+      tid = current;
+      MarkRegistersDirty();
+      return ERROR_FAILED(err) ? -1 : child;
+   }
+
+   void
+   Switch(int copy, error *err)
+   {
+      auto it = std::find(copies.begin(), copies.end(), copy);
+#if defined(USE_STRACE)
+      std::vector<bool> filter;
+#endif
+
+      if (it == copies.end())
+         ERROR_SET(err, unknown, "Not a copy of the target");
+
+      try
+      {
+         threads.reserve(1);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      copies.erase(it);
+
+      // The leader isn't reported until the rest of its threads have
+      // been reaped.
+      //
+      if (pid >= 0)
+      {
+         kill(pid, SIGKILL);
+         for (auto t = threads.rbegin(); t != threads.rend(); ++t)
+         {
+            if (*t)
+               Reap(*t, false);
+         }
+      }
+#if defined(USE_STRACE)
+      // The copy has the target's filter.
+      //
+      std::swap(filter, filtered);
+#endif
+      ClearPid();
+#if defined(USE_STRACE)
+      std::swap(filter, filtered);
+      UpdateTraceAll();
+#endif
+
+      pid = tid = copy;
+      threads.push_back(copy);
+      pendingSignal = 0;
+      lastStep = PT_STEP;
+      MarkRegistersDirty();
+
+      if (ptrace(PT_SETOPTIONS, pid, 0, (void*)TraceOptions()))
+         ERROR_SET(err, errno, errno);
+
+      OpenMemory();
+   exit:;
+   }
+
+   void
+   Discard(int copy, error *err)
+   {
+      auto it = std::find(copies.begin(), copies.end(), copy);
+
+      if (it == copies.end())
+         ERROR_SET(err, unknown, "Not a copy of the target");
+
+      copies.erase(it);
+      Reap(copy);
+   exit:;
+   }
+
+#endif
+
    void
    OnAttach(error *err)
    {
+      tid = pid;
+
+      // Whatever the last process was doing, this one's first stop
+      // isn't a breakpoint.
+      //
+      lastStep = PT_STEP;
+
       Wait(err);
       ERROR_CHECK(err);
 
-#if defined(USE_PROC_MEM)
+#if defined(USE_THREADS)
+      try
       {
-         char buf[1024];
-
-         snprintf(buf, sizeof(buf), "/proc/%" PID_T_FMT "/mem", pid);
-         memfd = open(buf, O_RDWR);
-         if (memfd < 0)
-         {
-            int r = errno;
-            error innerErr;
-            error_set_errno(&innerErr, r);
-            auto errString = error_get_string(&innerErr);
-            log_printf(
-               "Failed to open %s%s%s%s, will use slower ptrace interface",
-               buf,
-               errString ? " (" : "",
-               errString ? errString : "",
-               errString ? ")" : ""
-            );
-         }
+         threads.push_back(pid);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
       }
+
+      if (ptrace(PT_SETOPTIONS, pid, 0, (void*)TraceOptions()))
+         ERROR_SET(err, errno, errno);
+
+      AttachThreads(err);
+      ERROR_CHECK(err);
 #endif
 
+      OpenMemory();
+
       DetectModules(err);
       ERROR_CHECK(err);
    exit:;
    }
 
+   void
+   OpenMemory()
+   {
+#if defined(USE_PROC_MEM)
+      char buf[1024];
+
+      snprintf(buf, sizeof(buf), "/proc/%" PID_T_FMT "/mem", pid);
+      memfd = open(buf, O_RDWR);
+      if (memfd < 0)
+      {
+         int r = errno;
+         error innerErr;
+         error_set_errno(&innerErr, r);
+         auto errString = error_get_string(&innerErr);
+         log_printf(
+            "Failed to open %s%s%s%s, will use slower ptrace interface",
+            buf,
+            errString ? " (" : "",
+            errString ? errString : "",
+            errString ? ")" : ""
+         );
+      }
+#endif
+   }
+
    bool
    IsAttached()
    {
@@ -569,10 +1769,57 @@ struct PtraceProcess : public dbg::Process
    exit:;
    }
 
+#if defined(USE_SECCOMP)
+
+   // A seccomp filter that has the calls being traced stop for us, and
+   // lets everything else through.  A jump can only go 255
+   // instructions, so each call gets its own return.
+   //
+   void
+   BuildFilter(std::vector<struct sock_filter> &prog)
+   {
+      prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)));
+      prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SECCOMP_ARCH, 1, 0));
+      prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+      prog.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)));
+
+      for (size_t nr = 0; nr < traced.size(); ++nr)
+      {
+         if (!traced[nr])
+            continue;
+         prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)nr, 0, 1));
+         prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+      }
+
+      prog.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+   }
+
+#endif
+
    void
    Create(char *const *argv, error *err)
    {
       pid_t pid = 0;
+#if defined(USE_SECCOMP)
+      std::vector<struct sock_filter> prog;
+      struct sock_fprog fprog;
+      int status = 0;
+
+      // Built before the fork: the child shouldn't allocate.
+      //
+      try
+      {
+         if (std::find(traced.begin(), traced.end(), true) != traced.end())
+            BuildFilter(prog);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+      memset(&fprog, 0, sizeof(fprog));
+      fprog.len = prog.size();
+      fprog.filter = prog.data();
+#endif
 
       pid = fork();
       if (!pid)
@@ -580,6 +1827,19 @@ struct PtraceProcess : public dbg::Process
          closefrom(3);
          setpgid(0, 0);
          int r = ptrace(PT_TRACE_ME, 0, 0, 0);
+#if defined(USE_SECCOMP)
+         // Stop first, so that PTRACE_O_TRACESECCOMP is set by the
+         // time the filter needs it.  Without privileges, installing
+         // one takes no_new_privs, so set-user-ID programs stay as
+         // they are.
+         //
+         if (!r && fprog.len)
+            r = raise(SIGSTOP);
+         if (!r && fprog.len)
+            r = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+         if (!r && fprog.len)
+            r = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &fprog);
+#endif
          if (!r)
             r = execvp(*argv, argv);
          exit(r);
@@ -587,6 +1847,33 @@ struct PtraceProcess : public dbg::Process
       else if (pid > 0)
       {
          this->pid = pid;
+#if defined(USE_SECCOMP)
+         if (fprog.len)
+         {
+            if (waitpid(pid, &status, 0) < 0)
+               ERROR_SET(err, errno, errno);
+            if (!WIFSTOPPED(status))
+            {
+               ClearPid();
+               ERROR_SET(err, unknown, "Process exited during start");
+            }
+
+            try
+            {
+               filtered = traced;
+            }
+            catch (std::bad_alloc)
+            {
+               ERROR_SET(err, nomem);
+            }
+            UpdateTraceAll();
+
+            if (ptrace(PT_SETOPTIONS, pid, 0, (void*)TraceOptions()))
+               ERROR_SET(err, errno, errno);
+            if (ptrace(PT_CONTINUE, pid, (caddr_t)1, 0))
+               ERROR_SET(err, errno, errno);
+         }
+#endif
          OnAttach(err);
          ERROR_CHECK(err);
       }
@@ -612,9 +1899,9 @@ struct PtraceProcess : public dbg::Process
       if (registersDirty)
       {
 #ifdef GETREGS_REVERSED
-         if (ptrace(PT_GETREGS, pid, 0, &registers))
+         if (ptrace(PT_GETREGS, tid, 0, &registers))
 #else
-         if (ptrace(PT_GETREGS, pid, (caddr_t)&registers, 1))
+         if (ptrace(PT_GETREGS, tid, (caddr_t)&registers, 1))
 #endif
             ERROR_SET(err, errno, errno);
          registersDirty = false;
@@ -626,9 +1913,9 @@ struct PtraceProcess : public dbg::Process
    StoreAllRegisters(error *err)
    {
 #ifdef GETREGS_REVERSED
-      if (ptrace(PT_SETREGS, pid, 0, &registers))
+      if (ptrace(PT_SETREGS, tid, 0, &registers))
 #else
-      if (ptrace(PT_SETREGS, pid, (caddr_t)&registers, 1))
+      if (ptrace(PT_SETREGS, tid, (caddr_t)&registers, 1))
 #endif
       {
          // If that failed, our reg cache is now dirty.
@@ -652,6 +1939,19 @@ struct PtraceProcess : public dbg::Process
    ClearPid()
    {
       pid = -1;
+      tid = -1;
+#if defined(USE_TIMERFD)
+      stopsPending = 0;
+#endif
+#if defined(USE_THREADS)
+      threads.clear();
+      starting.clear();
+#endif
+#if defined(USE_STRACE)
+      filtered.clear();
+      inSyscall.clear();
+      UpdateTraceAll();
+#endif
 
 #if defined(USE_PROC_MEM)
       if (memfd >= 0)
@@ -755,6 +2055,9 @@ struct PtraceProcess : public dbg::Process
    {
       FILE *procmap = open_procmap(pid);
       char read_buffer[4096];
+      char last_path[sizeof(read_buffer)] = {0};
+      uint64_t last_base = 0;
+      bool last_reported = true;
 
       if (!procmap)
          ERROR_SET(err, errno, errno);
@@ -791,9 +2094,30 @@ struct PtraceProcess : public dbg::Process
          sscanf(range, "%" PRIX64 "-", &start_addr);
          sscanf(offset_string, "%" PRIX64, &offset);
 
-         if (offset || perms[2] != 'x')
+         // With -z separate-code (the default for a while now) the
+         // mapping with the headers is not executable, and the text
+         // comes at some later offset.  Remember where each file
+         // starts so that we can report that as the base.
+         //
+         if (!offset)
+         {
+            last_base = start_addr;
+            last_reported = false;
+            snprintf(last_path, sizeof(last_path), "%s", path);
+         }
+
+         if (perms[2] != 'x')
             continue;
 
+         if (offset)
+         {
+            if (last_reported || !*path || strcmp(path, last_path))
+               continue;
+            start_addr = last_base;
+         }
+
+         last_reported = true;
+
          if (!*path)
             path = NULL;
 
@@ -0,0 +1,703 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/record.h>
+#include <dbg/dbg.h>
+#include <dbg/arch.h>
+
+#include <common/c++/new.h>
+#include <common/misc.h>
+
+#include <algorithm>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+using dbg::addr_t;
+
+namespace {
+
+const char Magic[8] = { 'D', 'B', 'G', 'R', 'E', 'C', 'O', 'R' };
+const uint32_t Version = 1;
+
+// Chunks go to the writer at about this size.  Past MaxQueued of them
+// waiting, stepping waits too.
+//
+const size_t ChunkSize = 256 * 1024;
+const size_t MaxQueued = 64;
+
+// Much bigger than anything we write.  Past this the record is corrupt.
+//
+const uint32_t MaxChunk = 64 * 1024 * 1024;
+
+const int MaxInstruction = 16;
+const size_t PageSize = 4096;
+
+void
+WriteAll(int fd, const unsigned char *p, size_t len, int *failed)
+{
+   while (len)
+   {
+      ssize_t r = write(fd, p, len);
+      if (r < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         *failed = errno;
+         break;
+      }
+      p += r;
+      len -= r;
+   }
+}
+
+void
+GetRegisters(dbg::Debugger *dbg, std::vector<addr_t> &regs, error *err)
+{
+   int n = dbg->cpu->GetRegisterCount();
+
+   try
+   {
+      regs.resize(n);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   for (int i=0; i<n; ++i)
+   {
+      regs[i] = 0;
+      dbg->proc->GetRegister(i, &regs[i], err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+PutVarint(std::vector<unsigned char> &out, uint64_t v)
+{
+   while (v >= 0x80)
+   {
+      out.push_back((unsigned char)(v | 0x80));
+      v >>= 7;
+   }
+   out.push_back((unsigned char)v);
+}
+
+// Small changes either way come out small.
+//
+void
+PutChange(std::vector<unsigned char> &out, uint64_t from, uint64_t to)
+{
+   int64_t d = (int64_t)(to - from);
+   PutVarint(out, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+}
+
+bool
+GetVarint(const unsigned char *&p, const unsigned char *end, uint64_t *v)
+{
+   *v = 0;
+   for (int shift=0; p < end && shift < 64; shift += 7)
+   {
+      unsigned char c = *p++;
+
+      *v |= (uint64_t)(c & 0x7f) << shift;
+      if (!(c & 0x80))
+         return true;
+   }
+   return false;
+}
+
+bool
+GetChange(const unsigned char *&p, const unsigned char *end, addr_t *v)
+{
+   uint64_t z = 0;
+
+   if (!GetVarint(p, end, &z))
+      return false;
+   *v = (addr_t)((uint64_t)*v + ((z >> 1) ^ -(z & 1)));
+   return true;
+}
+
+} // end namespace
+
+void
+dbg::StepCapture::Step(Debugger *dbg, error *err)
+{
+   unsigned char text[MaxInstruction];
+   int len = sizeof(text);
+   addr_t pc = 0;
+
+   writes.clear();
+   data.clear();
+   ranges.clear();
+
+   GetRegisters(dbg, before, err);
+   ERROR_CHECK(err);
+   pc = before[DBG_IP];
+
+   dbg->ReadMemory(pc, len, text, err);
+   if (ERROR_FAILED(err))
+   {
+      // Maybe the code ends short of a whole buffer.
+      //
+      error_clear(err);
+      len = MIN(len, (int)(PageSize - pc % PageSize));
+      dbg->ReadMemory(pc, len, text, err);
+      ERROR_CHECK(err);
+   }
+
+   dbg->cpu->GetMemoryOperands(dbg->proc.Get(), text, len, pc, ranges, err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      for (auto &r : ranges)
+      {
+         Write w = { r.addr, (uint32_t)r.len, data.size(), data.size() + r.len };
+         error readErr;
+
+         data.resize(data.size() + 2 * r.len);
+
+         // Where we can't read, the instruction can't write either
+         // without faulting.
+         //
+         dbg->ReadMemory(r.addr, r.len, &data[w.old], &readErr);
+         if (ERROR_FAILED(&readErr))
+         {
+            data.resize(w.old);
+            continue;
+         }
+         writes.push_back(w);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->Step(err);
+   ERROR_CHECK(err);
+
+   if (!dbg->proc->IsAttached())
+   {
+      try
+      {
+         after = before;
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+      writes.clear();
+      goto exit;
+   }
+
+   GetRegisters(dbg, after, err);
+   ERROR_CHECK(err);
+
+   for (auto &w : writes)
+   {
+      const unsigned char *old = &data[w.old], *now = &data[w.now];
+      uint32_t first = 0, last = w.len;
+      error readErr;
+
+      // Gone from under it (eg. munmap), so there's nothing to say.
+      //
+      dbg->ReadMemory(w.addr, w.len, &data[w.now], &readErr);
+      if (ERROR_FAILED(&readErr))
+      {
+         w.len = 0;
+         continue;
+      }
+
+      while (first < last && old[first] == now[first])
+         ++first;
+      while (last > first && old[last - 1] == now[last - 1])
+         --last;
+
+      w.addr += first;
+      w.old += first;
+      w.now += first;
+      w.len = last - first;
+   }
+
+   writes.erase(
+      std::remove_if(
+         writes.begin(),
+         writes.end(),
+         [] (const Write &w) -> bool { return !w.len; }
+      ),
+      writes.end()
+   );
+exit:;
+}
+
+void
+dbg::RecordEncoder::Append(const StepCapture &step, error *err)
+{
+   try
+   {
+      if (!steps)
+      {
+         RecordChunk hdr;
+
+         memset(&hdr, 0, sizeof(hdr));
+         chunk.clear();
+         chunk.insert(chunk.end(), (unsigned char*)&hdr, (unsigned char*)(&hdr + 1));
+
+         for (auto reg : step.before)
+         {
+            uint64_t v = reg;
+            chunk.insert(chunk.end(), (unsigned char*)&v, (unsigned char*)(&v + 1));
+         }
+         regs = step.before;
+         lastWrite = 0;
+      }
+
+      uint64_t mask = 0;
+
+      PutChange(chunk, regs[DBG_IP], step.after[DBG_IP]);
+
+      for (size_t i=0; i<regs.size(); ++i)
+      {
+         if (i != DBG_IP && regs[i] != step.after[i])
+            mask |= (uint64_t)1 << i;
+      }
+      PutVarint(chunk, mask);
+      for (size_t i=0; i<regs.size(); ++i)
+      {
+         if (mask & ((uint64_t)1 << i))
+            PutChange(chunk, regs[i], step.after[i]);
+      }
+
+      PutVarint(chunk, step.writes.size());
+      for (auto &w : step.writes)
+      {
+         PutChange(chunk, lastWrite, w.addr);
+         PutVarint(chunk, w.len);
+         chunk.insert(chunk.end(), &step.data[w.old], &step.data[w.old] + w.len);
+         chunk.insert(chunk.end(), &step.data[w.now], &step.data[w.now] + w.len);
+         lastWrite = w.addr;
+      }
+
+      regs = step.after;
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   ++steps;
+   ++total;
+exit:;
+}
+
+void
+dbg::RecordEncoder::Seal()
+{
+   RecordChunk hdr;
+
+   if (!steps)
+      return;
+
+   hdr.len = chunk.size() - sizeof(hdr);
+   hdr.steps = steps;
+   hdr.first = total - steps;
+   memcpy(chunk.data(), &hdr, sizeof(hdr));
+}
+
+void
+dbg::RecordEncoder::Finish(std::vector<unsigned char> &out)
+{
+   out.clear();
+   if (!steps)
+      return;
+
+   Seal();
+   std::swap(out, chunk);
+   steps = 0;
+}
+
+void
+dbg::RecordDecoder::Start(
+   const unsigned char *chunk,
+   size_t len,
+   int registers,
+   error *err
+)
+{
+   RecordChunk hdr;
+
+   if (len < sizeof(hdr))
+      ERROR_SET(err, unknown, "Execution record is corrupt");
+   memcpy(&hdr, chunk, sizeof(hdr));
+   if (hdr.len != len - sizeof(hdr) || hdr.len < registers * sizeof(uint64_t))
+      ERROR_SET(err, unknown, "Execution record is corrupt");
+
+   try
+   {
+      regs.resize(registers);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   p = chunk + sizeof(hdr);
+   end = chunk + len;
+   for (int i=0; i<registers; ++i)
+   {
+      uint64_t v = 0;
+
+      memcpy(&v, p, sizeof(v));
+      regs[i] = v;
+      p += sizeof(v);
+   }
+
+   lastWrite = 0;
+   left = hdr.steps;
+exit:;
+}
+
+bool
+dbg::RecordDecoder::Next(StepCapture &step, error *err)
+{
+   uint64_t mask = 0, nwrites = 0;
+   bool r = false;
+
+   if (!left)
+      goto exit;
+
+   step.writes.clear();
+   step.data.clear();
+
+   try
+   {
+      step.before = regs;
+
+      if (!GetChange(p, end, &regs[DBG_IP]) || !GetVarint(p, end, &mask))
+         ERROR_SET(err, unknown, "Execution record is corrupt");
+      for (size_t i=0; i<regs.size(); ++i)
+      {
+         if ((mask & ((uint64_t)1 << i)) && !GetChange(p, end, &regs[i]))
+            ERROR_SET(err, unknown, "Execution record is corrupt");
+      }
+
+      step.after = regs;
+
+      if (!GetVarint(p, end, &nwrites))
+         ERROR_SET(err, unknown, "Execution record is corrupt");
+      for (uint64_t i=0; i<nwrites; ++i)
+      {
+         StepCapture::Write w;
+         uint64_t len = 0;
+
+         if (!GetChange(p, end, &lastWrite) ||
+             !GetVarint(p, end, &len) ||
+             len > (uint64_t)(end - p) / 2)
+         {
+            ERROR_SET(err, unknown, "Execution record is corrupt");
+         }
+
+         w.addr = lastWrite;
+         w.len = len;
+         w.old = step.data.size();
+         w.now = w.old + len;
+         step.data.insert(step.data.end(), p, p + 2 * len);
+         step.writes.push_back(w);
+         p += 2 * len;
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   --left;
+   r = true;
+exit:
+   return r;
+}
+
+void
+dbg::Recorder::Open(Debugger *dbg, const char *path, error *err)
+{
+   RecordHeader hdr;
+   sigset_t all, old;
+   bool started = false;
+
+   Close(err);
+   ERROR_CHECK(err);
+
+   fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      ERROR_SET(err, errno, errno);
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, Magic, sizeof(hdr.magic));
+   hdr.version = Version;
+   hdr.registers = dbg->cpu->GetRegisterCount();
+
+   WriteAll(fd, (const unsigned char*)&hdr, sizeof(hdr), &failed);
+   if (failed)
+      ERROR_SET(err, errno, failed);
+
+   encoder = RecordEncoder();
+   closing = false;
+   written = sizeof(hdr);
+
+   // The writer takes no signals.  The thread that waits for the
+   // target blocks SIGCHLD to read it from a signalfd, and a SIGCHLD
+   // delivered here instead would be lost.
+   //
+   sigfillset(&all);
+   if ((errno = pthread_sigmask(SIG_SETMASK, &all, &old)))
+      ERROR_SET(err, errno, errno);
+   try
+   {
+      writer = std::thread([this] () -> void { WriteChunks(); });
+      started = true;
+   }
+   catch (std::system_error)
+   {
+   }
+   pthread_sigmask(SIG_SETMASK, &old, nullptr);
+   if (!started)
+      ERROR_SET(err, unknown, "Couldn't start the writer thread");
+exit:
+   if (ERROR_FAILED(err) && fd >= 0)
+   {
+      close(fd);
+      fd = -1;
+      failed = 0;
+   }
+}
+
+void
+dbg::Recorder::Close(error *err)
+{
+   if (fd < 0)
+      goto exit;
+
+   Flush(err);
+
+   {
+      std::lock_guard<std::mutex> hold(lock);
+      closing = true;
+   }
+   cond.notify_all();
+   if (writer.joinable())
+      writer.join();
+
+   close(fd);
+   fd = -1;
+   queue.clear();
+
+   if (failed && !ERROR_FAILED(err))
+   {
+      int e = failed;
+      failed = 0;
+      ERROR_SET(err, errno, e);
+   }
+   failed = 0;
+exit:;
+}
+
+void
+dbg::Recorder::Flush(error *err)
+{
+   std::vector<unsigned char> out;
+   int e = 0;
+
+   encoder.Finish(out);
+   if (!out.size())
+      goto exit;
+
+   {
+      std::unique_lock<std::mutex> hold(lock);
+
+      while (queue.size() >= MaxQueued && !failed)
+         cond.wait(hold);
+
+      e = failed;
+      if (!e)
+      {
+         try
+         {
+            queue.push_back(std::move(out));
+         }
+         catch (std::bad_alloc)
+         {
+            e = ENOMEM;
+         }
+      }
+   }
+   if (e)
+      ERROR_SET(err, errno, e);
+
+   cond.notify_all();
+exit:;
+}
+
+void
+dbg::Recorder::Step(Debugger *dbg, error *err)
+{
+   if (fd < 0)
+      ERROR_SET(err, unknown, "Not recording");
+
+   step.Step(dbg, err);
+   ERROR_CHECK(err);
+   if (!dbg->proc->IsAttached())
+      goto exit;
+
+   // Something else moved the registers since the last step.
+   //
+   if (encoder.steps && !encoder.Follows(step))
+   {
+      Flush(err);
+      ERROR_CHECK(err);
+   }
+
+   encoder.Append(step, err);
+   ERROR_CHECK(err);
+
+   if (encoder.chunk.size() >= ChunkSize)
+   {
+      Flush(err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+dbg::Recorder::WriteChunks()
+{
+   for (;;)
+   {
+      std::vector<unsigned char> chunk;
+      int e = 0;
+
+      {
+         std::unique_lock<std::mutex> hold(lock);
+
+         while (!queue.size() && !closing)
+            cond.wait(hold);
+         if (!queue.size())
+            break;
+
+         std::swap(chunk, queue.front());
+         queue.pop_front();
+      }
+
+      WriteAll(fd, chunk.data(), chunk.size(), &e);
+
+      {
+         std::lock_guard<std::mutex> hold(lock);
+
+         if (e)
+         {
+            failed = e;
+            queue.clear();
+         }
+         else
+         {
+            written += chunk.size();
+         }
+      }
+      cond.notify_all();
+
+      if (e)
+         break;
+   }
+}
+
+dbg::RecordReader::~RecordReader()
+{
+   if (file)
+      fclose(file);
+}
+
+void
+dbg::RecordReader::Open(const char *path, error *err)
+{
+   RecordHeader hdr;
+
+   if (file)
+      fclose(file);
+
+   file = fopen(path, "rb");
+   if (!file)
+      ERROR_SET(err, errno, errno);
+
+   if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+       memcmp(hdr.magic, Magic, sizeof(hdr.magic)))
+   {
+      ERROR_SET(err, unknown, "Not an execution record");
+   }
+   if (hdr.version != Version)
+      ERROR_SET(err, unknown, "Unsupported execution record version");
+   if (hdr.registers <= DBG_IP || hdr.registers > 64)
+      ERROR_SET(err, unknown, "Execution record is corrupt");
+
+   registers = hdr.registers;
+exit:;
+}
+
+void
+dbg::RecordReader::Read(
+   std::function<void(uint64_t n, const StepCapture &step, error *err)> onStep,
+   error *err
+)
+{
+   RecordDecoder decoder;
+
+   for (;;)
+   {
+      RecordChunk hdr;
+      uint64_t n = 0;
+      size_t got = fread(&hdr, 1, sizeof(hdr), file);
+
+      if (!got && feof(file))
+         break;
+      if (got != sizeof(hdr) || hdr.len > MaxChunk)
+         ERROR_SET(err, unknown, "Execution record is truncated or corrupt");
+
+      try
+      {
+         chunk.resize(sizeof(hdr) + hdr.len);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+      memcpy(chunk.data(), &hdr, sizeof(hdr));
+      if (hdr.len && fread(chunk.data() + sizeof(hdr), hdr.len, 1, file) != 1)
+         ERROR_SET(err, unknown, "Execution record is truncated or corrupt");
+
+      decoder.Start(chunk.data(), chunk.size(), registers, err);
+      ERROR_CHECK(err);
+
+      for (n = hdr.first; decoder.Next(step, err); ++n)
+      {
+         onStep(n, step, err);
+         ERROR_CHECK(err);
+      }
+      ERROR_CHECK(err);
+   }
+
+   if (ferror(file))
+      ERROR_SET(err, errno, errno);
+exit:;
+}
@@ -1,49 +1,1159 @@
 #include <dbg/shell.h>
+#include <common/c++/new.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+namespace {
+
+using namespace dbg;
+using namespace dbg::shell;
+
+// Takes anything BreakpointLocation::Parse() does, or an address,
+// optionally followed by a condition.  Quotes around the condition are
+// optional.
+//
+void
+ParseBreakpoint(
+   CommandState &st,
+   const char *where,
+   const char *cond,
+   BreakpointLocation &loc,
+   error *err
+)
+{
+   std::string text;
+   size_t len = 0;
+
+   if (!loc.Parse(where, err))
+   {
+      ERROR_CHECK(err);
+
+      loc.module.clear();
+      loc.symbol.clear();
+      st.ParseBinaryArg(where, &loc.offset, sizeof(loc.offset), err);
+      ERROR_CHECK(err);
+   }
+
+   loc.condition = nullptr;
+
+   while (cond && isspace((unsigned char)*cond))
+      ++cond;
+   if (!cond || !*cond)
+      goto exit;
+
+   len = strlen(cond);
+   while (len && isspace((unsigned char)cond[len-1]))
+      --len;
+   if (len >= 2 && cond[0] == '"' && cond[len-1] == '"')
+   {
+      ++cond;
+      len -= 2;
+   }
+
+   try
+   {
+      text.assign(cond, len);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   New(loc.condition, err);
+   ERROR_CHECK(err);
+   loc.condition->Compile(st.dbg->cpu.Get(), text.c_str(), err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+// As in a breakpoint file: -t if the condition is to be checked in the
+// target, the location, then the condition if any.
+//
+void
+ParseBreakpoint(CommandState &st, const char *line, BreakpointLocation &loc, error *err)
+{
+   std::string where;
+   const char *cond = nullptr;
+   bool inTarget = false;
+
+   if (!strncmp(line, "-t", 2) && isspace((unsigned char)line[2]))
+   {
+      inTarget = true;
+      for (line += 2; isspace((unsigned char)*line); ++line)
+         ;
+   }
+   cond = line + strcspn(line, " \t");
+
+   try
+   {
+      where.assign(line, cond - line);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   ParseBreakpoint(st, where.c_str(), cond, loc, err);
+   ERROR_CHECK(err);
+
+   if (inTarget && !loc.condition.Get())
+      ERROR_SET(err, unknown, "-t needs a condition");
+   loc.inTarget = inTarget;
+exit:;
+}
+
+// The thread a "~N" prefix names, or 0 without one.
+//
+int
+GetThreadArg(CommandState &st, error *err)
+{
+   std::vector<int> threads;
+   int r = 0;
+
+   if (st.thread < 0)
+      goto exit;
+
+   st.dbg->proc->GetThreads(threads, err);
+   ERROR_CHECK(err);
+
+   if (!threads.size())
+      ERROR_SET(err, unknown, "Threads aren't supported on this platform");
+   if (st.thread >= (int)threads.size() || !threads[st.thread])
+      ERROR_SET(err, unknown, "No such thread");
+
+   r = threads[st.thread];
+exit:
+   return r;
+}
+
+// How bl shows the thread a breakpoint is for: its number if it's
+// still around.
+//
+void
+FormatThread(CommandState &st, int tid, char *buf, size_t len, error *err)
+{
+   std::vector<int> threads;
+
+   st.dbg->proc->GetThreads(threads, err);
+   ERROR_CHECK(err);
+
+   for (size_t i=0; i<threads.size(); ++i)
+   {
+      if (threads[i] == tid)
+      {
+         snprintf(buf, len, "~%d", (int)i);
+         goto exit;
+      }
+   }
+   snprintf(buf, len, "thread %d (gone)", tid);
+exit:;
+}
+
+void
+SetBreakpoint(CommandState &st, const char *line, error *err)
+{
+   BreakpointLocation loc;
+
+   ParseBreakpoint(st, line, loc, err);
+   ERROR_CHECK(err);
+
+   st.dbg->SetBreakpoint(loc, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+// How to write a breakpoint down so that it means the same thing next
+// time, when everything may have moved.
+//
+void
+DescribeBreakpoint(CommandState &st, BreakpointLocation *bp, std::string &out, error *err)
+{
+   BreakpointLocation loc;
+   Module *mod = nullptr;
+   const char *name = nullptr;
+
+   if (!bp->IsAddress())
+   {
+      bp->Format(out, err);
+      goto exit;
+   }
+
+   mod = st.dbg->modules.Lookup(bp->offset);
+   if (mod)
+   {
+      name = strrchr(mod->path.c_str(), '/');
+      name = name ? name + 1 : mod->path.c_str();
+   }
+
+   if (name && *name)
+   {
+      try
+      {
+         loc.module = name;
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+      loc.offset = bp->offset - mod->base;
+      loc.Format(out, err);
+      ERROR_CHECK(err);
+   }
+   else
+   {
+      bp->Format(out, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+// Collects the breakpoints named by the arguments: IDs, locations, or
+// * for all of them.
+//
+void
+GetBreakpointArgs(CommandState &st, std::vector<BreakpointLocation*> &out, error *err)
+{
+   out.clear();
+
+   try
+   {
+      for (size_t i=1; i<st.argv.size(); ++i)
+      {
+         BreakpointLocation loc;
+         BreakpointLocation *p = nullptr;
+         int id = 0;
+
+         if (st.argv[i] == "*")
+         {
+            for (auto &q : st.dbg->locations)
+               out.push_back(q.get());
+            continue;
+         }
+
+         if (loc.Parse(st.argv[i].c_str(), err))
+         {
+            p = st.dbg->FindBreakpointLocation(loc);
+         }
+         else
+         {
+            ERROR_CHECK(err);
+            st.ParseBinaryArg(i, &id, sizeof(id), err);
+            ERROR_CHECK(err);
+            p = st.dbg->FindBreakpoint(id);
+         }
+
+         if (!p)
+            ERROR_SET(err, unknown, "No such breakpoint");
+         out.push_back(p);
+      }
+
+      std::sort(out.begin(), out.end());
+      out.erase(std::unique(out.begin(), out.end()), out.end());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+FormatTime(const struct timeval &tv, char *buf, size_t len)
+{
+   struct tm tm;
+   time_t t = tv.tv_sec;
+   size_t n = 0;
+
+   localtime_r(&t, &tm);
+   n = strftime(buf, len, "%H:%M:%S", &tm);
+   snprintf(buf + n, len - n, ".%03d", (int)(tv.tv_usec / 1000));
+}
+
+// What a breakpoint has cost, for bl -v.
+//
+void
+PrintBreakpointStats(CommandState &st, BreakpointLocation *loc, error *err)
+{
+   char stopped[32], avg[32], max[32], cond[32], step[32];
+
+   FormatDuration(loc->stoppedTime, stopped, sizeof(stopped));
+   FormatDuration(loc->traps ? loc->stoppedTime / loc->traps : 0, avg, sizeof(avg));
+   FormatDuration(loc->maxStopped, max, sizeof(max));
+   FormatDuration(loc->conditionTime, cond, sizeof(cond));
+   FormatDuration(loc->stepTime, step, sizeof(step));
+
+   st.dbg->proc->EventCallbacks->OnMessage(
+      err,
+      "       traps %lu, stopped %s (avg %s, max %s), condition %s, step-over %s\n",
+      loc->traps,
+      stopped,
+      avg,
+      max,
+      cond,
+      step
+   );
+}
+
+struct FileEntry
+{
+   int lineNo;
+   std::string text;
+};
+
+// Reads a file of breakpoints, one per line, in any form "bp" takes.
+// Blank lines and lines starting with # are skipped.
+//
+void
+ReadBreakpointFile(const char *path, std::vector<FileEntry> &out, error *err)
+{
+   FILE *file = nullptr;
+   char line[4096];
+   int lineNo = 0;
+
+   file = fopen(path, "r");
+   if (!file)
+      ERROR_SET(err, errno, errno);
+
+   try
+   {
+      while (fgets(line, sizeof(line), file))
+      {
+         FileEntry e;
+         char *p = line;
+         char *q = nullptr;
+
+         ++lineNo;
+
+         while (isspace((unsigned char)*p))
+            ++p;
+         for (q = p + strlen(p); q > p && isspace((unsigned char)q[-1]); --q)
+            ;
+         *q = 0;
+
+         if (!*p || *p == '#')
+            continue;
+
+         e.lineNo = lineNo;
+         e.text = p;
+         out.push_back(std::move(e));
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   if (ferror(file))
+      ERROR_SET(err, errno, errno);
+exit:
+   if (file)
+      fclose(file);
+}
+
+void
+ReportLine(
+   CommandState &st,
+   const char *path,
+   const FileEntry &e,
+   error *lineErr,
+   error *err
+)
+{
+   auto errString = error_get_string(lineErr);
+   st.dbg->proc->EventCallbacks->OnMessage(
+      err,
+      "%s:%d: %s\n",
+      path,
+      e.lineNo,
+      errString ? errString : "Failed to set breakpoint"
+   );
+}
+
+void
+SetEachBreakpoint(
+   CommandState &st,
+   const char *path,
+   const std::vector<const FileEntry*> &entries,
+   error *err
+)
+{
+   for (auto e : entries)
+   {
+      error lineErr;
+
+      SetBreakpoint(st, e->text.c_str(), &lineErr);
+      if (ERROR_FAILED(&lineErr))
+      {
+         ReportLine(st, path, *e, &lineErr, err);
+         ERROR_CHECK(err);
+      }
+   }
+exit:;
+}
+
+//
+// Sets everything in a breakpoint file with as few trips to the target
+// as we can manage.  Strict mode is all or nothing.  Otherwise bad
+// lines are reported and skipped, and if the batch fails we retry one
+// at a time so that the rest still get set.
+//
+void
+LoadBreakpoints(CommandState &st, const char *path, bool strict, error *err)
+{
+   std::vector<FileEntry> entries;
+   std::vector<BreakpointLocation> locs;
+   std::vector<const FileEntry*> parsed;
+   error batchErr;
+
+   ReadBreakpointFile(path, entries, err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      for (auto &e : entries)
+      {
+         BreakpointLocation loc;
+         error lineErr;
+
+         ParseBreakpoint(st, e.text.c_str(), loc, &lineErr);
+         if (!ERROR_FAILED(&lineErr))
+         {
+            locs.push_back(std::move(loc));
+            parsed.push_back(&e);
+            continue;
+         }
+
+         ReportLine(st, path, e, &lineErr, err);
+         ERROR_CHECK(err);
+         if (strict)
+            ERROR_SET(err, unknown, "Failed to parse breakpoint file");
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   if (strict)
+   {
+      st.dbg->SetBreakpoints(locs, err);
+      ERROR_CHECK(err);
+      goto exit;
+   }
+
+   st.dbg->SetBreakpoints(locs, &batchErr);
+   if (ERROR_FAILED(&batchErr))
+   {
+      SetEachBreakpoint(st, path, parsed, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+// The tracepoint, then each item as recorded.
+//
+void
+FormatTraceRecord(
+   const Tracepoint *tp,
+   const unsigned char *data,
+   std::string &line,
+   error *err
+)
+{
+   char buf[64];
+
+   try
+   {
+      snprintf(buf, sizeof(buf), "%d:", tp->id);
+      line += buf;
+
+      for (auto &item : tp->items)
+      {
+         const unsigned char *p = data + item.offset;
+
+         line += ' ';
+         line += item.text;
+         line += '=';
+
+         if (!item.len)
+         {
+            addr_t value = 0;
+            memcpy(&value, p, sizeof(value));
+            snprintf(buf, sizeof(buf), "%llx", (unsigned long long)value);
+            line += buf;
+            continue;
+         }
+
+         for (uint32_t i=0; i<item.len; ++i)
+         {
+            snprintf(buf, sizeof(buf), i ? " %02x" : "%02x", p[i]);
+            line += buf;
+         }
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+void
+PrintTraceRecord(
+   CommandState &st,
+   const Tracepoint *tp,
+   const TraceRecord *rec,
+   error *err
+)
+{
+   std::string line;
+
+   FormatTraceRecord(tp, rec->data, line, err);
+   ERROR_CHECK(err);
+
+   st.dbg->proc->EventCallbacks->OnMessage(err, "%s\n", line.c_str());
+   ERROR_CHECK(err);
+exit:;
+}
+
+// As above, after when it happened, and followed by its backtrace.
+//
+void
+PrintLoggedEvent(
+   CommandState &st,
+   const Tracepoint *tp,
+   const TraceLogEventRecord *ev,
+   const unsigned char *data,
+   const addr_t *frames,
+   error *err
+)
+{
+   auto events = st.dbg->proc->EventCallbacks.Get();
+   std::string line;
+   char buf[128];
+
+   if (ev->time)
+   {
+      struct timeval tv;
+
+      tv.tv_sec = ev->time / 1000000000ULL;
+      tv.tv_usec = ev->time % 1000000000ULL / 1000;
+      FormatTime(tv, buf, sizeof(buf));
+   }
+   else
+   {
+      snprintf(buf, sizeof(buf), "#%llu", (unsigned long long)ev->seq);
+   }
+
+   try
+   {
+      line = buf;
+      line += ' ';
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   FormatTraceRecord(tp, data, line, err);
+   ERROR_CHECK(err);
+
+   events->OnMessage(err, "%s\n", line.c_str());
+   ERROR_CHECK(err);
+
+   for (uint32_t i=0; i<ev->frames; ++i)
+   {
+      auto addr = FormatAddr(st, frames[i], buf, sizeof(buf), err);
+      ERROR_CHECK(err);
+      events->OnMessage(err, "    %s\n", addr);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+} // end namespace
 
 void
 dbg::shell::RegisterBpCommands(CommandList &list, error *err)
 {
    list["bp"] = [] (CommandState &st, error *err) -> void
    {
-      addr_t addr = 0;
+      size_t arg = 1;
+      bool inTarget = false;
+
+      if (st.argv.size() > 1 && st.argv[1] == "-t")
+      {
+         inTarget = true;
+         ++arg;
+      }
+
+      if (st.argv.size() <= arg)
+         ERROR_SET(err, unknown, "usage: [~thread] bp [-t] <addr|module+offset|module!symbol|@file> [condition]");
+
+      if (st.argv[arg][0] == '@')
+      {
+         if (inTarget)
+            ERROR_SET(err, unknown, "-t goes on each line of the file");
+         if (st.thread >= 0)
+            ERROR_SET(err, unknown, "A file of breakpoints can't be for one thread");
+
+         LoadBreakpoints(st, st.argv[arg].c_str() + 1, true, err);
+         ERROR_CHECK(err);
+      }
+      else
+      {
+         BreakpointLocation loc;
+         std::string cond;
+
+         try
+         {
+            for (size_t i=arg+1; i<st.argv.size(); ++i)
+            {
+               if (cond.size())
+                  cond += ' ';
+               cond += st.argv[i];
+            }
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+
+         ParseBreakpoint(st, st.argv[arg].c_str(), cond.c_str(), loc, err);
+         ERROR_CHECK(err);
+
+         if (inTarget && !loc.condition.Get())
+            ERROR_SET(err, unknown, "-t needs a condition");
+         loc.inTarget = inTarget;
+
+         loc.thread = GetThreadArg(st, err);
+         ERROR_CHECK(err);
+
+         st.dbg->SetBreakpoint(loc, err);
+         ERROR_CHECK(err);
+      }
+   exit:;
+   };
+
+   list["bl"] = [] (CommandState &st, error *err) -> void
+   {
+      std::vector<Breakpoint*> list;
+      std::unordered_map<BreakpointLocation*, std::vector<Breakpoint*>> resolved;
+      std::string desc;
+      bool verbose = false;
+
+      if (st.argv.size() == 2 && st.argv[1] == "-v")
+         verbose = true;
+      else if (st.argv.size() > 1)
+         ERROR_SET(err, unknown, "usage: bl [-v]");
+
+      st.dbg->bps.GetUserBreakpoints(list, err);
+      ERROR_CHECK(err);
+
+      try
+      {
+         for (auto bp : list)
+            resolved[bp->location].push_back(bp);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      for (auto &p : st.dbg->locations)
+      {
+         auto loc = p.get();
+         auto it = resolved.find(loc);
+         char addrBuf[128], hitBuf[128];
+         const char *addr = "pending";
+
+         if (!loc->enabled)
+            addr = "-";
+         else if (it != resolved.end())
+         {
+            addr = FormatAddr(st, it->second[0]->vaddr, addrBuf, sizeof(addrBuf), err);
+            ERROR_CHECK(err);
+         }
+
+         // An address that's patched speaks for itself.
+         //
+         desc.clear();
+         if (!loc->IsAddress() || it == resolved.end())
+         {
+            loc->Format(desc, err);
+            ERROR_CHECK(err);
+         }
+
+         snprintf(hitBuf, sizeof(hitBuf), "hits %lu", loc->hits);
+         if (loc->hits)
+         {
+            size_t n = strlen(hitBuf);
+            snprintf(hitBuf + n, sizeof(hitBuf) - n, ", last ");
+            n = strlen(hitBuf);
+            FormatTime(loc->lastHit, hitBuf + n, sizeof(hitBuf) - n);
+         }
+         if (loc->thread)
+         {
+            size_t n = strlen(hitBuf);
+            snprintf(hitBuf + n, sizeof(hitBuf) - n, ", other threads %lu", loc->filtered);
+         }
+
+         if (loc->thread)
+         {
+            char threadBuf[64];
+
+            FormatThread(st, loc->thread, threadBuf, sizeof(threadBuf), err);
+            ERROR_CHECK(err);
+
+            try
+            {
+               if (desc.size())
+                  desc += ' ';
+               desc += threadBuf;
+            }
+            catch (std::bad_alloc)
+            {
+               ERROR_SET(err, nomem);
+            }
+         }
+
+         if (loc->condition.Get())
+         {
+            try
+            {
+               if (desc.size())
+                  desc += ' ';
+               desc += '"';
+               desc += loc->condition->text;
+               desc += '"';
+
+               // Whether the target is really checking it.
+               //
+               if (loc->inTarget)
+               {
+                  if (it == resolved.end() || it->second[0]->trap)
+                     desc += " in target";
+                  else
+                     desc += " in debugger";
+               }
+            }
+            catch (std::bad_alloc)
+            {
+               ERROR_SET(err, nomem);
+            }
+         }
+
+         st.dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "0x%.2x %c %s %s%s(%s)\n",
+            loc->id,
+            loc->enabled ? 'e' : 'd',
+            addr,
+            desc.c_str(),
+            desc.size() ? " " : "",
+            hitBuf
+         );
+         ERROR_CHECK(err);
+
+         if (verbose)
+         {
+            PrintBreakpointStats(st, loc, err);
+            ERROR_CHECK(err);
+         }
+
+         // Anywhere else it resolved to.
+         //
+         if (it == resolved.end())
+            continue;
+         for (size_t i=1; i<it->second.size(); ++i)
+         {
+            addr = FormatAddr(st, it->second[i]->vaddr, addrBuf, sizeof(addrBuf), err);
+            ERROR_CHECK(err);
+            st.dbg->proc->EventCallbacks->OnMessage(err, "       %s\n", addr);
+            ERROR_CHECK(err);
+         }
+      }
+   exit:;
+   };
+
+   list["bc"] = [] (CommandState &st, error *err) -> void
+   {
+      std::vector<BreakpointLocation*> list;
 
       if (st.argv.size() < 2)
-         ERROR_SET(err, unknown, "usage: bp <addr>");
+         ERROR_SET(err, unknown, "usage: bc <id|module+offset|module!symbol|*>...");
+
+      if (st.argv.size() == 2 && st.argv[1] == "*")
+      {
+         st.dbg->DeleteAllBreakpoints(err);
+         ERROR_CHECK(err);
+         goto exit;
+      }
 
-      addr = st.ParseAddress(1, err);
+      GetBreakpointArgs(st, list, err);
       ERROR_CHECK(err);
 
-      st.dbg->SetBreakpoint(addr, err);
+      st.dbg->DeleteBreakpoints(list, err);
       ERROR_CHECK(err);
    exit:;
    };
 
-   list["bl"] = [] (CommandState &st, error *err) -> void
+   list["bd"] = [] (CommandState &st, error *err) -> void
+   {
+      std::vector<BreakpointLocation*> list;
+
+      if (st.argv.size() < 2)
+         ERROR_SET(err, unknown, "usage: bd <id|module+offset|module!symbol|*>...");
+
+      GetBreakpointArgs(st, list, err);
+      ERROR_CHECK(err);
+
+      st.dbg->DisableBreakpoints(list, err);
+      ERROR_CHECK(err);
+   exit:;
+   };
+
+   list["be"] = [] (CommandState &st, error *err) -> void
    {
-      int idx = 0;
+      std::vector<BreakpointLocation*> list;
+
+      if (st.argv.size() < 2)
+         ERROR_SET(err, unknown, "usage: be <id|module+offset|module!symbol|*>...");
 
-      for (auto &bp : st.dbg->bps.bps)
+      GetBreakpointArgs(st, list, err);
+      ERROR_CHECK(err);
+
+      st.dbg->EnableBreakpoints(list, err);
+      ERROR_CHECK(err);
+   exit:;
+   };
+
+   list[".bpsave"] = [] (CommandState &st, error *err) -> void
+   {
+      FILE *file = nullptr;
+      std::string desc;
+
+      if (st.argv.size() < 2)
+         ERROR_SET(err, unknown, "usage: .bpsave <file>");
+
+      file = fopen(st.argv[1].c_str(), "w");
+      if (!file)
+         ERROR_SET(err, errno, errno);
+
+      for (auto &loc : st.dbg->locations)
       {
-         char buf[128];
-         const char *addr = FormatAddr(st, bp->vaddr, buf, sizeof(buf), err);
+         DescribeBreakpoint(st, loc.get(), desc, err);
          ERROR_CHECK(err);
-         st.dbg->proc->EventCallbacks->OnMessage(err, "0x%.2x %s\n", idx++, addr);
+         if (loc->condition.Get())
+         {
+            fprintf(
+               file,
+               "%s%s \"%s\"\n",
+               loc->inTarget ? "-t " : "",
+               desc.c_str(),
+               loc->condition->text.c_str()
+            );
+         }
+         else
+            fprintf(file, "%s\n", desc.c_str());
+      }
+
+      if (fflush(file) || ferror(file))
+         ERROR_SET(err, errno, errno);
+   exit:
+      if (file)
+         fclose(file);
+   };
+
+   // The same as bl -v, one tab-separated line per breakpoint, with
+   // times in nanoseconds.
+   //
+   list[".bpstats"] = [] (CommandState &st, error *err) -> void
+   {
+      FILE *file = nullptr;
+      std::string desc;
+      static const char header[] =
+         "id\tlocation\tenabled\thits\ttraps\tstopped_ns\tmax_stopped_ns\tcondition_ns\tstep_ns\tthread\tfiltered\n";
+      static const char format[] =
+         "%d\t%s\t%d\t%lu\t%lu\t%llu\t%llu\t%llu\t%llu\t%d\t%lu\n";
+
+      if (st.argv.size() > 2)
+         ERROR_SET(err, unknown, "usage: .bpstats [file]");
+
+      if (st.argv.size() == 2)
+      {
+         file = fopen(st.argv[1].c_str(), "w");
+         if (!file)
+            ERROR_SET(err, errno, errno);
+         fputs(header, file);
+      }
+      else
+      {
+         st.dbg->proc->EventCallbacks->OnMessage(err, "%s", header);
+         ERROR_CHECK(err);
+      }
+
+      for (auto &p : st.dbg->locations)
+      {
+         auto loc = p.get();
+
+         DescribeBreakpoint(st, loc, desc, err);
          ERROR_CHECK(err);
+
+         if (file)
+         {
+            fprintf(
+               file,
+               format,
+               loc->id,
+               desc.c_str(),
+               loc->enabled ? 1 : 0,
+               loc->hits,
+               loc->traps,
+               (unsigned long long)loc->stoppedTime,
+               (unsigned long long)loc->maxStopped,
+               (unsigned long long)loc->conditionTime,
+               (unsigned long long)loc->stepTime,
+               loc->thread,
+               loc->filtered
+            );
+         }
+         else
+         {
+            st.dbg->proc->EventCallbacks->OnMessage(
+               err,
+               format,
+               loc->id,
+               desc.c_str(),
+               loc->enabled ? 1 : 0,
+               loc->hits,
+               loc->traps,
+               (unsigned long long)loc->stoppedTime,
+               (unsigned long long)loc->maxStopped,
+               (unsigned long long)loc->conditionTime,
+               (unsigned long long)loc->stepTime,
+               loc->thread,
+               loc->filtered
+            );
+            ERROR_CHECK(err);
+         }
       }
+
+      if (file && (fflush(file) || ferror(file)))
+         ERROR_SET(err, errno, errno);
+   exit:
+      if (file)
+         fclose(file);
+   };
+
+   list[".bpload"] = [] (CommandState &st, error *err) -> void
+   {
+      if (st.argv.size() < 2)
+         ERROR_SET(err, unknown, "usage: .bpload <file>");
+
+      LoadBreakpoints(st, st.argv[1].c_str(), false, err);
+      ERROR_CHECK(err);
    exit:;
    };
 
-   list["bc"] = [] (CommandState &st, error *err) -> void
+   list[".tp"] = [] (CommandState &st, error *err) -> void
    {
-      int idx = 0;
+      auto &tps = st.dbg->tracepoints;
+      auto events = st.dbg->proc->EventCallbacks.Get();
+      std::string cmd = st.argv.size() >= 2 ? st.argv[1] : "";
 
-      if (st.argv.size() < 2)
-         ERROR_SET(err, unknown, "usage: bc <idx>");
+      if (cmd == "add" && st.argv.size() >= 4)
+      {
+         std::string items;
+         Tracepoint *tp = nullptr;
+         unsigned long frames = 0;
+         int arg = 2;
+         addr_t addr = 0;
+
+         if (st.argv[arg] == "-k")
+         {
+            char *end = nullptr;
+
+            if (st.argv.size() < 6)
+               ERROR_SET(err, unknown, "usage: .tp add -k <frames> <addr> <expr[:len]>,...");
+            frames = strtoul(st.argv[arg+1].c_str(), &end, 10);
+            if (*end || !frames)
+               ERROR_SET(err, unknown, "Expected a number of frames");
+            arg += 2;
+         }
+
+         addr = st.ParseAddress(arg, err);
+         ERROR_CHECK(err);
+
+         try
+         {
+            for (size_t i=arg+1; i<st.argv.size(); ++i)
+            {
+               if (items.size())
+                  items += ' ';
+               items += st.argv[i];
+            }
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+
+         tp = tps.Add(st.dbg, addr, items.c_str(), frames, err);
+         ERROR_CHECK(err);
+
+         events->OnMessage(err, "Tracepoint %d at %p\n", tp->id, (void*)tp->vaddr);
+         ERROR_CHECK(err);
+      }
+      else if (cmd == "clear" && st.argv.size() >= 3)
+      {
+         for (size_t i=2; i<st.argv.size(); ++i)
+         {
+            Tracepoint *tp = nullptr;
+            char *end = nullptr;
+
+            if (st.argv[i] == "*")
+            {
+               while (tps.tracepoints.size())
+               {
+                  tps.Remove(&tps.tracepoints.begin()->second, err);
+                  ERROR_CHECK(err);
+               }
+               continue;
+            }
+
+            tp = tps.Find(strtol(st.argv[i].c_str(), &end, 10));
+            if (*end || !tp)
+               ERROR_SET(err, unknown, "No such tracepoint");
+
+            tps.Remove(tp, err);
+            ERROR_CHECK(err);
+         }
+      }
+      else if (cmd == "drain")
+      {
+         uint64_t dropped = 0;
+
+         tps.Drain(
+            [&st] (const Tracepoint *tp, const TraceRecord *rec, error *err) -> void
+            {
+               PrintTraceRecord(st, tp, rec, err);
+            },
+            &dropped,
+            err
+         );
+         ERROR_CHECK(err);
+
+         if (dropped)
+         {
+            events->OnMessage(err, "%llu records dropped\n", (unsigned long long)dropped);
+            ERROR_CHECK(err);
+         }
+      }
+      else if (cmd == "log" && st.argv.size() == 3)
+      {
+         if (st.argv[2] == "close")
+            tps.CloseLog(err);
+         else
+            tps.OpenLog(st.argv[2].c_str(), err);
+         ERROR_CHECK(err);
+      }
+      else if (cmd.size())
+      {
+         ERROR_SET(err, unknown, "usage: .tp [add [-k <frames>] <addr> <expr[:len]>,...|clear <id|*>...|drain|log <file|close>]");
+      }
+      else
+      {
+         for (auto &p : tps.tracepoints)
+         {
+            auto &tp = p.second;
+
+            char frames[32] = "";
+
+            if (tp.frames)
+               snprintf(frames, sizeof(frames), " -k %u", tp.frames);
+
+            events->OnMessage(
+               err,
+               "%3d %p%s%s \"%s\" %lu records\n",
+               tp.id,
+               (void*)tp.vaddr,
+               frames,
+               tps.IsPatched(&tp) ? "" : " (unloaded)",
+               tp.text.c_str(),
+               tp.records
+            );
+            ERROR_CHECK(err);
+         }
+
+         if (tps.ring)
+         {
+            events->OnMessage(
+               err,
+               "%llu records dropped\n",
+               (unsigned long long)tps.ring->dropped
+            );
+            ERROR_CHECK(err);
+         }
+         if (tps.missed)
+         {
+            events->OnMessage(
+               err,
+               "%llu hits not recorded\n",
+               (unsigned long long)tps.missed
+            );
+            ERROR_CHECK(err);
+         }
+         if (tps.log.IsOpen())
+         {
+            events->OnMessage(err, "Logging\n");
+            ERROR_CHECK(err);
+         }
+      }
+   exit:;
+   };
+
+   list[".tracedump"] = [] (CommandState &st, error *err) -> void
+   {
+      TraceLogReader reader;
+      uint64_t events = 0;
+
+      if (st.argv.size() != 2)
+         ERROR_SET(err, unknown, "usage: .tracedump <file>");
+
+      reader.Open(st.argv[1].c_str(), err);
+      ERROR_CHECK(err);
 
-      st.ParseBinaryArg(1, &idx, sizeof(idx), err);
+      reader.Read(
+         [&st, &events] (const Tracepoint *tp, const TraceLogEventRecord *ev, const unsigned char *data, const addr_t *frames, error *err) -> void
+         {
+            PrintLoggedEvent(st, tp, ev, data, frames, err);
+            ++events;
+         },
+         [&st] (uint64_t count, error *err) -> void
+         {
+            st.dbg->proc->EventCallbacks->OnMessage(
+               err,
+               "(%llu records dropped)\n",
+               (unsigned long long)count
+            );
+         },
+         err
+      );
       ERROR_CHECK(err);
 
-      st.dbg->DeleteBreakpoint(idx, err);
+      st.dbg->proc->EventCallbacks->OnMessage(
+         err,
+         "%llu events\n",
+         (unsigned long long)events
+      );
       ERROR_CHECK(err);
    exit:;
    };
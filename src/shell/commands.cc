@@ -6,11 +6,68 @@
  copyright notice and this permission notice appear in all copies.
 */
 
+#include <dbg/misc.h>
+#include <dbg/record.h>
 #include <dbg/shell.h>
+#include <dbg/strace.h>
+#include <dbg/watchtrace.h>
+#include <common/c++/new.h>
+#include <common/misc.h>
 
 #include "dump.h"
 #include "edit.h"
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+using namespace dbg;
+using namespace dbg::shell;
+
+// An argument to .call: anything a breakpoint condition can be.
+//
+addr_t
+ComputeArg(CommandState &st, const char *str, error *err)
+{
+   common::Pointer<Condition> expr;
+   addr_t r = 0;
+
+   New(expr, err);
+   ERROR_CHECK(err);
+   expr->Compile(st.dbg->cpu.Get(), str, err);
+   ERROR_CHECK(err);
+   r = expr->Compute(st.dbg, err);
+   ERROR_CHECK(err);
+exit:
+   return r;
+}
+
+// The function at addr, from the debug info, if there is any.
+//
+const char *
+FunctionName(
+   CommandState &st,
+   addr_t addr,
+   std::vector<dwarf::InlineFrame> &inlines,
+   error *err
+)
+{
+   Module *mod = st.dbg->modules.Lookup(addr);
+   dwarf::DebugInfo *info = mod ? mod->GetDebugInfo() : nullptr;
+
+   if (!info || !info->GetInlineChain(addr - mod->bias, inlines, err) ||
+       !inlines.size())
+   {
+      return nullptr;
+   }
+   return inlines.back().name;
+}
+
+} // end namespace
+
 void
 dbg::shell::RegisterCommands(CommandList &list, error *err)
 {
@@ -34,9 +91,273 @@ dbg::shell::RegisterCommands(CommandList &list, error *err)
          st.dbg->Detach(err);
       };
 
+      list[".coverage"] = [] (CommandState &st, error *err) -> void
+      {
+         auto &cov = st.dbg->coverage;
+         auto events = st.dbg->proc->EventCallbacks.Get();
+         std::string cmd = st.argv.size() >= 2 ? st.argv[1] : "";
+
+         if (cmd == "add" && st.argv.size() >= 3)
+         {
+            for (size_t i=2; i<st.argv.size(); ++i)
+            {
+               BreakpointLocation loc;
+               bool found = false;
+
+               loc.module = st.argv[i];
+               for (auto &mod : st.dbg->modules.modules)
+               {
+                  if (!loc.Matches(mod->path.c_str()))
+                     continue;
+                  found = true;
+
+                  auto n = cov.blocks.size();
+                  cov.Add(st.dbg, mod.Get(), err);
+                  ERROR_CHECK(err);
+
+                  events->OnMessage(
+                     err,
+                     "%s: %d blocks\n",
+                     mod->path.c_str(),
+                     (int)(cov.blocks.size() - n)
+                  );
+                  ERROR_CHECK(err);
+               }
+
+               if (!found)
+                  ERROR_SET(err, unknown, "No such module");
+            }
+         }
+         else if (cmd == "stop")
+         {
+            cov.Stop(err);
+            ERROR_CHECK(err);
+         }
+         else if (cmd == "reset")
+         {
+            cov.Stop(err);
+            ERROR_CHECK(err);
+            cov.Reset();
+         }
+         else if (cmd == "write" && st.argv.size() >= 3)
+         {
+            cov.WriteDrcov(st.argv[2].c_str(), err);
+            ERROR_CHECK(err);
+         }
+         else if (cmd.size())
+         {
+            ERROR_SET(err, unknown, "usage: .coverage [add <module>...|stop|reset|write <file>]");
+         }
+         else
+         {
+            for (size_t i=0; i<cov.modules.size(); ++i)
+            {
+               int total = 0, hit = 0;
+
+               for (auto &b : cov.blocks)
+               {
+                  if (b.module != i)
+                     continue;
+                  ++total;
+                  if (b.hit)
+                     ++hit;
+               }
+
+               events->OnMessage(
+                  err,
+                  "%s: %d/%d blocks\n",
+                  cov.modules[i].path.c_str(),
+                  hit,
+                  total
+               );
+               ERROR_CHECK(err);
+            }
+         }
+      exit:;
+      };
+
+      list[".call"] = [] (CommandState &st, error *err) -> void
+      {
+         std::vector<SystemCall> calls;
+         std::vector<std::string> desc;
+         bool fresh = true;
+
+         try
+         {
+            for (size_t i=1; i<st.argv.size(); ++i)
+            {
+               std::string arg = st.argv[i];
+               bool last = false;
+
+               // Calls are separated by ';', on its own or at the end
+               // of an argument.
+               //
+               if (arg.size() && arg[arg.size()-1] == ';')
+               {
+                  arg.resize(arg.size() - 1);
+                  last = true;
+               }
+
+               if (arg.size() && fresh)
+               {
+                  SystemCall call;
+                  const SyscallName *sc = LookupSyscall(arg.c_str());
+
+                  memset(&call, 0, sizeof(call));
+                  if (sc)
+                  {
+                     call.nr = sc->nr;
+                  }
+                  else
+                  {
+                     call.nr = ComputeArg(st, arg.c_str(), err);
+                     ERROR_CHECK(err);
+                  }
+
+                  calls.push_back(call);
+                  desc.push_back(arg + "(");
+                  fresh = false;
+               }
+               else if (arg.size())
+               {
+                  auto &call = calls.back();
+
+                  if (call.nargs == (int)ARRAY_SIZE(call.args))
+                     ERROR_SET(err, unknown, "Too many system call arguments");
+                  call.args[call.nargs] = ComputeArg(st, arg.c_str(), err);
+                  ERROR_CHECK(err);
+
+                  if (call.nargs++)
+                     desc.back() += ", ";
+                  desc.back() += arg;
+               }
+
+               if (last)
+                  fresh = true;
+            }
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+
+         if (!calls.size())
+            ERROR_SET(err, unknown, "usage: .call <name|nr> [args...] [; <name|nr> [args...]]...");
+
+         st.dbg->Syscall(calls.data(), calls.size(), err);
+         ERROR_CHECK(err);
+
+         for (size_t i=0; i<calls.size(); ++i)
+         {
+            addr_t r = calls[i].result;
+
+            if (r > (addr_t)-4096)
+            {
+               st.dbg->proc->EventCallbacks->OnMessage(
+                  err,
+                  "%s) = -%d (%s)\n",
+                  desc[i].c_str(),
+                  (int)-r,
+                  strerror(-r)
+               );
+            }
+            else
+            {
+               st.dbg->proc->EventCallbacks->OnMessage(
+                  err,
+                  "%s) = 0x%llx\n",
+                  desc[i].c_str(),
+                  (unsigned long long)r
+               );
+            }
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
+
+      list[".stackprefetch"] = [] (CommandState &st, error *err) -> void
+      {
+         if (st.argv.size() >= 2)
+         {
+            uint32_t size = 0;
+            st.ParseBinaryArg(1, &size, sizeof(size), err);
+            ERROR_CHECK(err);
+            st.dbg->stackPrefetch = size;
+         }
+         st.dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "Stack prefetch: 0x%zx bytes\n",
+            st.dbg->stackPrefetch
+         );
+         ERROR_CHECK(err);
+      exit:;
+      };
+
       list["g"] = [] (CommandState &st, error *err) -> void
       {
-         st.dbg->Go(err);
+         static const struct
+         {
+            const char *suffix;
+            uint64_t scale;
+         } units[] =
+         {
+            {"", 1000000},
+            {"ms", 1000000},
+            {"s", 1000000000},
+            {"us", 1000},
+            {"ns", 1},
+         };
+         unsigned long long timeout = 0, hits = 0;
+         bool found = false;
+
+         for (size_t i = 1; i < st.argv.size(); i += 2)
+         {
+            char *p = nullptr;
+            unsigned long long n = 0;
+
+            if (i + 1 >= st.argv.size() || (st.argv[i] != "-t" && st.argv[i] != "-n"))
+               ERROR_SET(err, unknown, "usage: g [-t time[ms|s|us|ns]] [-n hits]");
+
+            n = strtoull(st.argv[i + 1].c_str(), &p, 0);
+            if (p == st.argv[i + 1].c_str() || !n)
+               ERROR_SET(err, unknown, "usage: g [-t time[ms|s|us|ns]] [-n hits]");
+
+            if (st.argv[i] == "-n")
+            {
+               if (hits || (*p && strcmp(p, "hits")))
+                  ERROR_SET(err, unknown, "usage: g [-t time[ms|s|us|ns]] [-n hits]");
+               hits = n;
+               continue;
+            }
+
+            if (found)
+               ERROR_SET(err, unknown, "usage: g [-t time[ms|s|us|ns]] [-n hits]");
+
+            // Plain numbers are milliseconds.  Anything too long to count
+            // in nanoseconds is refused rather than wrapped to something
+            // shorter.
+            //
+            for (size_t j = 0; j < ARRAY_SIZE(units) && !found; ++j)
+            {
+               if (!strcmp(p, units[j].suffix))
+               {
+                  if (n > UINT64_MAX / units[j].scale)
+                     ERROR_SET(err, unknown, "Time out of range");
+                  timeout = n * units[j].scale;
+                  found = true;
+               }
+            }
+            if (!found)
+               ERROR_SET(err, unknown, "usage: g [-t time[ms|s|us|ns]] [-n hits]");
+         }
+
+         if (st.dbg->Go(timeout, hits, err))
+         {
+            if (st.dbg->proc->timedOut)
+               st.dbg->proc->EventCallbacks->OnMessage(err, "Out of time\n");
+            else
+               st.dbg->proc->EventCallbacks->OnMessage(err, "Stopped after %llu breakpoint hits\n", hits);
+         }
          ERROR_CHECK(err);
          if (st.dbg->proc->IsAttached())
          {
@@ -48,9 +369,79 @@ dbg::shell::RegisterCommands(CommandList &list, error *err)
 
       list["k"] = [] (CommandState &st, error *err) -> void
       {
+         bool first = true;
+         std::vector<dwarf::InlineFrame> inlines;
+
          st.dbg->cpu->StackTrace(
             st.dbg,
-            [&st] (addr_t pc, addr_t frame, bool& cancel, error *err) -> void
+            [&] (addr_t pc, addr_t frame, bool& cancel, error *err) -> void
+            {
+               // Past the first frame we have return addresses, which
+               // can belong to the next inlined call or function over.
+               //
+               addr_t lookup = first ? pc : pc - 1;
+               Module *mod = st.dbg->modules.Lookup(lookup);
+               dwarf::DebugInfo *info = mod ? mod->GetDebugInfo() : nullptr;
+               char buf[64];
+
+               first = false;
+
+               if (!st.dbg->proc->EventCallbacks.Get())
+                  goto exit;
+
+               FormatAddr(st, pc, buf, sizeof(buf), err);
+               ERROR_CHECK(err);
+
+               if (!info || !info->GetInlineChain(lookup - mod->bias, inlines, err))
+               {
+                  ERROR_CHECK(err);
+                  st.dbg->proc->EventCallbacks->OnMessage(err, "%s\n", buf);
+                  ERROR_CHECK(err);
+                  goto exit;
+               }
+
+               // One line per function, innermost first.  Inlined ones
+               // say where they were inlined into the next one out.
+               //
+               for (size_t i=0; i<inlines.size(); ++i)
+               {
+                  auto &f = inlines[i];
+
+                  if (f.inlined)
+                  {
+                     st.dbg->proc->EventCallbacks->OnMessage(
+                        err,
+                        "%-*s %s [inlined at %s:%d]\n",
+                        (int)strlen(buf),
+                        i ? "" : buf,
+                        f.name ? f.name : "??",
+                        f.callFile ? f.callFile : "??",
+                        f.callLine
+                     );
+                  }
+                  else
+                  {
+                     st.dbg->proc->EventCallbacks->OnMessage(
+                        err,
+                        "%-*s %s\n",
+                        (int)strlen(buf),
+                        i ? "" : buf,
+                        f.name ? f.name : "??"
+                     );
+                  }
+                  ERROR_CHECK(err);
+               }
+            exit:;
+            },
+            err
+         );
+      };
+
+      list["ks"] = [] (CommandState &st, error *err) -> void
+      {
+         st.dbg->cpu->ScanStack(
+            st.dbg,
+            [&st] (addr_t pc, addr_t slot, bool& cancel, error *err) -> void
             {
                if (st.dbg->proc->EventCallbacks.Get())
                {
@@ -58,7 +449,7 @@ dbg::shell::RegisterCommands(CommandList &list, error *err)
 
                   FormatAddr(st, pc, buf, sizeof(buf), err);
                   ERROR_CHECK(err);
-                  st.dbg->proc->EventCallbacks->OnMessage(err, "%s\n", buf);
+                  st.dbg->proc->EventCallbacks->OnMessage(err, "%p %s\n", (void*)slot, buf);
                   ERROR_CHECK(err);
                }
             exit:;
@@ -71,8 +462,220 @@ dbg::shell::RegisterCommands(CommandList &list, error *err)
 
       list["t"] = [] (CommandState &st, error *err) -> void
       {
-         st.dbg->Step(err);
+         if (st.dbg->history.enabled)
+            st.dbg->history.Step(st.dbg, err);
+         else
+            st.dbg->Step(err);
+         ERROR_CHECK(err);
+         if (st.dbg->proc->IsAttached())
+         {
+            Disassemble(st, 1, err);
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
+
+      list["p"] = [] (CommandState &st, error *err) -> void
+      {
+         st.dbg->StepOver(err);
+         ERROR_CHECK(err);
+         if (st.dbg->proc->IsAttached())
+         {
+            Disassemble(st, 1, err);
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
+
+      list["gu"] = [] (CommandState &st, error *err) -> void
+      {
+         st.dbg->StepOut(err);
+         ERROR_CHECK(err);
+         if (st.dbg->proc->IsAttached())
+         {
+            Disassemble(st, 1, err);
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
+
+      list["tb"] = [] (CommandState &st, error *err) -> void
+      {
+         uint64_t before = st.dbg->branches.total;
+
+         if (st.argv.size() > 2)
+            ERROR_SET(err, unknown, "usage: tb [addr]");
+
+         if (st.argv.size() == 2)
+         {
+            addr_t addr = st.ParseAddress(1, err);
+            ERROR_CHECK(err);
+
+            st.dbg->GoBlocks(addr, err);
+            ERROR_CHECK(err);
+
+            st.dbg->proc->EventCallbacks->OnMessage(
+               err,
+               "%llu branches\n",
+               (unsigned long long)(st.dbg->branches.total - before)
+            );
+            ERROR_CHECK(err);
+         }
+         else
+         {
+            st.dbg->StepBlock(err);
+            ERROR_CHECK(err);
+         }
+
+         if (st.dbg->proc->IsAttached())
+         {
+            Disassemble(st, 1, err);
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
+
+      list[".branches"] = [] (CommandState &st, error *err) -> void
+      {
+         auto &trace = st.dbg->branches;
+         std::vector<BranchTrace::Branch> list;
+         size_t n = 0;
+
+         if (st.argv.size() == 2 && st.argv[1] == "clear")
+         {
+            trace.Clear();
+            goto exit;
+         }
+         if (st.argv.size() > 2)
+            ERROR_SET(err, unknown, "usage: .branches [count|clear]");
+
+         trace.Get(list, err);
+         ERROR_CHECK(err);
+
+         // The last n, if asked.
+         //
+         n = list.size();
+         if (st.argv.size() == 2)
+         {
+            char *p = nullptr;
+            unsigned long count = strtoul(st.argv[1].c_str(), &p, 0);
+
+            if (*p || !st.argv[1].size())
+               ERROR_SET(err, unknown, "usage: .branches [count|clear]");
+            n = MIN(n, count);
+         }
+
+         if (trace.total > list.size())
+         {
+            st.dbg->proc->EventCallbacks->OnMessage(
+               err,
+               "(%llu older branches have made way)\n",
+               (unsigned long long)(trace.total - list.size())
+            );
+            ERROR_CHECK(err);
+         }
+
+         for (size_t i=list.size()-n; i<list.size(); ++i)
+         {
+            char from[64], to[64];
+
+            if (list[i].from)
+               FormatAddr(st, list[i].from, from, sizeof(from), err);
+            else
+               snprintf(from, sizeof(from), "?");
+            ERROR_CHECK(err);
+            FormatAddr(st, list[i].to, to, sizeof(to), err);
+            ERROR_CHECK(err);
+
+            st.dbg->proc->EventCallbacks->OnMessage(err, "%s -> %s\n", from, to);
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
+
+      list["wt"] = [] (CommandState &st, error *err) -> void
+      {
+         WatchTrace trace;
+         std::vector<dwarf::InlineFrame> inlines;
+         long maxDepth = -1;
+         char time[32];
+
+         if (st.argv.size() == 3 && st.argv[1] == "-l")
+         {
+            char *p = nullptr;
+            maxDepth = strtol(st.argv[2].c_str(), &p, 0);
+
+            if (*p || !st.argv[2].size() || maxDepth < 0)
+               ERROR_SET(err, unknown, "usage: wt [-l depth]");
+         }
+         else if (st.argv.size() != 1)
+         {
+            ERROR_SET(err, unknown, "usage: wt [-l depth]");
+         }
+
+         trace.Run(st.dbg, err);
          ERROR_CHECK(err);
+
+         st.dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "%8s %9s %10s  %s\n",
+            "instrs",
+            "total",
+            "time",
+            "function"
+         );
+         ERROR_CHECK(err);
+
+         for (auto &call : trace.calls)
+         {
+            char addr[64];
+            const char *name = nullptr;
+
+            if (maxDepth >= 0 && call.depth > maxDepth)
+               continue;
+
+            FormatAddr(st, call.function, addr, sizeof(addr), err);
+            ERROR_CHECK(err);
+            name = FunctionName(st, call.function, inlines, err);
+            ERROR_CHECK(err);
+            FormatDuration(call.time, time, sizeof(time));
+
+            st.dbg->proc->EventCallbacks->OnMessage(
+               err,
+               "%8llu %9llu %10s  %*s%s%s%s\n",
+               (unsigned long long)call.instructions,
+               (unsigned long long)call.total,
+               time,
+               call.depth * 2,
+               "",
+               addr,
+               name ? " " : "",
+               name ? name : ""
+            );
+            ERROR_CHECK(err);
+         }
+
+         if (trace.dropped)
+         {
+            st.dbg->proc->EventCallbacks->OnMessage(
+               err,
+               "(%llu more calls are counted in their callers)\n",
+               (unsigned long long)trace.dropped
+            );
+            ERROR_CHECK(err);
+         }
+
+         FormatDuration(trace.time, time, sizeof(time));
+         st.dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "%llu instructions in %llu traps, %s: %.0f instructions/second\n",
+            (unsigned long long)trace.instructions,
+            (unsigned long long)trace.traps,
+            time,
+            trace.time ? trace.instructions * 1e9 / trace.time : 0.0
+         );
+         ERROR_CHECK(err);
+
          if (st.dbg->proc->IsAttached())
          {
             Disassemble(st, 1, err);
@@ -81,6 +684,428 @@ dbg::shell::RegisterCommands(CommandList &list, error *err)
       exit:;
       };
 
+      list["t-"] = [] (CommandState &st, error *err) -> void
+      {
+         if (!st.dbg->history.enabled)
+            ERROR_SET(err, unknown, "No history; turn it on with .history on");
+
+         st.dbg->ReverseStep(err);
+         ERROR_CHECK(err);
+
+         Disassemble(st, 1, err);
+         ERROR_CHECK(err);
+      exit:;
+      };
+
+      list["g-"] = [] (CommandState &st, error *err) -> void
+      {
+         if (!st.dbg->history.enabled)
+            ERROR_SET(err, unknown, "No history; turn it on with .history on");
+
+         st.dbg->ReverseGo(err);
+         ERROR_CHECK(err);
+
+         if (st.dbg->history.pos == st.dbg->history.GetFirst())
+         {
+            st.dbg->proc->EventCallbacks->OnMessage(err, "Reached the start of the history\n");
+            ERROR_CHECK(err);
+         }
+
+         Disassemble(st, 1, err);
+         ERROR_CHECK(err);
+      exit:;
+      };
+
+      list[".record"] = [] (CommandState &st, error *err) -> void
+      {
+         Recorder rec;
+         unsigned long long count = 0;
+         addr_t addr = 0;
+         size_t i = 1;
+         error closeErr;
+
+         if (st.argv.size() > 3 && st.argv[1] == "-n")
+         {
+            char *p = nullptr;
+            count = strtoull(st.argv[2].c_str(), &p, 0);
+
+            if (*p || !st.argv[2].size() || !count)
+               ERROR_SET(err, unknown, "usage: .record [-n steps] <file> [addr]");
+            i = 3;
+         }
+         if (st.argv.size() < i + 1 || st.argv.size() > i + 2)
+            ERROR_SET(err, unknown, "usage: .record [-n steps] <file> [addr]");
+
+         if (st.argv.size() == i + 2)
+         {
+            addr = st.ParseAddress(i + 1, err);
+            ERROR_CHECK(err);
+         }
+
+         rec.Open(st.dbg, st.argv[i].c_str(), err);
+         ERROR_CHECK(err);
+
+         st.dbg->Record(&rec, addr, count, err);
+
+         // What was recorded is worth keeping, whatever stopped it.
+         //
+         rec.Close(ERROR_FAILED(err) ? &closeErr : err);
+         ERROR_CHECK(err);
+
+         st.dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "%llu steps, %llu bytes\n",
+            (unsigned long long)rec.encoder.total,
+            (unsigned long long)rec.written
+         );
+         ERROR_CHECK(err);
+
+         if (st.dbg->proc->IsAttached())
+         {
+            Disassemble(st, 1, err);
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
+
+      list[".recdump"] = [] (CommandState &st, error *err) -> void
+      {
+         RecordReader reader;
+         uint64_t steps = 0;
+
+         if (st.argv.size() != 2)
+            ERROR_SET(err, unknown, "usage: .recdump <file>");
+
+         reader.Open(st.argv[1].c_str(), err);
+         ERROR_CHECK(err);
+
+         reader.Read(
+            [&st, &steps] (uint64_t n, const StepCapture &step, error *err) -> void
+            {
+               int nregs = st.dbg->cpu->GetRegisterCount();
+               char pc[64];
+               std::string line;
+
+               FormatAddr(st, step.before[DBG_IP], pc, sizeof(pc), err);
+               ERROR_CHECK(err);
+
+               // Each register that changed, then each write, with up
+               // to 16 of its new bytes.
+               //
+               try
+               {
+                  for (size_t i=0; i<step.after.size(); ++i)
+                  {
+                     const char *name = nullptr;
+                     char buf[64];
+
+                     if (i == DBG_IP || step.before[i] == step.after[i])
+                        continue;
+                     if (i < (size_t)nregs)
+                        name = st.dbg->cpu->GetRegisterName(i);
+                     if (name)
+                        snprintf(buf, sizeof(buf), " %s=%llx", name, (unsigned long long)step.after[i]);
+                     else
+                        snprintf(buf, sizeof(buf), " r%d=%llx", (int)i, (unsigned long long)step.after[i]);
+                     line += buf;
+                  }
+                  for (auto &w : step.writes)
+                  {
+                     char buf[64];
+
+                     snprintf(buf, sizeof(buf), " [%llx]=", (unsigned long long)w.addr);
+                     line += buf;
+                     for (uint32_t j=0; j<w.len && j<16; ++j)
+                     {
+                        snprintf(buf, sizeof(buf), "%02x", step.data[w.now + j]);
+                        line += buf;
+                     }
+                     if (w.len > 16)
+                        line += "...";
+                  }
+               }
+               catch (std::bad_alloc)
+               {
+                  ERROR_SET(err, nomem);
+               }
+
+               st.dbg->proc->EventCallbacks->OnMessage(
+                  err,
+                  "%10llu %s%s\n",
+                  (unsigned long long)n,
+                  pc,
+                  line.c_str()
+               );
+               ERROR_CHECK(err);
+               ++steps;
+            exit:;
+            },
+            err
+         );
+         ERROR_CHECK(err);
+
+         st.dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "%llu steps\n",
+            (unsigned long long)steps
+         );
+         ERROR_CHECK(err);
+      exit:;
+      };
+
+      list[".history"] = [] (CommandState &st, error *err) -> void
+      {
+         auto &history = st.dbg->history;
+
+         if (st.argv.size() >= 2 && st.argv[1] == "on" && st.argv.size() <= 3)
+         {
+            if (st.argv.size() == 3)
+            {
+               char *p = nullptr;
+               unsigned long long steps = strtoull(st.argv[2].c_str(), &p, 0);
+
+               if (*p || !st.argv[2].size() || steps < History::ChunkSteps)
+                  ERROR_SET(err, unknown, "usage: .history [on [steps]|off|clear]; keep at least 256 steps");
+               history.maxSteps = steps;
+            }
+            history.enabled = true;
+         }
+         else if (st.argv.size() == 2 && st.argv[1] == "off")
+         {
+            history.Clear();
+            history.enabled = false;
+         }
+         else if (st.argv.size() == 2 && st.argv[1] == "clear")
+         {
+            history.Clear();
+         }
+         else if (st.argv.size() != 1)
+         {
+            ERROR_SET(err, unknown, "usage: .history [on [steps]|off|clear]");
+         }
+
+         st.dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "History: %s, %llu of at most %llu steps, at step %llu, %llu bytes\n",
+            history.enabled ? "on" : "off",
+            (unsigned long long)(history.GetEnd() - history.GetFirst()),
+            (unsigned long long)history.maxSteps,
+            (unsigned long long)history.pos,
+            (unsigned long long)history.size
+         );
+         ERROR_CHECK(err);
+      exit:;
+      };
+
+      list[".checkpoint"] = [] (CommandState &st, error *err) -> void
+      {
+         auto &checkpoints = st.dbg->checkpoints;
+
+         if (st.argv.size() == 1)
+         {
+            int id = checkpoints.Take(st.dbg, err);
+            ERROR_CHECK(err);
+
+            st.dbg->proc->EventCallbacks->OnMessage(err, "Checkpoint %d\n", id);
+            ERROR_CHECK(err);
+         }
+         else if (st.argv.size() == 2 && st.argv[1] == "list")
+         {
+            uint64_t now = MonotonicTime();
+
+            for (auto &i : checkpoints.list)
+            {
+               auto &cp = i.second;
+               char pc[64];
+
+               FormatAddr(st, cp.pc, pc, sizeof(pc), err);
+               ERROR_CHECK(err);
+
+               st.dbg->proc->EventCallbacks->OnMessage(
+                  err,
+                  "%3d %s, %.1fs ago\n",
+                  cp.id,
+                  pc,
+                  (now - cp.time) / 1e9
+               );
+               ERROR_CHECK(err);
+            }
+         }
+         else if (st.argv.size() == 3 && st.argv[1] == "delete")
+         {
+            char *p = nullptr;
+            long id = strtol(st.argv[2].c_str(), &p, 10);
+
+            if (*p || !st.argv[2].size())
+               ERROR_SET(err, unknown, "usage: .checkpoint [list|delete <n>]");
+
+            checkpoints.Delete(st.dbg, id, err);
+            ERROR_CHECK(err);
+         }
+         else
+         {
+            ERROR_SET(err, unknown, "usage: .checkpoint [list|delete <n>]");
+         }
+      exit:;
+      };
+
+      list[".restart"] = [] (CommandState &st, error *err) -> void
+      {
+         char *p = nullptr;
+         long id = 0;
+
+         if (st.argv.size() != 2)
+            ERROR_SET(err, unknown, "usage: .restart <n>");
+
+         id = strtol(st.argv[1].c_str(), &p, 10);
+         if (*p || !st.argv[1].size())
+            ERROR_SET(err, unknown, "usage: .restart <n>");
+
+         st.dbg->checkpoints.Restart(st.dbg, id, err);
+         ERROR_CHECK(err);
+
+         Disassemble(st, 1, err);
+         ERROR_CHECK(err);
+      exit:;
+      };
+
+      list["sx"] = [] (CommandState &st, error *err) -> void
+      {
+         static const char *const names[] = {"stop", "print", "pass", "suppress"};
+         Process *proc = st.dbg->proc.Get();
+         int policy = -1;
+         std::vector<int> sigs;
+
+         if (st.argv.size() == 1)
+         {
+            char buf[32];
+
+            // Stop is the default, so only the rest are worth listing.
+            //
+            for (int sig = 1; sig < NSIG; ++sig)
+            {
+               if (proc->GetSignalPolicy(sig) == SignalStop)
+                  continue;
+               proc->EventCallbacks->OnMessage(
+                  err,
+                  "%-16s %s\n",
+                  FormatSignal(buf, sizeof(buf), sig),
+                  names[proc->GetSignalPolicy(sig)]
+               );
+               ERROR_CHECK(err);
+            }
+            goto exit;
+         }
+
+         for (size_t i = 0; i < ARRAY_SIZE(names); ++i)
+         {
+            if (st.argv[1] == names[i])
+               policy = i;
+         }
+         if (policy < 0 || st.argv.size() < 3)
+            ERROR_SET(err, unknown, "usage: sx [stop|print|pass|suppress <signal>...]");
+
+         try
+         {
+            for (size_t i = 2; i < st.argv.size(); ++i)
+            {
+               int sig = ParseSignal(st.argv[i].c_str());
+
+               if (sig < 0)
+                  ERROR_SET(err, unknown, "Unknown signal");
+
+               // The debugger needs these for itself.
+               //
+               if (sig == SIGKILL || sig == SIGSTOP || sig == SIGTRAP || sig == SIGINT)
+                  ERROR_SET(err, unknown, "SIGINT, SIGKILL, SIGSTOP and SIGTRAP always stop");
+
+               sigs.push_back(sig);
+            }
+         }
+         catch (const std::bad_alloc &)
+         {
+            ERROR_SET(err, nomem);
+         }
+
+         // All or nothing.
+         //
+         for (auto sig : sigs)
+            proc->signalPolicy[sig] = policy;
+      exit:;
+      };
+
+      list[".strace"] = [] (CommandState &st, error *err) -> void
+      {
+         // Past the highest call number on any platform we know.
+         //
+         static const size_t MaxSyscall = 1024;
+         std::vector<bool> calls;
+         std::string names;
+
+         try
+         {
+            if (st.argv.size() == 1)
+            {
+               auto &traced = st.dbg->strace.calls;
+
+               for (size_t nr = 0; nr < traced.size(); ++nr)
+               {
+                  const SyscallName *sc = LookupSyscall((addr_t)nr);
+
+                  if (!traced[nr])
+                     continue;
+                  if (names.size())
+                     names += ' ';
+                  names += sc ? sc->name : std::to_string(nr);
+               }
+
+               st.dbg->proc->EventCallbacks->OnMessage(
+                  err,
+                  "%s\n",
+                  names.size() ? names.c_str() : "Not tracing system calls"
+               );
+               ERROR_CHECK(err);
+               goto exit;
+            }
+
+            if (st.argv.size() == 2 && st.argv[1] == "off")
+            {
+               st.dbg->strace.Set(st.dbg, calls, err);
+               ERROR_CHECK(err);
+               goto exit;
+            }
+
+            if (st.argv.size() == 2 && st.argv[1] == "all")
+            {
+               calls.resize(MaxSyscall, true);
+            }
+            else
+            {
+               for (size_t i = 1; i < st.argv.size(); ++i)
+               {
+                  const SyscallName *sc = LookupSyscall(st.argv[i].c_str());
+                  char *p = nullptr;
+                  unsigned long nr = sc ? sc->nr : strtoul(st.argv[i].c_str(), &p, 0);
+
+                  if (!sc && (*p || !st.argv[i].size() || nr >= MaxSyscall))
+                     ERROR_SET(err, unknown, "usage: .strace [off|all|<name|nr>...]");
+
+                  if (calls.size() <= nr)
+                     calls.resize(nr + 1);
+                  calls[nr] = true;
+               }
+            }
+         }
+         catch (const std::bad_alloc &)
+         {
+            ERROR_SET(err, nomem);
+         }
+
+         st.dbg->strace.Set(st.dbg, calls, err);
+         ERROR_CHECK(err);
+      exit:;
+      };
+
       list["q"] = [] (CommandState &st, error *err) -> void
       {
          st.dbg->proc->Quit(err);
@@ -88,6 +1113,34 @@ dbg::shell::RegisterCommands(CommandList &list, error *err)
       };
 
       list["u"] = DisassembleCommand();
+
+      list["~"] = [] (CommandState &st, error *err) -> void
+      {
+         std::vector<int> threads;
+         int current = st.dbg->proc->GetCurrentThread();
+
+         st.dbg->proc->GetThreads(threads, err);
+         ERROR_CHECK(err);
+
+         if (!threads.size())
+            ERROR_SET(err, unknown, "Threads aren't supported on this platform");
+
+         for (size_t i=0; i<threads.size(); ++i)
+         {
+            if (!threads[i])
+               continue;
+
+            st.dbg->proc->EventCallbacks->OnMessage(
+               err,
+               "%c%3d  tid %d\n",
+               threads[i] == current ? '.' : ' ',
+               (int)i,
+               threads[i]
+            );
+            ERROR_CHECK(err);
+         }
+      exit:;
+      };
    }
    catch (std::bad_alloc)
    {
@@ -118,9 +118,9 @@ main(int argc, char **argv)
    ERROR_CHECK(&err);
 
    if (pid)
-      dbg->proc->Attach(pid, &err);
+      dbg->Attach(pid, &err);
    else
-      dbg->proc->Create(argv, &err);
+      dbg->Create(argv, &err);
    ERROR_CHECK(&err);
 
    state.dbg = dbgPtr = dbg.Get();
@@ -134,7 +134,11 @@ main(int argc, char **argv)
    for (; !state.quitFlag && (line = readline("dbg> ")); free_and_clear(line))
    {
       state.Parse(line, &err);
-      ERROR_CHECK(&err);
+      if (ERROR_FAILED(&err))
+      {
+         error_clear(&err);
+         continue;
+      }
 
       if (!state.argv.size())
          continue;
@@ -8,6 +8,7 @@
 
 #include <dbg/shell.h>
 
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
@@ -25,6 +26,17 @@ dbg::shell::FormatAddr(
    return buf;
 }
 
+void
+dbg::shell::FormatDuration(uint64_t ns, char *buf, size_t len)
+{
+   if (ns < 1000000)
+      snprintf(buf, len, "%.1fus", ns / 1e3);
+   else if (ns < 1000000000)
+      snprintf(buf, len, "%.3fms", ns / 1e6);
+   else
+      snprintf(buf, len, "%.3fs", ns / 1e9);
+}
+
 dbg::addr_t
 dbg::shell::CommandState::ParseAddress(int argvIdx, error *err)
 {
@@ -137,5 +149,20 @@ dbg::shell::CommandState::Parse(const char *str, error *err)
    {
       ERROR_SET(err, nomem);
    }
+
+   // "~N cmd" is cmd for the Nth thread.  "~" alone is a command.
+   //
+   thread = -1;
+   if (argv.size() > 1 && argv[0].size() > 1 && argv[0][0] == '~')
+   {
+      char *end = nullptr;
+      long n = strtol(argv[0].c_str() + 1, &end, 10);
+
+      if (*end || n < 0)
+         ERROR_SET(err, unknown, "Expected a thread number after ~");
+
+      thread = n;
+      argv.erase(argv.begin());
+   }
 exit:;
 }
@@ -0,0 +1,618 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/strace.h>
+#include <dbg/dbg.h>
+#include <dbg/misc.h>
+
+#include <common/c++/new.h>
+
+#include <algorithm>
+#include <string>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+namespace {
+
+const dbg::SyscallName syscalls[] =
+{
+#if defined(SYS_read)
+   { "read", SYS_read, "dxu" },
+#endif
+#if defined(SYS_write)
+   { "write", SYS_write, "dxu" },
+#endif
+#if defined(SYS_open)
+   { "open", SYS_open, "sxo" },
+#endif
+#if defined(SYS_close)
+   { "close", SYS_close, "d" },
+#endif
+#if defined(SYS_stat)
+   { "stat", SYS_stat, "sx" },
+#endif
+#if defined(SYS_fstat)
+   { "fstat", SYS_fstat, "dx" },
+#endif
+#if defined(SYS_lstat)
+   { "lstat", SYS_lstat, "sx" },
+#endif
+#if defined(SYS_poll)
+   { "poll", SYS_poll, "xud" },
+#endif
+#if defined(SYS_lseek)
+   { "lseek", SYS_lseek, "dld" },
+#endif
+#if defined(SYS_mmap)
+   { "mmap", SYS_mmap, "xuxxdx" },
+#endif
+#if defined(SYS_mprotect)
+   { "mprotect", SYS_mprotect, "xux" },
+#endif
+#if defined(SYS_munmap)
+   { "munmap", SYS_munmap, "xu" },
+#endif
+#if defined(SYS_brk)
+   { "brk", SYS_brk, "x" },
+#endif
+#if defined(SYS_rt_sigaction)
+   { "rt_sigaction", SYS_rt_sigaction, "dxx" },
+#endif
+#if defined(SYS_rt_sigprocmask)
+   { "rt_sigprocmask", SYS_rt_sigprocmask, "dxxu" },
+#endif
+#if defined(SYS_ioctl)
+   { "ioctl", SYS_ioctl, "dxx" },
+#endif
+#if defined(SYS_pread64)
+   { "pread64", SYS_pread64, "dxul" },
+#endif
+#if defined(SYS_pwrite64)
+   { "pwrite64", SYS_pwrite64, "dxul" },
+#endif
+#if defined(SYS_readv)
+   { "readv", SYS_readv, "dxd" },
+#endif
+#if defined(SYS_writev)
+   { "writev", SYS_writev, "dxd" },
+#endif
+#if defined(SYS_access)
+   { "access", SYS_access, "so" },
+#endif
+#if defined(SYS_pipe)
+   { "pipe", SYS_pipe, "x" },
+#endif
+#if defined(SYS_select)
+   { "select", SYS_select, "dxxxx" },
+#endif
+#if defined(SYS_sched_yield)
+   { "sched_yield", SYS_sched_yield, "" },
+#endif
+#if defined(SYS_mremap)
+   { "mremap", SYS_mremap, "xuuxx" },
+#endif
+#if defined(SYS_madvise)
+   { "madvise", SYS_madvise, "xud" },
+#endif
+#if defined(SYS_dup)
+   { "dup", SYS_dup, "d" },
+#endif
+#if defined(SYS_dup2)
+   { "dup2", SYS_dup2, "dd" },
+#endif
+#if defined(SYS_nanosleep)
+   { "nanosleep", SYS_nanosleep, "xx" },
+#endif
+#if defined(SYS_getpid)
+   { "getpid", SYS_getpid, "" },
+#endif
+#if defined(SYS_socket)
+   { "socket", SYS_socket, "ddd" },
+#endif
+#if defined(SYS_connect)
+   { "connect", SYS_connect, "dxu" },
+#endif
+#if defined(SYS_accept)
+   { "accept", SYS_accept, "dxx" },
+#endif
+#if defined(SYS_sendto)
+   { "sendto", SYS_sendto, "dxuxxu" },
+#endif
+#if defined(SYS_recvfrom)
+   { "recvfrom", SYS_recvfrom, "dxuxxx" },
+#endif
+#if defined(SYS_sendmsg)
+   { "sendmsg", SYS_sendmsg, "dxx" },
+#endif
+#if defined(SYS_recvmsg)
+   { "recvmsg", SYS_recvmsg, "dxx" },
+#endif
+#if defined(SYS_shutdown)
+   { "shutdown", SYS_shutdown, "dd" },
+#endif
+#if defined(SYS_bind)
+   { "bind", SYS_bind, "dxu" },
+#endif
+#if defined(SYS_listen)
+   { "listen", SYS_listen, "dd" },
+#endif
+#if defined(SYS_clone)
+   { "clone", SYS_clone, "xxxxx" },
+#endif
+#if defined(SYS_fork)
+   { "fork", SYS_fork, "" },
+#endif
+#if defined(SYS_vfork)
+   { "vfork", SYS_vfork, "" },
+#endif
+#if defined(SYS_execve)
+   { "execve", SYS_execve, "sxx" },
+#endif
+#if defined(SYS_exit)
+   { "exit", SYS_exit, "d" },
+#endif
+#if defined(SYS_wait4)
+   { "wait4", SYS_wait4, "dxxx" },
+#endif
+#if defined(SYS_kill)
+   { "kill", SYS_kill, "dd" },
+#endif
+#if defined(SYS_uname)
+   { "uname", SYS_uname, "x" },
+#endif
+#if defined(SYS_fcntl)
+   { "fcntl", SYS_fcntl, "ddx" },
+#endif
+#if defined(SYS_flock)
+   { "flock", SYS_flock, "dd" },
+#endif
+#if defined(SYS_fsync)
+   { "fsync", SYS_fsync, "d" },
+#endif
+#if defined(SYS_ftruncate)
+   { "ftruncate", SYS_ftruncate, "dd" },
+#endif
+#if defined(SYS_getcwd)
+   { "getcwd", SYS_getcwd, "xu" },
+#endif
+#if defined(SYS_chdir)
+   { "chdir", SYS_chdir, "s" },
+#endif
+#if defined(SYS_fchdir)
+   { "fchdir", SYS_fchdir, "d" },
+#endif
+#if defined(SYS_rename)
+   { "rename", SYS_rename, "ss" },
+#endif
+#if defined(SYS_mkdir)
+   { "mkdir", SYS_mkdir, "so" },
+#endif
+#if defined(SYS_rmdir)
+   { "rmdir", SYS_rmdir, "s" },
+#endif
+#if defined(SYS_creat)
+   { "creat", SYS_creat, "so" },
+#endif
+#if defined(SYS_link)
+   { "link", SYS_link, "ss" },
+#endif
+#if defined(SYS_unlink)
+   { "unlink", SYS_unlink, "s" },
+#endif
+#if defined(SYS_symlink)
+   { "symlink", SYS_symlink, "ss" },
+#endif
+#if defined(SYS_readlink)
+   { "readlink", SYS_readlink, "sxu" },
+#endif
+#if defined(SYS_chmod)
+   { "chmod", SYS_chmod, "so" },
+#endif
+#if defined(SYS_fchmod)
+   { "fchmod", SYS_fchmod, "do" },
+#endif
+#if defined(SYS_chown)
+   { "chown", SYS_chown, "sdd" },
+#endif
+#if defined(SYS_umask)
+   { "umask", SYS_umask, "o" },
+#endif
+#if defined(SYS_gettimeofday)
+   { "gettimeofday", SYS_gettimeofday, "xx" },
+#endif
+#if defined(SYS_getuid)
+   { "getuid", SYS_getuid, "" },
+#endif
+#if defined(SYS_getgid)
+   { "getgid", SYS_getgid, "" },
+#endif
+#if defined(SYS_geteuid)
+   { "geteuid", SYS_geteuid, "" },
+#endif
+#if defined(SYS_getppid)
+   { "getppid", SYS_getppid, "" },
+#endif
+#if defined(SYS_setsid)
+   { "setsid", SYS_setsid, "" },
+#endif
+#if defined(SYS_prctl)
+   { "prctl", SYS_prctl, "dxxxx" },
+#endif
+#if defined(SYS_arch_prctl)
+   { "arch_prctl", SYS_arch_prctl, "dx" },
+#endif
+#if defined(SYS_gettid)
+   { "gettid", SYS_gettid, "" },
+#endif
+#if defined(SYS_futex)
+   { "futex", SYS_futex, "xdxxxx" },
+#endif
+#if defined(SYS_getdents64)
+   { "getdents64", SYS_getdents64, "dxu" },
+#endif
+#if defined(SYS_set_tid_address)
+   { "set_tid_address", SYS_set_tid_address, "x" },
+#endif
+#if defined(SYS_clock_gettime)
+   { "clock_gettime", SYS_clock_gettime, "dx" },
+#endif
+#if defined(SYS_clock_nanosleep)
+   { "clock_nanosleep", SYS_clock_nanosleep, "ddxx" },
+#endif
+#if defined(SYS_exit_group)
+   { "exit_group", SYS_exit_group, "d" },
+#endif
+#if defined(SYS_epoll_wait)
+   { "epoll_wait", SYS_epoll_wait, "dxdd" },
+#endif
+#if defined(SYS_epoll_ctl)
+   { "epoll_ctl", SYS_epoll_ctl, "dddx" },
+#endif
+#if defined(SYS_tgkill)
+   { "tgkill", SYS_tgkill, "ddd" },
+#endif
+#if defined(SYS_openat)
+   { "openat", SYS_openat, "asxo" },
+#endif
+#if defined(SYS_mkdirat)
+   { "mkdirat", SYS_mkdirat, "aso" },
+#endif
+#if defined(SYS_newfstatat)
+   { "newfstatat", SYS_newfstatat, "asxx" },
+#endif
+#if defined(SYS_unlinkat)
+   { "unlinkat", SYS_unlinkat, "asx" },
+#endif
+#if defined(SYS_renameat)
+   { "renameat", SYS_renameat, "asas" },
+#endif
+#if defined(SYS_readlinkat)
+   { "readlinkat", SYS_readlinkat, "asxu" },
+#endif
+#if defined(SYS_faccessat)
+   { "faccessat", SYS_faccessat, "aso" },
+#endif
+#if defined(SYS_ppoll)
+   { "ppoll", SYS_ppoll, "xuxx" },
+#endif
+#if defined(SYS_accept4)
+   { "accept4", SYS_accept4, "dxxx" },
+#endif
+#if defined(SYS_eventfd2)
+   { "eventfd2", SYS_eventfd2, "ux" },
+#endif
+#if defined(SYS_epoll_create1)
+   { "epoll_create1", SYS_epoll_create1, "x" },
+#endif
+#if defined(SYS_dup3)
+   { "dup3", SYS_dup3, "ddx" },
+#endif
+#if defined(SYS_pipe2)
+   { "pipe2", SYS_pipe2, "xx" },
+#endif
+#if defined(SYS_prlimit64)
+   { "prlimit64", SYS_prlimit64, "ddxx" },
+#endif
+#if defined(SYS_getrandom)
+   { "getrandom", SYS_getrandom, "xux" },
+#endif
+#if defined(SYS_memfd_create)
+   { "memfd_create", SYS_memfd_create, "sx" },
+#endif
+#if defined(SYS_statx)
+   { "statx", SYS_statx, "asxxx" },
+#endif
+#if defined(SYS_openat2)
+   { "openat2", SYS_openat2, "asxu" },
+#endif
+#if defined(SYS_close_range)
+   { "close_range", SYS_close_range, "ddx" },
+#endif
+   { nullptr, 0, nullptr },
+};
+
+// How much of a string argument to show.
+//
+const size_t MaxString = 64;
+
+const size_t PageSize = 4096;
+
+void
+AppendFormat(std::string &out, const char *fmt, unsigned long long value)
+{
+   char buf[32];
+
+   snprintf(buf, sizeof(buf), fmt, value);
+   out += buf;
+}
+
+// Quoted, with anything unprintable escaped, and "..." after it if it
+// goes on.  If it can't be read, it's the address.
+//
+void
+AppendString(dbg::Debugger *dbg, dbg::addr_t addr, std::string &out)
+{
+   char buf[MaxString];
+   size_t len = 0;
+   bool ended = false;
+
+   // A page at a time, so the end of the string can be at the end of
+   // the mapping.
+   //
+   while (len < sizeof(buf) && !ended)
+   {
+      error err;
+      size_t n = PageSize - (addr + len) % PageSize;
+
+      if (n > sizeof(buf) - len)
+         n = sizeof(buf) - len;
+
+      dbg->ReadMemory(addr + len, n, buf + len, &err);
+      if (ERROR_FAILED(&err))
+         break;
+
+      ended = memchr(buf + len, 0, n) != nullptr;
+      len += n;
+   }
+
+   if (!addr || !len)
+   {
+      AppendFormat(out, "0x%llx", addr);
+      return;
+   }
+
+   out += '"';
+   for (size_t i = 0; i < len && buf[i]; ++i)
+   {
+      unsigned char c = buf[i];
+
+      if (c == '"' || c == '\\')
+      {
+         out += '\\';
+         out += c;
+      }
+      else if (c == '\n')
+         out += "\\n";
+      else if (c == '\t')
+         out += "\\t";
+      else if (c < ' ' || c >= 0x7f)
+         AppendFormat(out, "\\x%02llx", c);
+      else
+         out += c;
+   }
+   out += '"';
+   if (!ended)
+      out += "...";
+}
+
+void
+AppendArg(dbg::Debugger *dbg, char type, dbg::addr_t value, std::string &out)
+{
+   switch (type)
+   {
+   case 'd':
+      AppendFormat(out, "%lld", (int)value);
+      break;
+   case 'l':
+      AppendFormat(out, "%lld", (long long)value);
+      break;
+   case 'u':
+      AppendFormat(out, "%llu", value);
+      break;
+   case 'o':
+      AppendFormat(out, "0%llo", value);
+      break;
+   case 's':
+      AppendString(dbg, value, out);
+      break;
+   case 'a':
+#if defined(AT_FDCWD)
+      if ((int)value == AT_FDCWD)
+      {
+         out += "AT_FDCWD";
+         break;
+      }
+#endif
+      AppendFormat(out, "%lld", (int)value);
+      break;
+   default:
+      AppendFormat(out, "0x%llx", value);
+   }
+}
+
+// As .call shows them: errors with their text, addresses in hex.
+//
+void
+AppendResult(dbg::addr_t r, std::string &out)
+{
+   if (r > (dbg::addr_t)-4096)
+   {
+      AppendFormat(out, "-%llu (", -r);
+      out += strerror(-r);
+      out += ')';
+   }
+   else if (r < 0x80000000)
+   {
+      AppendFormat(out, "%llu", r);
+   }
+   else
+   {
+      AppendFormat(out, "0x%llx", r);
+   }
+}
+
+} // end namespace
+
+const dbg::SyscallName *
+dbg::LookupSyscall(const char *name)
+{
+   for (auto p = syscalls; p->name; ++p)
+   {
+      if (!strcmp(p->name, name))
+         return p;
+   }
+   return nullptr;
+}
+
+const dbg::SyscallName *
+dbg::LookupSyscall(addr_t nr)
+{
+   for (auto p = syscalls; p->name; ++p)
+   {
+      if ((addr_t)p->nr == nr)
+         return p;
+   }
+   return nullptr;
+}
+
+bool
+dbg::SyscallTrace::IsEnabled() const
+{
+   return std::find(calls.begin(), calls.end(), true) != calls.end();
+}
+
+void
+dbg::SyscallTrace::Set(Debugger *dbg, const std::vector<bool> &newCalls, error *err)
+{
+   std::vector<bool> copy;
+   bool was = IsEnabled();
+
+   try
+   {
+      copy = newCalls;
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->proc->SetSyscallTrace(copy, err);
+   ERROR_CHECK(err);
+
+   calls.swap(copy);
+   if (!was)
+      Clear();
+exit:;
+}
+
+void
+dbg::SyscallTrace::Clear()
+{
+   open.clear();
+   start = MonotonicTime();
+}
+
+void
+dbg::SyscallTrace::OnSyscall(Debugger *dbg, const SyscallStop &stop, error *err)
+{
+   const SyscallName *sc = LookupSyscall(stop.nr);
+   const char *name = sc ? sc->name : nullptr;
+   char unknown[32];
+   uint64_t now = MonotonicTime();
+   uint64_t since = now - start;
+   std::string line;
+   auto it = open.begin();
+
+   if (!name)
+   {
+      snprintf(unknown, sizeof(unknown), "syscall_%llu", (unsigned long long)stop.nr);
+      name = unknown;
+   }
+
+   while (it != open.end() && it->thread != stop.thread)
+      ++it;
+
+   try
+   {
+      if (stop.entry)
+      {
+         const char *args = sc ? sc->args : "xxxxxx";
+
+         for (int i = 0; args[i]; ++i)
+         {
+            if (i)
+               line += ", ";
+            AppendArg(dbg, args[i], stop.args[i], line);
+         }
+
+         if (it == open.end())
+         {
+            Open call = { stop.thread, now };
+            open.push_back(call);
+         }
+         else
+         {
+            it->entered = now;
+         }
+
+         dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "%llu.%06llu [%d] %s(%s)\n",
+            (unsigned long long)(since / 1000000000),
+            (unsigned long long)(since / 1000 % 1000000),
+            stop.thread,
+            name,
+            line.c_str()
+         );
+         ERROR_CHECK(err);
+      }
+      else
+      {
+         uint64_t took = 0;
+
+         if (it != open.end())
+         {
+            took = now - it->entered;
+            open.erase(it);
+         }
+
+         AppendResult(stop.result, line);
+
+         dbg->proc->EventCallbacks->OnMessage(
+            err,
+            "%llu.%06llu [%d] %s = %s <%llu.%06llu>\n",
+            (unsigned long long)(since / 1000000000),
+            (unsigned long long)(since / 1000 % 1000000),
+            stop.thread,
+            name,
+            line.c_str(),
+            (unsigned long long)(took / 1000000000),
+            (unsigned long long)(took / 1000 % 1000000)
+         );
+         ERROR_CHECK(err);
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
@@ -0,0 +1,393 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/tracelog.h>
+#include <dbg/tracepoint.h>
+
+#include <common/c++/new.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+using dbg::addr_t;
+
+namespace {
+
+const char Magic[8] = { 'D', 'B', 'G', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t Version = 1;
+
+const size_t BufferSize = 64 * 1024;
+
+// Much bigger than anything we write.  Past this the log is corrupt.
+//
+const uint32_t MaxRecord = 16 * 1024 * 1024;
+
+void
+WriteAll(int fd, const unsigned char *p, size_t len, error *err)
+{
+   while (len)
+   {
+      ssize_t r = write(fd, p, len);
+      if (r < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         ERROR_SET(err, errno, errno);
+      }
+      p += r;
+      len -= r;
+   }
+exit:;
+}
+
+} // end namespace
+
+void
+dbg::TraceLog::Open(const char *path, error *err)
+{
+   TraceLogHeader hdr;
+
+   Close(err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      buffer.resize(BufferSize);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0)
+      ERROR_SET(err, errno, errno);
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, Magic, sizeof(hdr.magic));
+   hdr.version = Version;
+
+   Write(&hdr, sizeof(hdr), err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::TraceLog::Close(error *err)
+{
+   if (fd < 0)
+      goto exit;
+
+   Flush(err);
+   close(fd);
+   fd = -1;
+   used = 0;
+exit:;
+}
+
+void
+dbg::TraceLog::Flush(error *err)
+{
+   if (fd < 0 || !used)
+      goto exit;
+
+   // Whatever happens, don't write it twice.
+   //
+   WriteAll(fd, buffer.data(), used, err);
+   used = 0;
+exit:;
+}
+
+void
+dbg::TraceLog::Write(const void *buf, size_t len, error *err)
+{
+   auto p = (const unsigned char*)buf;
+
+   if (fd < 0)
+      ERROR_SET(err, unknown, "Trace log isn't open");
+
+   if (used + len > buffer.size())
+   {
+      Flush(err);
+      ERROR_CHECK(err);
+
+      if (len > buffer.size())
+      {
+         WriteAll(fd, p, len, err);
+         goto exit;
+      }
+   }
+
+   memcpy(buffer.data() + used, p, len);
+   used += len;
+exit:;
+}
+
+void
+dbg::TraceLog::WriteDefinition(const Tracepoint *tp, error *err)
+{
+   TraceLogRecord rec;
+   TraceLogDefinitionRecord def;
+
+   rec.len = sizeof(def);
+   for (auto &item : tp->items)
+      rec.len += sizeof(TraceLogItem) + item.text.size();
+   rec.type = TraceLogDefinition;
+
+   def.id = tp->id;
+   def.items = tp->items.size();
+   def.vaddr = tp->vaddr;
+   def.size = tp->size;
+   def.frames = tp->frames;
+
+   Write(&rec, sizeof(rec), err);
+   ERROR_CHECK(err);
+   Write(&def, sizeof(def), err);
+   ERROR_CHECK(err);
+
+   for (auto &item : tp->items)
+   {
+      TraceLogItem out;
+
+      out.len = item.len;
+      out.offset = item.offset;
+      out.textLen = item.text.size();
+
+      Write(&out, sizeof(out), err);
+      ERROR_CHECK(err);
+      Write(item.text.data(), item.text.size(), err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+dbg::TraceLog::WriteEvent(
+   const Tracepoint *tp,
+   uint64_t seq,
+   uint64_t time,
+   const void *data,
+   const addr_t *frames,
+   uint32_t nframes,
+   error *err
+)
+{
+   TraceLogRecord rec;
+   TraceLogEventRecord ev;
+
+   rec.len = sizeof(ev) + tp->size + nframes * sizeof(uint64_t);
+   rec.type = TraceLogEvent;
+
+   ev.id = tp->id;
+   ev.frames = nframes;
+   ev.seq = seq;
+   ev.time = time;
+
+   Write(&rec, sizeof(rec), err);
+   ERROR_CHECK(err);
+   Write(&ev, sizeof(ev), err);
+   ERROR_CHECK(err);
+   Write(data, tp->size, err);
+   ERROR_CHECK(err);
+
+   for (uint32_t i=0; i<nframes; ++i)
+   {
+      uint64_t pc = frames[i];
+
+      Write(&pc, sizeof(pc), err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+dbg::TraceLog::WriteDropped(uint64_t count, error *err)
+{
+   TraceLogRecord rec;
+   TraceLogDroppedRecord dropped;
+
+   rec.len = sizeof(dropped);
+   rec.type = TraceLogDropped;
+   dropped.count = count;
+
+   Write(&rec, sizeof(rec), err);
+   ERROR_CHECK(err);
+   Write(&dropped, sizeof(dropped), err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+dbg::TraceLogReader::~TraceLogReader()
+{
+   if (file)
+      fclose(file);
+}
+
+void
+dbg::TraceLogReader::Open(const char *path, error *err)
+{
+   TraceLogHeader hdr;
+
+   if (file)
+   {
+      fclose(file);
+      tracepoints.clear();
+   }
+
+   file = fopen(path, "rb");
+   if (!file)
+      ERROR_SET(err, errno, errno);
+
+   if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+       memcmp(hdr.magic, Magic, sizeof(hdr.magic)))
+   {
+      ERROR_SET(err, unknown, "Not a trace log");
+   }
+   if (hdr.version != Version)
+      ERROR_SET(err, unknown, "Unsupported trace log version");
+exit:;
+}
+
+void
+dbg::TraceLogReader::Read(
+   std::function<void(const Tracepoint *tp, const TraceLogEventRecord *ev, const unsigned char *data, const addr_t *frames, error *err)> onEvent,
+   std::function<void(uint64_t count, error *err)> onDropped,
+   error *err
+)
+{
+   std::vector<addr_t> frames;
+
+   for (;;)
+   {
+      TraceLogRecord rec;
+      const unsigned char *p = nullptr;
+      size_t n = fread(&rec, 1, sizeof(rec), file);
+
+      if (!n && feof(file))
+         break;
+      if (n != sizeof(rec) || rec.len > MaxRecord)
+         ERROR_SET(err, unknown, "Trace log is truncated or corrupt");
+
+      try
+      {
+         record.resize(rec.len);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+      if (rec.len && fread(record.data(), rec.len, 1, file) != 1)
+         ERROR_SET(err, unknown, "Trace log is truncated or corrupt");
+      p = record.data();
+
+      if (rec.type == TraceLogDefinition)
+      {
+         TraceLogDefinitionRecord def;
+         std::unique_ptr<Tracepoint> tp;
+         size_t off = sizeof(def);
+
+         if (rec.len < sizeof(def))
+            ERROR_SET(err, unknown, "Bad tracepoint definition in log");
+         memcpy(&def, p, sizeof(def));
+
+         try
+         {
+            tp.reset(new Tracepoint());
+            tp->id = def.id;
+            tp->vaddr = def.vaddr;
+            tp->size = def.size;
+            tp->frames = def.frames;
+
+            for (uint32_t i=0; i<def.items; ++i)
+            {
+               TraceLogItem in;
+               Tracepoint::Item item;
+
+               if (rec.len - off < sizeof(in))
+                  ERROR_SET(err, unknown, "Bad tracepoint definition in log");
+               memcpy(&in, p + off, sizeof(in));
+               off += sizeof(in);
+
+               if (rec.len - off < in.textLen ||
+                   in.offset + (in.len ? in.len : sizeof(addr_t)) > def.size)
+               {
+                  ERROR_SET(err, unknown, "Bad tracepoint definition in log");
+               }
+               item.len = in.len;
+               item.offset = in.offset;
+               item.text.assign((const char*)p + off, in.textLen);
+               off += in.textLen;
+
+               if (tp->text.size())
+                  tp->text += ", ";
+               tp->text += item.text;
+               tp->items.push_back(std::move(item));
+            }
+
+            tracepoints[def.id] = std::move(tp);
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+      }
+      else if (rec.type == TraceLogEvent)
+      {
+         TraceLogEventRecord ev;
+         decltype(tracepoints.begin()) it;
+
+         if (rec.len < sizeof(ev))
+            ERROR_SET(err, unknown, "Bad event in trace log");
+         memcpy(&ev, p, sizeof(ev));
+
+         it = tracepoints.find(ev.id);
+         if (it == tracepoints.end())
+            ERROR_SET(err, unknown, "Trace log has an event for an undefined tracepoint");
+         if (rec.len != sizeof(ev) + it->second->size + (size_t)ev.frames * sizeof(uint64_t))
+            ERROR_SET(err, unknown, "Bad event in trace log");
+
+         try
+         {
+            frames.resize(ev.frames);
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+         for (uint32_t i=0; i<ev.frames; ++i)
+         {
+            uint64_t pc = 0;
+            memcpy(&pc, p + sizeof(ev) + it->second->size + i * sizeof(pc), sizeof(pc));
+            frames[i] = pc;
+         }
+
+         onEvent(it->second.get(), &ev, p + sizeof(ev), frames.data(), err);
+         ERROR_CHECK(err);
+      }
+      else if (rec.type == TraceLogDropped)
+      {
+         TraceLogDroppedRecord dropped;
+
+         if (rec.len < sizeof(dropped))
+            ERROR_SET(err, unknown, "Bad record in trace log");
+         memcpy(&dropped, p, sizeof(dropped));
+
+         onDropped(dropped.count, err);
+         ERROR_CHECK(err);
+      }
+
+      // Anything else is from a later version, and skipped.
+      //
+   }
+
+   if (ferror(file))
+      ERROR_SET(err, errno, errno);
+exit:;
+}
@@ -0,0 +1,593 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/tracepoint.h>
+#include <dbg/dbg.h>
+
+#include <common/c++/new.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+using dbg::addr_t;
+
+namespace {
+
+#if defined(SYS_mmap2)
+const addr_t MmapNr = SYS_mmap2;
+#else
+const addr_t MmapNr = SYS_mmap;
+#endif
+
+const uint32_t MaxFrames = 256;
+
+void
+Trim(const char *&p, const char *&q)
+{
+   while (p < q && isspace((unsigned char)*p))
+      ++p;
+   while (q > p && isspace((unsigned char)q[-1]))
+      --q;
+}
+
+void
+OnTracepointHit(dbg::Debugger *dbg, dbg::Breakpoint *bp, void *context, error *err)
+{
+   auto tps = (dbg::Tracepoints*)context;
+
+   for (auto &p : tps->tracepoints)
+   {
+      if (p.second.frames && p.second.vaddr == bp->vaddr)
+      {
+         tps->Record(&p.second, err);
+         break;
+      }
+   }
+}
+
+} // end namespace
+
+void
+dbg::Tracepoint::Parse(Cpu *cpu, const char *str, error *err)
+{
+   const char *p = str;
+   uint32_t off = 0;
+
+   try
+   {
+      text = str;
+      items.clear();
+
+      while (*p)
+      {
+         const char *end = p + strcspn(p, ",");
+         const char *colon = nullptr;
+         Item item;
+
+         item.len = 0;
+         item.offset = off;
+
+         Trim(p, end);
+         item.text.assign(p, end - p);
+
+         for (const char *q = end; q > p; --q)
+         {
+            if (q[-1] == ':')
+            {
+               colon = q - 1;
+               break;
+            }
+         }
+         if (colon)
+         {
+            const char *num = colon + 1;
+            const char *numEnd = end;
+            std::string digits;
+            char *stop = nullptr;
+            int base = 16;
+
+            Trim(num, numEnd);
+            if (numEnd - num > 2 && !strncmp(num, "0n", 2))
+            {
+               base = 10;
+               num += 2;
+            }
+            digits.assign(num, numEnd - num);
+            item.len = strtoul(digits.c_str(), &stop, base);
+            if (!digits.size() || *stop || !item.len)
+               ERROR_SET(err, unknown, "Expected a length after ':'");
+            end = colon;
+            Trim(p, end);
+         }
+
+         if (p == end)
+            ERROR_SET(err, unknown, "Expected an expression");
+
+         New(item.expr, err);
+         ERROR_CHECK(err);
+         item.expr->Compile(cpu, std::string(p, end - p).c_str(), err);
+         ERROR_CHECK(err);
+
+         // Everything starts on a word.
+         //
+         off += ((item.len ? item.len : sizeof(addr_t)) + 7) & ~7;
+         if (offsetof(TraceRecord, data) + off > TraceRing::SlotSize)
+            ERROR_SET(err, unknown, "Too much to record in one go");
+
+         items.push_back(item);
+
+         p += strcspn(p, ",");
+         if (*p)
+            ++p;
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   if (!items.size())
+      ERROR_SET(err, unknown, "Nothing to record");
+   size = off;
+exit:;
+}
+
+void
+dbg::Tracepoints::MapRing(addr_t near, error *err)
+{
+#if defined(__linux__) && defined(SYS_memfd_create) && defined(MFD_CLOEXEC)
+   static const char name[] = "dbg-trace";
+   size_t size = sizeof(TraceRing) + TraceRing::SlotSize * TraceRing::Slots;
+   addr_t nameAddr = 0, addr = 0;
+   int targetFd = -1, fd = -1;
+   void *map = MAP_FAILED;
+
+   // The name has to be somewhere in the target.
+   //
+   nameAddr = dbg->trampolines.Allocate(dbg, near, sizeof(name), err);
+   ERROR_CHECK(err);
+   dbg->proc->WriteMemory(nameAddr, sizeof(name), name, err);
+   ERROR_CHECK(err);
+
+   targetFd = dbg->Syscall(SYS_memfd_create, { nameAddr, MFD_CLOEXEC }, err);
+   ERROR_CHECK(err);
+   dbg->Syscall(SYS_ftruncate, { (addr_t)targetFd, size }, err);
+   ERROR_CHECK(err);
+
+   addr = dbg->Syscall(
+      MmapNr,
+      { 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, (addr_t)targetFd, 0 },
+      err
+   );
+   ERROR_CHECK(err);
+
+   fd = dbg->proc->OpenFile(targetFd, O_RDWR, err);
+   ERROR_CHECK(err);
+   if (fd < 0)
+      ERROR_SET(err, unknown, "Can't share memory with the target");
+
+   map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (map == MAP_FAILED)
+      ERROR_SET(err, errno, errno);
+
+   remote = addr;
+   ring = (TraceRing*)map;
+   ringSize = size;
+   map = MAP_FAILED;
+   addr = 0;
+exit:
+   if (fd >= 0)
+      close(fd);
+   if (map != MAP_FAILED)
+      munmap(map, size);
+
+   // The mapping keeps the memfd alive for both of us.
+   //
+   if (targetFd >= 0 || addr)
+   {
+      error innerErr;
+
+      if (addr)
+         dbg->Syscall(SYS_munmap, { addr, size }, &innerErr);
+      if (targetFd >= 0)
+         dbg->Syscall(SYS_close, { (addr_t)targetFd }, &innerErr);
+   }
+#else
+   ERROR_SET(err, unknown, "Tracepoints aren't supported on this platform");
+exit:;
+#endif
+}
+
+dbg::Tracepoint *
+dbg::Tracepoints::Add(
+   Debugger *dbg,
+   addr_t pc,
+   const char *items,
+   uint32_t frames,
+   error *err
+)
+{
+   Tracepoint tp;
+   Tracepoint *slot = nullptr;
+   std::vector<Breakpoint::ptr> batch;
+   Breakpoint::ptr patch = Breakpoint::Null();
+   Breakpoint *bp = nullptr;
+   bool inserted = false;
+
+   this->dbg = dbg;
+
+   tp.Parse(dbg->cpu.Get(), items, err);
+   ERROR_CHECK(err);
+   tp.id = nextId;
+   tp.vaddr = pc;
+   tp.frames = frames;
+
+   if (frames > MaxFrames)
+      ERROR_SET(err, unknown, "Too many frames");
+   if (dbg->bps.Lookup(pc))
+      ERROR_SET(err, unknown, "There's already a breakpoint there");
+
+   // Before any events for it.
+   //
+   if (log.IsOpen())
+   {
+      log.WriteDefinition(&tp, err);
+      ERROR_CHECK(err);
+   }
+
+   if (frames)
+   {
+      try
+      {
+         slot = &tracepoints[tp.id];
+         inserted = true;
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      dbg->SetInternalBreakpoint(pc, OnTracepointHit, this, err);
+      ERROR_CHECK(err);
+      goto done;
+   }
+
+   if (!ring)
+   {
+      MapRing(pc, err);
+      ERROR_CHECK(err);
+   }
+
+   patch = dbg->trampolines.Build(
+      dbg,
+      pc,
+      [this, dbg, pc, &tp] (addr_t to, std::vector<unsigned char> &code, error *err) -> void
+      {
+         dbg->cpu->CompileTracepoint(&tp, remote, pc, code, err);
+      },
+      err
+   );
+   ERROR_CHECK(err);
+   tp.trampoline = patch->trampoline;
+   bp = patch.get();
+
+   try
+   {
+      batch.push_back(std::move(patch));
+      slot = &tracepoints[tp.id];
+      inserted = true;
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->bps.Insert(batch, err);
+   ERROR_CHECK(err);
+
+   dbg->proc->WriteMemory(pc, bp->size, bp->PatchedText(), err);
+   if (ERROR_FAILED(err))
+   {
+      dbg->bps.Remove(bp);
+      goto exit;
+   }
+
+done:
+   *slot = std::move(tp);
+   ++nextId;
+exit:
+   if (ERROR_FAILED(err) && inserted)
+   {
+      tracepoints.erase(tp.id);
+      slot = nullptr;
+   }
+   return slot;
+}
+
+void
+dbg::Tracepoints::Remove(Tracepoint *tp, error *err)
+{
+   if (IsPatched(tp))
+   {
+      auto bp = dbg->bps.Lookup(tp->vaddr);
+
+      if (tp->frames)
+         dbg->DeleteInternalBreakpoint(bp, err);
+      else
+         dbg->RemoveBreakpoint(bp, err);
+      ERROR_CHECK(err);
+   }
+
+   tracepoints.erase(tp->id);
+exit:;
+}
+
+void
+dbg::Tracepoints::Drop(addr_t start, addr_t end)
+{
+   for (auto it = tracepoints.begin(); it != tracepoints.end(); )
+   {
+      if (it->second.vaddr >= start && it->second.vaddr < end)
+      {
+         if (ring)
+            unloaded.insert(*it);
+         it = tracepoints.erase(it);
+      }
+      else
+      {
+         ++it;
+      }
+   }
+}
+
+dbg::Tracepoint *
+dbg::Tracepoints::Find(int id)
+{
+   auto it = tracepoints.find(id);
+   return it == tracepoints.end() ? nullptr : &it->second;
+}
+
+bool
+dbg::Tracepoints::IsPatched(const Tracepoint *tp)
+{
+   auto bp = dbg ? dbg->bps.Lookup(tp->vaddr) : nullptr;
+
+   if (!bp || bp->vaddr != tp->vaddr)
+      return false;
+   if (tp->frames)
+      return bp->handler == OnTracepointHit && bp->context == this;
+   return bp->trampoline == tp->trampoline;
+}
+
+void
+dbg::Tracepoints::Drain(
+   std::function<void(const Tracepoint *tp, const TraceRecord *rec, error *err)> callback,
+   uint64_t *dropped,
+   error *err
+)
+{
+   const unsigned char *slots = nullptr;
+   uint64_t tail = 0, total = 0;
+
+   *dropped = 0;
+   if (!ring)
+      goto exit;
+   slots = (const unsigned char*)(ring + 1);
+
+   // Only we write tail.  The target's writes to a slot are visible by
+   // the time its seq is.
+   //
+   tail = ring->tail;
+   for (;;)
+   {
+      auto rec = (const TraceRecord*)
+         (slots + (tail & (TraceRing::Slots - 1)) * TraceRing::SlotSize);
+      auto it = tracepoints.end();
+      Tracepoint *tp = nullptr;
+
+      if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != tail + 1)
+         break;
+
+      if ((it = tracepoints.find(rec->id)) != tracepoints.end())
+         tp = &it->second;
+      else if ((it = unloaded.find(rec->id)) != unloaded.end())
+         tp = &it->second;
+
+      if (tp)
+      {
+         if (log.IsOpen())
+         {
+            log.WriteEvent(tp, rec->seq, 0, rec->data, nullptr, 0, err);
+            ERROR_CHECK(err);
+         }
+         if (callback)
+         {
+            callback(tp, rec, err);
+            ERROR_CHECK(err);
+         }
+         ++tp->records;
+      }
+
+      __atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELEASE);
+   }
+
+   // Nothing more can come from code that's gone.
+   //
+   if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+      unloaded.clear();
+
+   total = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+   *dropped = total - lastDropped;
+   lastDropped = total;
+
+   if (*dropped && log.IsOpen())
+   {
+      log.WriteDropped(*dropped, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+dbg::Tracepoints::OpenLog(const char *path, error *err)
+{
+   CloseLog(err);
+   ERROR_CHECK(err);
+
+   log.Open(path, err);
+   ERROR_CHECK(err);
+
+   for (auto &p : tracepoints)
+   {
+      log.WriteDefinition(&p.second, err);
+      ERROR_CHECK(err);
+   }
+   for (auto &p : unloaded)
+   {
+      log.WriteDefinition(&p.second, err);
+      ERROR_CHECK(err);
+   }
+exit:
+   if (ERROR_FAILED(err))
+   {
+      error innerErr;
+      log.Close(&innerErr);
+   }
+}
+
+void
+dbg::Tracepoints::CloseLog(error *err)
+{
+   error innerErr;
+
+   FlushLog(err);
+   log.Close(ERROR_FAILED(err) ? &innerErr : err);
+}
+
+void
+dbg::Tracepoints::FlushLog(error *err)
+{
+   uint64_t dropped = 0;
+
+   if (!log.IsOpen())
+      goto exit;
+
+   Drain(nullptr, &dropped, err);
+   ERROR_CHECK(err);
+
+   log.Flush(err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Tracepoints::Record(Tracepoint *tp, error *err)
+{
+   struct timespec ts;
+   uint64_t dropped = 0;
+   error itemErr, stackErr;
+
+   if (!log.IsOpen())
+   {
+      ++missed;
+      goto exit;
+   }
+
+   try
+   {
+      scratch.resize(tp->size);
+      stack.clear();
+      stack.reserve(tp->frames);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+   memset(scratch.data(), 0, scratch.size());
+
+   for (auto &item : tp->items)
+   {
+      addr_t value = item.expr->Compute(dbg, &itemErr);
+      unsigned char *p = scratch.data() + item.offset;
+
+      if (!ERROR_FAILED(&itemErr))
+      {
+         if (item.len)
+            dbg->ReadMemory(value, item.len, p, &itemErr);
+         else
+            memcpy(p, &value, sizeof(value));
+      }
+      if (ERROR_FAILED(&itemErr))
+      {
+         ++missed;
+         goto exit;
+      }
+   }
+
+   // As much of the stack as makes sense; a trace that stops early is
+   // still worth having.
+   //
+   if (tp->frames)
+   {
+      dbg->cpu->StackTrace(
+         dbg,
+         [this, tp] (addr_t pc, addr_t frame, bool &cancel, error *err) -> void
+         {
+            stack.push_back(pc);
+            if (stack.size() >= tp->frames)
+               cancel = true;
+         },
+         &stackErr
+      );
+   }
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+
+   log.WriteEvent(
+      tp,
+      0,
+      ts.tv_sec * 1000000000ULL + ts.tv_nsec,
+      scratch.data(),
+      stack.data(),
+      stack.size(),
+      err
+   );
+   ERROR_CHECK(err);
+   ++tp->records;
+
+   // While we're here.
+   //
+   Drain(nullptr, &dropped, err);
+   ERROR_CHECK(err);
+exit:;
+}
+
+void
+dbg::Tracepoints::Reset()
+{
+   error err;
+
+   CloseLog(&err);
+
+   if (ring)
+      munmap(ring, ringSize);
+
+   ring = nullptr;
+   ringSize = 0;
+   remote = 0;
+   lastDropped = 0;
+   missed = 0;
+   tracepoints.clear();
+   unloaded.clear();
+}
@@ -0,0 +1,534 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/trampoline.h>
+#include <dbg/dbg.h>
+
+#include <common/misc.h>
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Elsewhere, the address is a hint, and we check we got it.
+//
+#if !defined(MAP_FIXED_NOREPLACE)
+#if defined(__linux__)
+#define MAP_FIXED_NOREPLACE 0x100000
+#else
+#define MAP_FIXED_NOREPLACE 0
+#endif
+#endif
+
+using dbg::addr_t;
+
+namespace {
+
+const size_t ArenaSize = 64 * 1024;
+
+// How far a jump goes, less room for the arena itself.
+//
+const addr_t Reach = 0x7fff0000 - ArenaSize;
+
+// Where to look for room: a step at a time either side of the code.
+// Below first, since above the program is where its heap grows.
+//
+const addr_t MapStep = 64 * 1024 * 1024;
+const int MapTries = 16;
+
+// Enough of the target's code to cover a jump with whole instructions.
+//
+const int MaxPatch = 32;
+
+bool
+InReach(addr_t a, addr_t b)
+{
+   return (a > b ? a - b : b - a) < Reach;
+}
+
+// A system call for the arena itself.  The debugger makes its stub in
+// an arena, so this can't go through Debugger::Syscall().
+//
+addr_t
+Syscall(dbg::Debugger *dbg, dbg::SystemCall &call, error *err)
+{
+   dbg->proc->Syscall(&call, 1, dbg->syscallStub, err);
+   ERROR_CHECK(err);
+
+   if (call.result > (addr_t)-4096)
+      ERROR_SET(err, errno, -call.result);
+exit:
+   return call.result;
+}
+
+addr_t
+Map(dbg::Debugger *dbg, addr_t hint, error *err, int flags = 0)
+{
+   // We write to it with the debugger's privileges, so it never needs
+   // to be writable.
+   //
+   dbg::SystemCall call =
+   {
+#if defined(SYS_mmap2)
+      SYS_mmap2,
+#else
+      SYS_mmap,
+#endif
+      {
+         hint,
+         ArenaSize,
+         PROT_READ | PROT_EXEC,
+         (addr_t)(MAP_PRIVATE | MAP_ANONYMOUS | flags),
+         (addr_t)-1,
+         0
+      },
+      6
+   };
+
+   return Syscall(dbg, call, err);
+}
+
+void
+Unmap(dbg::Debugger *dbg, addr_t addr)
+{
+   dbg::SystemCall call = { SYS_munmap, { addr, ArenaSize }, 2 };
+   error err;
+
+   Syscall(dbg, call, &err);
+}
+
+// How much of a was written when the arenas were as in before, or -1 if
+// it wasn't there.
+//
+ssize_t
+Written(const std::vector<dbg::Trampolines::Arena> &before, const dbg::Trampolines::Arena &a)
+{
+   for (auto &b : before)
+   {
+      if (b.base == a.base)
+         return b.used;
+   }
+   return -1;
+}
+
+} // end namespace
+
+addr_t
+dbg::Trampolines::Allocate(Debugger *dbg, addr_t near, size_t len, error *err)
+{
+   addr_t r = 0;
+
+   this->dbg = dbg;
+
+   len = (len + 15) & ~(size_t)15;
+
+   for (auto &a : arenas)
+   {
+      if (a.size - a.used >= len && InReach(a.base, near))
+      {
+         r = a.base + a.used;
+         a.used += len;
+         goto exit;
+      }
+   }
+
+   if (len > ArenaSize)
+      ERROR_SET(err, unknown, "Trampoline too big");
+
+   try
+   {
+      arenas.reserve(arenas.size() + 1);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   // The hint is only a hint.  If something's already there we get
+   // memory somewhere else, which may be too far away.
+   //
+   for (int i=0; i<2*MapTries; ++i)
+   {
+      addr_t step = MapStep * (i % MapTries + 1);
+      addr_t hint = 0;
+
+      if (i < MapTries)
+      {
+         if (near < step)
+            continue;
+         hint = near - step;
+      }
+      else
+      {
+         hint = near + step;
+      }
+      hint &= ~(addr_t)(ArenaSize - 1);
+
+      r = Map(dbg, hint, err);
+      ERROR_CHECK(err);
+
+      if (InReach(r, near) && InReach(r + ArenaSize, near))
+      {
+         arenas.push_back(Arena{r, ArenaSize, len});
+         goto exit;
+      }
+
+      Unmap(dbg, r);
+      r = 0;
+   }
+
+   ERROR_SET(err, unknown, "No room for a trampoline near the breakpoint");
+exit:
+   return r;
+}
+
+dbg::Breakpoint::ptr
+dbg::Trampolines::Build(
+   Debugger *dbg,
+   addr_t vaddr,
+   const Generator &gen,
+   error *err
+)
+{
+   unsigned char text[MaxPatch];
+   std::vector<unsigned char> code;
+   std::vector<Breakpoint*> others;
+   Breakpoint::ptr patch = Breakpoint::Null();
+   int jumpSize = dbg->cpu->GetJumpSize();
+   addr_t tramp = 0;
+   int n = 0;
+
+   this->dbg = dbg;
+
+   if (!jumpSize)
+      ERROR_SET(err, unknown, "Not supported on this architecture");
+
+   dbg->ReadMemory(vaddr, sizeof(text), text, err);
+   ERROR_CHECK(err);
+
+   // Once to see how big it is, pretending it's right next to the
+   // code, and again once we know where it goes.
+   //
+   tramp = vaddr;
+   for (int pass=0; pass<2; ++pass)
+   {
+      code.clear();
+
+      gen(tramp, code, err);
+      ERROR_CHECK(err);
+
+      dbg->cpu->RelocateInstructions(
+         text,
+         sizeof(text),
+         vaddr,
+         jumpSize,
+         tramp + code.size(),
+         code,
+         &n,
+         err
+      );
+      ERROR_CHECK(err);
+
+      try
+      {
+         code.resize(code.size() + jumpSize);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      dbg->cpu->GenerateJump(
+         tramp + code.size() - jumpSize,
+         vaddr + n,
+         &code[code.size() - jumpSize],
+         jumpSize,
+         err
+      );
+      ERROR_CHECK(err);
+
+      if (pass)
+         break;
+
+      dbg->bps.FindBreakpointsInRange(others, vaddr + 1, n - 1, err);
+      ERROR_CHECK(err);
+      if (others.size())
+         ERROR_SET(err, unknown, "Another breakpoint is in the way");
+
+      tramp = Allocate(dbg, vaddr, code.size(), err);
+      ERROR_CHECK(err);
+   }
+
+   patch = Breakpoint::Allocate(n, err);
+   ERROR_CHECK(err);
+
+   patch->vaddr = vaddr;
+   patch->trampoline = tramp;
+   memcpy(patch->OldText(), text, n);
+
+   dbg->cpu->GenerateJump(vaddr, tramp, patch->PatchedText(), n, err);
+   ERROR_CHECK(err);
+
+   dbg->proc->WriteMemory(tramp, code.size(), code.data(), err);
+   ERROR_CHECK(err);
+exit:
+   if (ERROR_FAILED(err))
+      patch = Breakpoint::Null();
+   return patch;
+}
+
+dbg::Breakpoint *
+dbg::Trampolines::Install(Debugger *dbg, Breakpoint *bp, error *err)
+{
+   Breakpoint::ptr patch = Breakpoint::Null();
+   Condition *cond = bp->location ? bp->location->condition.Get() : nullptr;
+   addr_t trap = 0;
+   Breakpoint *r = nullptr;
+
+   if (bp->trampoline)
+   {
+      r = bp;
+      goto exit;
+   }
+   if (!cond)
+      ERROR_SET(err, unknown, "Breakpoint has no condition");
+   if (bp->handler)
+      ERROR_SET(err, unknown, "The debugger needs to see every hit here");
+
+   patch = Build(
+      dbg,
+      bp->vaddr,
+      [dbg, bp, cond, &trap] (addr_t to, std::vector<unsigned char> &code, error *err) -> void
+      {
+         dbg->cpu->CompileCondition(cond, bp->vaddr, to, code, &trap, err);
+      },
+      err
+   );
+   ERROR_CHECK(err);
+
+   patch->seq = bp->seq;
+   patch->user = bp->user;
+   patch->handler = bp->handler;
+   patch->context = bp->context;
+   patch->location = bp->location;
+   patch->trap = trap;
+
+   try
+   {
+      traps[trap] = bp->vaddr;
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   dbg->proc->WriteMemory(bp->vaddr, patch->size, patch->PatchedText(), err);
+   ERROR_CHECK(err);
+
+   r = patch.get();
+   dbg->bps.bps.find(bp->vaddr)->second = std::move(patch);
+exit:
+   return r;
+}
+
+addr_t
+dbg::Trampolines::Displace(Debugger *dbg, Breakpoint *bp, error *err)
+{
+   unsigned char text[MaxPatch];
+   std::vector<unsigned char> code;
+   int jumpSize = dbg->cpu->GetJumpSize();
+   addr_t to = 0;
+   int n = 0;
+
+   this->dbg = dbg;
+
+   if (bp->displaced == ~(addr_t)0)
+      ERROR_SET(err, unknown, "Can't move the instruction at the breakpoint");
+   if (bp->displaced)
+      goto exit;
+
+   if (!jumpSize)
+      ERROR_SET(err, unknown, "Not supported on this architecture");
+   if (bp->trampoline)
+      ERROR_SET(err, unknown, "Not a trap");
+
+   dbg->ReadMemory(bp->vaddr, sizeof(text), text, err);
+   ERROR_CHECK(err);
+
+   // As in Build(), once for the size and once for real.
+   //
+   to = bp->vaddr;
+   for (int pass=0; pass<2; ++pass)
+   {
+      code.clear();
+
+      dbg->cpu->RelocateInstructions(
+         text,
+         sizeof(text),
+         bp->vaddr,
+         1,
+         to,
+         code,
+         &n,
+         err
+      );
+      ERROR_CHECK(err);
+
+      try
+      {
+         code.resize(code.size() + jumpSize);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      dbg->cpu->GenerateJump(
+         to + code.size() - jumpSize,
+         bp->vaddr + n,
+         &code[code.size() - jumpSize],
+         jumpSize,
+         err
+      );
+      ERROR_CHECK(err);
+
+      if (pass)
+         break;
+
+      to = Allocate(dbg, bp->vaddr, code.size(), err);
+      ERROR_CHECK(err);
+   }
+
+   dbg->proc->WriteMemory(to, code.size(), code.data(), err);
+   ERROR_CHECK(err);
+
+   bp->displaced = to;
+   bp->displacedEnd = to + code.size();
+exit:
+   if (ERROR_FAILED(err))
+   {
+      // Don't try again.  Running out of memory might be different,
+      // but that's not worth the trouble.
+      //
+      bp->displaced = ~(addr_t)0;
+      return 0;
+   }
+   return bp->displaced;
+}
+
+dbg::Breakpoint *
+dbg::Trampolines::FindTrap(addr_t pc)
+{
+   auto it = traps.find(pc);
+   Breakpoint *bp = nullptr;
+
+   if (it == traps.end())
+      return nullptr;
+
+   // It may have been removed since.
+   //
+   bp = dbg->bps.Lookup(it->second);
+   return (bp && bp->vaddr == it->second && bp->trap == pc) ? bp : nullptr;
+}
+
+void
+dbg::Trampolines::Drop(Breakpoint *bp)
+{
+   auto it = bp->trap ? traps.find(bp->trap) : traps.end();
+
+   if (it != traps.end() && it->second == bp->vaddr)
+      traps.erase(it);
+}
+
+void
+dbg::Trampolines::Reset()
+{
+   arenas.clear();
+   traps.clear();
+}
+
+bool
+dbg::Trampolines::WrittenSince(const std::vector<Arena> &before)
+{
+   for (auto &a : arenas)
+   {
+      ssize_t had = Written(before, a);
+
+      if (had < 0 || (size_t)had != a.used)
+         return true;
+   }
+   return false;
+}
+
+void
+dbg::Trampolines::Save(
+   Debugger *dbg,
+   const std::vector<Arena> &before,
+   std::vector<unsigned char> &out,
+   error *err
+)
+{
+   out.clear();
+
+   for (auto &a : arenas)
+   {
+      size_t from = MAX(Written(before, a), 0);
+      size_t len = a.used - from;
+
+      try
+      {
+         out.resize(out.size() + len);
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+
+      dbg->proc->ReadMemory(a.base + from, len, out.data() + out.size() - len, err);
+      ERROR_CHECK(err);
+   }
+exit:;
+}
+
+void
+dbg::Trampolines::Restore(
+   Debugger *dbg,
+   const std::vector<Arena> &before,
+   const std::vector<unsigned char> &saved,
+   error *err
+)
+{
+   const unsigned char *p = saved.data();
+
+   for (auto &a : arenas)
+   {
+      ssize_t had = Written(before, a);
+      size_t from = MAX(had, 0);
+      size_t len = a.used - from;
+
+      // Where it was, and nowhere else.  Something may be there
+      // already, if the target moved things around since.
+      //
+      if (had < 0)
+      {
+         addr_t r = Map(dbg, a.base, err, MAP_FIXED_NOREPLACE);
+         ERROR_CHECK(err);
+
+         if (r != a.base)
+         {
+            Unmap(dbg, r);
+            ERROR_SET(err, unknown, "Somewhere else is using a trampoline's address");
+         }
+      }
+
+      dbg->proc->WriteMemory(a.base + from, len, p, err);
+      ERROR_CHECK(err);
+      p += len;
+   }
+exit:;
+}
@@ -0,0 +1,320 @@
+/*
+ Copyright (C) 2019 Andrew Sveikauskas
+
+ Permission to use, copy, modify, and distribute this software for any
+ purpose with or without fee is hereby granted, provided that the above
+ copyright notice and this permission notice appear in all copies.
+*/
+
+#include <dbg/watchtrace.h>
+#include <dbg/dbg.h>
+#include <dbg/misc.h>
+
+#include <common/c++/new.h>
+#include <common/misc.h>
+
+using dbg::addr_t;
+
+namespace {
+
+// Calls are about 48 bytes each.
+//
+const size_t MaxCalls = 1000000;
+
+// How much straight-line code to decode at once.
+//
+const size_t MaxBlock = 64;
+const size_t BlockBytes = 512;
+const int MaxInstruction = 16;
+
+// Past this, a block step went somewhere we can't follow (eg. the code
+// changed under us), and we stop counting.
+//
+const uint64_t MaxWalk = 100000;
+
+const size_t PageSize = 4096;
+
+struct Frame
+{
+   int call;
+   uint64_t entered;
+};
+
+} // end namespace
+
+const std::vector<dbg::WatchTrace::Instruction> *
+dbg::WatchTrace::GetBlock(Debugger *dbg, addr_t start, error *err)
+{
+   std::vector<Instruction> *r = nullptr;
+   unsigned char text[BlockBytes];
+   size_t len = sizeof(text), off = 0;
+   bool clipped = false;
+   auto it = blocks.find(start);
+
+   if (it != blocks.end())
+      return &it->second;
+
+   // As it runs: a breakpoint's patch is what the CPU sees.  A trap
+   // ends the block step there anyway.
+   //
+   dbg->proc->ReadMemory(start, len, text, err);
+   if (ERROR_FAILED(err))
+   {
+      // Maybe that ran off the end of the code.
+      //
+      error_clear(err);
+      len = MIN(len, PageSize - start % PageSize);
+      clipped = true;
+
+      dbg->proc->ReadMemory(start, len, text, err);
+      ERROR_CHECK(err);
+   }
+
+   try
+   {
+      r = &blocks[start];
+
+      // Stop short of an instruction that might be cut off.
+      //
+      while (r->size() < MaxBlock &&
+             (clipped ? off < len : len - off >= MaxInstruction))
+      {
+         Instruction insn;
+         int n = dbg->cpu->DecodeBranch(
+            text + off,
+            len - off,
+            start + off,
+            &insn.kind,
+            &insn.target
+         );
+         if (!n)
+            break;
+
+         insn.addr = start + off;
+         insn.len = n;
+         r->push_back(insn);
+         off += n;
+
+         if (insn.kind != Cpu::BranchNone && insn.kind != Cpu::BranchConditional)
+            break;
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:
+   return r;
+}
+
+uint64_t
+dbg::WatchTrace::Walk(
+   Debugger *dbg,
+   addr_t start,
+   addr_t to,
+   Cpu::BranchKind *kind,
+   error *err
+)
+{
+   uint64_t n = 0;
+   addr_t pc = start;
+
+   *kind = Cpu::BranchNone;
+
+   while (n < MaxWalk)
+   {
+      auto block = GetBlock(dbg, pc, err);
+      ERROR_CHECK(err);
+      if (!block->size())
+         break;
+
+      for (auto &insn : *block)
+      {
+         // Got there without a branch: something cut the block short.
+         //
+         if (insn.addr == to && n)
+            goto exit;
+
+         ++n;
+
+         if (insn.kind == Cpu::BranchConditional && insn.target != to)
+            continue;
+         if (insn.kind != Cpu::BranchNone)
+         {
+            *kind = insn.kind;
+            goto exit;
+         }
+      }
+
+      pc = block->back().addr + block->back().len;
+   }
+exit:
+   return n;
+}
+
+void
+dbg::WatchTrace::Run(Debugger *dbg, error *err)
+{
+   std::vector<Frame> stack;
+   addr_t pc = 0, sp = 0, top = 0;
+   uint64_t start = MonotonicTime();
+   unsigned long seq = dbg->bps.nextSeq;
+
+   // Whoever stopped here has already told the breakpoint here, if
+   // there's one with a handler.
+   //
+   bool handled = true;
+
+   calls.clear();
+   blocks.clear();
+   dropped = instructions = traps = time = 0;
+
+   pc = dbg->cpu->GetPc(dbg->proc.Get(), err);
+   ERROR_CHECK(err);
+   top = dbg->cpu->GetSp(dbg->proc.Get(), err);
+   ERROR_CHECK(err);
+
+   try
+   {
+      calls.push_back(Call{pc, -1, 0, 0, 0, 0});
+      stack.push_back(Frame{0, start});
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+
+   for (;;)
+   {
+      auto bp = dbg->bps.Lookup(pc);
+      Cpu::BranchKind kind = Cpu::BranchNone;
+      addr_t from = pc;
+      uint64_t n = 0;
+      int len = 0;
+
+      // New patches change the code under what's been decoded.
+      //
+      if (dbg->bps.nextSeq != seq)
+      {
+         blocks.clear();
+         seq = dbg->bps.nextSeq;
+      }
+
+      if (bp && bp->vaddr == pc && !bp->trampoline)
+      {
+         unsigned char text[MaxInstruction];
+         addr_t target = 0;
+
+         // One instruction, the way the debugger always gets past a
+         // breakpoint.  It's decoded as it was before the patch.
+         //
+         if (bp->handler && !handled)
+         {
+            bp->handler(dbg, bp, bp->context, err);
+            ERROR_CHECK(err);
+         }
+
+         dbg->ReadMemory(pc, sizeof(text), text, err);
+         ERROR_CHECK(err);
+         len = dbg->cpu->DecodeBranch(text, sizeof(text), pc, &kind, &target);
+
+         dbg->Step(err);
+         ERROR_CHECK(err);
+         handled = true;
+
+         n = 1;
+      }
+      else
+      {
+         dbg->proc->StepBlock(err);
+         ERROR_CHECK(err);
+         handled = false;
+      }
+
+      ++traps;
+      if (!dbg->proc->IsAttached())
+         break;
+
+      pc = dbg->cpu->GetPc(dbg->proc.Get(), err);
+      ERROR_CHECK(err);
+      sp = dbg->cpu->GetSp(dbg->proc.Get(), err);
+      ERROR_CHECK(err);
+
+      if (n)
+      {
+         // A conditional branch that fell through is nothing.
+         //
+         if (kind == Cpu::BranchConditional && pc == from + len)
+            kind = Cpu::BranchNone;
+      }
+      else
+      {
+         n = Walk(dbg, from, pc, &kind, err);
+         ERROR_CHECK(err);
+      }
+
+      instructions += n;
+      calls[stack.back().call].instructions += n;
+
+      // The function we started in has returned, or been unwound.
+      //
+      if (sp > top)
+         break;
+
+      if (kind == Cpu::BranchCall)
+      {
+         uint64_t now = MonotonicTime();
+         int parent = stack.back().call;
+
+         try
+         {
+            if (calls.size() < MaxCalls)
+            {
+               calls.push_back(Call{pc, parent, (int)stack.size(), 0, 0, 0});
+               stack.push_back(Frame{(int)calls.size() - 1, now});
+            }
+            else
+            {
+               ++dropped;
+               stack.push_back(Frame{parent, 0});
+            }
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+      }
+      else if (kind == Cpu::BranchReturn && stack.size() > 1)
+      {
+         auto &frame = stack.back();
+
+         if (frame.entered)
+            calls[frame.call].time = MonotonicTime() - frame.entered;
+         stack.pop_back();
+      }
+   }
+
+exit:
+   // Anything still open ends now: the process went away, or something
+   // unwound past the returns we saw.
+   //
+   {
+      uint64_t now = MonotonicTime();
+
+      for (auto &frame : stack)
+      {
+         if (frame.entered)
+            calls[frame.call].time = now - frame.entered;
+      }
+      time = now - start;
+   }
+
+   // Callees come after their callers.
+   //
+   for (size_t i=calls.size(); i-- > 0; )
+   {
+      calls[i].total += calls[i].instructions;
+      if (calls[i].parent >= 0)
+         calls[calls[i].parent].total += calls[i].total;
+   }
+}
@@ -8,9 +8,17 @@
 
 #include <dbg/dbg.h>
 #include <dbg/arch.h>
+#include <dbg/condition.h>
+#include <dbg/tracepoint.h>
+#include <dbg/memory.h>
+#include <dbg/addrset.h>
+#include <common/misc.h>
 
 #include <udis86.h>
 
+#include <algorithm>
+#include <initializer_list>
+
 #include <string.h>
 
 static void
@@ -27,6 +35,29 @@ set_mode(ud_t *ud)
    }
 }
 
+// Where a direct jump or call goes.
+//
+static dbg::addr_t
+jump_target(const ud_t *ud, dbg::addr_t pc, int instrLen)
+{
+   dbg::addr_t target = pc + instrLen;
+
+   switch (ud->operand[0].size)
+   {
+   case 8:
+      target += ud->operand[0].lval.sbyte;
+      break;
+   case 16:
+      target += ud->operand[0].lval.sword;
+      break;
+   default:
+      target += ud->operand[0].lval.sdword;
+      break;
+   }
+
+   return target;
+}
+
 int
 dbg::Cpu::GetInstructionLength(const void *text, int len)
 {
@@ -39,6 +70,276 @@ dbg::Cpu::GetInstructionLength(const void *text, int len)
    return ud_disassemble(&ud);
 }
 
+int
+dbg::Cpu::DecodeBranch(
+   const void *text,
+   int len,
+   addr_t pc,
+   BranchKind *kind,
+   addr_t *target
+)
+{
+   ud_t ud;
+   int r = 0;
+
+   *kind = BranchNone;
+   *target = 0;
+
+   ud_init(&ud);
+   set_mode(&ud);
+   ud_set_input_buffer(&ud, (const uint8_t*)text, len);
+   ud_set_pc(&ud, pc);
+
+   r = ud_disassemble(&ud);
+   if (r <= 0 || ud.mnemonic == UD_Iinvalid)
+      return 0;
+
+   switch (ud.mnemonic)
+   {
+   case UD_Ija:   case UD_Ijae:  case UD_Ijb:   case UD_Ijbe:
+   case UD_Ijcxz: case UD_Ijecxz: case UD_Ijrcxz:
+   case UD_Ijg:   case UD_Ijge:  case UD_Ijl:   case UD_Ijle:
+   case UD_Ijno:  case UD_Ijnp:  case UD_Ijns:  case UD_Ijnz:
+   case UD_Ijo:   case UD_Ijp:   case UD_Ijs:   case UD_Ijz:
+   case UD_Iloop: case UD_Iloope: case UD_Iloopne:
+      *kind = BranchConditional;
+      break;
+   case UD_Ijmp:
+      *kind = BranchJump;
+      break;
+   case UD_Icall:
+      *kind = BranchCall;
+      break;
+   case UD_Iret:  case UD_Iretf:
+   case UD_Iiretw: case UD_Iiretd: case UD_Iiretq:
+      *kind = BranchReturn;
+      break;
+   default:
+      break;
+   }
+
+   if (*kind != BranchNone && ud.operand[0].type == UD_OP_JIMM)
+      *target = jump_target(&ud, pc, r);
+
+   return r;
+}
+
+int
+dbg::Cpu::GetCallLength(const void *text, int len)
+{
+   ud_t ud;
+   int r = 0;
+
+   ud_init(&ud);
+   set_mode(&ud);
+   ud_set_input_buffer(&ud, (const uint8_t*)text, len);
+
+   r = ud_disassemble(&ud);
+   return (r > 0 && ud.mnemonic == UD_Icall) ? r : 0;
+}
+
+// A register that makes up part of an address, as one of ours, or -1.
+//
+static int
+address_register(enum ud_type reg)
+{
+   switch (reg)
+   {
+   case UD_R_EAX: return DBG_AX;
+   case UD_R_EBX: return DBG_BX;
+   case UD_R_ECX: return DBG_CX;
+   case UD_R_EDX: return DBG_DX;
+   case UD_R_ESI: return DBG_SI;
+   case UD_R_EDI: return DBG_DI;
+   case UD_R_ESP: return DBG_SP;
+   case UD_R_EBP: return DBG_BP;
+#if defined(__amd64__)
+   case UD_R_RAX: return DBG_AX;
+   case UD_R_RBX: return DBG_BX;
+   case UD_R_RCX: return DBG_CX;
+   case UD_R_RDX: return DBG_DX;
+   case UD_R_RSI: return DBG_SI;
+   case UD_R_RDI: return DBG_DI;
+   case UD_R_RSP: return DBG_SP;
+   case UD_R_RBP: return DBG_BP;
+   case UD_R_R8:  case UD_R_R8D:  return DBG_R8;
+   case UD_R_R9:  case UD_R_R9D:  return DBG_R9;
+   case UD_R_R10: case UD_R_R10D: return DBG_R10;
+   case UD_R_R11: case UD_R_R11D: return DBG_R11;
+   case UD_R_R12: case UD_R_R12D: return DBG_R12;
+   case UD_R_R13: case UD_R_R13D: return DBG_R13;
+   case UD_R_R14: case UD_R_R14D: return DBG_R14;
+   case UD_R_R15: case UD_R_R15D: return DBG_R15;
+#endif
+   default:
+      return -1;
+   }
+}
+
+void
+dbg::Cpu::GetMemoryOperands(
+   Process *proc,
+   const void *text,
+   int len,
+   addr_t pc,
+   std::vector<MemoryRange> &out,
+   error *err
+)
+{
+   const int word = sizeof(addr_t);
+   ud_t ud;
+   int instrLen = 0;
+   int string = 0;
+
+   ud_init(&ud);
+   set_mode(&ud);
+   ud_set_input_buffer(&ud, (const uint8_t*)text, len);
+   ud_set_pc(&ud, pc);
+
+   instrLen = ud_disassemble(&ud);
+   if (instrLen <= 0 || ud.mnemonic == UD_Iinvalid)
+      goto exit;
+
+   switch (ud.mnemonic)
+   {
+   case UD_Ilea:
+   case UD_Inop:
+      // A memory operand that's never touched.
+      //
+      goto exit;
+   case UD_Ipush:
+   case UD_Ipushfw:
+   case UD_Ipushfd:
+   case UD_Ipushfq:
+   case UD_Icall:
+      {
+         addr_t sp = GetSp(proc, err);
+         ERROR_CHECK(err);
+         try
+         {
+            out.push_back(MemoryRange{sp - word, word});
+         }
+         catch (std::bad_alloc)
+         {
+            ERROR_SET(err, nomem);
+         }
+      }
+      break;
+   case UD_Istosb: case UD_Imovsb:
+      string = 1;
+      break;
+   case UD_Istosw: case UD_Imovsw:
+      string = 2;
+      break;
+   case UD_Istosd:
+      string = 4;
+      break;
+   case UD_Imovsd:
+      // Or the SSE one, which has operands.
+      //
+      if (ud.operand[0].type == UD_NONE)
+         string = 4;
+      break;
+   case UD_Istosq: case UD_Imovsq:
+      string = 8;
+      break;
+   default:
+      break;
+   }
+
+   // One element at [di]: a step stops after each time round a rep.
+   //
+   if (string)
+   {
+      addr_t di = 0;
+
+      proc->GetRegister(DBG_DI, &di, err);
+      ERROR_CHECK(err);
+      try
+      {
+         out.push_back(MemoryRange{di, string});
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+   }
+
+   for (size_t i=0; i<ARRAY_SIZE(ud.operand) && ud.operand[i].type != UD_NONE; ++i)
+   {
+      auto &op = ud.operand[i];
+      addr_t addr = 0;
+      int size = op.size / 8;
+
+      if (op.type != UD_OP_MEM)
+         continue;
+      if (ud.pfx_seg == UD_R_FS || ud.pfx_seg == UD_R_GS)
+         continue;
+
+      if (op.base == UD_R_RIP)
+      {
+         addr = pc + instrLen;
+      }
+      else if (op.base != UD_NONE)
+      {
+         addr_t reg = 0;
+         int regno = address_register(op.base);
+
+         if (regno < 0)
+            continue;
+         proc->GetRegister(regno, &reg, err);
+         ERROR_CHECK(err);
+         addr += reg;
+      }
+
+      if (op.index != UD_NONE)
+      {
+         addr_t reg = 0;
+         int regno = address_register(op.index);
+
+         if (regno < 0)
+            continue;
+         proc->GetRegister(regno, &reg, err);
+         ERROR_CHECK(err);
+         addr += reg * (op.scale ? op.scale : 1);
+      }
+
+      switch (op.offset)
+      {
+      case 8:
+         addr += op.lval.sbyte;
+         break;
+      case 16:
+         addr += op.lval.sword;
+         break;
+      case 32:
+         addr += op.lval.sdword;
+         break;
+      case 64:
+         addr += op.lval.sqword;
+         break;
+      }
+
+      if (ud.adr_mode == 32)
+         addr = (uint32_t)addr;
+
+      if (ud.mnemonic == UD_Ifxsave)
+         size = 512;
+      else if (!size)
+         size = word;
+
+      try
+      {
+         out.push_back(MemoryRange{addr, size});
+      }
+      catch (std::bad_alloc)
+      {
+         ERROR_SET(err, nomem);
+      }
+   }
+exit:;
+}
+
 struct DisasmState
 {
    dbg::Debugger *dbg;
@@ -123,6 +424,156 @@ dbg::Cpu::Disassemble(
 exit:;
 }
 
+void
+dbg::Cpu::FindBasicBlocks(
+   const void *text,
+   size_t len,
+   addr_t vaddr,
+   std::vector<addr_t> &out,
+   error *err
+)
+{
+   std::vector<addr_t> starts, targets;
+   bool leader = true;
+   size_t n = out.size();
+   ud_t ud;
+
+   ud_init(&ud);
+   set_mode(&ud);
+   ud_set_input_buffer(&ud, (const uint8_t*)text, len);
+   ud_set_pc(&ud, vaddr);
+
+   try
+   {
+      int instrLen = 0;
+
+      while ((instrLen = ud_disassemble(&ud)) > 0)
+      {
+         addr_t pc = ud_insn_off(&ud);
+
+         switch (ud.mnemonic)
+         {
+         case UD_Iinvalid:
+            leader = true;
+            continue;
+         case UD_Inop:
+         case UD_Iint3:
+            // Padding, if we're between blocks.
+            //
+            if (leader)
+               continue;
+            break;
+         default:
+            break;
+         }
+
+         starts.push_back(pc);
+         if (leader)
+            out.push_back(pc);
+         leader = false;
+
+         switch (ud.mnemonic)
+         {
+         case UD_Ija:   case UD_Ijae:  case UD_Ijb:   case UD_Ijbe:
+         case UD_Ijcxz: case UD_Ijecxz: case UD_Ijrcxz:
+         case UD_Ijg:   case UD_Ijge:  case UD_Ijl:   case UD_Ijle:
+         case UD_Ijno:  case UD_Ijnp:  case UD_Ijns:  case UD_Ijnz:
+         case UD_Ijo:   case UD_Ijp:   case UD_Ijs:   case UD_Ijz:
+         case UD_Iloop: case UD_Iloope: case UD_Iloopne:
+         case UD_Ijmp:
+         case UD_Iret:  case UD_Iretf:
+         case UD_Ihlt:  case UD_Iud2:
+            leader = true;
+            // fall through ...
+         case UD_Icall:
+            if (ud.operand[0].type == UD_OP_JIMM)
+            {
+               addr_t target = jump_target(&ud, pc, instrLen);
+
+               if (target >= vaddr && target - vaddr < len)
+                  targets.push_back(target);
+            }
+            break;
+         default:
+            break;
+         }
+      }
+
+      // Branches that land mid-instruction are either the sweep
+      // getting out of step or something too clever for us.  A
+      // breakpoint there would do damage, so leave them out.
+      //
+      for (auto target : targets)
+      {
+         if (std::binary_search(starts.begin(), starts.end(), target))
+            out.push_back(target);
+      }
+
+      std::sort(out.begin() + n, out.end());
+      out.erase(std::unique(out.begin() + n, out.end()), out.end());
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:;
+}
+
+dbg::addr_t
+dbg::Cpu::FindTakenBranch(
+   const void *text,
+   size_t len,
+   addr_t vaddr,
+   addr_t to
+)
+{
+   int instrLen = 0;
+   ud_t ud;
+
+   ud_init(&ud);
+   set_mode(&ud);
+   ud_set_input_buffer(&ud, (const uint8_t*)text, len);
+   ud_set_pc(&ud, vaddr);
+
+   while ((instrLen = ud_disassemble(&ud)) > 0)
+   {
+      addr_t pc = ud_insn_off(&ud);
+
+      // Got there without a branch.  (Back to the start is a loop.)
+      //
+      if (pc == to && pc != vaddr)
+         break;
+
+      switch (ud.mnemonic)
+      {
+      case UD_Iinvalid:
+         return 0;
+      case UD_Ija:   case UD_Ijae:  case UD_Ijb:   case UD_Ijbe:
+      case UD_Ijcxz: case UD_Ijecxz: case UD_Ijrcxz:
+      case UD_Ijg:   case UD_Ijge:  case UD_Ijl:   case UD_Ijle:
+      case UD_Ijno:  case UD_Ijnp:  case UD_Ijns:  case UD_Ijnz:
+      case UD_Ijo:   case UD_Ijp:   case UD_Ijs:   case UD_Ijz:
+      case UD_Iloop: case UD_Iloope: case UD_Iloopne:
+         // Not taken, unless it goes where we ended up.
+         //
+         if (ud.operand[0].type == UD_OP_JIMM &&
+             jump_target(&ud, pc, instrLen) != to)
+         {
+            break;
+         }
+         return pc;
+      case UD_Ijmp:  case UD_Icall:
+      case UD_Iret:  case UD_Iretf:
+      case UD_Iiretw: case UD_Iiretd: case UD_Iiretq:
+         return pc;
+      default:
+         break;
+      }
+   }
+
+   return 0;
+}
+
 dbg::addr_t
 dbg::Cpu::GetPc(
    Process *proc,
@@ -134,6 +585,17 @@ dbg::Cpu::GetPc(
    return addr;
 }
 
+dbg::addr_t
+dbg::Cpu::GetSp(
+   Process *proc,
+   error *err
+)
+{
+   addr_t addr = 0;
+   proc->GetRegister(DBG_SP, &addr, err);
+   return addr;
+}
+
 void
 dbg::Cpu::GenerateBreakpoint(
    addr_t pc,
@@ -169,120 +631,1196 @@ exit:;
 }
 
 void
-dbg::Cpu::StackTrace(
-   Debugger *dbg,
-   std::function<void(addr_t pc, addr_t frame, bool& cancel, error *err)> callback,
+dbg::Cpu::SetPc(Process *proc, addr_t pc, error *err)
+{
+   proc->SetRegister(DBG_IP, &pc, err);
+}
+
+int
+dbg::Cpu::GetJumpSize()
+{
+   return 5;
+}
+
+void
+dbg::Cpu::GenerateJump(
+   addr_t pc,
+   addr_t target,
+   void *buffer,
+   int len,
    error *err
 )
 {
-   bool cancel = false;
-   addr_t ip = 0, frame = 0, stack = 0;
-   ud_t ud;
-   unsigned char buf[16];
+   int64_t rel = (int64_t)(target - (pc + 5));
+   int32_t rel32 = (int32_t)rel;
+   unsigned char *p = (unsigned char*)buffer;
 
-   // Grab some interesting registers...
-   //
-   dbg->proc->GetRegister(DBG_IP, &ip, err);
-   ERROR_CHECK(err);
-   dbg->proc->GetRegister(DBG_BP, &frame, err);
-   ERROR_CHECK(err);
-   callback(ip, frame, cancel, err);
-   ERROR_CHECK(err);
-   if (cancel)
-      goto exit;
+   if (len < 5)
+      ERROR_SET(err, unknown, "No room for a jump");
+   if (rel != rel32)
+      ERROR_SET(err, unknown, "Jump target out of reach");
 
-   // Handle some corner cases where the frame pointer is in flux.
-   //
-   dbg->ReadMemory(ip, sizeof(buf), buf, err);
-   ERROR_CHECK(err);
+   *p++ = 0xe9;                  // jmp rel32
+   memcpy(p, &rel32, sizeof(rel32));
+   memset(p + sizeof(rel32), 0xcc, len - 5);
+exit:;
+}
+
+void
+dbg::Cpu::RelocateInstructions(
+   const void *text,
+   int len,
+   addr_t pc,
+   int minLen,
+   addr_t to,
+   std::vector<unsigned char> &out,
+   int *consumed,
+   error *err
+)
+{
+   ud_t ud;
+   size_t base = out.size();
+   int n = 0;
 
    ud_init(&ud);
    set_mode(&ud);
+   ud_set_input_buffer(&ud, (const uint8_t*)text, len);
+   ud_set_pc(&ud, pc);
 
-   ud_set_input_buffer(&ud, buf, sizeof(buf));
-
-   if (!ud_disassemble(&ud))
-      ERROR_SET(err, unknown, "Disassemble failed");
+   *consumed = 0;
 
-   switch (ud.mnemonic)
+   try
    {
-      // 
-      // If the current instruction is "mov ebp, esp", grab the frame
-      // pointer from esp.
-      // 
+      while (n < minLen)
+      {
+         int instrLen = ud_disassemble(&ud);
+         const unsigned char *instr = (const unsigned char*)text + n;
+         size_t start = out.size();
+         bool ripRelative = false, immediate = false;
 
-   case UD_Imov:
+         if (instrLen <= 0 || ud.mnemonic == UD_Iinvalid)
+            ERROR_SET(err, unknown, "Can't decode instruction to move");
 
-      if (ud.operand[0].type != UD_OP_REG ||
-          ud.operand[1].type != UD_OP_REG)
-         break;
+         switch (ud.mnemonic)
+         {
+         case UD_Ija:   case UD_Ijae:  case UD_Ijb:   case UD_Ijbe:
+         case UD_Ijcxz: case UD_Ijecxz: case UD_Ijrcxz:
+         case UD_Ijg:   case UD_Ijge:  case UD_Ijl:   case UD_Ijle:
+         case UD_Ijno:  case UD_Ijnp:  case UD_Ijns:  case UD_Ijnz:
+         case UD_Ijo:   case UD_Ijp:   case UD_Ijs:   case UD_Ijz:
+         case UD_Iloop: case UD_Iloope: case UD_Iloopne:
+         case UD_Ijmp:  case UD_Icall:
+         case UD_Iret:  case UD_Iretf:
+         case UD_Iiretw: case UD_Iiretd: case UD_Iiretq:
+         case UD_Iint3: case UD_Iint:
+         case UD_Ihlt:  case UD_Iud2:
+            // Anything after a branch in the patch is likely someone's
+            // branch target.  Don't even try.
+            //
+            ERROR_SET(err, unknown, "Can't move a branch");
+         default:
+            break;
+         }
 
-      if (ud.operand[0].base != UD_R_EBP && ud.operand[0].base != UD_R_RBP)
-         break;
+         for (size_t i=0; i<ARRAY_SIZE(ud.operand) && ud.operand[i].type != UD_NONE; ++i)
+         {
+            if (ud.operand[i].type == UD_OP_MEM && ud.operand[i].base == UD_R_RIP)
+               ripRelative = true;
+            else if (ud.operand[i].type == UD_OP_IMM)
+               immediate = true;
+         }
 
-      if (ud.operand[1].base != UD_R_ESP && ud.operand[1].base != UD_R_RSP)
-         break;
+         out.insert(out.end(), instr, instr + instrLen);
 
-      frame = 0;
-      dbg->proc->GetRegister(DBG_SP, &frame, err);
-      ERROR_CHECK(err);
+         // The displacement is the last thing in the instruction,
+         // unless there's an immediate after it.  Working out how big
+         // that is isn't worth it for what's left.
+         //
+         if (ripRelative)
+         {
+            int32_t disp = 0;
+            int64_t moved = 0;
 
-      break;
+            if (immediate || instrLen < 5)
+               ERROR_SET(err, unknown, "Can't move this rip-relative instruction");
 
-   //
-   // If the current instruction is "push ebp" or "ret", grab the
-   // previous IP from [esp].
-   //
+            memcpy(&disp, &out[out.size() - 4], sizeof(disp));
+            moved = (int64_t)disp + (int64_t)(pc + n) - (int64_t)(to + (start - base));
+            if (moved != (int32_t)moved)
+               ERROR_SET(err, unknown, "Instruction moved out of reach of its data");
+            disp = (int32_t)moved;
+            memcpy(&out[out.size() - 4], &disp, sizeof(disp));
+         }
 
-   case UD_Ipush:
+         n += instrLen;
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
 
-      if (ud.operand[0].type != UD_OP_REG)
-         break;
-      if (ud.operand[0].base != UD_R_EBP && ud.operand[0].base != UD_R_RBP)
-         break;
+   *consumed = n;
+exit:
+   if (ERROR_FAILED(err))
+      out.resize(base);
+}
 
-   case UD_Iret:
+#if defined(__amd64__)
 
-      dbg->proc->GetRegister(DBG_SP, &stack, err);
-      ERROR_CHECK(err);
+namespace {
 
-      ip = 0;
+//
+// Conditions to x86-64.  The condition's stack is the machine stack:
+// operators pop into rax (and rcx), and push the result.  Underneath
+// are the registers this clobbers, saved below the red zone, and we
+// read them from there when the condition asks.
+//
+const int RedZone = 128;
 
-      dbg->ReadMemory(stack, sizeof(void*), &ip, err);
-      ERROR_CHECK(err);
+enum
+{
+   SavedDx,
+   SavedCx,
+   SavedAx,
+   SavedFlags,
+   SavedWords
+};
 
-      if (ip)
-      {
-         callback(ip, frame, cancel, err);
-         ERROR_CHECK(err);
-         if (cancel)
-            goto exit;
-      }
-      break;
+void
+Emit(std::vector<unsigned char> &out, std::initializer_list<unsigned char> bytes)
+{
+   out.insert(out.end(), bytes);
+}
 
-   default:
-      break;
-   }
+void
+Emit(std::vector<unsigned char> &out, const void *buf, size_t len)
+{
+   out.insert(out.end(), (const unsigned char*)buf, (const unsigned char*)buf + len);
+}
 
-   // Read the prevous frames...
-   //
-   while (!cancel && ip && frame)
+// Where a register lives in the encoding, for those we leave alone.
+//
+int
+Encoding(int regno)
+{
+   switch (regno)
+   {
+   case DBG_BX: return 3;
+   case DBG_BP: return 5;
+   case DBG_SI: return 6;
+   case DBG_DI: return 7;
+   }
+   if (regno >= DBG_R8 && regno <= DBG_R15)
+      return 8 + regno - DBG_R8;
+   return -1;
+}
+
+// rax = the register as it was at pc, when depth values are on the
+// condition's stack.
+//
+void
+LoadRegister(
+   std::vector<unsigned char> &out,
+   int regno,
+   int depth,
+   dbg::addr_t pc,
+   error *err
+)
+{
+   int32_t saved = -1;
+   int enc = -1;
+
+   switch (regno)
+   {
+   case DBG_AX:    saved = SavedAx;    break;
+   case DBG_CX:    saved = SavedCx;    break;
+   case DBG_DX:    saved = SavedDx;    break;
+   case DBG_FLAGS: saved = SavedFlags; break;
+   case DBG_SP:
+      saved = 8 * (depth + SavedWords) + RedZone;
+      Emit(out, { 0x48, 0x8d, 0x84, 0x24 });    // lea rax, [rsp+disp32]
+      Emit(out, &saved, sizeof(saved));
+      goto exit;
+   case DBG_IP:
+      Emit(out, { 0x48, 0xb8 });                // mov rax, imm64
+      Emit(out, &pc, sizeof(pc));
+      goto exit;
+   }
+
+   if (saved >= 0)
+   {
+      saved = 8 * (depth + saved);
+      Emit(out, { 0x48, 0x8b, 0x84, 0x24 });    // mov rax, [rsp+disp32]
+      Emit(out, &saved, sizeof(saved));
+      goto exit;
+   }
+
+   if ((enc = Encoding(regno)) < 0)
+      ERROR_SET(err, unknown, "Register not supported in the target");
+
+   // mov rax, reg
+   //
+   Emit(out, {
+      (unsigned char)(0x48 | (enc >= 8 ? 0x04 : 0)),
+      0x89,
+      (unsigned char)(0xc0 | ((enc & 7) << 3))
+   });
+exit:;
+}
+
+// Pushes the value of condition code, with depth values of ours
+// already on the stack.  Dividing by zero unwinds all of them and jumps
+// to a bailout; the offset of each such rel32 is appended to bailouts
+// for the caller to fill in.
+//
+void
+EmitExpression(
+   std::vector<unsigned char> &out,
+   const std::vector<unsigned char> &code,
+   dbg::addr_t pc,
+   int depth,
+   std::vector<size_t> &bailouts,
+   error *err
+)
+{
+   const unsigned char *c = code.data();
+   size_t n = code.size();
+   size_t pos = 0;
+   int32_t rel = 0;
+   int base = depth;
+
+   // Native offsets of each instruction in the condition, and the
+   // jumps that need them filled in.
+   //
+   std::vector<size_t> at(n + 1, SIZE_MAX);
+   std::vector<std::pair<size_t, size_t>> jumps;
+
+   while (pos < n)
+   {
+      unsigned char op = c[pos];
+      size_t operands = 0;
+
+      at[pos++] = out.size();
+
+      switch (op)
+      {
+      case dbg::Condition::OpConst:      operands = sizeof(dbg::addr_t);   break;
+      case dbg::Condition::OpRegister:   operands = 2;                break;
+      case dbg::Condition::OpLoad:       operands = 1;                break;
+      case dbg::Condition::OpJumpIfZero:
+      case dbg::Condition::OpJumpIfNonZero:
+                                    operands = sizeof(uint16_t); break;
+      }
+      if (n - pos < operands)
+         ERROR_SET(err, unknown, "Bad condition code");
+
+      switch (op)
+      {
+      case dbg::Condition::OpConst:
+      case dbg::Condition::OpRegister:
+         if (op == dbg::Condition::OpConst)
+         {
+            Emit(out, { 0x48, 0xb8 });       // mov rax, imm64
+            Emit(out, c + pos, sizeof(dbg::addr_t));
+         }
+         else
+         {
+            LoadRegister(out, c[pos], depth, pc, err);
+            ERROR_CHECK(err);
+         }
+         Emit(out, { 0x50 });                // push rax
+         ++depth;
+         break;
+
+      case dbg::Condition::OpLoad:
+         if (depth < base + 1)
+            ERROR_SET(err, unknown, "Bad condition code");
+         Emit(out, { 0x58 });                // pop rax
+         switch (c[pos])
+         {
+         case 1: Emit(out, { 0x0f, 0xb6, 0x00 });  break;  // movzx eax, byte [rax]
+         case 2: Emit(out, { 0x0f, 0xb7, 0x00 });  break;  // movzx eax, word [rax]
+         case 4: Emit(out, { 0x8b, 0x00 });        break;  // mov eax, [rax]
+         case 8: Emit(out, { 0x48, 0x8b, 0x00 });  break;  // mov rax, [rax]
+         default:
+            ERROR_SET(err, unknown, "Bad condition code");
+         }
+         Emit(out, { 0x50 });
+         break;
+
+      case dbg::Condition::OpNeg:
+      case dbg::Condition::OpNot:
+      case dbg::Condition::OpBitNot:
+      case dbg::Condition::OpBool:
+         if (depth < base + 1)
+            ERROR_SET(err, unknown, "Bad condition code");
+         Emit(out, { 0x58 });
+         switch (op)
+         {
+         case dbg::Condition::OpNeg:
+            Emit(out, { 0x48, 0xf7, 0xd8 });      // neg rax
+            break;
+         case dbg::Condition::OpBitNot:
+            Emit(out, { 0x48, 0xf7, 0xd0 });      // not rax
+            break;
+         default:
+            // test rax, rax; sete/setne al; movzx eax, al
+            //
+            Emit(out, {
+               0x48, 0x85, 0xc0,
+               0x0f, (unsigned char)(op == dbg::Condition::OpNot ? 0x94 : 0x95), 0xc0,
+               0x0f, 0xb6, 0xc0
+            });
+            break;
+         }
+         Emit(out, { 0x50 });
+         break;
+
+      case dbg::Condition::OpJumpIfZero:
+      case dbg::Condition::OpJumpIfNonZero:
+      {
+         uint16_t target = 0;
+
+         if (depth < base + 1)
+            ERROR_SET(err, unknown, "Bad condition code");
+         memcpy(&target, c + pos, sizeof(target));
+         if (target > n)
+            ERROR_SET(err, unknown, "Bad condition code");
+
+         // The value stays if we jump, and goes if we don't.
+         //
+         // mov rax, [rsp]; test rax, rax; jz/jnz rel32; pop rax
+         //
+         Emit(out, {
+            0x48, 0x8b, 0x04, 0x24,
+            0x48, 0x85, 0xc0,
+            0x0f, (unsigned char)(op == dbg::Condition::OpJumpIfZero ? 0x84 : 0x85),
+            0, 0, 0, 0
+         });
+         jumps.push_back(std::make_pair(out.size() - 4, (size_t)target));
+         Emit(out, { 0x58 });
+         --depth;
+         break;
+      }
+
+      default:
+         if (depth < base + 2)
+            ERROR_SET(err, unknown, "Bad condition code");
+         Emit(out, { 0x59, 0x58 });          // pop rcx; pop rax
+         depth -= 2;
+
+         switch (op)
+         {
+         case dbg::Condition::OpAdd: Emit(out, { 0x48, 0x01, 0xc8 });       break;
+         case dbg::Condition::OpSub: Emit(out, { 0x48, 0x29, 0xc8 });       break;
+         case dbg::Condition::OpAnd: Emit(out, { 0x48, 0x21, 0xc8 });       break;
+         case dbg::Condition::OpOr:  Emit(out, { 0x48, 0x09, 0xc8 });       break;
+         case dbg::Condition::OpXor: Emit(out, { 0x48, 0x31, 0xc8 });       break;
+         case dbg::Condition::OpMul: Emit(out, { 0x48, 0x0f, 0xaf, 0xc1 }); break;
+
+         case dbg::Condition::OpDiv:
+         case dbg::Condition::OpMod:
+         {
+            int32_t unwind = 8 * depth;
+
+            // Dividing by zero stops, same as any condition we can't
+            // evaluate.  Unwind our stack and trap.
+            //
+            // test rcx, rcx; jnz ok; lea rsp, [rsp+unwind]; jmp trap
+            //
+            Emit(out, { 0x48, 0x85, 0xc9, 0x75, 13, 0x48, 0x8d, 0xa4, 0x24 });
+            Emit(out, &unwind, sizeof(unwind));
+            Emit(out, { 0xe9, 0, 0, 0, 0 });
+            bailouts.push_back(out.size() - 4);
+
+            // ok: xor edx, edx; div rcx
+            //
+            Emit(out, { 0x31, 0xd2, 0x48, 0xf7, 0xf1 });
+            if (op == dbg::Condition::OpMod)
+               Emit(out, { 0x48, 0x89, 0xd0 });    // mov rax, rdx
+            break;
+         }
+
+         case dbg::Condition::OpShl:
+         case dbg::Condition::OpShr:
+            // Shifting by 64 or more gives 0, as in Evaluate().
+            //
+            // xor edx, edx; shl/shr rax, cl; cmp rcx, 64; cmovae rax, rdx
+            //
+            Emit(out, {
+               0x31, 0xd2,
+               0x48, 0xd3, (unsigned char)(op == dbg::Condition::OpShl ? 0xe0 : 0xe8),
+               0x48, 0x83, 0xf9, 0x40,
+               0x48, 0x0f, 0x43, 0xc2
+            });
+            break;
+
+         case dbg::Condition::OpLt:
+         case dbg::Condition::OpLe:
+         case dbg::Condition::OpGt:
+         case dbg::Condition::OpGe:
+         case dbg::Condition::OpEq:
+         case dbg::Condition::OpNe:
+         {
+            unsigned char setcc = 0;
+
+            switch (op)
+            {
+            case dbg::Condition::OpLt: setcc = 0x92; break;   // setb
+            case dbg::Condition::OpLe: setcc = 0x96; break;   // setbe
+            case dbg::Condition::OpGt: setcc = 0x97; break;   // seta
+            case dbg::Condition::OpGe: setcc = 0x93; break;   // setae
+            case dbg::Condition::OpEq: setcc = 0x94; break;   // sete
+            default:              setcc = 0x95; break;   // setne
+            }
+
+            // cmp rax, rcx; setcc al; movzx eax, al
+            //
+            Emit(out, { 0x48, 0x39, 0xc8, 0x0f, setcc, 0xc0, 0x0f, 0xb6, 0xc0 });
+            break;
+         }
+
+         default:
+            ERROR_SET(err, unknown, "Bad condition code");
+         }
+
+         Emit(out, { 0x50 });
+         ++depth;
+         break;
+      }
+
+      pos += operands;
+   }
+
+   at[n] = out.size();
+   if (depth != base + 1)
+      ERROR_SET(err, unknown, "Bad condition code");
+
+   for (auto &j : jumps)
+   {
+      if (at[j.second] == SIZE_MAX)
+         ERROR_SET(err, unknown, "Bad condition code");
+      rel = (int32_t)(at[j.second] - (j.first + 4));
+      memcpy(&out[j.first], &rel, sizeof(rel));
+   }
+exit:;
+}
+
+} // end namespace
+
+#endif
+
+void
+dbg::Cpu::CompileCondition(
+   const Condition *cond,
+   addr_t pc,
+   addr_t to,
+   std::vector<unsigned char> &out,
+   addr_t *trap,
+   error *err
+)
+{
+#if defined(__amd64__)
+   size_t base = out.size();
+   size_t trapPath = 0;
+   int32_t rel = 0;
+   std::vector<size_t> bailouts;
+
+   try
+   {
+      // lea rsp, [rsp-128]; pushfq; push rax; push rcx; push rdx
+      //
+      Emit(out, { 0x48, 0x8d, 0x64, 0x24, 0x80, 0x9c, 0x50, 0x51, 0x52 });
+
+      EmitExpression(out, cond->code, pc, 0, bailouts, err);
+      ERROR_CHECK(err);
+
+      // pop rax; test rax, rax; jz continue
+      //
+      Emit(out, { 0x58, 0x48, 0x85, 0xc0, 0x74, 13 });
+
+      // Put everything back.  Once to trap, and once to carry on.
+      //
+      // pop rdx; pop rcx; pop rax; popfq; lea rsp, [rsp+128]
+      //
+      for (int i=0; i<2; ++i)
+      {
+         if (!i)
+            trapPath = out.size();
+         Emit(out, { 0x5a, 0x59, 0x58, 0x9d, 0x48, 0x8d, 0xa4, 0x24, 0x80, 0, 0, 0 });
+         if (!i)
+         {
+            *trap = to + (out.size() - base);
+            Emit(out, { 0xcc });
+         }
+      }
+
+      for (auto b : bailouts)
+      {
+         rel = (int32_t)(trapPath - (b + 4));
+         memcpy(&out[b], &rel, sizeof(rel));
+      }
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:
+   if (ERROR_FAILED(err))
+      out.resize(base);
+#else
+   ERROR_SET(err, unknown, "Conditions can't run in the target on this architecture");
+exit:;
+#endif
+}
+
+void
+dbg::Cpu::CompileTracepoint(
+   const Tracepoint *tp,
+   addr_t ring,
+   addr_t pc,
+   std::vector<unsigned char> &out,
+   error *err
+)
+{
+#if defined(__amd64__)
+   const int32_t head = offsetof(TraceRing, head);
+   const int32_t tail = offsetof(TraceRing, tail);
+   const int32_t dropped = offsetof(TraceRing, dropped);
+   const int32_t slots = TraceRing::Slots;
+   const int32_t mask = TraceRing::Slots - 1;
+   const int32_t slot0 = sizeof(TraceRing);
+   const int32_t id = tp->id;
+   int32_t disp = 0, unwind = 0;
+   size_t base = out.size();
+   size_t retry = 0, full = 0, done = 0, bail = 0, toFull = 0, toDone = 0;
+   int k = tp->items.size();
+   unsigned char shift = 0;
+   std::vector<size_t> bailouts;
+   auto link = [&out] (size_t from, size_t target) -> void
+   {
+      int32_t rel = (int32_t)(target - (from + 4));
+      memcpy(&out[from], &rel, sizeof(rel));
+   };
+
+   if (offsetof(TraceRecord, data) + tp->size > TraceRing::SlotSize)
+      ERROR_SET(err, unknown, "Tracepoint records too much");
+   while (((size_t)1 << shift) < TraceRing::SlotSize)
+      ++shift;
+
+   try
+   {
+      // lea rsp, [rsp-128]; pushfq; push rax; push rcx; push rdx
+      //
+      Emit(out, { 0x48, 0x8d, 0x64, 0x24, 0x80, 0x9c, 0x50, 0x51, 0x52 });
+
+      // Everything we want goes on the stack first, while the
+      // registers are as they were.
+      //
+      for (int i=0; i<k; ++i)
+      {
+         EmitExpression(out, tp->items[i].expr->code, pc, i, bailouts, err);
+         ERROR_CHECK(err);
+      }
+
+      // Reserve a slot, if there's room:
+      //
+      // mov rcx, ring
+      // retry:
+      // mov rax, [rcx+head]; mov rdx, rax; sub rdx, [rcx+tail]
+      // cmp rdx, slots; jae full
+      // lea rdx, [rax+1]; lock cmpxchg [rcx+head], rdx; jnz retry
+      //
+      Emit(out, { 0x48, 0xb9 });
+      Emit(out, &ring, sizeof(ring));
+      retry = out.size();
+      Emit(out, { 0x48, 0x8b, 0x81 });
+      Emit(out, &head, sizeof(head));
+      Emit(out, { 0x48, 0x89, 0xc2, 0x48, 0x2b, 0x91 });
+      Emit(out, &tail, sizeof(tail));
+      Emit(out, { 0x48, 0x81, 0xfa });
+      Emit(out, &slots, sizeof(slots));
+      Emit(out, { 0x0f, 0x83, 0, 0, 0, 0 });
+      toFull = out.size() - 4;
+      Emit(out, { 0x48, 0x8d, 0x50, 0x01, 0xf0, 0x48, 0x0f, 0xb1, 0x91 });
+      Emit(out, &head, sizeof(head));
+      Emit(out, { 0x0f, 0x85, 0, 0, 0, 0 });
+      link(out.size() - 4, retry);
+
+      // rdx = the slot; its seq is the slot's number until it's done.
+      //
+      // mov rdx, rax; and edx, mask; shl rdx, shift
+      // lea rdx, [rcx+rdx+slot0]; mov [rdx], rax; mov dword [rdx+id], id
+      //
+      Emit(out, { 0x48, 0x89, 0xc2, 0x81, 0xe2 });
+      Emit(out, &mask, sizeof(mask));
+      Emit(out, { 0x48, 0xc1, 0xe2, shift, 0x48, 0x8d, 0x94, 0x11 });
+      Emit(out, &slot0, sizeof(slot0));
+      Emit(out, { 0x48, 0x89, 0x02, 0xc7, 0x82 });
+      disp = offsetof(TraceRecord, id);
+      Emit(out, &disp, sizeof(disp));
+      Emit(out, &id, sizeof(id));
+
+      // Last one first.
+      //
+      for (int i=k-1; i>=0; --i)
+      {
+         auto &item = tp->items[i];
+         uint32_t j = 0;
+
+         disp = offsetof(TraceRecord, data) + item.offset;
+         Emit(out, { 0x58 });                      // pop rax
+
+         if (!item.len)
+         {
+            Emit(out, { 0x48, 0x89, 0x82 });      // mov [rdx+disp], rax
+            Emit(out, &disp, sizeof(disp));
+            continue;
+         }
+
+         for (; item.len - j >= 8; j += 8)
+         {
+            int32_t src = j, dst = disp + j;
+
+            Emit(out, { 0x48, 0x8b, 0x88 });      // mov rcx, [rax+src]
+            Emit(out, &src, sizeof(src));
+            Emit(out, { 0x48, 0x89, 0x8a });      // mov [rdx+dst], rcx
+            Emit(out, &dst, sizeof(dst));
+         }
+         for (; j < item.len; ++j)
+         {
+            int32_t src = j, dst = disp + j;
+
+            Emit(out, { 0x0f, 0xb6, 0x88 });      // movzx ecx, byte [rax+src]
+            Emit(out, &src, sizeof(src));
+            Emit(out, { 0x88, 0x8a });            // mov [rdx+dst], cl
+            Emit(out, &dst, sizeof(dst));
+         }
+      }
+
+      // inc qword [rdx]; jmp done
+      //
+      Emit(out, { 0x48, 0xff, 0x02, 0xe9, 0, 0, 0, 0 });
+      toDone = out.size() - 4;
+
+      // full: lea rsp, [rsp+unwind]
+      // bail: mov rcx, ring; lock inc qword [rcx+dropped]
+      //
+      full = out.size();
+      unwind = 8 * k;
+      Emit(out, { 0x48, 0x8d, 0xa4, 0x24 });
+      Emit(out, &unwind, sizeof(unwind));
+      bail = out.size();
+      Emit(out, { 0x48, 0xb9 });
+      Emit(out, &ring, sizeof(ring));
+      Emit(out, { 0xf0, 0x48, 0xff, 0x81 });
+      Emit(out, &dropped, sizeof(dropped));
+
+      // done: pop rdx; pop rcx; pop rax; popfq; lea rsp, [rsp+128]
+      //
+      done = out.size();
+      Emit(out, { 0x5a, 0x59, 0x58, 0x9d, 0x48, 0x8d, 0xa4, 0x24, 0x80, 0, 0, 0 });
+
+      link(toFull, full);
+      link(toDone, done);
+      for (auto b : bailouts)
+         link(b, bail);
+   }
+   catch (std::bad_alloc)
+   {
+      ERROR_SET(err, nomem);
+   }
+exit:
+   if (ERROR_FAILED(err))
+      out.resize(base);
+#else
+   ERROR_SET(err, unknown, "Tracepoints aren't supported on this architecture");
+exit:;
+#endif
+}
+
+namespace {
+
+const int dwarfRegisters[] = { DBG_DWARF_REGISTERS };
+
+// Unwinds one frame using CFI from the module containing the pc.
+// Returns false if there's no CFI for it or it didn't work out, in
+// which case regs is untouched.
+//
+bool
+CfiStep(
+   dbg::Debugger *dbg,
+   dbg::MemoryWindow &stack,
+   dbg::dwarf::RegisterSet &regs,
+   bool exactPc,
+   bool *signalFrame
+)
+{
+   error err;
+   dbg::addr_t pc = regs.regs[DBG_DWARF_IP];
+   dbg::Module *mod = nullptr;
+   dbg::dwarf::CallFrameInfo *cfi = nullptr;
+   dbg::dwarf::UnwindRow row;
+
+   // A return address points after the call, which might be past the
+   // end of the function if the callee doesn't return.
+   //
+   if (!exactPc)
+      --pc;
+
+   mod = dbg->modules.Lookup(pc);
+   if (!mod || !(cfi = mod->GetCallFrameInfo()))
+      return false;
+
+   if (!cfi->FindRow(pc - mod->bias, &row, &err))
+      return false;
+
+   dbg::dwarf::Unwind(
+      row,
+      regs,
+      [&stack] (dbg::addr_t addr, int len, void *buf, error *err) -> void
+      {
+         stack.Read(addr, len, buf, err);
+      },
+      &err
+   );
+   if (ERROR_FAILED(&err))
+      return false;
+
+   *signalFrame = row.signalFrame;
+   return true;
+}
+
+// The old fashioned way: follow the chain of saved frame pointers.
+// Returns false at the end of the chain.
+//
+bool
+FramePointerStep(
+   dbg::Debugger *dbg,
+   dbg::MemoryWindow &window,
+   dbg::dwarf::RegisterSet &regs,
+   bool first,
+   error *err
+)
+{
+   bool r = false;
+   dbg::addr_t ip = regs.regs[DBG_DWARF_IP];
+   dbg::addr_t frame = regs.regs[DBG_DWARF_BP];
+   dbg::addr_t stack = regs.regs[DBG_DWARF_SP];
+   void *ptrs[2];
+
+   // Handle some corner cases where the frame pointer is in flux.
+   //
+   if (first)
    {
-      void *ptrs[2];
+      ud_t ud;
+      unsigned char buf[16];
 
-      dbg->ReadMemory(frame, sizeof(ptrs), ptrs, err);
+      dbg->ReadMemory(ip, sizeof(buf), buf, err);
       ERROR_CHECK(err);
 
-      frame = (addr_t)ptrs[0];
-      ip = (addr_t)ptrs[1];
+      ud_init(&ud);
+      set_mode(&ud);
+
+      ud_set_input_buffer(&ud, buf, sizeof(buf));
+
+      if (!ud_disassemble(&ud))
+         ERROR_SET(err, unknown, "Disassemble failed");
+
+      switch (ud.mnemonic)
+      {
+         //
+         // If the current instruction is "mov ebp, esp", grab the frame
+         // pointer from esp.
+         //
+
+      case UD_Imov:
+
+         if (ud.operand[0].type != UD_OP_REG ||
+             ud.operand[1].type != UD_OP_REG)
+            break;
+
+         if (ud.operand[0].base != UD_R_EBP && ud.operand[0].base != UD_R_RBP)
+            break;
+
+         if (ud.operand[1].base != UD_R_ESP && ud.operand[1].base != UD_R_RSP)
+            break;
+
+         frame = stack;
+         break;
+
+      //
+      // If the current instruction is "push ebp" or "ret", grab the
+      // previous IP from [esp].
+      //
+
+      case UD_Ipush:
+
+         if (ud.operand[0].type != UD_OP_REG)
+            break;
+         if (ud.operand[0].base != UD_R_EBP && ud.operand[0].base != UD_R_RBP)
+            break;
+
+      case UD_Iret:
+
+         ip = 0;
+
+         window.Read(stack, sizeof(void*), &ip, err);
+         ERROR_CHECK(err);
+
+         regs.Set(DBG_DWARF_IP, ip);
+         regs.Set(DBG_DWARF_SP, stack + sizeof(void*));
+         r = true;
+         goto exit;
+
+      default:
+         break;
+      }
+   }
+
+   if (!frame)
+      goto exit;
+
+   // Read the previous frame...
+   //
+   window.Read(frame, sizeof(ptrs), ptrs, err);
+   ERROR_CHECK(err);
+
+   regs.Set(DBG_DWARF_BP, (dbg::addr_t)ptrs[0]);
+   regs.Set(DBG_DWARF_IP, (dbg::addr_t)ptrs[1]);
+   regs.Set(DBG_DWARF_SP, frame + sizeof(ptrs));
+   r = true;
+
+exit:
+   return r && !ERROR_FAILED(err);
+}
+
+// Builds the set of executable ranges from every module we know of.
+//
+void
+GetCodeRanges(dbg::Debugger *dbg, dbg::AddressSet &code, error *err)
+{
+   std::vector<dbg::ElfSection> segs;
+
+   for (auto &mod : dbg->modules.modules)
+   {
+      auto img = mod->GetImage();
+      if (!img)
+         continue;
+
+      segs.clear();
+      img->GetExecutableSegments(segs, err);
+      ERROR_CHECK(err);
 
-      if (ip)
+      for (auto &seg : segs)
       {
-         callback(ip, frame, cancel, err);
+         code.Add(seg.vaddr + mod->bias, seg.vaddr + seg.size + mod->bias, err);
          ERROR_CHECK(err);
       }
    }
 
+   code.Finalize(err);
+   ERROR_CHECK(err);
 exit:;
 }
 
+// Longest call instruction we expect to see: REX + ff /2 + SIB + disp32.
+//
+const int MaxCallLength = 8;
+
+// Does the instruction ending at addr look like a call?  We can't
+// disassemble backwards, so try every length a call could be.
+//
+bool
+IsReturnAddress(dbg::Debugger *dbg, dbg::AddressSet &code, dbg::addr_t addr)
+{
+   auto mod = dbg->modules.Lookup(addr - 1);
+   dbg::ElfImage *img = nullptr;
+
+   if (!mod || !(img = mod->GetImage()))
+      return false;
+
+   for (unsigned len=2; len<=MaxCallLength; ++len)
+   {
+      dbg::ElfSection text;
+      ud_t ud;
+
+      if (!img->GetLoadedRange(addr - len - mod->bias, &text) ||
+          text.size < len)
+         continue;
+
+      ud_init(&ud);
+      set_mode(&ud);
+      ud_set_input_buffer(&ud, text.data, len);
+      ud_set_pc(&ud, addr - len);
+
+      if (ud_disassemble(&ud) != len || ud.mnemonic != UD_Icall)
+         continue;
+
+      // A direct call has to land in code too.  Indirect ones we have
+      // to take on faith.
+      //
+      if (ud.operand[0].type == UD_OP_JIMM)
+      {
+         dbg::addr_t target = addr;
+
+         switch (ud.operand[0].size)
+         {
+         case 8:
+            target += ud.operand[0].lval.sbyte;
+            break;
+         case 16:
+            target += ud.operand[0].lval.sword;
+            break;
+         default:
+            target += ud.operand[0].lval.sdword;
+            break;
+         }
+
+         if (!code.Contains(target))
+            continue;
+      }
+
+      return true;
+   }
+
+   return false;
+}
+
+// How much more of the stack to read at a time when scanning with
+// prefetch turned off.  Scanning has to read all of it regardless.
+//
+const size_t ScanChunkSize = 64 * 1024;
+
+// Walks the stack upwards from start, calling back with each slot that
+// holds a plausible return address.  Stops when the callback returns
+// false or we run out of stack.
+//
+void
+ScanForReturnAddresses(
+   dbg::Debugger *dbg,
+   dbg::MemoryWindow &window,
+   dbg::AddressSet &code,
+   dbg::addr_t start,
+   const std::function<bool(dbg::addr_t slot, dbg::addr_t value)> &callback,
+   error *err
+)
+{
+   start = (start + sizeof(dbg::addr_t) - 1) & ~(dbg::addr_t)(sizeof(dbg::addr_t) - 1);
+   if (start < window.base)
+      goto exit;
+
+   if (!window.chunkSize)
+      window.chunkSize = ScanChunkSize;
+
+   for (;;)
+   {
+      if (start >= window.End())
+      {
+         if (!window.Extend(start + sizeof(dbg::addr_t), err))
+            break;
+         ERROR_CHECK(err);
+      }
+
+      if (!code.Scan(
+             window.buf.data() + (start - window.base),
+             window.End() - start,
+             [&] (size_t off, dbg::addr_t value) -> bool
+             {
+                if (!IsReturnAddress(dbg, code, value))
+                   return true;
+                return callback(start + off, value);
+             }))
+         break;
+
+      start = window.End();
+   }
+exit:;
+}
+
+// Last resort: take the nearest thing on the stack that looks like a
+// return address.
+//
+bool
+ScanStep(
+   dbg::Debugger *dbg,
+   dbg::MemoryWindow &window,
+   dbg::AddressSet &code,
+   dbg::dwarf::RegisterSet &regs,
+   error *err
+)
+{
+   bool r = false;
+
+   ScanForReturnAddresses(
+      dbg,
+      window,
+      code,
+      regs.regs[DBG_DWARF_SP],
+      [&] (dbg::addr_t slot, dbg::addr_t value) -> bool
+      {
+         regs.Set(DBG_DWARF_IP, value);
+         regs.Set(DBG_DWARF_SP, slot + sizeof(dbg::addr_t));
+         r = true;
+         return false;
+      },
+      err
+   );
+
+   return r && !ERROR_FAILED(err);
+}
+
+} // end namespace
+
+void
+dbg::Cpu::StackTrace(
+   Debugger *dbg,
+   std::function<void(addr_t pc, addr_t frame, bool& cancel, error *err)> callback,
+   error *err
+)
+{
+   bool cancel = false;
+   bool first = true;
+   bool exactPc = true;
+   dwarf::RegisterSet regs;
+   MemoryWindow stack;
+   AddressSet code;
+   bool haveCode = false;
+
+   memset(&regs, 0, sizeof(regs));
+
+   // Grab the registers that CFI knows about...
+   //
+   for (int i=0; i<DBG_DWARF_REGISTER_COUNT; ++i)
+   {
+      addr_t val = 0;
+      dbg->proc->GetRegister(dwarfRegisters[i], &val, err);
+      ERROR_CHECK(err);
+      regs.Set(i, val);
+   }
+
+   // Most of what we read from here on is just above the stack
+   // pointer, so grab it all at once.
+   //
+   stack.Init(dbg, regs.regs[DBG_DWARF_SP], dbg->stackPrefetch, err);
+   ERROR_CHECK(err);
+
+   callback(regs.regs[DBG_DWARF_IP], regs.regs[DBG_DWARF_BP], cancel, err);
+   ERROR_CHECK(err);
+
+   // Read the previous frames, preferring CFI and falling back to the
+   // frame pointer chain for any frame without it, and to scanning the
+   // stack when that doesn't work either.
+   //
+   while (!cancel)
+   {
+      addr_t sp = regs.regs[DBG_DWARF_SP];
+      bool signalFrame = false;
+
+      if (!CfiStep(dbg, stack, regs, exactPc, &signalFrame))
+      {
+         dwarf::RegisterSet saved = regs;
+         bool ok = false;
+
+         if (!haveCode)
+         {
+            GetCodeRanges(dbg, code, err);
+            ERROR_CHECK(err);
+            haveCode = true;
+         }
+
+         if (!code.ranges.size())
+         {
+            // Without any module info we can't second-guess the frame
+            // pointer, so trust it as we always have.
+            //
+            ok = FramePointerStep(dbg, stack, regs, first, err);
+            ERROR_CHECK(err);
+         }
+         else
+         {
+            error fpErr;
+
+            // Code built without frame pointers leaves garbage in BP.
+            // If following it doesn't lead back into code, scan for a
+            // return address instead.
+            //
+            ok = FramePointerStep(dbg, stack, regs, first, &fpErr);
+            if (!ok || !code.Contains(regs.regs[DBG_DWARF_IP]))
+            {
+               regs = saved;
+               ok = ScanStep(dbg, stack, code, regs, err);
+               ERROR_CHECK(err);
+            }
+         }
+
+         if (!ok)
+            break;
+      }
+
+      if (!regs.IsValid(DBG_DWARF_IP) || !regs.regs[DBG_DWARF_IP])
+         break;
+
+      // The stack only grows one way; if we didn't move, we're chasing
+      // garbage.  Frames above a signal handler are exempt since it may
+      // be running on an alternate stack.
+      //
+      if (!signalFrame && regs.regs[DBG_DWARF_SP] <= sp)
+         break;
+
+      callback(regs.regs[DBG_DWARF_IP], regs.regs[DBG_DWARF_BP], cancel, err);
+      ERROR_CHECK(err);
+
+      first = false;
+      exactPc = signalFrame;
+   }
+
+exit:;
+}
+
+void
+dbg::Cpu::ScanStack(
+   Debugger *dbg,
+   std::function<void(addr_t pc, addr_t slot, bool& cancel, error *err)> callback,
+   error *err
+)
+{
+   bool cancel = false;
+   addr_t ip = 0, sp = 0;
+   MemoryWindow stack;
+   AddressSet code;
+
+   dbg->proc->GetRegister(DBG_IP, &ip, err);
+   ERROR_CHECK(err);
+   dbg->proc->GetRegister(DBG_SP, &sp, err);
+   ERROR_CHECK(err);
+
+   callback(ip, sp, cancel, err);
+   ERROR_CHECK(err);
+   if (cancel)
+      goto exit;
+
+   GetCodeRanges(dbg, code, err);
+   ERROR_CHECK(err);
+   if (!code.ranges.size())
+      ERROR_SET(err, unknown, "No module information to scan against");
+
+   stack.Init(dbg, sp, dbg->stackPrefetch, err);
+   ERROR_CHECK(err);
+
+   ScanForReturnAddresses(
+      dbg,
+      stack,
+      code,
+      sp,
+      [&] (addr_t slot, addr_t value) -> bool
+      {
+         callback(value, slot, cancel, err);
+         return !cancel && !ERROR_FAILED(err);
+      },
+      err
+   );
+   ERROR_CHECK(err);
+exit:;
+}